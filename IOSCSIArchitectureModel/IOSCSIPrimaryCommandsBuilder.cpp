@@ -192,13 +192,13 @@ IOSCSIPrimaryCommandsDevice::IsMemoryDescriptorValid (
 	require_nonzero ( dataBuffer, ErrorExit );
 	require ( ( dataBuffer->getLength ( ) >= requiredSize ), ErrorExit );
 	valid = true;
-	
-	
+
+
 ErrorExit:
-	
-	
+
+
 	return valid;
-	
+
 }	
 
 
@@ -895,6 +895,44 @@ ErrorExit:
 }
 
 
+//
+//	 RECEIVE_COPY_RESULTS - Builds a RECEIVE_COPY_RESULTS command.	[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::RECEIVE_COPY_RESULTS (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField5Bit			SERVICE_ACTION,
+						SCSICmdField1Byte			LIST_IDENTIFIER,
+						SCSICmdField4Byte			ALLOCATION_LENGTH,
+						SCSICmdField1Byte			CONTROL )
+{
+	
+	SCSITask *	scsiRequest	= NULL;
+	bool		status 		= false;
+	
+	scsiRequest = OSDynamicCast ( SCSITask, request );
+	require_nonzero ( scsiRequest, ErrorExit );
+	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
+	
+	status = GetSCSIPrimaryCommandObject ( )->RECEIVE_COPY_RESULTS (
+											scsiRequest,
+											dataBuffer,
+											SERVICE_ACTION,
+											LIST_IDENTIFIER,
+											ALLOCATION_LENGTH,
+											CONTROL );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 RELEASE_6 - Builds a RELEASE_6 command.						[PROTECTED]
 //
@@ -97,12 +97,88 @@ enum
 #define kAppleKeySwitchProperty						"AppleKeyswitch"
 #define kKeySwitchProperty							"Keyswitch"
 
+// Largest transfer each read or write CDB size can describe.
+#define kReadWrite6ByteMaximumLBA					0x001FFFFFULL
+#define kReadWrite6ByteMaximumBlockCount			0x000000FFULL
+#define kReadWrite10ByteMaximumBlockCount			0x0000FFFFULL
+#define kReadWrite32BitMaximum						0xFFFFFFFFULL
+
+// Largest read or write request advertised to the layers above us. Anything
+// larger than a single task can carry is split by SendReadWriteRequest ( ).
+#define kReadWriteRequestMaximumByteCount			( 16 * 1024 * 1024 )
+
+// The FUA bit is in the same place in every READ and WRITE (10), (12) and
+// (16) CDB.
+#define kReadWriteCDB_FUAMask						0x08
+
+// Indices into fReadWriteTaskTemplates.
+#define kReadWriteTaskTemplate_Read					0
+#define kReadWriteTaskTemplate_Write				1
+#define kReadWriteTaskTemplateCount					2
+
+// How long a synchronous command polls the transport for its completion
+// before going to sleep.
+#define kPollForCompletionTimeInMicroseconds		100
+
 // Reserved fields
 #define fKeySwitchNotifier							fIOSCSIPrimaryCommandsDeviceReserved->fKeySwitchNotifier
 #define fANSIVersion								fIOSCSIPrimaryCommandsDeviceReserved->fANSIVersion
 #define fCMDQUE										fIOSCSIPrimaryCommandsDeviceReserved->fCMDQUE
 #define	fTaskID										fIOSCSIPrimaryCommandsDeviceReserved->fTaskID
 #define	fTaskIDLock									fIOSCSIPrimaryCommandsDeviceReserved->fTaskIDLock
+#define fReadWriteCDBSizeMask						fIOSCSIPrimaryCommandsDeviceReserved->fReadWriteCDBSizeMask
+#define fReadWriteSplitLock							fIOSCSIPrimaryCommandsDeviceReserved->fReadWriteSplitLock
+#define fMaximumReadBlockCount						fIOSCSIPrimaryCommandsDeviceReserved->fMaximumReadBlockCount
+#define fMaximumWriteBlockCount						fIOSCSIPrimaryCommandsDeviceReserved->fMaximumWriteBlockCount
+#define fMaximumReadByteCount						fIOSCSIPrimaryCommandsDeviceReserved->fMaximumReadByteCount
+#define fMaximumWriteByteCount						fIOSCSIPrimaryCommandsDeviceReserved->fMaximumWriteByteCount
+#define fMaximumScatterGatherElementCount			fIOSCSIPrimaryCommandsDeviceReserved->fMaximumScatterGatherElementCount
+#define fReadWriteTaskTemplates						fIOSCSIPrimaryCommandsDeviceReserved->fReadWriteTaskTemplates
+#define fDeviceMaximumTransferBlockCount			fIOSCSIPrimaryCommandsDeviceReserved->fDeviceMaximumTransferBlockCount
+#define fOptimalTransferBlockCount					fIOSCSIPrimaryCommandsDeviceReserved->fOptimalTransferBlockCount
+#define fOptimalTransferBlockGranularity			fIOSCSIPrimaryCommandsDeviceReserved->fOptimalTransferBlockGranularity
+#define fPhysicalBlockGranularity					fIOSCSIPrimaryCommandsDeviceReserved->fPhysicalBlockGranularity
+#define fPhysicalBlockAlignment						fIOSCSIPrimaryCommandsDeviceReserved->fPhysicalBlockAlignment
+#define fProtocolPollsForCompletion					fIOSCSIPrimaryCommandsDeviceReserved->fProtocolPollsForCompletion
+
+
+//
+//	Structures
+//
+
+// A read or write request which was split into several tasks. Each of the
+// tasks points at this through its application layer split reference.
+struct SCSIReadWriteSplitRequest
+{
+	IOMemoryDescriptor *	clientBuffer;
+	SCSITaskIdentifier		failedTask;
+	UInt32					outstandingCount;
+	UInt64					requestedByteCount;
+	UInt64					realizedByteCount;
+};
+
+// A task built by SendReadWriteRequest ( ) which has not been sent yet.
+struct SCSIReadWriteSplitTask
+{
+	SCSITaskIdentifier		request;
+	IOMemoryDescriptor *	buffer;
+	UInt64					startBlock;
+	UInt64					blockCount;
+};
+
+// The parts of a read or write task which are the same for every request
+// to a device. See InitializeReadWriteTaskTemplates ( ).
+struct SCSIReadWriteTaskTemplate
+{
+	UInt64					blockSize;
+	UInt8					operationCode6;
+	UInt8					operationCode10;
+	UInt8					operationCode12;
+	UInt8					operationCode16;
+	UInt8					commandFlags;
+	UInt8					dataTransferDirection;
+	bool					tagged;
+};
 
 #if 0
 #pragma mark -
@@ -143,7 +219,6 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 	
 	bool			result			= false;
 	bool			supported		= false;
-	UInt64			maxByteCount	= 0;
 	OSIterator *	iterator		= NULL;
 	OSObject *		obj				= NULL;
 	OSDictionary *	dict			= NULL;
@@ -167,14 +242,20 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 	
 	fANSIVersion = kINQUIRY_ANSI_VERSION_NoClaimedConformance;
 	
+	// Every command set supports the 10 byte read and write commands.
+	fReadWriteCDBSizeMask = kSCSIReadWriteCDBSize_10ByteMask;
+	
 	fTaskIDLock = IOSimpleLockAlloc ( );
 	require_nonzero ( fTaskIDLock, FreeReservedMemory );
 	
+	fReadWriteSplitLock = IOSimpleLockAlloc ( );
+	require_nonzero ( fReadWriteSplitLock, FreeTaskIDLock );
+	
 	fProtocolDriver = OSDynamicCast ( IOSCSIProtocolInterface, provider );
-	require_nonzero ( fProtocolDriver, FreeTaskIDLock );
+	require_nonzero ( fProtocolDriver, FreeReadWriteSplitLock );
 	
 	fDeviceCharacteristicsDictionary = OSDictionary::withCapacity ( 1 );
-	require_nonzero ( fDeviceCharacteristicsDictionary, FreeTaskIDLock );
+	require_nonzero ( fDeviceCharacteristicsDictionary, FreeReadWriteSplitLock );
 	
 	string = ( OSString * ) GetProtocolDriver ( )->getProperty ( kIOPropertySCSIVendorIdentification );	
 	check ( string );
@@ -256,6 +337,12 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 	
 	fProtocolAccessEnabled = true;
 	
+	// Ask before InitializeDeviceSupport ( ) so the synchronous commands
+	// sent while bringing the device up are polled too.
+	fProtocolPollsForCompletion = GetProtocolDriver ( )->IsProtocolServiceSupported (
+						kSCSIProtocolFeature_PollForCompletion,
+						NULL );
+	
 	require ( InitializeDeviceSupport ( ), CloseProvider );
 	
 	iterator = getMatchingServices ( nameMatching ( kAppleKeySwitchProperty ) );
@@ -347,25 +434,42 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 		
 	}
 	
-	// See if the transport driver wants us to limit the read transfer byte count
+	// See if the transport driver wants us to limit the transfer counts. These
+	// limit each task, SendReadWriteRequest ( ) splits requests which are larger.
+	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
+						kSCSIProtocolFeature_MaximumReadBlockTransferCount,
+						&fMaximumReadBlockCount );
+	
+	if ( supported == false )
+		fMaximumReadBlockCount = 0;
+	
+	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
+						kSCSIProtocolFeature_MaximumWriteBlockTransferCount,
+						&fMaximumWriteBlockCount );
+	
+	if ( supported == false )
+		fMaximumWriteBlockCount = 0;
+	
 	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
 						kSCSIProtocolFeature_MaximumReadTransferByteCount,
-						&maxByteCount );	
+						&fMaximumReadByteCount );	
 	
-	if ( supported == true )
-	{
-		setProperty ( kIOMaximumByteCountReadKey, maxByteCount, 64 );
-	}
+	if ( supported == false )
+		fMaximumReadByteCount = 0;
 	
-	// See if the transport driver wants us to limit the write transfer byte count
 	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
 						kSCSIProtocolFeature_MaximumWriteTransferByteCount,
-						&maxByteCount );	
+						&fMaximumWriteByteCount );	
 	
-	if ( supported == true )
-	{
-		setProperty ( kIOMaximumByteCountWriteKey, maxByteCount, 64 );
-	}
+	if ( supported == false )
+		fMaximumWriteByteCount = 0;
+	
+	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
+						kSCSIProtocolFeature_MaximumScatterGatherElementCount,
+						&fMaximumScatterGatherElementCount );
+	
+	if ( supported == false )
+		fMaximumScatterGatherElementCount = 0;
 	
 	fDeviceAccessEnabled = true;
 	StartDeviceSupport ( );
@@ -384,11 +488,19 @@ CloseProvider:
 FreeDeviceDictionary:
 	
 	
-	require_nonzero ( fDeviceCharacteristicsDictionary, FreeTaskIDLock );
+	require_nonzero ( fDeviceCharacteristicsDictionary, FreeReadWriteSplitLock );
 	fDeviceCharacteristicsDictionary->release ( );
 	fDeviceCharacteristicsDictionary = NULL;
 	
 	
+FreeReadWriteSplitLock:
+	
+	
+	require_nonzero ( fReadWriteSplitLock, FreeTaskIDLock );
+	IOSimpleLockFree ( fReadWriteSplitLock );
+	fReadWriteSplitLock = NULL;
+	
+	
 FreeTaskIDLock:
 	
 	
@@ -470,6 +582,22 @@ IOSCSIPrimaryCommandsDevice::free ( void )
 			
 		}
 		
+		if ( fReadWriteSplitLock != NULL )
+		{
+			
+			IOSimpleLockFree ( fReadWriteSplitLock );
+			fReadWriteSplitLock = NULL;
+			
+		}
+		
+		if ( fReadWriteTaskTemplates != NULL )
+		{
+			
+			IODelete ( fReadWriteTaskTemplates, SCSIReadWriteTaskTemplate, kReadWriteTaskTemplateCount );
+			fReadWriteTaskTemplates = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIPrimaryCommandsDeviceReserved, IOSCSIPrimaryCommandsDeviceExpansionData, 1 );
 		fIOSCSIPrimaryCommandsDeviceReserved = NULL;
 		
@@ -1165,6 +1293,13 @@ IOSCSIPrimaryCommandsDevice::SendCommand (
 	
 	GetProtocolDriver ( )->ExecuteCommand ( request );
 	
+	// Give a fast device the chance to complete the command before paying
+	// for a sleep and wakeup.
+	if ( fProtocolPollsForCompletion == true )
+	{
+		PollForTask ( request );
+	}
+	
 	// Wait for the completion routine to get called
 	fCommandGate->runAction ( ( IOCommandGate::Action )
 							  &IOSCSIPrimaryCommandsDevice::sWaitForTask,
@@ -1261,6 +1396,44 @@ IOSCSIPrimaryCommandsDevice::GatedWaitForTask ( SCSITaskIdentifier request )
 }
 
 
+//
+//  PollForTask - Polls the protocol driver for a task's completion for a
+//				   short while. Returns when the task has ended or the time
+//				   is up, whichever is first.						  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::PollForTask ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *		task	= OSDynamicCast ( SCSITask, request );
+	AbsoluteTime	deadline;
+	AbsoluteTime	now;
+	
+	require_nonzero ( task, ErrorExit );
+	
+	clock_interval_to_deadline ( kPollForCompletionTimeInMicroseconds, kMicrosecondScale, &deadline );
+	
+	while ( task->GetTaskState ( ) != kSCSITaskState_ENDED )
+	{
+		
+		GetProtocolDriver ( )->HandleProtocolServiceFeature ( kSCSIProtocolFeature_PollForCompletion, request );
+		
+		clock_get_uptime ( &now );
+		if ( CMP_ABSOLUTETIME ( &now, &deadline ) >= 0 )
+			break;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark  SCSI Task Field Accessors
@@ -1279,7 +1452,7 @@ IOSCSIPrimaryCommandsDevice::ResetForNewTask (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->ResetForNewTask ( );
@@ -1299,7 +1472,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskAttribute (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskAttribute ( newAttribute );
@@ -1317,7 +1490,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskAttribute ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaskAttribute ( );
@@ -1337,7 +1510,7 @@ IOSCSIPrimaryCommandsDevice::SetTaggedTaskIdentifier (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaggedTaskIdentifier ( taggedTaskIdentifier );
@@ -1356,7 +1529,7 @@ IOSCSIPrimaryCommandsDevice::GetTaggedTaskIdentifier (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaggedTaskIdentifier ( );
@@ -1375,7 +1548,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskState ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskState ( newTaskState );
@@ -1393,7 +1566,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskState ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskState( );
 	
 }
@@ -1410,7 +1583,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskStatus ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskStatus ( newStatus );
@@ -1428,7 +1601,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskStatus ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaskStatus ( );
@@ -1453,7 +1626,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1488,7 +1661,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1529,7 +1702,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1576,7 +1749,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1600,6 +1773,27 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 }
 
 
+//
+//  SetCommandDescriptorBlock - Sets an already packed CDB.		[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
+									SCSITaskIdentifier 					request,
+									const SCSICommandDescriptorBlock *	cdbData,
+									UInt8								cdbSize )
+{
+	
+	SCSITask *	scsiRequest;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
+	
+	return scsiRequest->SetCommandDescriptorBlock ( cdbData, cdbSize );
+	
+}
+
+
 //
 //  SetDataTransferDirection - Sets the data transfer direction.	[PROTECTED]
 //
@@ -1612,7 +1806,7 @@ IOSCSIPrimaryCommandsDevice::SetDataTransferDirection (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	return scsiRequest->SetDataTransferDirection ( newDirection );
 	
@@ -1630,7 +1824,7 @@ IOSCSIPrimaryCommandsDevice::GetDataTransferDirection (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetDataTransferDirection ( );
@@ -1651,7 +1845,7 @@ IOSCSIPrimaryCommandsDevice::SetRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetRequestedDataTransferCount ( newRequestedCount );
@@ -1671,7 +1865,7 @@ IOSCSIPrimaryCommandsDevice::GetRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetRequestedDataTransferCount ( );
@@ -1692,7 +1886,7 @@ IOSCSIPrimaryCommandsDevice::SetRealizedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetRealizedDataTransferCount ( newRealizedDataCount );
@@ -1712,7 +1906,7 @@ IOSCSIPrimaryCommandsDevice::GetRealizedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetRealizedDataTransferCount ( );
@@ -1731,7 +1925,7 @@ IOSCSIPrimaryCommandsDevice::SetDataBuffer ( SCSITaskIdentifier		request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetDataBuffer ( newBuffer );
@@ -1749,7 +1943,7 @@ IOSCSIPrimaryCommandsDevice::GetDataBuffer ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetDataBuffer ( );
@@ -1770,7 +1964,7 @@ IOSCSIPrimaryCommandsDevice::SetTimeoutDuration (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTimeoutDuration ( newTimeout );
@@ -1789,7 +1983,7 @@ IOSCSIPrimaryCommandsDevice::GetTimeoutDuration ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTimeoutDuration ( );
@@ -1809,7 +2003,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskCompletionCallback (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskCompletionCallback ( newCallback );
@@ -1828,7 +2022,7 @@ IOSCSIPrimaryCommandsDevice::TaskCompletedNotification (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->TaskCompletedNotification ( );
@@ -1848,7 +2042,7 @@ IOSCSIPrimaryCommandsDevice::SetServiceResponse (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetServiceResponse ( serviceResponse );
@@ -1867,7 +2061,7 @@ IOSCSIPrimaryCommandsDevice::GetServiceResponse (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetServiceResponse ( );
@@ -1892,7 +2086,7 @@ IOSCSIPrimaryCommandsDevice::SetAutosenseCommand (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetAutosenseCommand ( cdbByte0, cdbByte1, cdbByte2,
@@ -1925,7 +2119,7 @@ IOSCSIPrimaryCommandsDevice::GetAutoSenseData ( SCSITaskIdentifier	request,
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetAutoSenseData ( senseData, senseDataSize );
@@ -1943,7 +2137,7 @@ IOSCSIPrimaryCommandsDevice::GetAutoSenseDataSize ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetAutoSenseDataSize ( );
@@ -1964,7 +2158,7 @@ IOSCSIPrimaryCommandsDevice::SetApplicationLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetApplicationLayerReference ( newReferenceValue );
@@ -1984,7 +2178,7 @@ IOSCSIPrimaryCommandsDevice::GetApplicationLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetApplicationLayerReference ( );
@@ -1993,220 +2187,1178 @@ IOSCSIPrimaryCommandsDevice::GetApplicationLayerReference (
 
 
 //
-//  sGetOwnerForTask - Gets the owner for a task			[STATIC][PROTECTED]
+//  SetApplicationLayerSplitReference - Sets the split request a task
+//										 belongs to.				[PROTECTED]
 //
 
-OSObject *
-IOSCSIPrimaryCommandsDevice::sGetOwnerForTask ( SCSITaskIdentifier request )
+bool
+IOSCSIPrimaryCommandsDevice::SetApplicationLayerSplitReference (
+									SCSITaskIdentifier	request,
+									void *				newReferenceValue )
 {
 	
-	SCSITask *	scsiRequest = NULL;
+	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
-	return scsiRequest->GetTaskOwner ( );
+	return scsiRequest->SetApplicationLayerSplitReference ( newReferenceValue );
 	
 }
 
 
-#if 0
-#pragma mark -
-#pragma mark  Device Information Methods
-#pragma mark -
-#endif
-
-
 //
-//  GetVendorString - Gets the vendor string.						[PROTECTED]
+//  GetApplicationLayerSplitReference - Gets the split request a task
+//										 belongs to.				[PROTECTED]
 //
 
-char *
-IOSCSIPrimaryCommandsDevice::GetVendorString ( void )
+void *
+IOSCSIPrimaryCommandsDevice::GetApplicationLayerSplitReference (
+										SCSITaskIdentifier	request )
 {
 	
-	OSString *		vendorString;
+	SCSITask *		scsiRequest;
 	
-	vendorString = ( OSString * ) GetProtocolDriver ( )->getProperty (
-										kIOPropertySCSIVendorIdentification );
-	if ( vendorString != NULL )
-	{
-		return ( ( char * ) vendorString->getCStringNoCopy ( ) );
-	}
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
 	
-	else
-	{
-		return "NULL STRING";
-	}
+	return scsiRequest->GetApplicationLayerSplitReference ( );
 	
 }
 
 
 //
-//  GetProductString - Gets the product string.					[PROTECTED]
+//  sGetOwnerForTask - Gets the owner for a task			[STATIC][PROTECTED]
 //
 
-char *
-IOSCSIPrimaryCommandsDevice::GetProductString ( void )
+OSObject *
+IOSCSIPrimaryCommandsDevice::sGetOwnerForTask ( SCSITaskIdentifier request )
 {
 	
-	OSString *		productString;
+	SCSITask *	scsiRequest = NULL;
 	
-	productString = ( OSString * ) GetProtocolDriver ( )->getProperty (
-										kIOPropertySCSIProductIdentification );
-	if ( productString != NULL )
-	{
-		return ( ( char * ) productString->getCStringNoCopy ( ) );
-	}
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
 	
-	else
-	{
-		return "NULL STRING";
-	}
+	return scsiRequest->GetTaskOwner ( );
 	
 }
 
 
-//
-//  GetRevisionString - Gets the product revision level string.	[PROTECTED]
-//
-
-char *
-IOSCSIPrimaryCommandsDevice::GetRevisionString ( void )
-{
-	
-	OSString *		revisionString;
-	
-	STATUS_LOG ( ( "%s::%s\n", getName ( ), __FUNCTION__ ) );
-	
-	revisionString = ( OSString * ) GetProtocolDriver ( )->getProperty (
-										kIOPropertySCSIProductRevisionLevel );
-	
-	if ( revisionString != NULL )
-	{
-		return ( ( char * ) revisionString->getCStringNoCopy ( ) );
-	}
-	
-	else
-	{
-		return "NULL STRING";
-	}
-	
-}
+#if 0
+#pragma mark -
+#pragma mark  Read/Write Request Support
+#pragma mark -
+#endif
 
 
 //
-//  GetProtocolCharacteristicsDictionary - Gets the protocol characteristics
-//											dictionary.				[PROTECTED]
+//	 SetReadWriteCDBSizeMask - Sets the CDB sizes which may be used for read
+//								and write requests.					[PROTECTED]
 //
 
-OSDictionary *
-IOSCSIPrimaryCommandsDevice::GetProtocolCharacteristicsDictionary ( void )
+void
+IOSCSIPrimaryCommandsDevice::SetReadWriteCDBSizeMask ( UInt8 mask )
 {
 	
-	return ( OSDictionary * ) GetProtocolDriver ( )->getProperty (
-										kIOPropertyProtocolCharacteristicsKey );
+	check ( mask );
+	fReadWriteCDBSizeMask = mask;
 	
 }
 
 
 //
-//  GetDeviceCharacteristicsDictionary - 	Gets the device characteristics
-//											dictionary.				[PROTECTED]
+//	 GetReadWriteCDBSizeMask - Gets the CDB sizes which may be used for read
+//								and write requests.					[PROTECTED]
 //
 
-OSDictionary *
-IOSCSIPrimaryCommandsDevice::GetDeviceCharacteristicsDictionary ( void )
+UInt8
+IOSCSIPrimaryCommandsDevice::GetReadWriteCDBSizeMask ( void )
 {
-	
-	check ( fDeviceCharacteristicsDictionary );
-	return fDeviceCharacteristicsDictionary;
-	
+	return fReadWriteCDBSizeMask;
 }
 
 
 //
-//  GetANSIVersion - Gets the ANSI version the device claims conformance to.
-//																	[PROTECTED]
+//	 SetReadWriteTransferLimits - Sets the device's own transfer limits
+//								   for read and write requests.		[PROTECTED]
 //
 
-UInt8
-IOSCSIPrimaryCommandsDevice::GetANSIVersion ( void )
+void
+IOSCSIPrimaryCommandsDevice::SetReadWriteTransferLimits (
+									UInt32		maximumBlockCount,
+									UInt32		optimalBlockCount,
+									UInt32		blockGranularity )
 {
 	
-	return fANSIVersion;
+	fDeviceMaximumTransferBlockCount	= maximumBlockCount;
+	fOptimalTransferBlockCount			= optimalBlockCount;
+	fOptimalTransferBlockGranularity	= blockGranularity;
 	
 }
 
 
 //
-//  SetANSIVersion - Sets the ANSI version the device claims conformance to.
+//	 SetReadWriteTransferAlignment - Sets the physical block layout of the
+//									  medium for read and write requests.
 //																	[PROTECTED]
 //
 
 void
-IOSCSIPrimaryCommandsDevice::SetANSIVersion ( UInt8 newVersion )
+IOSCSIPrimaryCommandsDevice::SetReadWriteTransferAlignment (
+									UInt32		logicalBlocksPerPhysicalBlock,
+									UInt32		lowestAlignedBlock )
 {
 	
-	fANSIVersion = newVersion;
+	fPhysicalBlockGranularity	= logicalBlocksPerPhysicalBlock;
+	fPhysicalBlockAlignment		= lowestAlignedBlock;
 	
 }
 
 
 //
-//  GetCMDQUE - Gets the CMDQUE bit from the INQUIRY data.			[PROTECTED]
+//	 GetReadWriteCDBSize - Gets the smallest enabled CDB size which can
+//							describe a transfer.					[PROTECTED]
 //
 
-bool
-IOSCSIPrimaryCommandsDevice::GetCMDQUE ( void )
+UInt8
+IOSCSIPrimaryCommandsDevice::GetReadWriteCDBSize (
+									UInt64		startBlock,
+									UInt64		blockCount )
 {
 	
-	return fCMDQUE;
+	UInt8	cdbSize = 0;
 	
-}
-
-
-//
-//  SetCMDQUE - Sets the CMDQUE bit from the INQUIRY data.			[PROTECTED]
-//
-
-void
-IOSCSIPrimaryCommandsDevice::SetCMDQUE ( bool value )
-{
+	require_nonzero ( blockCount, ErrorExit );
+	
+	if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_6ByteMask ) &&
+		 ( startBlock <= kReadWrite6ByteMaximumLBA ) &&
+		 ( blockCount <= kReadWrite6ByteMaximumBlockCount ) )
+	{
+		cdbSize = kSCSICDBSize_6Byte;
+	}
+	
+	else if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_10ByteMask ) &&
+			  ( startBlock <= kReadWrite32BitMaximum ) &&
+			  ( blockCount <= kReadWrite10ByteMaximumBlockCount ) )
+	{
+		cdbSize = kSCSICDBSize_10Byte;
+	}
+	
+	else if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_12ByteMask ) &&
+			  ( startBlock <= kReadWrite32BitMaximum ) &&
+			  ( blockCount <= kReadWrite32BitMaximum ) )
+	{
+		cdbSize = kSCSICDBSize_12Byte;
+	}
+	
+	else if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_16ByteMask ) &&
+			  ( blockCount <= kReadWrite32BitMaximum ) )
+	{
+		cdbSize = kSCSICDBSize_16Byte;
+	}
+	
+	
+ErrorExit:
 	
-	fCMDQUE = value;
+	
+	return cdbSize;
 	
 }
 
 
 //
-//  GetModeSense - Called to get mode sense data from the device.	[PROTECTED]
+//	 GetReadWriteTaskBlockLimit - Gets the largest number of blocks a single
+//								   read or write task starting at startBlock
+//								   may transfer.					[PROTECTED]
 //
 
-IOReturn
-IOSCSIPrimaryCommandsDevice::GetModeSense ( 
-						IOMemoryDescriptor *		dataBuffer,
-						SCSICmdField6Bit 			PAGE_CODE,
-						SCSICmdField2Byte 			ALLOCATION_LENGTH,
-						bool *						use10ByteModeSense )
+UInt64
+IOSCSIPrimaryCommandsDevice::GetReadWriteTaskBlockLimit (
+									UInt64		startBlock,
+									UInt64		blockSize,
+									bool		isWrite )
 {
 	
-	SCSIServiceResponse			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier			request			= NULL;
-	SCSICmdField1Bit			DBD				= 0;
-	IOReturn					status			= kIOReturnNoResources;
-	bool						commandOK		= false;
+	UInt64	blockLimit		= 0;
+	UInt64	byteLimit		= 0;
+	UInt64	segmentLimit	= 0;
+	UInt32	maxBlockCount	= 0;
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_nonzero ( blockSize, ErrorExit );
 	
-OUTERLOOP:
-		
-		
-		DBD = 1;	/* Disable block descriptors */
+	// Start with the longest transfer any enabled CDB can describe at
+	// this address.
+	if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_16ByteMask ) ||
+		 ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_12ByteMask ) &&
+		   ( startBlock <= kReadWrite32BitMaximum ) ) )
+	{
+		blockLimit = kReadWrite32BitMaximum;
+	}
+	
+	else if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_10ByteMask ) &&
+			  ( startBlock <= kReadWrite32BitMaximum ) )
+	{
+		blockLimit = kReadWrite10ByteMaximumBlockCount;
+	}
+	
+	else if ( ( fReadWriteCDBSizeMask & kSCSIReadWriteCDBSize_6ByteMask ) &&
+			  ( startBlock <= kReadWrite6ByteMaximumLBA ) )
+	{
+		blockLimit = kReadWrite6ByteMaximumBlockCount;
+	}
+	
+	require_nonzero ( blockLimit, ErrorExit );
+	
+	// Then clamp it to what the transport can carry in a single task.
+	if ( isWrite == true )
+	{
 		
+		maxBlockCount	= fMaximumWriteBlockCount;
+		byteLimit		= fMaximumWriteByteCount;
 		
-	INNERLOOP:
+	}
+	
+	else
+	{
+		
+		maxBlockCount	= fMaximumReadBlockCount;
+		byteLimit		= fMaximumReadByteCount;
+		
+	}
+	
+	if ( ( maxBlockCount > 0 ) && ( maxBlockCount < blockLimit ) )
+		blockLimit = maxBlockCount;
+	
+	// The device may have a limit of its own.
+	if ( ( fDeviceMaximumTransferBlockCount > 0 ) &&
+		 ( fDeviceMaximumTransferBlockCount < blockLimit ) )
+		blockLimit = fDeviceMaximumTransferBlockCount;
+	
+	// A buffer which is not page aligned may need one more scatter/gather
+	// element than it has pages, so only count on ( elements - 1 ) pages.
+	if ( fMaximumScatterGatherElementCount > 1 )
+	{
+		
+		segmentLimit = ( UInt64 ) ( fMaximumScatterGatherElementCount - 1 ) * PAGE_SIZE;
+		
+		if ( ( byteLimit == 0 ) || ( segmentLimit < byteLimit ) )
+			byteLimit = segmentLimit;
+		
+	}
+	
+	if ( byteLimit > 0 )
+	{
+		
+		byteLimit /= blockSize;
+		
+		// Always allow at least one block to be transferred.
+		if ( byteLimit == 0 )
+			byteLimit = 1;
+		
+		if ( byteLimit < blockLimit )
+			blockLimit = byteLimit;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return blockLimit;
+	
+}
+
+
+//
+//	 GetReadWriteRequestBlockLimit - Gets the largest number of blocks to
+//									  advertise for a single read or write
+//									  request.						[PROTECTED]
+//
+
+UInt64
+IOSCSIPrimaryCommandsDevice::GetReadWriteRequestBlockLimit ( UInt64 blockSize )
+{
+	
+	UInt64	blockLimit = 0;
+	
+	require_nonzero ( blockSize, ErrorExit );
+	
+	blockLimit = kReadWriteRequestMaximumByteCount / blockSize;
+	if ( blockLimit == 0 )
+		blockLimit = 1;
+	
+	// Advertise a whole number of optimal transfers so that the layers
+	// above break up large requests where the device would like them to.
+	if ( ( fOptimalTransferBlockCount > 0 ) &&
+		 ( fOptimalTransferBlockCount <= blockLimit ) )
+		blockLimit -= blockLimit % fOptimalTransferBlockCount;
+	
+	
+ErrorExit:
+	
+	
+	return blockLimit;
+	
+}
+
+
+//
+//	 GetReadWriteSplitBlockCount - Gets the number of blocks the next task
+//									of a split read or write request
+//									should transfer.				[PROTECTED]
+//
+
+UInt64
+IOSCSIPrimaryCommandsDevice::GetReadWriteSplitBlockCount (
+									UInt64		startBlock,
+									UInt64		blocksLeft,
+									UInt64		blockSize,
+									bool		isWrite )
+{
+	
+	UInt64	blockLimit	= 0;
+	UInt64	endBlock	= 0;
+	UInt64	granularity	= 0;
+	UInt64	alignment	= 0;
+	
+	blockLimit = GetReadWriteTaskBlockLimit ( startBlock, blockSize, isWrite );
+	require_nonzero ( blockLimit, ErrorExit );
+	
+	// The optimal granularity is normally a multiple of the physical block
+	// size, use whichever is larger.
+	granularity = fOptimalTransferBlockGranularity;
+	if ( fPhysicalBlockGranularity > granularity )
+		granularity = fPhysicalBlockGranularity;
+	
+	if ( blocksLeft <= blockLimit )
+	{
+		blockLimit = blocksLeft;
+	}
+	
+	else if ( granularity > 1 )
+	{
+		
+		// End the task on a granularity boundary so the device does not
+		// have to read-modify-write where two tasks meet. A task too short
+		// to reach the next boundary is left as it is.
+		alignment	= fPhysicalBlockAlignment % granularity;
+		endBlock	= startBlock + blockLimit;
+		
+		if ( endBlock > alignment )
+			endBlock -= ( endBlock - alignment ) % granularity;
+		
+		if ( endBlock > startBlock )
+			blockLimit = endBlock - startBlock;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return blockLimit;
+	
+}
+
+
+//
+//	 SendReadWriteRequest - Builds and sends the task or tasks needed to
+//							 read or write a client request.		[PROTECTED]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::SendReadWriteRequest (
+									IOMemoryDescriptor *	buffer,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									UInt64					blockSize,
+									bool					isWrite,
+									void *					clientData,
+									SCSITaskCompletion		taskCompletion )
+{
+	
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  blockSize,
+								  isWrite,
+								  false,
+								  clientData,
+								  taskCompletion );
+	
+}
+
+
+//
+//	 SendReadWriteRequest - Builds and sends the task or tasks needed to
+//							 read or write a client request, optionally
+//							 writing through the device's cache.	[PROTECTED]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::SendReadWriteRequest (
+									IOMemoryDescriptor *	buffer,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									UInt64					blockSize,
+									bool					isWrite,
+									bool					forceUnitAccess,
+									void *					clientData,
+									SCSITaskCompletion		taskCompletion )
+{
+	
+	IOReturn					status			= kIOReturnBadArgument;
+	SCSITaskIdentifier			request			= NULL;
+	SCSIReadWriteSplitRequest *	splitRequest	= NULL;
+	SCSIReadWriteSplitTask *	splitTasks		= NULL;
+	UInt64						blockLimit		= 0;
+	UInt64						offset			= 0;
+	UInt32						taskCount		= 0;
+	UInt32						index			= 0;
+	bool						cmdStatus		= false;
+	
+	require_nonzero ( buffer, ErrorExit );
+	require_nonzero ( blockCount, ErrorExit );
+	require_nonzero ( blockSize, ErrorExit );
+	
+	blockLimit = GetReadWriteTaskBlockLimit ( startBlock, blockSize, isWrite );
+	require_nonzero ( blockLimit, ErrorExit );
+	
+	if ( blockCount <= blockLimit )
+	{
+		
+		// The common case, the whole request fits in a single task.
+		status = kIOReturnNoResources;
+		request = GetSCSITask ( );
+		require_nonzero ( request, ErrorExit );
+		
+		cmdStatus = BuildReadWriteTask ( request,
+										 buffer,
+										 blockSize,
+										 startBlock,
+										 blockCount,
+										 GetReadWriteCDBSize ( startBlock, blockCount ),
+										 isWrite,
+										 forceUnitAccess );
+		
+		if ( cmdStatus == false )
+		{
+			
+			ReleaseSCSITask ( request );
+			request	= NULL;
+			status	= kIOReturnBadArgument;
+			goto ErrorExit;
+			
+		}
+		
+		SetApplicationLayerReference ( request, clientData );
+		SendReadWriteTask ( request, startBlock, blockCount, isWrite, taskCompletion );
+		status = kIOReturnSuccess;
+		goto ErrorExit;
+		
+	}
+	
+	// Count the tasks needed. The limit is worked out again for each task
+	// since a larger CDB may be needed further into the request.
+	while ( offset < blockCount )
+	{
+		
+		blockLimit = GetReadWriteSplitBlockCount ( startBlock + offset,
+												   blockCount - offset,
+												   blockSize,
+												   isWrite );
+		require_nonzero ( blockLimit, ErrorExit );
+		
+		offset += blockLimit;
+		taskCount++;
+		
+	}
+	
+	status = kIOReturnNoResources;
+	
+	splitRequest = IONew ( SCSIReadWriteSplitRequest, 1 );
+	require_nonzero ( splitRequest, ErrorExit );
+	
+	splitTasks = IONew ( SCSIReadWriteSplitTask, taskCount );
+	require_nonzero ( splitTasks, FreeSplitRequest );
+	
+	bzero ( splitTasks, taskCount * sizeof ( SCSIReadWriteSplitTask ) );
+	
+	splitRequest->clientBuffer			= buffer;
+	splitRequest->failedTask			= NULL;
+	splitRequest->outstandingCount		= taskCount;
+	splitRequest->requestedByteCount	= blockCount * blockSize;
+	splitRequest->realizedByteCount		= 0;
+	
+	// Build every task before sending any of them so that a failure here
+	// can still be reported to the client without anything in flight.
+	for ( index = 0, offset = 0; index < taskCount; index++ )
+	{
+		
+		SCSIReadWriteSplitTask *	splitTask = &splitTasks[index];
+		
+		splitTask->startBlock = startBlock + offset;
+		splitTask->blockCount = GetReadWriteSplitBlockCount ( splitTask->startBlock,
+															  blockCount - offset,
+															  blockSize,
+															  isWrite );
+		
+		splitTask->buffer = IOMemoryDescriptor::withSubRange ( buffer,
+															   offset * blockSize,
+															   splitTask->blockCount * blockSize,
+															   buffer->getDirection ( ) );
+		require_nonzero ( splitTask->buffer, ReleaseSplitTasks );
+		
+		splitTask->request = GetSCSITask ( );
+		require_nonzero ( splitTask->request, ReleaseSplitTasks );
+		
+		cmdStatus = BuildReadWriteTask ( splitTask->request,
+										 splitTask->buffer,
+										 blockSize,
+										 splitTask->startBlock,
+										 splitTask->blockCount,
+										 GetReadWriteCDBSize ( splitTask->startBlock, splitTask->blockCount ),
+										 isWrite,
+										 forceUnitAccess );
+		
+		if ( cmdStatus == false )
+		{
+			
+			status = kIOReturnBadArgument;
+			goto ReleaseSplitTasks;
+			
+		}
+		
+		SetApplicationLayerReference ( splitTask->request, clientData );
+		SetApplicationLayerSplitReference ( splitTask->request, splitRequest );
+		
+		offset += splitTask->blockCount;
+		
+	}
+	
+	// Send them all. The split request may be completed and freed as soon
+	// as the last task is sent, so it must not be touched after this.
+	for ( index = 0; index < taskCount; index++ )
+	{
+		
+		SendReadWriteTask ( splitTasks[index].request,
+							splitTasks[index].startBlock,
+							splitTasks[index].blockCount,
+							isWrite,
+							taskCompletion );
+		
+	}
+	
+	IODelete ( splitTasks, SCSIReadWriteSplitTask, taskCount );
+	splitTasks = NULL;
+	
+	status = kIOReturnSuccess;
+	goto ErrorExit;
+	
+	
+ReleaseSplitTasks:
+	
+	
+	for ( index = 0; index < taskCount; index++ )
+	{
+		
+		if ( splitTasks[index].request != NULL )
+		{
+			
+			ReleaseSCSITask ( splitTasks[index].request );
+			splitTasks[index].request = NULL;
+			
+		}
+		
+		if ( splitTasks[index].buffer != NULL )
+		{
+			
+			splitTasks[index].buffer->release ( );
+			splitTasks[index].buffer = NULL;
+			
+		}
+		
+	}
+	
+	IODelete ( splitTasks, SCSIReadWriteSplitTask, taskCount );
+	splitTasks = NULL;
+	
+	
+FreeSplitRequest:
+	
+	
+	require_nonzero ( splitRequest, ErrorExit );
+	IODelete ( splitRequest, SCSIReadWriteSplitRequest, 1 );
+	splitRequest = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 CompleteReadWriteTask - Accounts for a completed read or write task.
+//							  Returns the task to complete the client
+//							  request with, or NULL if other tasks of a
+//							  split request are still outstanding.	[PROTECTED]
+//
+
+SCSITaskIdentifier
+IOSCSIPrimaryCommandsDevice::CompleteReadWriteTask ( SCSITaskIdentifier request )
+{
+	
+	SCSIReadWriteSplitRequest *	splitRequest	= NULL;
+	IOMemoryDescriptor *		buffer			= NULL;
+	bool						lastTask		= false;
+	
+	require_nonzero ( request, ErrorExit );
+	
+	// Tasks which were not split complete the client request directly.
+	splitRequest = ( SCSIReadWriteSplitRequest * ) GetApplicationLayerSplitReference ( request );
+	require_nonzero_quiet ( splitRequest, ErrorExit );
+	
+	SetApplicationLayerSplitReference ( request, NULL );
+	
+	// Point the task back at the client's buffer before dropping the
+	// sub range it was sent with.
+	buffer = GetDataBuffer ( request );
+	SetDataBuffer ( request, splitRequest->clientBuffer );
+	
+	if ( buffer != NULL )
+	{
+		buffer->release ( );
+	}
+	
+	IOSimpleLockLock ( fReadWriteSplitLock );
+	
+	splitRequest->realizedByteCount += GetRealizedDataTransferCount ( request );
+	
+	// Hold on to the first task which failed, its status and sense data
+	// are reported for the whole request.
+	if ( ( splitRequest->failedTask == NULL ) &&
+		 ( ( GetServiceResponse ( request ) != kSCSIServiceResponse_TASK_COMPLETE ) ||
+		   ( GetTaskStatus ( request ) != kSCSITaskStatus_GOOD ) ) )
+	{
+		
+		splitRequest->failedTask = request;
+		request = NULL;
+		
+	}
+	
+	splitRequest->outstandingCount--;
+	lastTask = ( splitRequest->outstandingCount == 0 );
+	
+	IOSimpleLockUnlock ( fReadWriteSplitLock );
+	
+	if ( lastTask == false )
+	{
+		
+		if ( request != NULL )
+		{
+			
+			ReleaseSCSITask ( request );
+			request = NULL;
+			
+		}
+		
+		goto ErrorExit;
+		
+	}
+	
+	if ( splitRequest->failedTask != NULL )
+	{
+		
+		if ( request != NULL )
+		{
+			ReleaseSCSITask ( request );
+		}
+		
+		request = splitRequest->failedTask;
+		
+	}
+	
+	// Report the transfer counts of the whole request.
+	SetRequestedDataTransferCount ( request, splitRequest->requestedByteCount );
+	SetRealizedDataTransferCount ( request, splitRequest->realizedByteCount );
+	
+	IODelete ( splitRequest, SCSIReadWriteSplitRequest, 1 );
+	splitRequest = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return request;
+	
+}
+
+
+//
+//	 InitializeReadWriteTaskTemplates - Captures the read and write task
+//										 templates.					[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::InitializeReadWriteTaskTemplates ( UInt64 blockSize )
+{
+	
+	SCSIReadWriteTaskTemplate *	ioTemplate	= NULL;
+	UInt32						index		= 0;
+	bool						result		= false;
+	
+	if ( fReadWriteTaskTemplates == NULL )
+	{
+		
+		fReadWriteTaskTemplates = IONew ( SCSIReadWriteTaskTemplate, kReadWriteTaskTemplateCount );
+		require_nonzero ( fReadWriteTaskTemplates, ErrorExit );
+		
+	}
+	
+	bzero ( fReadWriteTaskTemplates, sizeof ( SCSIReadWriteTaskTemplate ) * kReadWriteTaskTemplateCount );
+	
+	for ( index = 0; index < kReadWriteTaskTemplateCount; index++ )
+	{
+		
+		ioTemplate = &fReadWriteTaskTemplates[index];
+		
+		// No protection information, DPO or FUA is requested, so the flags
+		// byte is clear. The timeout is not part of the template since
+		// SendReadWriteTask ( ) sends every task with the device's read or
+		// write timeout.
+		ioTemplate->blockSize		= blockSize;
+		ioTemplate->commandFlags	= 0;
+		ioTemplate->tagged			= GetCMDQUE ( );
+		
+		if ( index == kReadWriteTaskTemplate_Write )
+		{
+			
+			ioTemplate->operationCode6			= kSCSICmd_WRITE_6;
+			ioTemplate->operationCode10			= kSCSICmd_WRITE_10;
+			ioTemplate->operationCode12			= kSCSICmd_WRITE_12;
+			ioTemplate->operationCode16			= kSCSICmd_WRITE_16;
+			ioTemplate->dataTransferDirection	= kSCSIDataTransfer_FromInitiatorToTarget;
+			
+		}
+		
+		else
+		{
+			
+			ioTemplate->operationCode6			= kSCSICmd_READ_6;
+			ioTemplate->operationCode10			= kSCSICmd_READ_10;
+			ioTemplate->operationCode12			= kSCSICmd_READ_12;
+			ioTemplate->operationCode16			= kSCSICmd_READ_16;
+			ioTemplate->dataTransferDirection	= kSCSIDataTransfer_FromTargetToInitiator;
+			
+		}
+		
+	}
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 SetReadWriteTaskTemplateBlockSize - Updates the block size of the read
+//										  and write task templates when the
+//										  medium changes.			[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::SetReadWriteTaskTemplateBlockSize ( UInt64 blockSize )
+{
+	
+	require_nonzero_quiet ( fIOSCSIPrimaryCommandsDeviceReserved, ErrorExit );
+	require_nonzero_quiet ( fReadWriteTaskTemplates, ErrorExit );
+	
+	fReadWriteTaskTemplates[kReadWriteTaskTemplate_Read].blockSize	= blockSize;
+	fReadWriteTaskTemplates[kReadWriteTaskTemplate_Write].blockSize	= blockSize;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 StampReadWriteTask - Fills in a read or write task from the device's
+//						   task template.							[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::StampReadWriteTask (
+									SCSITaskIdentifier		request,
+									IOMemoryDescriptor *	buffer,
+									UInt64					blockSize,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									UInt8					cdbSize,
+									bool					isWrite,
+									bool					forceUnitAccess )
+{
+	
+	SCSITask *					scsiRequest	= NULL;
+	SCSIReadWriteTaskTemplate *	ioTemplate	= NULL;
+	SCSICommandDescriptorBlock	cdb;
+	UInt8						flags		= 0;
+	bool						result		= false;
+	
+	require_nonzero_quiet ( fReadWriteTaskTemplates, ErrorExit );
+	require_nonzero ( blockSize, ErrorExit );
+	
+	ioTemplate = &fReadWriteTaskTemplates[isWrite ? kReadWriteTaskTemplate_Write : kReadWriteTaskTemplate_Read];
+	require_quiet ( ( ioTemplate->blockSize == blockSize ), ErrorExit );
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	require_nonzero ( scsiRequest, ErrorExit );
+	
+	// The task is expected to be fresh from GetSCSITask ( ), whose fields
+	// are already at their defaults, so only the fields which differ from
+	// those are written. A task which has been built before is left to the
+	// command builders, which reset it first.
+	require_quiet ( ( scsiRequest->GetCommandDescriptorBlockSize ( ) == 0 ), ErrorExit );
+	
+	// GetReadWriteCDBSize ( ) has already checked that the LBA and transfer
+	// length fit in a CDB of this size, so they are stored without being
+	// checked again.
+	bzero ( cdb, sizeof ( cdb ) );
+	flags = ioTemplate->commandFlags;
+	
+	if ( forceUnitAccess == true )
+		flags |= kReadWriteCDB_FUAMask;
+	
+	switch ( cdbSize )
+	{
+		
+		case kSCSICDBSize_6Byte:
+		{
+			
+			// READ(6) and WRITE(6) have no flags byte, it holds the top five
+			// bits of the LBA instead, so FUA can not be requested.
+			require_quiet ( ( forceUnitAccess == false ), ErrorExit );
+			
+			cdb[0] = ioTemplate->operationCode6;
+			cdb[1] = ( UInt8 ) ( ( startBlock >> 16 ) & 0x1F );
+			OSWriteBigInt16 ( cdb, 2, ( UInt16 ) startBlock );
+			cdb[4] = ( UInt8 ) blockCount;
+			
+		}
+		break;
+		
+		case kSCSICDBSize_10Byte:
+		{
+			
+			cdb[0] = ioTemplate->operationCode10;
+			cdb[1] = flags;
+			OSWriteBigInt32 ( cdb, 2, ( UInt32 ) startBlock );
+			OSWriteBigInt16 ( cdb, 7, ( UInt16 ) blockCount );
+			
+		}
+		break;
+		
+		case kSCSICDBSize_12Byte:
+		{
+			
+			cdb[0] = ioTemplate->operationCode12;
+			cdb[1] = flags;
+			OSWriteBigInt32 ( cdb, 2, ( UInt32 ) startBlock );
+			OSWriteBigInt32 ( cdb, 6, ( UInt32 ) blockCount );
+			
+		}
+		break;
+		
+		case kSCSICDBSize_16Byte:
+		{
+			
+			cdb[0] = ioTemplate->operationCode16;
+			cdb[1] = flags;
+			OSWriteBigInt64 ( cdb, 2, startBlock );
+			OSWriteBigInt32 ( cdb, 10, ( UInt32 ) blockCount );
+			
+		}
+		break;
+		
+		default:
+			goto ErrorExit;
+		
+	}
+	
+	check ( buffer->getLength ( ) >= ( blockCount * blockSize ) );
+	
+	scsiRequest->SetCommandDescriptorBlock ( &cdb, cdbSize );
+	scsiRequest->SetDataTransferDirection ( ioTemplate->dataTransferDirection );
+	scsiRequest->SetDataBuffer ( buffer );
+	scsiRequest->SetRequestedDataTransferCount ( blockCount * blockSize );
+	
+	// New tasks already have the SIMPLE task attribute.
+	if ( ioTemplate->tagged == true )
+	{
+		scsiRequest->SetTaggedTaskIdentifier ( GetUniqueTagID ( ) );
+	}
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 BuildReadWriteTask - Builds a read or write task. Subclasses override
+//						   this for their command set.				[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::BuildReadWriteTask (
+									SCSITaskIdentifier		request,
+									IOMemoryDescriptor *	buffer,
+									UInt64					blockSize,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									UInt8					cdbSize,
+									bool					isWrite,
+									bool					forceUnitAccess )
+{
+	return false;
+}
+
+
+//
+//	 SendReadWriteTask - Sends a read or write task built by
+//						  SendReadWriteRequest ( ).					[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::SendReadWriteTask (
+									SCSITaskIdentifier		request,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									bool					isWrite,
+									SCSITaskCompletion		taskCompletion )
+{
+	
+	SendCommand ( request,
+				  ( isWrite == true ) ? fWriteTimeoutDuration : fReadTimeoutDuration,
+				  taskCompletion );
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Device Information Methods
+#pragma mark -
+#endif
+
+
+//
+//  GetVendorString - Gets the vendor string.						[PROTECTED]
+//
+
+char *
+IOSCSIPrimaryCommandsDevice::GetVendorString ( void )
+{
+	
+	OSString *		vendorString;
+	
+	vendorString = ( OSString * ) GetProtocolDriver ( )->getProperty (
+										kIOPropertySCSIVendorIdentification );
+	if ( vendorString != NULL )
+	{
+		return ( ( char * ) vendorString->getCStringNoCopy ( ) );
+	}
+	
+	else
+	{
+		return "NULL STRING";
+	}
+	
+}
+
+
+//
+//  GetProductString - Gets the product string.					[PROTECTED]
+//
+
+char *
+IOSCSIPrimaryCommandsDevice::GetProductString ( void )
+{
+	
+	OSString *		productString;
+	
+	productString = ( OSString * ) GetProtocolDriver ( )->getProperty (
+										kIOPropertySCSIProductIdentification );
+	if ( productString != NULL )
+	{
+		return ( ( char * ) productString->getCStringNoCopy ( ) );
+	}
+	
+	else
+	{
+		return "NULL STRING";
+	}
+	
+}
+
+
+//
+//  GetRevisionString - Gets the product revision level string.	[PROTECTED]
+//
+
+char *
+IOSCSIPrimaryCommandsDevice::GetRevisionString ( void )
+{
+	
+	OSString *		revisionString;
+	
+	STATUS_LOG ( ( "%s::%s\n", getName ( ), __FUNCTION__ ) );
+	
+	revisionString = ( OSString * ) GetProtocolDriver ( )->getProperty (
+										kIOPropertySCSIProductRevisionLevel );
+	
+	if ( revisionString != NULL )
+	{
+		return ( ( char * ) revisionString->getCStringNoCopy ( ) );
+	}
+	
+	else
+	{
+		return "NULL STRING";
+	}
+	
+}
+
+
+//
+//  GetProtocolCharacteristicsDictionary - Gets the protocol characteristics
+//											dictionary.				[PROTECTED]
+//
+
+OSDictionary *
+IOSCSIPrimaryCommandsDevice::GetProtocolCharacteristicsDictionary ( void )
+{
+	
+	return ( OSDictionary * ) GetProtocolDriver ( )->getProperty (
+										kIOPropertyProtocolCharacteristicsKey );
+	
+}
+
+
+//
+//  GetDeviceCharacteristicsDictionary - 	Gets the device characteristics
+//											dictionary.				[PROTECTED]
+//
+
+OSDictionary *
+IOSCSIPrimaryCommandsDevice::GetDeviceCharacteristicsDictionary ( void )
+{
+	
+	check ( fDeviceCharacteristicsDictionary );
+	return fDeviceCharacteristicsDictionary;
+	
+}
+
+
+//
+//  GetANSIVersion - Gets the ANSI version the device claims conformance to.
+//																	[PROTECTED]
+//
+
+UInt8
+IOSCSIPrimaryCommandsDevice::GetANSIVersion ( void )
+{
+	
+	return fANSIVersion;
+	
+}
+
+
+//
+//  SetANSIVersion - Sets the ANSI version the device claims conformance to.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::SetANSIVersion ( UInt8 newVersion )
+{
+	
+	fANSIVersion = newVersion;
+	
+}
+
+
+//
+//  GetCMDQUE - Gets the CMDQUE bit from the INQUIRY data.			[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::GetCMDQUE ( void )
+{
+	
+	return fCMDQUE;
+	
+}
+
+
+//
+//  SetCMDQUE - Sets the CMDQUE bit from the INQUIRY data.			[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::SetCMDQUE ( bool value )
+{
+	
+	fCMDQUE = value;
+	
+}
+
+
+//
+//  GetModeSense - Called to get mode sense data from the device.	[PROTECTED]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::GetModeSense ( 
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField6Bit 			PAGE_CODE,
+						SCSICmdField2Byte 			ALLOCATION_LENGTH,
+						bool *						use10ByteModeSense )
+{
+	
+	SCSIServiceResponse			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	SCSICmdField1Bit			DBD				= 0;
+	IOReturn					status			= kIOReturnNoResources;
+	bool						commandOK		= false;
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+OUTERLOOP:
+		
+		
+		DBD = 1;	/* Disable block descriptors */
+		
+		
+	INNERLOOP:
 		
 		
 		if ( *use10ByteModeSense )
@@ -2538,9 +3690,10 @@ IOSCSIPrimaryCommandsDevice::sWaitForTask (
 #endif
 
 
+OSMetaClassDefineReservedUsed ( IOSCSIPrimaryCommandsDevice,  1 );	/* BuildReadWriteTask */
+OSMetaClassDefineReservedUsed ( IOSCSIPrimaryCommandsDevice,  2 );	/* SendReadWriteTask */
+
 // Space reserved for future expansion.
-OSMetaClassDefineReservedUnused ( IOSCSIPrimaryCommandsDevice,  1 );
-OSMetaClassDefineReservedUnused ( IOSCSIPrimaryCommandsDevice,  2 );
 OSMetaClassDefineReservedUnused ( IOSCSIPrimaryCommandsDevice,  3 );
 OSMetaClassDefineReservedUnused ( IOSCSIPrimaryCommandsDevice,  4 );
 OSMetaClassDefineReservedUnused ( IOSCSIPrimaryCommandsDevice,  5 );
@@ -66,6 +66,16 @@ enum
 	kThirtySecondTimeoutInMS	= 30 * kOneSecondTimeoutInMS
 };
 
+// CDB sizes which may be used for read and write requests.
+// See SetReadWriteCDBSizeMask ( ).
+enum
+{
+	kSCSIReadWriteCDBSize_6ByteMask		= ( 1 << 0 ),
+	kSCSIReadWriteCDBSize_10ByteMask	= ( 1 << 1 ),
+	kSCSIReadWriteCDBSize_12ByteMask	= ( 1 << 2 ),
+	kSCSIReadWriteCDBSize_16ByteMask	= ( 1 << 3 )
+};
+
 // Mode page values for page control field
 enum
 {
@@ -77,6 +87,7 @@ enum
 
 // Forward declarations for internal use only classes
 class SCSIPrimaryCommands;
+struct SCSIReadWriteTaskTemplate;
 
 
 //
@@ -116,6 +127,7 @@ private:
 	
 	static IOReturn	sWaitForTask ( void * object, SCSITaskIdentifier request );
 	IOReturn		GatedWaitForTask ( SCSITaskIdentifier request );
+	void			PollForTask ( SCSITaskIdentifier request );
 	
 protected:
 	
@@ -129,6 +141,20 @@ protected:
 		bool						fCMDQUE;
 		SCSITaggedTaskIdentifier	fTaskID;
 		IOSimpleLock *				fTaskIDLock;
+		UInt8						fReadWriteCDBSizeMask;
+		IOSimpleLock *				fReadWriteSplitLock;
+		UInt32						fMaximumReadBlockCount;
+		UInt32						fMaximumWriteBlockCount;
+		UInt64						fMaximumReadByteCount;
+		UInt64						fMaximumWriteByteCount;
+		UInt32						fMaximumScatterGatherElementCount;
+		SCSIReadWriteTaskTemplate *	fReadWriteTaskTemplates;
+		UInt32						fDeviceMaximumTransferBlockCount;
+		UInt32						fOptimalTransferBlockCount;
+		UInt32						fOptimalTransferBlockGranularity;
+		UInt32						fPhysicalBlockGranularity;
+		UInt32						fPhysicalBlockAlignment;
+		bool						fProtocolPollsForCompletion;
 	};
 	IOSCSIPrimaryCommandsDeviceExpansionData * fIOSCSIPrimaryCommandsDeviceReserved;
 	
@@ -298,6 +324,13 @@ protected:
 										UInt8					cdbByte13,
 										UInt8					cdbByte14,
 										UInt8					cdbByte15 );
+	
+	// Populate the Command Descriptor Block from one already packed from a
+	// SCSICDBField layout.
+	bool 							SetCommandDescriptorBlock ( 
+										SCSITaskIdentifier 					request,
+										const SCSICommandDescriptorBlock *	cdbData,
+										UInt8								cdbSize );
 										
 	bool							SetDataTransferDirection ( 
 										SCSITaskIdentifier 		request, 
@@ -358,6 +391,96 @@ protected:
 										void * 					newReferenceValue );
 	void *							GetApplicationLayerReference (
 										SCSITaskIdentifier 		request );
+	bool							SetApplicationLayerSplitReference (
+										SCSITaskIdentifier 		request,
+										void * 					newReferenceValue );
+	void *							GetApplicationLayerSplitReference (
+										SCSITaskIdentifier 		request );
+	
+	// Read and write request support shared by the block, reduced block
+	// and multimedia command set devices. SendReadWriteRequest ( ) picks
+	// the smallest CDB enabled by SetReadWriteCDBSizeMask ( ) which can
+	// describe a transfer and, if the transfer exceeds what the transport
+	// can carry in one task, splits it into several tasks which are all
+	// issued at once. The completion routine passed in must call
+	// CompleteReadWriteTask ( ) and only complete the client request when
+	// it returns a task. A request sent with forceUnitAccess set has every
+	// one of its tasks built with the FUA bit, so the data is written
+	// through the device's cache. READ(6) and WRITE(6) have no FUA bit, so
+	// a device which enables them must build such tasks with a larger CDB.
+	// SetReadWriteTransferLimits ( ) adds the device's
+	// own limits: no task exceeds maximumBlockCount, split tasks end on a
+	// multiple of blockGranularity and the advertised request size is a
+	// multiple of optimalBlockCount. Zero means no limit or preference.
+	// SetReadWriteTransferAlignment ( ) does the same for the physical
+	// blocks of the medium, so split tasks also end on a physical block
+	// boundary. Physical blocks start at lowestAlignedBlock.
+	void							SetReadWriteCDBSizeMask ( UInt8 mask );
+	UInt8							GetReadWriteCDBSizeMask ( void );
+	void							SetReadWriteTransferLimits (
+										UInt32					maximumBlockCount,
+										UInt32					optimalBlockCount,
+										UInt32					blockGranularity );
+	void							SetReadWriteTransferAlignment (
+										UInt32					logicalBlocksPerPhysicalBlock,
+										UInt32					lowestAlignedBlock );
+	UInt8							GetReadWriteCDBSize (
+										UInt64					startBlock,
+										UInt64					blockCount );
+	UInt64							GetReadWriteTaskBlockLimit (
+										UInt64					startBlock,
+										UInt64					blockSize,
+										bool					isWrite );
+	UInt64							GetReadWriteRequestBlockLimit (
+										UInt64					blockSize );
+	UInt64							GetReadWriteSplitBlockCount (
+										UInt64					startBlock,
+										UInt64					blocksLeft,
+										UInt64					blockSize,
+										bool					isWrite );
+	IOReturn						SendReadWriteRequest (
+										IOMemoryDescriptor *	buffer,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										UInt64					blockSize,
+										bool					isWrite,
+										void *					clientData,
+										SCSITaskCompletion		taskCompletion );
+	IOReturn						SendReadWriteRequest (
+										IOMemoryDescriptor *	buffer,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										UInt64					blockSize,
+										bool					isWrite,
+										bool					forceUnitAccess,
+										void *					clientData,
+										SCSITaskCompletion		taskCompletion );
+	SCSITaskIdentifier				CompleteReadWriteTask (
+										SCSITaskIdentifier		request );
+
+	// Read and write task templates. InitializeReadWriteTaskTemplates ( )
+	// captures everything about a read or write task which does not change
+	// from one request to the next (opcodes, flags, direction, tagging and
+	// block size) once the device characteristics are known.
+	// StampReadWriteTask ( ) then fills in a new task from the template
+	// with only the LBA, transfer length, buffer and tag, skipping the
+	// parameter validation and task reset done by the command builders. It returns false if there
+	// is no template for the block size or CDB size, or if FUA is requested
+	// of a 6 byte CDB, in which case the task should be built with the
+	// command builders instead.
+	bool							InitializeReadWriteTaskTemplates (
+										UInt64					blockSize );
+	void							SetReadWriteTaskTemplateBlockSize (
+										UInt64					blockSize );
+	bool							StampReadWriteTask (
+										SCSITaskIdentifier		request,
+										IOMemoryDescriptor *	buffer,
+										UInt64					blockSize,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										UInt8					cdbSize,
+										bool					isWrite,
+										bool					forceUnitAccess );
 	
 	void 							IncrementOutstandingCommandsCount ( void );
 	static void						sIncrementOutstandingCommandsCount ( 
@@ -605,6 +728,15 @@ public:
 		 					SCSICmdField1Byte			PAGE_CODE,
 		 					SCSICmdField2Byte 			ALLOCATION_LENGTH,
 							SCSICmdField1Byte 			CONTROL );
+	
+	// Defined in SPC-3 section 6.18
+	bool				RECEIVE_COPY_RESULTS (
+							SCSITaskIdentifier			request,
+							IOMemoryDescriptor *		dataBuffer,
+		 					SCSICmdField5Bit 			SERVICE_ACTION,
+		 					SCSICmdField1Byte			LIST_IDENTIFIER,
+		 					SCSICmdField4Byte 			ALLOCATION_LENGTH,
+							SCSICmdField1Byte 			CONTROL );
 
 	virtual bool		RELEASE_6 (
 							SCSITaskIdentifier			request,
@@ -726,11 +858,42 @@ public:
 							SCSICmdField3Byte 			PARAMETER_LIST_LENGTH,
 							SCSICmdField1Byte 			CONTROL );
 	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIPrimaryCommandsDevice, 1 );
+	
+protected:
+	
+	// This method is called by SendReadWriteRequest ( ) to build a read or
+	// write of blockCount blocks at startBlock using a CDB of cdbSize bytes.
+	// Subclasses override it to encode the commands of their command set.
+	// forceUnitAccess is only set for writes the subclass itself sent with
+	// it set. The default implementation builds nothing and returns false.
+	virtual bool					BuildReadWriteTask (
+										SCSITaskIdentifier		request,
+										IOMemoryDescriptor *	buffer,
+										UInt64					blockSize,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										UInt8					cdbSize,
+										bool					isWrite,
+										bool					forceUnitAccess );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIPrimaryCommandsDevice, 2 );
+	
+	// This method is called by SendReadWriteRequest ( ) to send each task
+	// it has built. Subclasses may override it to hold tasks back, e.g. to
+	// sort them. The default implementation sends the task right away.
+	virtual void					SendReadWriteTask (
+										SCSITaskIdentifier		request,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										bool					isWrite,
+										SCSITaskCompletion		taskCompletion );
+	
 private:
 	
 	// Space reserved for future expansion.
-	OSMetaClassDeclareReservedUnused ( IOSCSIPrimaryCommandsDevice,  1 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIPrimaryCommandsDevice,  2 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIPrimaryCommandsDevice,  3 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIPrimaryCommandsDevice,  4 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIPrimaryCommandsDevice,  5 );
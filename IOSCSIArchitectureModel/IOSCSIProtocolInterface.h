@@ -56,6 +56,11 @@
 // This property is a string, although if it exists it should always be true.
 #define kIOPropertySCSIManualEjectKey				"Manual Eject"
 
+// This key is used to indicate that the device uses solid state media and does
+// not benefit from having its requests sorted by logical block address.
+// This property is a string, although if it exists it should always be true.
+#define kIOPropertySCSISolidStateKey				"Solid State"
+
 // This key is used to define the Read Time Out for a particular device
 // This property overrides all of the protocol defaults
 // This Property is a value, in miliseconds
@@ -97,6 +102,18 @@ enum
 };
 
 
+// Completion coalescing settings used with
+// kSCSIProtocolFeature_CompletionCoalescing. A transport holds back its
+// completion interrupt until maximumCompletions commands have completed or
+// maximumDelayInMicroseconds have passed since the first of them, whichever
+// comes first. A maximumCompletions of 0 or 1 turns coalescing off.
+typedef struct SCSICompletionCoalescing
+{
+	UInt32		maximumCompletions;
+	UInt32		maximumDelayInMicroseconds;
+} SCSICompletionCoalescing;
+
+
 typedef UInt32 SCSIProtocolFeature;
 // SCSI Protocol Features
 enum
@@ -165,7 +182,47 @@ enum
 	// autosense data when a kSCSITaskStatus_CHECK_CONDITION is set,
 	// then the protocol layer should return true. E.g. FireWire
 	// transport drivers should respond true to this.
-	kSCSIProtocolFeature_ProtocolAlwaysReportsAutosenseData	= 11
+	kSCSIProtocolFeature_ProtocolAlwaysReportsAutosenseData	= 11,
+	
+	// kSCSIProtocolFeature_MaximumScatterGatherElementCount:
+	// If the SCSI Protocol Services Driver can only map a limited number
+	// of scatter/gather elements for a single task, it will return true
+	// to this query and return the element count in the UInt32 pointer
+	// that is passed in as the serviceValue. Read and write requests
+	// which may need more elements are split into several tasks.
+	kSCSIProtocolFeature_MaximumScatterGatherElementCount	= 12,
+	
+	// kSCSIProtocolFeature_SubmissionQueueCount:
+	// If the SCSI Protocol Services Driver has more than one hardware
+	// submission queue, each of which can be fed independently, it will
+	// return true to this query and return the number of queues in the
+	// UInt32 pointer that is passed in as the serviceValue. Tasks are then
+	// queued per CPU and SendSCSICommand may be called concurrently for
+	// different queues. The driver uses GetSubmissionQueue ( ) to find the
+	// queue a task was sent on. Drivers which return false are called for
+	// one task at a time, as before.
+	kSCSIProtocolFeature_SubmissionQueueCount				= 13,
+	
+	// kSCSIProtocolFeature_PollForCompletion:
+	// If the SCSI Protocol Services Driver can reap completed commands
+	// without waiting for its interrupt, it will return true to this query.
+	// Threads waiting on a synchronous command then call
+	// HandleProtocolServiceFeature with this feature for a short while
+	// before going to sleep, passing the SCSITaskIdentifier being waited
+	// for as the serviceValue. The driver should complete whatever commands
+	// are done, through CommandCompleted as usual, and return true if it
+	// completed any.
+	kSCSIProtocolFeature_PollForCompletion					= 14,
+	
+	// kSCSIProtocolFeature_CompletionCoalescing:
+	// If the SCSI Protocol Services Driver can coalesce completion
+	// interrupts, it will return true to this query and return its current
+	// settings in the SCSICompletionCoalescing pointer that is passed in as
+	// the serviceValue. The application layer changes the settings by
+	// calling HandleProtocolServiceFeature with this feature and a pointer
+	// to the new SCSICompletionCoalescing settings. The transport may round
+	// them to what its hardware supports.
+	kSCSIProtocolFeature_CompletionCoalescing				= 15
 	
 };
 
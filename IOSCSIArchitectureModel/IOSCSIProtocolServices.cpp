@@ -30,6 +30,11 @@
 #include <libkern/OSByteOrder.h>
 #include <libkern/OSAtomic.h>
 #include <libkern/c++/OSDictionary.h>
+#include <libkern/c++/OSArray.h>
+#include <libkern/c++/OSNumber.h>
+
+// Mach includes
+#include <kern/cpu_number.h>
 
 // General IOKit includes
 #include <IOKit/IOWorkLoop.h>
@@ -44,6 +49,13 @@
 #define fSemaphore						fIOSCSIProtocolServicesReserved->fSemaphore
 #define fRequiresAutosenseDescriptor	fIOSCSIProtocolServicesReserved->fRequiresAutosenseDescriptor
 #define fCompletionRoutine				fIOSCSIProtocolServicesReserved->fCompletionRoutine
+#define fLogicalUnitQueues				fIOSCSIProtocolServicesReserved->fLogicalUnitQueues
+#define fActiveLogicalUnitQueue			fIOSCSIProtocolServicesReserved->fActiveLogicalUnitQueue
+#define fQueuedTaskCount				fIOSCSIProtocolServicesReserved->fQueuedTaskCount
+#define fSubmissionQueues				fIOSCSIProtocolServicesReserved->fSubmissionQueues
+#define fSubmissionQueueCount			fIOSCSIProtocolServicesReserved->fSubmissionQueueCount
+#define fSubmissionQueueCompletionCount	fIOSCSIProtocolServicesReserved->fSubmissionQueueCompletionCount
+#define fRefusedSubmissionQueueCount	fIOSCSIProtocolServicesReserved->fRefusedSubmissionQueueCount
 
 //
 //	Macros
@@ -110,6 +122,122 @@ enum
 	kSCSITaskQueueCompletionMask	= ( 1 << kSCSITaskQueueCompletionBit )
 };
 
+enum
+{
+	// Only single level LUN values are supported by SCSITask, so there can
+	// be at most 256 logical unit queues.
+	kSCSIMaximumLogicalUnitQueues		= 256,
+	
+	// Number of bytes a logical unit with a weight of 1 may send each time
+	// it is visited by the deficit round robin scheduler.
+	kSCSILogicalUnitQueueQuantum		= 128 * 1024,
+	
+	// Commands that transfer little or no data are charged this much so
+	// that a logical unit can not flood the interface with them for free.
+	kSCSILogicalUnitQueueMinimumCost	= 4 * 1024
+};
+
+enum
+{
+	// Upper bound on the number of hardware submission queues used.
+	kSCSIMaximumSubmissionQueues		= 64,
+	
+	// Submission queues are padded to this size so that two of them never
+	// share a cache line.
+	kSCSISubmissionQueueAlignment		= 64
+};
+
+#define kIOPropertyLogicalUnitQueueStatisticsKey		"Logical Unit Queue Statistics"
+#define kIOPropertyLogicalUnitNumberKey					"Logical Unit Number"
+#define kIOPropertyLogicalUnitQueueWeightKey			"Weight"
+#define kIOPropertyLogicalUnitQueueDepthKey				"Queue Depth"
+#define kIOPropertyLogicalUnitMaximumQueueDepthKey		"Maximum Queue Depth"
+#define kIOPropertyLogicalUnitTasksDispatchedKey		"Tasks Dispatched"
+#define kIOPropertyLogicalUnitBytesDispatchedKey		"Bytes Dispatched"
+#define kIOPropertyLogicalUnitTotalWaitTimeKey			"Total Queue Wait Time (ns)"
+#define kIOPropertyLogicalUnitMaximumWaitTimeKey		"Maximum Queue Wait Time (ns)"
+
+
+//
+//	Structures
+//
+
+// Structure for the per logical unit task queues. All fields are protected
+// by fQueueLock.
+struct SCSILogicalUnitTaskQueue
+{
+	
+	// The queued tasks for this logical unit.
+	SCSITask *					head;
+	SCSITask *					tail;
+	
+	// Links in the circular list of logical unit queues with queued tasks.
+	SCSILogicalUnitTaskQueue *	nextActive;
+	SCSILogicalUnitTaskQueue *	previousActive;
+	
+	// Deficit round robin scheduling state.
+	UInt32						weight;
+	SInt64						deficit;
+	
+	// The task last taken from this queue and the deficit it will cost once
+	// the subclass accepts it. A task the subclass refuses goes back on the
+	// shared queue and is charged when it is finally accepted.
+	SCSITask *					pendingTask;
+	SInt64						pendingCost;
+	
+	// Statistics.
+	UInt32						depth;
+	UInt32						maximumDepth;
+	UInt64						tasksDispatched;
+	UInt64						bytesDispatched;
+	UInt64						totalWaitTime;
+	UInt64						maximumWaitTime;
+	
+};
+
+typedef struct SCSILogicalUnitTaskQueue SCSILogicalUnitTaskQueue;
+
+
+// Structure for the per hardware queue task queues used when the subclass
+// has more than one submission queue. All fields but semaphore and refused
+// are protected by lock. Tasks are sent from each queue in FIFO order, so logical unit
+// queue weights only apply in single queue mode.
+struct SCSISubmissionQueue
+{
+	
+	IOSimpleLock *				lock;
+	
+	// The queued tasks for this submission queue.
+	SCSITask *					head;
+	SCSITask *					tail;
+	UInt32						queuedTaskCount;
+	
+	// Busy and completion bits, as fSemaphore is for the single queue.
+	UInt32						semaphore;
+	
+	// Set while the task at the head of the queue is waiting for the
+	// subclass to free a slot.
+	UInt32						refused;
+	
+	// The index of the hardware queue this queue feeds.
+	UInt32						index;
+	
+} __attribute__ ( ( aligned ( kSCSISubmissionQueueAlignment ) ) );
+
+typedef struct SCSISubmissionQueue SCSISubmissionQueue;
+
+
+//
+//	Prototypes
+//
+
+static SInt64
+GetTaskQueueCost ( SCSITask * task );
+
+static void
+ActivateLogicalUnitQueue ( SCSILogicalUnitTaskQueue ** 	activeQueue,
+						   SCSILogicalUnitTaskQueue * 	queue );
+
 
 #if 0
 #pragma mark -
@@ -126,8 +254,9 @@ bool
 IOSCSIProtocolServices::start ( IOService * provider )
 {
 	
-	OSDictionary *  dict 	= NULL;	
-	bool			result	= false;
+	OSDictionary *  dict 		= NULL;	
+	UInt32			queueCount	= 0;
+	bool			result		= false;
 	
 	result = super::start ( provider );
 	require ( result, ErrorExit );
@@ -146,10 +275,20 @@ IOSCSIProtocolServices::start ( IOService * provider )
 	// Zero the reserved data section.
 	bzero ( fIOSCSIProtocolServicesReserved, sizeof ( IOSCSIProtocolServicesExpansionData ) );
 	
+	// Allocate the table of per logical unit queues. The queues themselves
+	// are allocated as the logical units are attached, see
+	// CreateLogicalUnitQueue ( ).
+	fLogicalUnitQueues = IONew ( SCSILogicalUnitTaskQueue *, kSCSIMaximumLogicalUnitQueues );
+	require_nonzero ( fLogicalUnitQueues, FreeReserved );
+	bzero ( fLogicalUnitQueues, kSCSIMaximumLogicalUnitQueues * sizeof ( SCSILogicalUnitTaskQueue * ) );
+	
 	// Allocate the mutex for accessing the SCSI Task Queue.
 	fQueueLock = IOSimpleLockAlloc ( );
 	require_nonzero ( fQueueLock, FreeReserved );
 	
+	// Every device has a logical unit zero.
+	CreateLogicalUnitQueue ( 0 );
+	
 	// If the provider has a Protocol Characteristics dictionary, copy
 	// it to the Protocol Services object.
 	dict = OSDynamicCast ( OSDictionary, provider->getProperty ( kIOPropertyProtocolCharacteristicsKey ) );
@@ -180,6 +319,25 @@ IOSCSIProtocolServices::start ( IOService * provider )
 										kSCSIProtocolFeature_ProtocolAlwaysReportsAutosenseData,
 										NULL );
 	
+	// If the protocol layer driver has several hardware submission queues,
+	// give each one its own software queue so that CPUs submitting to
+	// different queues never serialize on fQueueLock. If the queues can't
+	// be allocated, fall back to the single queue.
+	if ( IsProtocolServiceSupported ( kSCSIProtocolFeature_SubmissionQueueCount, &queueCount ) == true )
+	{
+		
+		if ( queueCount > kSCSIMaximumSubmissionQueues )
+		{
+			queueCount = kSCSIMaximumSubmissionQueues;
+		}
+		
+		if ( queueCount > 1 )
+		{
+			AllocateSubmissionQueues ( queueCount );
+		}
+		
+	}
+	
 #if DEBUG
 	
 	setProperty ( "kSCSIProtocolFeature_ProtocolAlwaysReportsAutosenseData", !fRequiresAutosenseDescriptor );
@@ -195,6 +353,12 @@ FreeReserved:
 	
 	
 	require_nonzero_quiet ( fIOSCSIProtocolServicesReserved, ErrorExit );
+	
+	if ( fLogicalUnitQueues != NULL )
+	{
+		IODelete ( fLogicalUnitQueues, SCSILogicalUnitTaskQueue *, kSCSIMaximumLogicalUnitQueues );
+	}
+	
 	IODelete ( fIOSCSIProtocolServicesReserved, IOSCSIProtocolServicesExpansionData, 1 );
 	fIOSCSIProtocolServicesReserved = NULL;
 	
@@ -227,6 +391,26 @@ IOSCSIProtocolServices::free ( void )
 	if ( fIOSCSIProtocolServicesReserved != NULL )
 	{
 		
+		FreeSubmissionQueues ( );
+		
+		if ( fLogicalUnitQueues != NULL )
+		{
+			
+			for ( UInt32 index = 0; index < kSCSIMaximumLogicalUnitQueues; index++ )
+			{
+				
+				if ( fLogicalUnitQueues[index] != NULL )
+				{
+					IODelete ( fLogicalUnitQueues[index], SCSILogicalUnitTaskQueue, 1 );
+				}
+				
+			}
+			
+			IODelete ( fLogicalUnitQueues, SCSILogicalUnitTaskQueue *, kSCSIMaximumLogicalUnitQueues );
+			fLogicalUnitQueues = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIProtocolServicesReserved, IOSCSIProtocolServicesExpansionData, 1 );
 		fIOSCSIProtocolServicesReserved = NULL;
 		
@@ -457,7 +641,7 @@ IOSCSIProtocolServices::GetTaskAttribute ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskAttribute ( );
 	
 }
@@ -474,7 +658,7 @@ IOSCSIProtocolServices::SetTaskState ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetTaskState ( newTaskState );
 	
 }
@@ -490,7 +674,7 @@ IOSCSIProtocolServices::GetTaskState ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskState ( );
 	
 }
@@ -505,11 +689,26 @@ IOSCSIProtocolServices::GetLogicalUnitNumber ( SCSITaskIdentifier request )
 {
 	SCSITask *	scsiRequest;
 	
-    scsiRequest = OSDynamicCast ( SCSITask, request );
+    scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetLogicalUnitNumber();
 }
 
 
+//
+//	 GetSubmissionQueue - Gets the hardware submission queue the task is
+//						   being sent on.							[PROTECTED]
+//
+
+UInt32
+IOSCSIProtocolServices::GetSubmissionQueue ( SCSITaskIdentifier request )
+{
+	SCSITask *	scsiRequest;
+	
+    scsiRequest = SCSITaskFromIdentifier ( request );
+	return scsiRequest->GetSubmissionQueue ( );
+}
+
+
 //
 //	 GetCommandDescriptorBlockSize - Gets the size of the CDB.		[PROTECTED]
 //
@@ -522,7 +721,7 @@ IOSCSIProtocolServices::GetCommandDescriptorBlockSize (
 	SCSITask *	scsiRequest;
 	UInt8		size;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -553,7 +752,7 @@ IOSCSIProtocolServices::GetCommandDescriptorBlock (
 	SCSITask *	scsiRequest;
 	bool		result = false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -583,7 +782,7 @@ IOSCSIProtocolServices::GetDataTransferDirection (
 	SCSITask *	scsiRequest;
 	UInt8		direction;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -614,7 +813,7 @@ IOSCSIProtocolServices::GetRequestedDataTransferCount (
 	SCSITask *	scsiRequest;
 	UInt64		amount;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -646,7 +845,7 @@ IOSCSIProtocolServices::SetRealizedDataTransferCount (
 	SCSITask *	scsiRequest;
 	bool		result;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -677,7 +876,7 @@ IOSCSIProtocolServices::GetRealizedDataTransferCount (
 	SCSITask *	scsiRequest;
 	UInt64		amount;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -707,7 +906,7 @@ IOSCSIProtocolServices::GetDataBuffer ( SCSITaskIdentifier request )
 	SCSITask *				scsiRequest;
 	IOMemoryDescriptor *	buffer;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
 	{
 		buffer = scsiRequest->GetDataBuffer ( );
@@ -733,7 +932,7 @@ IOSCSIProtocolServices::GetDataBufferOffset ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetDataBufferOffset ( );
 	
 }
@@ -750,7 +949,7 @@ IOSCSIProtocolServices::GetTimeoutDuration ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTimeoutDuration ( );
 
 }
@@ -769,7 +968,7 @@ IOSCSIProtocolServices::GetAutosenseRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetAutosenseRequestedDataTransferCount ( );
 	
 }
@@ -805,7 +1004,7 @@ IOSCSIProtocolServices::SetAutoSenseData (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetAutoSenseData ( senseData, senseDataSize );
 	
 }
@@ -824,7 +1023,7 @@ IOSCSIProtocolServices::SetProtocolLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetProtocolLayerReference ( newReferenceValue );
 	
 }
@@ -841,7 +1040,7 @@ IOSCSIProtocolServices::GetProtocolLayerReference ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetProtocolLayerReference ( );
 	
 }
@@ -859,7 +1058,7 @@ IOSCSIProtocolServices::SetTaskExecutionMode (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetTaskExecutionMode ( newTaskMode );
 	
 }
@@ -875,7 +1074,7 @@ IOSCSIProtocolServices::GetTaskExecutionMode ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskExecutionMode ( );
 	
 }
@@ -892,7 +1091,7 @@ IOSCSIProtocolServices::EnsureAutosenseDescriptorExists ( SCSITaskIdentifier req
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->EnsureAutosenseDescriptorExists ( );
 	
 }
@@ -905,8 +1104,13 @@ IOSCSIProtocolServices::EnsureAutosenseDescriptorExists ( SCSITaskIdentifier req
 #endif
 
 // Following are the commands used to manipulate the queue of pending SCSI Tasks.
-// Currently the queuing is strictly first in, first out.  This needs to be changed
-// to support the SCSI queueing model in the SCSI Architecture Model-2 specification.
+// Each logical unit has its own first in, first out queue. Tasks are taken from
+// the logical unit queues in deficit round robin order, so that a logical unit
+// doing large transfers can not starve the other logical units sharing this
+// interface. The shared queue headed by fSCSITaskQueueHead holds autosense
+// requests and tasks the subclass could not yet accept; it is always serviced
+// before the logical unit queues. This still needs to be changed to support the
+// SCSI queueing model in the SCSI Architecture Model-2 specification.
 
 //
 //	 AddSCSITaskToQueue -	Add the SCSI Task to the queue. The Task's
@@ -918,44 +1122,93 @@ void
 IOSCSIProtocolServices::AddSCSITaskToQueue ( SCSITaskIdentifier request )
 {
 	
-	SCSITask *	scsiRequest;
+	SCSITask *					scsiRequest;
+	SCSILogicalUnitTaskQueue *	queue;
+	AbsoluteTime				now;
 	
 	STATUS_LOG ( ( "%s: AddSCSITaskToQueue called.\n", getName ( ) ) );
 	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	
+	clock_get_uptime ( &now );
+	
 	IOSimpleLockLock ( fQueueLock );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	queue = fLogicalUnitQueues[scsiRequest->GetLogicalUnitNumber ( )];
 	
 	// Make sure that the new request does not have a following task.
 	scsiRequest->EnqueueFollowingSCSITask ( NULL );
+	scsiRequest->SetQueueEntryTime ( now );
 	
-	// Check to see if there are any tasks currently queued.
-	if ( fSCSITaskQueueHead == NULL )
+	if ( queue == NULL )
 	{
 		
-		// There are no other tasks currently queued, so
-		// save this one as the head.
-		fSCSITaskQueueHead = scsiRequest;
+		// The logical unit has no queue of its own, either because it was
+		// never attached or because the queue could not be allocated. Fall
+		// back to the shared queue.
+		if ( fSCSITaskQueueHead == NULL )
+		{
+			
+			// There are no other tasks currently queued, so
+			// save this one as the head.
+			fSCSITaskQueueHead = scsiRequest;
+			
+		}
+		
+		else
+		{
+			
+			// There is at least one task currently in the queue,
+			// Add the current one to the end.
+			SCSITask *	currentElement;
+			
+			currentElement = fSCSITaskQueueHead;
+			while ( currentElement->GetFollowingSCSITask ( ) != NULL )
+			{
+				currentElement = currentElement->GetFollowingSCSITask ( );
+			}
+			
+			currentElement->EnqueueFollowingSCSITask ( scsiRequest );
+			
+		}
 		
 	}
 	
 	else
 	{
 		
-		// There is at least one task currently in the queue,
-		// Add the current one to the end.
-		SCSITask *	currentElement;
+		// Check to see if there are any tasks currently queued
+		// for this logical unit.
+		if ( queue->head == NULL )
+		{
+			
+			// There are no other tasks currently queued, so save this one
+			// as the head and give the logical unit its turn.
+			queue->head = scsiRequest;
+			ActivateLogicalUnitQueue ( &fActiveLogicalUnitQueue, queue );
+			
+		}
 		
-		currentElement = fSCSITaskQueueHead;
-		while ( currentElement->GetFollowingSCSITask ( ) != NULL )
+		else
 		{
-			currentElement = currentElement->GetFollowingSCSITask ( );
+			
+			// Add the current one to the end.
+			queue->tail->EnqueueFollowingSCSITask ( scsiRequest );
+			
 		}
 		
-		currentElement->EnqueueFollowingSCSITask ( scsiRequest );
+		queue->tail = scsiRequest;
+		queue->depth++;
+		
+		if ( queue->depth > queue->maximumDepth )
+		{
+			queue->maximumDepth = queue->depth;
+		}
 		
 	}
 	
+	fQueuedTaskCount++;
+	
 	IOSimpleLockUnlock ( fQueueLock );
 	
 }
@@ -973,6 +1226,16 @@ void
 IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 {
 	
+	// Tasks sent on a hardware submission queue, such as one going back
+	// for autosense, return to the head of that queue.
+	if ( fSubmissionQueues != NULL )
+	{
+		
+		AddSCSITaskToHeadOfSubmissionQueue ( &fSubmissionQueues[request->GetSubmissionQueue ( )], request );
+		return;
+		
+	}
+	
 	IOSimpleLockLock ( fQueueLock );
 	
 	// If the head of the queue is NULL, there are no other tasks and so just add
@@ -1037,6 +1300,8 @@ IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 		
 	}
 	
+	fQueuedTaskCount++;
+	
 	IOSimpleLockUnlock ( fQueueLock );
 	
 }
@@ -1051,24 +1316,16 @@ SCSITask *
 IOSCSIProtocolServices::RetrieveNextSCSITaskFromQueue ( void )
 {
 	
-	SCSITask *		selectedTask;
+	SCSITask *					selectedTask	= NULL;
+	SCSILogicalUnitTaskQueue *	queue			= NULL;
+	SInt64						cost			= 0;
 	
 	IOSimpleLockLock ( fQueueLock );
 	
-	// Check to see if there are any tasks currently queued.
-	if ( fSCSITaskQueueHead == NULL )
-	{
-		
-		// There are currently no tasks queued, return NULL.
-		selectedTask = NULL;
-		
-	}
-	
-	else
+	// Check to see if there are any tasks on the shared queue.
+	if ( fSCSITaskQueueHead != NULL )
 	{
 		
-		// There is at least one task currently in the queue,
-		
 		// Grab the head task
 		selectedTask = fSCSITaskQueueHead;
 		
@@ -1081,155 +1338,934 @@ IOSCSIProtocolServices::RetrieveNextSCSITaskFromQueue ( void )
 		
 	}
 	
-	IOSimpleLockUnlock ( fQueueLock );
-	
-	return selectedTask;
-	
-}
-
-
-//
-//	 AbortSCSITaskFromQueue -	Check to see if the SCSI Task resides and
-//								abort it if it does. This currently does
-//								nothing since the ABORT TASK and ABORT TASK SET
-//								management functions are not supported.
-//																	[PROTECTED]
-//
-
-bool
-IOSCSIProtocolServices::AbortSCSITaskFromQueue ( SCSITask *request )
-{
-	
-	// If the indicated SCSI Task currently resides in the Queue, the SCSI Task
-	// will be removed and no further processing shall occur on that Task.  This
-	// method will then return true.
-	
-	// If the SCSI Task does not currently reside in the queue, this method will
-	// return false.
-	return false;
-	
-}
-
-
-//
-//	 SendSCSITasksFromQueue -	Removes tasks from the queue and sends them to
-//								the protocol layer for processing.	[PROTECTED]
-//
-
-void
-IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
-{
-	
-	// Is there anything in the queue?
-	while ( fSCSITaskQueueHead != NULL ) 
+	else if ( fActiveLogicalUnitQueue != NULL )
 	{
 		
-		bool	qDrained = false;
+		// Walk the logical unit queues in round robin order, giving each one
+		// its quantum as it is visited, until one has built up enough deficit
+		// to send the task at its head. Every visit adds to a deficit, so
+		// this always terminates.
+		queue = fActiveLogicalUnitQueue;
+		cost  = GetTaskQueueCost ( queue->head );
 		
-		// Do we need to drive the queue?
-		if ( OSBitOrAtomic ( kSCSITaskQueueBusyMask, &fSemaphore ) & kSCSITaskQueueBusyMask )
+		while ( queue->deficit < cost )
 		{
 			
-			// Someone else is driving the queue, break out and let them do it.
-			break;
+			queue = queue->nextActive;
+			queue->deficit += queue->weight * kSCSILogicalUnitQueueQuantum;
+			cost = GetTaskQueueCost ( queue->head );
 			
 		}
 		
-		// Send as many commands as there are in the queue, or upto the point
-		// the transport driver tells us it can't handle any more.
+		fActiveLogicalUnitQueue = queue;
 		
-		while ( true )
+		selectedTask	= queue->head;
+		queue->head		= selectedTask->GetFollowingSCSITask ( );
+		selectedTask->EnqueueFollowingSCSITask ( NULL );
+		
+		// The deficit is only charged once the subclass accepts the task,
+		// see ChargeSCSITaskToLogicalUnitQueue ( ).
+		queue->pendingTask	= selectedTask;
+		queue->pendingCost	= cost;
+		queue->depth--;
+		
+		if ( queue->head == NULL )
 		{
 			
-			SCSIServiceResponse 	serviceResponse;
-			SCSITaskStatus			taskStatus;
-			SCSITask *				nextVictim	= NULL;
-			bool					cmdAccepted = false;
-			
-			// We're sending a command down, so clear the completion bit so
-			// we know if a completion occurred while we were sending a command.
-			OSBitAndAtomic ( ~kSCSITaskQueueCompletionMask, &fSemaphore );
+			// This logical unit has nothing more to send. Take it out of the
+			// rotation and forfeit any remaining deficit, as the deficit round
+			// robin algorithm requires. That includes the cost of this task.
+			queue->tail			= NULL;
+			queue->deficit		= 0;
+			queue->pendingCost	= 0;
 			
-			// Get the next command from the request queue
-			nextVictim = RetrieveNextSCSITaskFromQueue ( );
-			if ( nextVictim == NULL )
+			if ( queue->nextActive == queue )
 			{
-				
-				// No command in the queue, break out of the loop because
-				// we drained the queue.
-				qDrained = true;
-				break;
-				
+				fActiveLogicalUnitQueue = NULL;
 			}
 			
-			cmdAccepted = SendSCSICommand ( nextVictim, &serviceResponse, &taskStatus );
-			if ( cmdAccepted == false )
+			else
 			{
 				
-				// The subclass can not process the command at this time,
-				// add it to the queue and try again later.
-				AddSCSITaskToHeadOfQueue ( nextVictim );
-				break;
-				
-			}
-			
-			else if ( serviceResponse != kSCSIServiceResponse_Request_In_Process )
-			{
+				queue->previousActive->nextActive = queue->nextActive;
+				queue->nextActive->previousActive = queue->previousActive;
 				
-				// The command was sent and completed, send next Task based on its Attribute.
-				nextVictim->SetServiceResponse ( serviceResponse );
-				nextVictim->SetTaskStatus ( taskStatus );
-				nextVictim->SetTaskState ( kSCSITaskState_ENDED );
+				// The next logical unit in the rotation gets its turn.
+				fActiveLogicalUnitQueue = queue->nextActive;
+				fActiveLogicalUnitQueue->deficit += fActiveLogicalUnitQueue->weight * kSCSILogicalUnitQueueQuantum;
 				
 			}
 			
+			queue->nextActive		= NULL;
+			queue->previousActive	= NULL;
+			
 		}
 		
-		// We aren't driving the queue any more. Mark that we aren't doing so.
-		OSBitAndAtomic ( ~kSCSITaskQueueBusyMask, &fSemaphore );
-		
-		// We broke out of the while loop above either because there are no more
-		// commands to process, or the transport driver cannot handle any more at
-		// this time. Check if any completions occurred since we released the queue
-		// driving privilege. If so, we attempt to keep processing the queue.
-		if ( ( qDrained == false ) && ( ( fSemaphore & kSCSITaskQueueCompletionMask ) == 0 ) )
-		{
-			// No completions, break out.
-			break;
-		}
-		
-		// A completion did occur. Start over...
-		
 	}
 	
+	if ( selectedTask != NULL )
+	{
+		fQueuedTaskCount--;
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	return selectedTask;
+	
 }
 
 
 //
-//	 RejectSCSITasksCurrentlyQueued -	Rejects task currently queued.
-//																	[PROTECTED]
+//	 ChargeSCSITaskToLogicalUnitQueue -	Charges a task the subclass has
+//											accepted to the logical unit queue
+//											it was taken from.		[PROTECTED]
 //
 
 void
-IOSCSIProtocolServices::RejectSCSITasksCurrentlyQueued ( void )
+IOSCSIProtocolServices::ChargeSCSITaskToLogicalUnitQueue ( SCSITask * request )
 {
 	
-	SCSITask *		nextVictim;
+	SCSILogicalUnitTaskQueue *	queue		= NULL;
+	AbsoluteTime				now;
+	AbsoluteTime				entryTime;
+	UInt64						waitTime	= 0;
 	
-	STATUS_LOG ( ( "%s: RejectSCSITasksCurrentlyQueued called.\n", getName ( ) ) );
+	require_nonzero_quiet ( fLogicalUnitQueues, Exit );
 	
-	do 
-	{
+	queue = fLogicalUnitQueues[request->GetLogicalUnitNumber ( )];
+	require_nonzero_quiet ( queue, Exit );
+	
+	IOSimpleLockLock ( fQueueLock );
+	
+	// Tasks which did not come from this queue, such as ones going back for
+	// autosense, have already been charged or are not charged at all.
+	if ( queue->pendingTask == request )
+	{
+		
+		clock_get_uptime ( &now );
+		entryTime = request->GetQueueEntryTime ( );
+		SUB_ABSOLUTETIME ( &now, &entryTime );
+		absolutetime_to_nanoseconds ( now, &waitTime );
+		
+		queue->deficit -= queue->pendingCost;
+		queue->pendingTask	= NULL;
+		queue->pendingCost	= 0;
+		
+		queue->tasksDispatched++;
+		queue->bytesDispatched += request->GetRequestedDataTransferCount ( );
+		queue->totalWaitTime += waitTime;
+		
+		if ( waitTime > queue->maximumWaitTime )
+		{
+			queue->maximumWaitTime = waitTime;
+		}
+		
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 CreateLogicalUnitQueue -	Allocates the queue for the specified logical
+//								unit if it does not already have one. Must
+//								not be called with fQueueLock held.	   [PUBLIC]
+//
+
+bool
+IOSCSIProtocolServices::CreateLogicalUnitQueue ( UInt8 theLogicalUnit )
+{
+	
+	SCSILogicalUnitTaskQueue *	queue		= NULL;
+	SCSILogicalUnitTaskQueue *	newQueue	= NULL;
+	
+	require_nonzero ( fLogicalUnitQueues, Exit );
+	
+	queue = fLogicalUnitQueues[theLogicalUnit];
+	require_quiet ( ( queue == NULL ), Exit );
+	
+	newQueue = IONew ( SCSILogicalUnitTaskQueue, 1 );
+	require_nonzero ( newQueue, Exit );
+	
+	bzero ( newQueue, sizeof ( SCSILogicalUnitTaskQueue ) );
+	newQueue->weight = kSCSILogicalUnitQueueWeight_Default;
+	
+	IOSimpleLockLock ( fQueueLock );
+	
+	// Someone else may have allocated the queue while we were
+	// allocating ours.
+	queue = fLogicalUnitQueues[theLogicalUnit];
+	if ( queue == NULL )
+	{
+		
+		fLogicalUnitQueues[theLogicalUnit] = newQueue;
+		queue		= newQueue;
+		newQueue	= NULL;
+		
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	if ( newQueue != NULL )
+	{
+		IODelete ( newQueue, SCSILogicalUnitTaskQueue, 1 );
+	}
+	
+	
+Exit:
+	
+	
+	return ( queue != NULL );
+	
+}
+
+
+//
+//	 PublishLogicalUnitQueueStatistics -	Updates the per logical unit
+//											queue statistics in the registry.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::PublishLogicalUnitQueueStatistics ( void )
+{
+	
+	OSArray *					statistics	= NULL;
+	OSDictionary *				dict		= NULL;
+	OSNumber *					number		= NULL;
+	SCSILogicalUnitTaskQueue	snapshot;
+	
+	require_nonzero_quiet ( fIOSCSIProtocolServicesReserved, ErrorExit );
+	require_nonzero_quiet ( fLogicalUnitQueues, ErrorExit );
+	require_nonzero_quiet ( fQueueLock, ErrorExit );
+	
+	statistics = OSArray::withCapacity ( 1 );
+	require_nonzero ( statistics, ErrorExit );
+	
+	for ( UInt32 index = 0; index < kSCSIMaximumLogicalUnitQueues; index++ )
+	{
+		
+		if ( fLogicalUnitQueues[index] == NULL )
+			continue;
+		
+		// Take a consistent copy of the counters.
+		IOSimpleLockLock ( fQueueLock );
+		snapshot = *fLogicalUnitQueues[index];
+		IOSimpleLockUnlock ( fQueueLock );
+		
+		dict = OSDictionary::withCapacity ( 8 );
+		require_nonzero ( dict, ReleaseStatistics );
+		
+		number = OSNumber::withNumber ( index, 8 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitNumberKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.weight, 32 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitQueueWeightKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.depth, 32 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitQueueDepthKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.maximumDepth, 32 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitMaximumQueueDepthKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.tasksDispatched, 64 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitTasksDispatchedKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.bytesDispatched, 64 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitBytesDispatchedKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.totalWaitTime, 64 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitTotalWaitTimeKey, number );
+			number->release ( );
+			
+		}
+		
+		number = OSNumber::withNumber ( snapshot.maximumWaitTime, 64 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyLogicalUnitMaximumWaitTimeKey, number );
+			number->release ( );
+			
+		}
+		
+		statistics->setObject ( dict );
+		dict->release ( );
+		
+	}
+	
+	if ( statistics->getCount ( ) != 0 )
+	{
+		setProperty ( kIOPropertyLogicalUnitQueueStatisticsKey, statistics );
+	}
+	
+	
+ReleaseStatistics:
+	
+	
+	statistics->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 GetTaskQueueCost -	Gets the number of bytes of deficit needed to send
+//							the task.								 [STATIC]
+//
+
+static SInt64
+GetTaskQueueCost ( SCSITask * task )
+{
+	
+	SInt64	cost = task->GetRequestedDataTransferCount ( );
+	
+	if ( cost < kSCSILogicalUnitQueueMinimumCost )
+	{
+		cost = kSCSILogicalUnitQueueMinimumCost;
+	}
+	
+	return cost;
+	
+}
+
+
+//
+//	 ActivateLogicalUnitQueue -	Adds a logical unit queue which just became
+//									non-empty to the round robin rotation.
+//									Must be called with fQueueLock held.
+//																	 [STATIC]
+//
+
+static void
+ActivateLogicalUnitQueue ( SCSILogicalUnitTaskQueue ** 	activeQueue,
+						   SCSILogicalUnitTaskQueue * 	queue )
+{
+	
+	SCSILogicalUnitTaskQueue *	current = *activeQueue;
+	
+	if ( current == NULL )
+	{
+		
+		// This is the only logical unit with work, so it gets
+		// its turn right away.
+		queue->nextActive		= queue;
+		queue->previousActive	= queue;
+		queue->deficit			= queue->weight * kSCSILogicalUnitQueueQuantum;
+		*activeQueue			= queue;
+		
+	}
+	
+	else
+	{
+		
+		// Insert the queue at the end of the current round, just behind
+		// the logical unit whose turn it is. It gets its quantum when the
+		// scheduler reaches it.
+		queue->nextActive		= current;
+		queue->previousActive	= current->previousActive;
+		queue->deficit			= 0;
+		
+		current->previousActive->nextActive	= queue;
+		current->previousActive				= queue;
+		
+	}
+	
+}
+
+
+//
+//	 AbortSCSITaskFromQueue -	Check to see if the SCSI Task resides and
+//								abort it if it does. This currently does
+//								nothing since the ABORT TASK and ABORT TASK SET
+//								management functions are not supported.
+//																	[PROTECTED]
+//
+
+bool
+IOSCSIProtocolServices::AbortSCSITaskFromQueue ( SCSITask *request )
+{
+	
+	// If the indicated SCSI Task currently resides in the Queue, the SCSI Task
+	// will be removed and no further processing shall occur on that Task.  This
+	// method will then return true.
+	
+	// If the SCSI Task does not currently reside in the queue, this method will
+	// return false.
+	return false;
+	
+}
+
+
+//
+//	 SendSCSITasksFromQueue -	Removes tasks from the queue and sends them to
+//								the protocol layer for processing.	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
+{
+	
+	UInt32	queuedTaskCount = 0;
+	
+	IOSimpleLockLock ( fQueueLock );
+	queuedTaskCount = fQueuedTaskCount;
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	// Is there anything in the queue?
+	while ( queuedTaskCount != 0 ) 
+	{
+		
+		bool	qDrained = false;
+		
+		// Do we need to drive the queue?
+		if ( OSBitOrAtomic ( kSCSITaskQueueBusyMask, &fSemaphore ) & kSCSITaskQueueBusyMask )
+		{
+			
+			// Someone else is driving the queue, break out and let them do it.
+			break;
+			
+		}
+		
+		// Send as many commands as there are in the queue, or upto the point
+		// the transport driver tells us it can't handle any more.
+		
+		while ( true )
+		{
+			
+			SCSIServiceResponse 	serviceResponse;
+			SCSITaskStatus			taskStatus;
+			SCSITask *				nextVictim	= NULL;
+			bool					cmdAccepted = false;
+			
+			// We're sending a command down, so clear the completion bit so
+			// we know if a completion occurred while we were sending a command.
+			OSBitAndAtomic ( ~kSCSITaskQueueCompletionMask, &fSemaphore );
+			
+			// Get the next command from the request queue
+			nextVictim = RetrieveNextSCSITaskFromQueue ( );
+			if ( nextVictim == NULL )
+			{
+				
+				// No command in the queue, break out of the loop because
+				// we drained the queue.
+				qDrained = true;
+				break;
+				
+			}
+			
+			cmdAccepted = SendSCSICommand ( nextVictim, &serviceResponse, &taskStatus );
+			if ( cmdAccepted == false )
+			{
+				
+				// The subclass can not process the command at this time,
+				// add it to the queue and try again later.
+				AddSCSITaskToHeadOfQueue ( nextVictim );
+				break;
+				
+			}
+			
+			ChargeSCSITaskToLogicalUnitQueue ( nextVictim );
+			
+			if ( serviceResponse != kSCSIServiceResponse_Request_In_Process )
+			{
+				
+				// The command was sent and completed, send next Task based on its Attribute.
+				nextVictim->SetServiceResponse ( serviceResponse );
+				nextVictim->SetTaskStatus ( taskStatus );
+				nextVictim->SetTaskState ( kSCSITaskState_ENDED );
+				
+			}
+			
+		}
+		
+		// We aren't driving the queue any more. Mark that we aren't doing so.
+		OSBitAndAtomic ( ~kSCSITaskQueueBusyMask, &fSemaphore );
+		
+		// We broke out of the while loop above either because there are no more
+		// commands to process, or the transport driver cannot handle any more at
+		// this time. Check if any completions occurred since we released the queue
+		// driving privilege. If so, we attempt to keep processing the queue.
+		if ( ( qDrained == false ) && ( ( fSemaphore & kSCSITaskQueueCompletionMask ) == 0 ) )
+		{
+			// No completions, break out.
+			break;
+		}
+		
+		// A completion did occur. Start over...
+		IOSimpleLockLock ( fQueueLock );
+		queuedTaskCount = fQueuedTaskCount;
+		IOSimpleLockUnlock ( fQueueLock );
+		
+	}
+	
+}
+
+
+//
+//	 AllocateSubmissionQueues -	Allocates one task queue per hardware
+//									submission queue.				[PROTECTED]
+//
+
+bool
+IOSCSIProtocolServices::AllocateSubmissionQueues ( UInt32 count )
+{
+	
+	SCSISubmissionQueue *	queues	= NULL;
+	bool					result	= false;
+	
+	queues = ( SCSISubmissionQueue * ) IOMallocAligned ( count * sizeof ( SCSISubmissionQueue ),
+														 kSCSISubmissionQueueAlignment );
+	require_nonzero ( queues, ErrorExit );
+	
+	bzero ( queues, count * sizeof ( SCSISubmissionQueue ) );
+	
+	fSubmissionQueues		= queues;
+	fSubmissionQueueCount	= count;
+	
+	for ( UInt32 index = 0; index < count; index++ )
+	{
+		
+		queues[index].index = index;
+		queues[index].lock	= IOSimpleLockAlloc ( );
+		require_nonzero ( queues[index].lock, FreeQueues );
+		
+	}
+	
+	result = true;
+	
+	return result;
+	
+	
+FreeQueues:
+	
+	
+	FreeSubmissionQueues ( );
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeSubmissionQueues -	Frees the per hardware queue task queues.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::FreeSubmissionQueues ( void )
+{
+	
+	require_nonzero_quiet ( fSubmissionQueues, Exit );
+	
+	for ( UInt32 index = 0; index < fSubmissionQueueCount; index++ )
+	{
+		
+		if ( fSubmissionQueues[index].lock != NULL )
+		{
+			IOSimpleLockFree ( fSubmissionQueues[index].lock );
+		}
+		
+	}
+	
+	IOFreeAligned ( fSubmissionQueues, fSubmissionQueueCount * sizeof ( SCSISubmissionQueue ) );
+	
+	fSubmissionQueues		= NULL;
+	fSubmissionQueueCount	= 0;
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 AddSCSITaskToSubmissionQueue -	Adds the SCSI Task to the tail of a
+//										submission queue.			[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::AddSCSITaskToSubmissionQueue ( SCSISubmissionQueue *	queue,
+													   SCSITask *				request )
+{
+	
+	request->SetSubmissionQueue ( queue->index );
+	request->EnqueueFollowingSCSITask ( NULL );
+	
+	IOSimpleLockLock ( queue->lock );
+	
+	if ( queue->head == NULL )
+	{
+		queue->head = request;
+	}
+	
+	else
+	{
+		queue->tail->EnqueueFollowingSCSITask ( request );
+	}
+	
+	queue->tail = request;
+	queue->queuedTaskCount++;
+	
+	IOSimpleLockUnlock ( queue->lock );
+	
+}
+
+
+//
+//	 AddSCSITaskToHeadOfSubmissionQueue -	Adds the SCSI Task to the head of
+//											a submission queue. Autosense
+//											tasks go ahead of everything
+//											else, as in the single queue.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::AddSCSITaskToHeadOfSubmissionQueue ( SCSISubmissionQueue *	queue,
+															 SCSITask *				request )
+{
+	
+	SCSITask *	prev = NULL;
+	SCSITask *	next = NULL;
+	
+	IOSimpleLockLock ( queue->lock );
+	
+	if ( ( queue->head == NULL ) ||
+		 ( request->GetTaskExecutionMode ( ) == kSCSITaskMode_Autosense ) ||
+		 ( queue->head->GetTaskExecutionMode ( ) != kSCSITaskMode_Autosense ) )
+	{
+		
+		request->EnqueueFollowingSCSITask ( queue->head );
+		queue->head = request;
+		
+	}
+	
+	else
+	{
+		
+		// Put the task behind any autosense tasks already at the front.
+		prev = queue->head;
+		next = prev->GetFollowingSCSITask ( );
+		
+		while ( ( next != NULL ) && ( next->GetTaskExecutionMode ( ) == kSCSITaskMode_Autosense ) )
+		{
+			
+			prev = next;
+			next = prev->GetFollowingSCSITask ( );
+			
+		}
+		
+		request->EnqueueFollowingSCSITask ( next );
+		prev->EnqueueFollowingSCSITask ( request );
+		
+	}
+	
+	if ( request->GetFollowingSCSITask ( ) == NULL )
+	{
+		queue->tail = request;
+	}
+	
+	queue->queuedTaskCount++;
+	
+	IOSimpleLockUnlock ( queue->lock );
+	
+}
+
+
+//
+//	 RetrieveNextSCSITaskFromSubmissionQueue -	Removes the next SCSI Task
+//												from a submission queue and
+//												returns it.			[PROTECTED]
+//
+
+SCSITask *
+IOSCSIProtocolServices::RetrieveNextSCSITaskFromSubmissionQueue ( SCSISubmissionQueue * queue )
+{
+	
+	SCSITask *	selectedTask = NULL;
+	
+	IOSimpleLockLock ( queue->lock );
+	
+	selectedTask = queue->head;
+	if ( selectedTask != NULL )
+	{
+		
+		queue->head = selectedTask->GetFollowingSCSITask ( );
+		selectedTask->EnqueueFollowingSCSITask ( NULL );
+		
+		if ( queue->head == NULL )
+		{
+			queue->tail = NULL;
+		}
+		
+		queue->queuedTaskCount--;
+		
+	}
+	
+	IOSimpleLockUnlock ( queue->lock );
+	
+	return selectedTask;
+	
+}
+
+
+//
+//	 SendSCSITasksFromSubmissionQueue -	Removes tasks from a submission
+//											queue and sends them to the
+//											protocol layer for processing.
+//											Only one thread drives each
+//											queue, but different queues
+//											are driven concurrently.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::SendSCSITasksFromSubmissionQueue ( SCSISubmissionQueue * queue )
+{
+	
+	// Is there anything in the queue?
+	while ( queue->queuedTaskCount != 0 )
+	{
+		
+		bool	qDrained = false;
+		
+		// Do we need to drive the queue?
+		if ( OSBitOrAtomic ( kSCSITaskQueueBusyMask, &queue->semaphore ) & kSCSITaskQueueBusyMask )
+		{
+			
+			// Someone else is driving the queue, break out and let them do it.
+			break;
+			
+		}
+		
+		while ( true )
+		{
+			
+			SCSIServiceResponse 	serviceResponse;
+			SCSITaskStatus			taskStatus;
+			SCSITask *				nextVictim		= NULL;
+			bool					cmdAccepted 	= false;
+			SInt32					completionCount	= 0;
+			
+			// We're sending a command down, so clear the completion bit so
+			// we know if a completion occurred while we were sending a command.
+			OSBitAndAtomic ( ~kSCSITaskQueueCompletionMask, &queue->semaphore );
+			completionCount = fSubmissionQueueCompletionCount;
+			
+			nextVictim = RetrieveNextSCSITaskFromSubmissionQueue ( queue );
+			if ( nextVictim == NULL )
+			{
+				
+				qDrained = true;
+				break;
+				
+			}
+			
+			cmdAccepted = SendSCSICommand ( nextVictim, &serviceResponse, &taskStatus );
+			if ( cmdAccepted == false )
+			{
+				
+				// The subclass is full. The slot may be freed by a command
+				// on any queue completing, so ask the next completion to try
+				// this queue again, and try again now if one already came in
+				// while the command was being sent.
+				AddSCSITaskToHeadOfSubmissionQueue ( queue, nextVictim );
+				
+				if ( OSCompareAndSwap ( 0, 1, &queue->refused ) == true )
+				{
+					OSIncrementAtomic ( &fRefusedSubmissionQueueCount );
+				}
+				
+				if ( fSubmissionQueueCompletionCount != completionCount )
+				{
+					OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+				}
+				
+				break;
+				
+			}
+			
+			else if ( serviceResponse != kSCSIServiceResponse_Request_In_Process )
+			{
+				
+				nextVictim->SetServiceResponse ( serviceResponse );
+				nextVictim->SetTaskStatus ( taskStatus );
+				nextVictim->SetTaskState ( kSCSITaskState_ENDED );
+				
+			}
+			
+		}
+		
+		OSBitAndAtomic ( ~kSCSITaskQueueBusyMask, &queue->semaphore );
+		
+		// Keep going if a completion freed a slot while we were sending.
+		if ( ( qDrained == false ) && ( ( queue->semaphore & kSCSITaskQueueCompletionMask ) == 0 ) )
+		{
+			break;
+		}
+		
+	}
+	
+}
+
+
+//
+//	 SendSCSITasksFromRefusedSubmissionQueues -	Drives each submission
+//													queue the subclass has
+//													refused a task from since
+//													the last completion.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::SendSCSITasksFromRefusedSubmissionQueues ( void )
+{
+	
+	SCSISubmissionQueue *	queue = NULL;
+	
+	for ( UInt32 index = 0; index < fSubmissionQueueCount; index++ )
+	{
+		
+		queue = &fSubmissionQueues[index];
+		
+		if ( OSCompareAndSwap ( 1, 0, &queue->refused ) == true )
+		{
+			
+			OSDecrementAtomic ( &fRefusedSubmissionQueueCount );
+			
+			OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+			SendSCSITasksFromSubmissionQueue ( queue );
+			
+		}
+		
+	}
+	
+}
+
+
+//
+//	 RejectSCSITasksCurrentlyQueued -	Rejects task currently queued.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIProtocolServices::RejectSCSITasksCurrentlyQueued ( void )
+{
+	
+	SCSITask *					nextVictim;
+	SCSILogicalUnitTaskQueue *	queue;
+	
+	STATUS_LOG ( ( "%s: RejectSCSITasksCurrentlyQueued called.\n", getName ( ) ) );
+	
+	do 
+	{
 		
 		// get the next command from the request queue
 		nextVictim = RetrieveNextSCSITaskFromQueue ( );
 		if ( nextVictim != NULL )
 		{
+			
+			// The task will never be charged to the logical unit queue it
+			// was taken from, so make sure that queue no longer refers to it
+			// before it is completed and possibly reused.
+			queue = fLogicalUnitQueues[nextVictim->GetLogicalUnitNumber ( )];
+			if ( queue != NULL )
+			{
+				
+				IOSimpleLockLock ( fQueueLock );
+				
+				if ( queue->pendingTask == nextVictim )
+				{
+					
+					queue->pendingTask	= NULL;
+					queue->pendingCost	= 0;
+					
+				}
+				
+				IOSimpleLockUnlock ( fQueueLock );
+				
+			}
+			
 			RejectTask ( nextVictim );
+			
 		}
 		
 	} while ( nextVictim != NULL );
 	
+	for ( UInt32 index = 0; index < fSubmissionQueueCount; index++ )
+	{
+		
+		do
+		{
+			
+			nextVictim = RetrieveNextSCSITaskFromSubmissionQueue ( &fSubmissionQueues[index] );
+			if ( nextVictim != NULL )
+			{
+				RejectTask ( nextVictim );
+			}
+			
+		} while ( nextVictim != NULL );
+		
+	}
+	
 }
 
 
@@ -1248,7 +2284,7 @@ IOSCSIProtocolServices::ProcessCompletedTask (
 	
 	STATUS_LOG ( ( "%s: ProcessCompletedTask called.\n", getName ( ) ) );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
 	{
@@ -1354,7 +2390,7 @@ IOSCSIProtocolServices::RejectTask ( SCSITaskIdentifier request )
 	
 	STATUS_LOG ( ( "%s: RejectTask called.\n", getName ( ) ) );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	scsiRequest->SetTaskState ( kSCSITaskState_ENDED );
 	scsiRequest->SetServiceResponse ( kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
@@ -1411,6 +2447,82 @@ IOSCSIProtocolServices::RegisterSCSITaskCompletionRoutine (
 }
 
 
+//
+//	 SetLogicalUnitQueueWeight - Sets the scheduling weight of the specified
+//								  logical unit's queue.				   [PUBLIC]
+//
+
+bool
+IOSCSIProtocolServices::SetLogicalUnitQueueWeight ( UInt8	theLogicalUnit,
+													UInt32	weight )
+{
+	
+	SCSILogicalUnitTaskQueue *	queue	= NULL;
+	bool						result	= false;
+	
+	require ( ( weight >= kSCSILogicalUnitQueueWeight_Minimum ), ErrorExit );
+	require ( ( weight <= kSCSILogicalUnitQueueWeight_Maximum ), ErrorExit );
+	
+	result = CreateLogicalUnitQueue ( theLogicalUnit );
+	require ( result, ErrorExit );
+	
+	// The new weight takes effect the next time the
+	// logical unit's queue gets its quantum.
+	IOSimpleLockLock ( fQueueLock );
+	queue = fLogicalUnitQueues[theLogicalUnit];
+	queue->weight = weight;
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 GetLogicalUnitQueueWeight - Gets the scheduling weight of the specified
+//								  logical unit's queue.				   [PUBLIC]
+//
+
+UInt32
+IOSCSIProtocolServices::GetLogicalUnitQueueWeight ( UInt8 theLogicalUnit )
+{
+	
+	UInt32	weight = kSCSILogicalUnitQueueWeight_Default;
+	
+	if ( fLogicalUnitQueues[theLogicalUnit] != NULL )
+	{
+		weight = fLogicalUnitQueues[theLogicalUnit]->weight;
+	}
+	
+	return weight;
+	
+}
+
+
+//
+//	 serializeProperties - Refreshes the queue statistics before the
+//							properties are serialized.				   [PUBLIC]
+//
+
+bool
+IOSCSIProtocolServices::serializeProperties ( OSSerialize * s ) const
+{
+	
+	// The statistics are only gathered into registry objects when someone
+	// asks for them, so the I/O path never has to touch the registry.
+	( ( IOSCSIProtocolServices * ) this )->PublishLogicalUnitQueueStatistics ( );
+	
+	return super::serializeProperties ( s );
+	
+}
+
+
 //
 //	 CommandCompleted - Called by subclass to complete a command.	[PROTECTED]
 //
@@ -1434,6 +2546,32 @@ IOSCSIProtocolServices::CommandCompleted ( 	SCSITaskIdentifier 	request,
 		
 	}
 	
+	if ( fSubmissionQueues != NULL )
+	{
+		
+		SCSISubmissionQueue *	queue = NULL;
+		
+		// The task may be reused as soon as it is completed, so find the
+		// queue it freed a slot on first.
+		queue = &fSubmissionQueues[GetSubmissionQueue ( request )];
+		OSIncrementAtomic ( &fSubmissionQueueCompletionCount );
+		OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+		
+		ProcessCompletedTask ( request, serviceResponse, taskStatus );
+		
+		SendSCSITasksFromSubmissionQueue ( queue );
+		
+		// The slot this task freed may be the one another queue is
+		// waiting for.
+		if ( fRefusedSubmissionQueueCount != 0 )
+		{
+			SendSCSITasksFromRefusedSubmissionQueues ( );
+		}
+		
+		return;
+		
+	}
+	
 	OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &fSemaphore );
 	
 	ProcessCompletedTask ( request, serviceResponse, taskStatus );
@@ -1475,8 +2613,15 @@ void
 IOSCSIProtocolServices::ExecuteCommand ( SCSITaskIdentifier request )
 {
 	
+	SCSITask *	scsiRequest = NULL;
+	
 	STATUS_LOG ( ( "%s::%s called.\n", getName ( ), __FUNCTION__ ) );
 	
+	// This is where tasks enter the protocol layer, so check the type once
+	// here. The accessors used from here on trust it.
+	scsiRequest = OSDynamicCast ( SCSITask, request );
+	check ( scsiRequest );
+	
 	// Make sure that the protocol driver does not go away 
 	// if there are outstanding commands.
 	retain ( );
@@ -1504,6 +2649,21 @@ IOSCSIProtocolServices::ExecuteCommand ( SCSITaskIdentifier request )
 		EnsureAutosenseDescriptorExists ( request );
 	}
 	
+	if ( fSubmissionQueues != NULL )
+	{
+		
+		SCSISubmissionQueue *	queue = NULL;
+		
+		// Queue the request on the submission queue of the CPU it was
+		// issued on, so that CPUs don't contend with each other.
+		queue = &fSubmissionQueues[cpu_number ( ) % fSubmissionQueueCount];
+		
+		AddSCSITaskToSubmissionQueue ( queue, scsiRequest );
+		SendSCSITasksFromSubmissionQueue ( queue );
+		return;
+		
+	}
+	
 	// Add the new request to the queue
 	AddSCSITaskToQueue ( request );
 	
@@ -54,8 +54,19 @@ enum
 	kSCSIProtocolLayerNumDefaultStates			= 2
 };
 
+// Logical Unit queue weights used when scheduling tasks from the queues of
+// logical units that share this protocol services object.
+enum
+{
+	kSCSILogicalUnitQueueWeight_Minimum			= 1,
+	kSCSILogicalUnitQueueWeight_Default			= 1,
+	kSCSILogicalUnitQueueWeight_Maximum			= 64
+};
+
 // Forward definitions of internal use only classes
 class SCSITask;
+struct SCSILogicalUnitTaskQueue;
+struct SCSISubmissionQueue;
 
 //
 //	Class Declaration
@@ -88,6 +99,25 @@ protected:
 		UInt32				fSemaphore;
 		bool				fRequiresAutosenseDescriptor;
 		SCSITaskCompletion	fCompletionRoutine;
+		
+		// Per logical unit task queues. Tasks are dispatched from these in
+		// deficit round robin order so that one logical unit can not starve
+		// the others sharing this interface.
+		SCSILogicalUnitTaskQueue **	fLogicalUnitQueues;
+		SCSILogicalUnitTaskQueue *	fActiveLogicalUnitQueue;
+		UInt32						fQueuedTaskCount;
+		
+		// Submission queues for subclasses with more than one hardware
+		// submission queue. Each has its own lock so that CPUs feeding
+		// different queues do not contend. NULL in single queue mode.
+		SCSISubmissionQueue *		fSubmissionQueues;
+		UInt32						fSubmissionQueueCount;
+		
+		// The hardware queues may share resources in the subclass, so a
+		// queue the subclass refused is driven again by a completion on
+		// any queue. These count the completions and refused queues.
+		volatile SInt32				fSubmissionQueueCompletionCount;
+		volatile SInt32				fRefusedSubmissionQueueCount;
 	};
 	IOSCSIProtocolServicesExpansionData * fIOSCSIProtocolServicesReserved;
 	
@@ -129,6 +159,10 @@ protected:
 	
 	UInt8			GetLogicalUnitNumber ( SCSITaskIdentifier request );
 	
+	// Returns the hardware submission queue the task is being sent on. Always
+	// 0 unless the subclass reports kSCSIProtocolFeature_SubmissionQueueCount.
+	UInt32			GetSubmissionQueue ( SCSITaskIdentifier request );
+	
 	// Method to determine the size of the command descriptor block.
 	UInt8	GetCommandDescriptorBlockSize ( SCSITaskIdentifier request );
 	
@@ -200,9 +234,27 @@ protected:
 	// Remove the next SCSI Task for the queue and return it.
 	SCSITask * RetrieveNextSCSITaskFromQueue ( void );
 	
+	// Charge a task taken from a logical unit queue to that queue once the
+	// subclass has accepted it.
+	void	ChargeSCSITaskToLogicalUnitQueue ( SCSITask * request );
+	
 	// Check to see if the SCSI Task resides in the queue and abort it if it does.
 	bool 	AbortSCSITaskFromQueue ( SCSITask * request );
 	
+	// Update the per logical unit queue statistics in the registry.
+	void	PublishLogicalUnitQueueStatistics ( void );
+	
+	// Per submission queue versions of the queue management methods, used
+	// instead of the ones above when the subclass has more than one hardware
+	// submission queue.
+	bool		AllocateSubmissionQueues ( UInt32 count );
+	void		FreeSubmissionQueues ( void );
+	void		AddSCSITaskToSubmissionQueue ( SCSISubmissionQueue * queue, SCSITask * request );
+	void		AddSCSITaskToHeadOfSubmissionQueue ( SCSISubmissionQueue * queue, SCSITask * request );
+	SCSITask *	RetrieveNextSCSITaskFromSubmissionQueue ( SCSISubmissionQueue * queue );
+	void		SendSCSITasksFromSubmissionQueue ( SCSISubmissionQueue * queue );
+	void		SendSCSITasksFromRefusedSubmissionQueues ( void );
+	
 	// Methods for sending and completing SCSI tasks
 	void	SendSCSITasksFromQueue ( void );
 	
@@ -258,6 +310,24 @@ public:
 	
 	void RegisterSCSITaskCompletionRoutine ( SCSITaskCompletion completion );
 	
+	// The CreateLogicalUnitQueue method allocates the queue for the specified
+	// logical unit. It is called as each logical unit is attached, so that
+	// sending a task never has to allocate. Tasks for a logical unit without
+	// a queue go on the shared queue. Returns false if the queue could not
+	// be allocated.
+	bool	CreateLogicalUnitQueue ( UInt8 theLogicalUnit );
+	
+	// The SetLogicalUnitQueueWeight method sets the relative share of the
+	// interface given to the specified logical unit when tasks for more than
+	// one logical unit are waiting to be sent. A logical unit with a weight
+	// of 4 is allowed to transfer four times as many bytes per scheduling
+	// round as one with a weight of 1.
+	bool	SetLogicalUnitQueueWeight ( UInt8 theLogicalUnit, UInt32 weight );
+	UInt32	GetLogicalUnitQueueWeight ( UInt8 theLogicalUnit );
+	
+	// The queue statistics are refreshed when the properties are serialized.
+	virtual bool	serializeProperties ( OSSerialize * s ) const;
+	
 	// ------- SCSI Architecture Model Task Management Functions ------
 	// The ExecuteCommand method will take a SCSI Task and transport
 	// it across the physical wire(s) to the device
@@ -337,10 +337,29 @@ void
 IOSCSITargetDevice::AddPath ( IOSCSIProtocolServices * provider )
 {
 	
+	OSIterator *			iter	= NULL;
+	IOSCSILogicalUnitNub *	lun		= NULL;
+	
 	STATUS_LOG ( ( "+IOSCSITargetDevice::AddPath\n" ) );
 	
 	attach ( provider );
 	provider->open ( this );
+	
+	// Give the logical units which are already attached their queues on
+	// the new path.
+	iter = getClientIterator ( );
+	if ( iter != NULL )
+	{
+		
+		while ( ( lun = OSDynamicCast ( IOSCSILogicalUnitNub, iter->getNextObject ( ) ) ) != NULL )
+		{
+			provider->CreateLogicalUnitQueue ( lun->GetLogicalUnitNumber ( ) );
+		}
+		
+		iter->release ( );
+		
+	}
+	
 	if ( fPathManager != NULL )
 	{
 		
@@ -499,6 +518,27 @@ IOSCSITargetDevice::message ( UInt32 type, IOService * nub, void * arg )
 }
 
 
+//
+//	 serializeProperties - Refreshes the path statistics before the
+//							properties are serialized.				   [PUBLIC]
+//
+
+bool
+IOSCSITargetDevice::serializeProperties ( OSSerialize * s ) const
+{
+	
+	// Completions only bump the path counters, the registry copies are
+	// brought up to date when someone asks for them.
+	if ( fPathManager != NULL )
+	{
+		fPathManager->PublishStatistics ( );
+	}
+	
+	return super::serializeProperties ( s );
+	
+}
+
+
 //
 //	 detach - Detaches a path from the target device.				   [PUBLIC]
 //
@@ -1138,11 +1178,8 @@ IOSCSITargetDevice::SetTargetLayerReference ( SCSITaskIdentifier 	request,
 	SCSITask *	scsiRequest = NULL;
 	bool		result		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
-	if ( scsiRequest != NULL )
-	{
-		result = scsiRequest->SetTargetLayerReference ( value );
-	}
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	result = scsiRequest->SetTargetLayerReference ( value );
 	
 	return result;
 	
@@ -1161,11 +1198,8 @@ IOSCSITargetDevice::GetTargetLayerReference ( SCSITaskIdentifier request )
 	SCSITask *	scsiRequest = NULL;
 	void *		result		= NULL;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
-	if ( scsiRequest != NULL )
-	{
-		result = scsiRequest->GetTargetLayerReference ( );
-	}
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	result = scsiRequest->GetTargetLayerReference ( );
 	
 	return result;
 	
@@ -1712,6 +1746,20 @@ IOSCSITargetDevice::TargetTaskCompletion ( SCSITaskIdentifier request )
 					
 				}
 				
+				else if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x2A ) &&
+						  ( ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x06 ) ||
+							( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x07 ) ) )
+				{
+					
+					// ASYMMETRIC ACCESS STATE CHANGED or
+					// IMPLICIT ASYMMETRIC ACCESS STATE TRANSITION FAILED
+					if ( fPathManager != NULL )
+					{
+						fPathManager->AccessStateChanged ( );
+					}
+					
+				}
+				
 			}
 			
 		}
@@ -1991,6 +2039,30 @@ IOSCSITargetDevice::CreateLogicalUnit ( SCSILogicalUnitNumber logicalUnit )
 	
 	bool						result	= false;
 	IOSCSILogicalUnitNub * 		nub		= NULL;
+	IOSCSIProtocolServices *	path	= NULL;
+	OSIterator *				iter	= NULL;
+	OSObject *					obj		= NULL;
+	
+	// Allocate the logical unit's queue on each path before it can send
+	// any tasks, so that sending a task never has to allocate one.
+	iter = getProviderIterator ( );
+	if ( iter != NULL )
+	{
+		
+		while ( ( obj = iter->getNextObject ( ) ) != NULL )
+		{
+			
+			path = OSDynamicCast ( IOSCSIProtocolServices, obj );
+			if ( path != NULL )
+			{
+				path->CreateLogicalUnitQueue ( ( UInt8 ) logicalUnit );
+			}
+			
+		}
+		
+		iter->release ( );
+		
+	}
 	
 	nub = OSTypeAlloc ( IOSCSILogicalUnitNub );
 	require_nonzero ( nub, ErrorExit );
@@ -67,6 +67,7 @@ public:
 	
 	static bool			Create ( IOSCSIProtocolServices * provider );
 	virtual IOReturn 	message ( UInt32 type, IOService * nub, void * arg );
+	virtual bool		serializeProperties ( OSSerialize * s ) const;
 	
 protected:
 	
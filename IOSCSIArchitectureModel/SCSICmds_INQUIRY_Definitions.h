@@ -144,6 +144,7 @@ enum
 	/* 0x10 - 0x1E Reserved Device Types */
 	kINQUIRY_PERIPHERAL_TYPE_ObjectBasedStorageDevice			= 0x11,
 	kINQUIRY_PERIPHERAL_TYPE_AutomationDriveInterface			= 0x12,
+	kINQUIRY_PERIPHERAL_TYPE_HostManagedZonedBlockDevice		= 0x14,
 	kINQUIRY_PERIPHERAL_TYPE_WellKnownLogicalUnit				= 0x1E,
 	kINQUIRY_PERIPHERAL_TYPE_UnknownOrNoDeviceType				= 0x1F,
 	
@@ -366,7 +367,10 @@ enum
 {
 	kINQUIRY_Page00_PageCode				= 0x00,
 	kINQUIRY_Page80_PageCode				= 0x80,
-	kINQUIRY_Page83_PageCode				= 0x83
+	kINQUIRY_Page83_PageCode				= 0x83,
+	kINQUIRY_PageB0_PageCode				= 0xB0,
+	kINQUIRY_PageB1_PageCode				= 0xB1,
+	kINQUIRY_PageB2_PageCode				= 0xB2
 };	
 
 
@@ -495,4 +499,120 @@ enum
 #define kIOPropertySCSIINQUIRYDeviceIdentifier			"Identifier"
 		
 
+#if 0
+#pragma mark -
+#pragma mark  INQUIRY Block Limits Page B0 Definitions
+#pragma mark -
+#endif
+
+// This section contains all structures and definitions used by the INQUIRY
+// command in response to a request for page B0h - Block Limits Page (SBC-3)
+
+typedef struct SCSICmd_INQUIRY_PageB0_Data
+{
+	UInt8		PERIPHERAL_DEVICE_TYPE;				// 7-5 = Qualifier. 4-0 = Device type.
+	UInt8		PAGE_CODE;							// Must be equal to B0h
+	UInt16		PAGE_LENGTH;						// Must be equal to 3Ch
+	UInt8		WSNZ;								// 7-1 = Reserved. 0 = WSNZ
+	UInt8		MAXIMUM_COMPARE_AND_WRITE_LENGTH;
+	UInt16		OPTIMAL_TRANSFER_LENGTH_GRANULARITY;
+	UInt32		MAXIMUM_TRANSFER_LENGTH;
+	UInt32		OPTIMAL_TRANSFER_LENGTH;
+	UInt32		MAXIMUM_PREFETCH_XDREAD_XDWRITE_TRANSFER_LENGTH;
+	UInt32		MAXIMUM_UNMAP_LBA_COUNT;
+	UInt32		MAXIMUM_UNMAP_BLOCK_DESCRIPTOR_COUNT;
+	UInt32		OPTIMAL_UNMAP_GRANULARITY;
+	UInt32		UNMAP_GRANULARITY_ALIGNMENT;		// 31 = UGAVALID. 30-0 = Alignment
+	UInt8		MAXIMUM_WRITE_SAME_LENGTH[8];		// Not 8 byte aligned, use OSReadBigInt64
+	UInt8		RESERVED[20];
+} SCSICmd_INQUIRY_PageB0_Data;
+
+// A MAXIMUM UNMAP LBA COUNT or MAXIMUM UNMAP BLOCK DESCRIPTOR COUNT of
+// FFFFFFFFh indicates there is no limit. Devices that predate the unmap
+// fields return the shorter SBC-2 page, which ends after the OPTIMAL
+// TRANSFER LENGTH field.
+enum
+{
+	kINQUIRY_PageB0_PageLength				= 0x3C,
+	kINQUIRY_PageB0_SBC2_PageLength			= 0x0C,
+	kINQUIRY_PageB0_UnmapCountUnlimited		= 0xFFFFFFFF,
+	kINQUIRY_PageB0_UGAVALID_Mask			= 0x80000000
+};
+
+
+#if 0
+#pragma mark -
+#pragma mark  INQUIRY Block Device Characteristics Page B1 Definitions
+#pragma mark -
+#endif
+
+// This section contains all structures and definitions used by the INQUIRY
+// command in response to a request for page B1h - Block Device
+// Characteristics Page (SBC-3)
+
+typedef struct SCSICmd_INQUIRY_PageB1_Data
+{
+	UInt8		PERIPHERAL_DEVICE_TYPE;				// 7-5 = Qualifier. 4-0 = Device type.
+	UInt8		PAGE_CODE;							// Must be equal to B1h
+	UInt16		PAGE_LENGTH;						// Must be equal to 3Ch
+	UInt16		MEDIUM_ROTATION_RATE;
+	UInt8		PRODUCT_TYPE;
+	UInt8		NOMINAL_FORM_FACTOR;				// 7-6 = WABEREQ. 5-4 = WACEREQ. 3-0 = Nominal form factor
+	UInt8		FLAGS;								// 5-4 = ZONED. 1 = FUAB. 0 = VBULS
+	UInt8		RESERVED[55];
+} SCSICmd_INQUIRY_PageB1_Data;
+
+// Definitions for the ZONED field of the FLAGS field (ZBC). Host managed
+// devices report a peripheral device type of 14h instead.
+enum
+{
+	kINQUIRY_PageB1_ZONED_Mask				= 0x30,
+	kINQUIRY_PageB1_ZONED_NotReported		= 0x00,
+	kINQUIRY_PageB1_ZONED_HostAware			= 0x10,
+	kINQUIRY_PageB1_ZONED_DeviceManaged		= 0x20
+};
+
+
+#if 0
+#pragma mark -
+#pragma mark  INQUIRY Logical Block Provisioning Page B2 Definitions
+#pragma mark -
+#endif
+
+// This section contains all structures and definitions used by the INQUIRY
+// command in response to a request for page B2h - Logical Block
+// Provisioning Page (SBC-3)
+
+typedef struct SCSICmd_INQUIRY_PageB2_Data
+{
+	UInt8		PERIPHERAL_DEVICE_TYPE;				// 7-5 = Qualifier. 4-0 = Device type.
+	UInt8		PAGE_CODE;							// Must be equal to B2h
+	UInt16		PAGE_LENGTH;						// n-3 bytes
+	UInt8		THRESHOLD_EXPONENT;
+	UInt8		FLAGS;								// 7 = LBPU. 6 = LBPWS. 5 = LBPWS10. 2 = LBPRZ. 1 = ANC_SUP. 0 = DP
+	UInt8		PROVISIONING_TYPE;					// 7-3 = Reserved. 2-0 = Provisioning Type
+	UInt8		RESERVED;
+} SCSICmd_INQUIRY_PageB2_Data;
+
+// Definitions for the FLAGS field
+enum
+{
+	kINQUIRY_PageB2_LBPU_Mask				= 0x80,
+	kINQUIRY_PageB2_LBPWS_Mask				= 0x40,
+	kINQUIRY_PageB2_LBPWS10_Mask			= 0x20,
+	kINQUIRY_PageB2_LBPRZ_Mask				= 0x04,
+	kINQUIRY_PageB2_ANC_SUP_Mask			= 0x02,
+	kINQUIRY_PageB2_DP_Mask					= 0x01
+};
+
+// Definitions for the PROVISIONING TYPE field
+enum
+{
+	kINQUIRY_PageB2_ProvisioningTypeFull			= 0x00,
+	kINQUIRY_PageB2_ProvisioningTypeResource		= 0x01,
+	kINQUIRY_PageB2_ProvisioningTypeThin			= 0x02,
+	kINQUIRY_PageB2_ProvisioningTypeMask			= 0x07
+};
+
+
 #endif	/* _IOKIT_SCSI_CMDS_INQUIRY_H_ */
\ No newline at end of file
@@ -66,6 +66,8 @@ enum
 {
 	kModeSenseSBCDeviceSpecific_WriteProtectBit	 =  7,
 	kModeSenseSBCDeviceSpecific_WriteProtectMask =  (1 << kModeSenseSBCDeviceSpecific_WriteProtectBit),
+	kModeSenseSBCDeviceSpecific_DPOFUABit		 =  4,
+	kModeSenseSBCDeviceSpecific_DPOFUAMask		 =  (1 << kModeSenseSBCDeviceSpecific_DPOFUABit),
 };
 
 // General mode parameter block descriptor
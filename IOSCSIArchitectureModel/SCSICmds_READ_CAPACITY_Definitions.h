@@ -64,7 +64,9 @@ struct SCSI_Capacity_Data_Long
 	UInt64		RETURNED_LOGICAL_BLOCK_ADDRESS;
 	UInt32		BLOCK_LENGTH_IN_BYTES;
 	UInt8		RTO_EN_PROT_EN;
-	UInt8		Reserved[19];
+	UInt8		LOGICAL_BLOCKS_PER_PHYSICAL_BLOCK_EXPONENT;
+	UInt16		LBPME_LBPRZ_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS;
+	UInt8		Reserved[16];
 };
 typedef struct SCSI_Capacity_Data_Long SCSI_Capacity_Data_Long;
 
@@ -88,4 +90,25 @@ enum
 	kREAD_CAPACITY_PROT_Mask								= 0x01
 };
 
+/* Values for the LOGICAL BLOCK PROVISIONING MANAGEMENT ENABLED (LBPME) and
+ * LOGICAL BLOCK PROVISIONING READ ZEROS (LBPRZ) bits in the READ CAPACITY
+ * Long Data structure (SBC-3). These are masks for the host order value of
+ * the LBPME_LBPRZ_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS field.
+ */
+enum
+{
+	kREAD_CAPACITY_LBPME_Mask								= 0x8000,
+	kREAD_CAPACITY_LBPRZ_Mask								= 0x4000
+};
+
+/* Masks for the LOGICAL BLOCKS PER PHYSICAL BLOCK EXPONENT field and for the
+ * LOWEST ALIGNED LOGICAL BLOCK ADDRESS in the host order value of the
+ * LBPME_LBPRZ_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS field (SBC-3).
+ */
+enum
+{
+	kREAD_CAPACITY_LOGICAL_BLOCKS_PER_PHYSICAL_BLOCK_EXPONENT_Mask	= 0x0F,
+	kREAD_CAPACITY_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS_Mask		= 0x3FFF
+};
+
 #endif	/* _IOKIT_SCSI_CMDS_READ_CAPACITY_H_ */
@@ -219,4 +219,77 @@ typedef UInt64	SCSICmdField8Byte;
 #define 	kSCSICmdFieldMask63Bit		0x7FFFFFFFFFFFFFFFULL
 #define 	kSCSICmdFieldMask8Byte		0xFFFFFFFFFFFFFFFFULL
 
+
+#if defined(__cplusplus)
+
+#pragma mark Command Descriptor Block Layouts
+/* A command's CDB layout is a set of SCSICDBField types, one per field, each
+ * giving the byte the field starts at, the bit within the last byte of the
+ * field that holds its least significant bit, and its width in bits. Fields
+ * that span bytes are big-endian unless they say otherwise.
+ *
+ * Everything about a field is a template parameter, so IsValid ( ) folds to
+ * a single mask test (or nothing, when the parameter's type is no wider than
+ * the field) and Pack ( ) folds to one or more byte stores. The same layout
+ * therefore drives both the parameter checks and the packing.
+ */
+
+enum
+{
+	kSCSICDBFieldBigEndian		= 0,
+	kSCSICDBFieldLittleEndian	= 1
+};
+
+template < UInt8 OFFSET, UInt8 SHIFT, UInt8 WIDTH, UInt8 ENDIAN = kSCSICDBFieldBigEndian >
+struct SCSICDBField
+{
+	
+	enum
+	{
+		kOffset	= OFFSET,
+		kBytes	= ( SHIFT + WIDTH + 7 ) / 8
+	};
+	
+	/* Fails to compile if the field runs off the end of a 16 byte CDB. */
+	typedef char	FitsInCDB[ ( ( OFFSET + kBytes ) <= 16 ) ? 1 : -1 ];
+	
+	/* Returns true if value is not wider than the field. */
+	static inline bool
+	IsValid ( UInt64 value )
+	{
+		return ( WIDTH >= 64 ) || ( ( value >> ( WIDTH % 64 ) ) == 0 );
+	}
+	
+	/* ORs value into the field. The CDB must have been cleared and value
+	 * must have been checked with IsValid ( ).
+	 */
+	static inline void
+	Pack ( UInt8 * cdb, UInt64 value )
+	{
+		
+		UInt8	index = 0;
+		
+		value <<= SHIFT;
+		
+		for ( index = 0; index < kBytes; index++ )
+		{
+			
+			if ( ENDIAN == kSCSICDBFieldBigEndian )
+			{
+				cdb[OFFSET + index] |= ( UInt8 ) ( value >> ( ( kBytes - 1 - index ) * 8 ) );
+			}
+			
+			else
+			{
+				cdb[OFFSET + index] |= ( UInt8 ) ( value >> ( index * 8 ) );
+			}
+			
+		}
+		
+	}
+	
+};
+
+#endif	/* defined(__cplusplus) */
+
 #endif	/* _IOKIT_SCSI_COMMAND_DEFINITIONS_H_ */
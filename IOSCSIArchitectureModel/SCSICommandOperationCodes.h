@@ -95,6 +95,7 @@ enum
     kSCSICmd_CHANGE_DEFINITION              = 0x40,
     kSCSICmd_CLOSE_TRACK_SESSION            = 0x5B,
     kSCSICmd_COMPARE                        = 0x39,
+    kSCSICmd_COMPARE_AND_WRITE              = 0x89,
     kSCSICmd_COPY                           = 0x18,
     kSCSICmd_COPY_AND_VERIFY                = 0x3A,
     kSCSICmd_ERASE_10						= 0x2C,
@@ -206,6 +207,7 @@ enum
     kSCSICmd_SYNCHRONIZE_CACHE              = 0x35,
     kSCSICmd_SYNCHRONIZE_CACHE_16           = 0x91,
     kSCSICmd_TEST_UNIT_READY                = 0x00,
+	kSCSICmd_UNMAP							= 0x42,
 	kSCSICmd_UPDATE_BLOCK					= 0x3D,
     kSCSICmd_VERIFY_10                      = 0x2F,
     kSCSICmd_VERIFY_12                      = 0xAF,
@@ -229,6 +231,8 @@ enum
     kSCSICmd_XDWRITE_EXTENDED               = 0x80,
     kSCSICmd_XDWRITEREAD_10           		= 0x53,
     kSCSICmd_XPWRITE                        = 0x51,
+    kSCSICmd_ZBC_IN                         = 0x95,
+    kSCSICmd_ZBC_OUT                        = 0x94,
     
     kSCSICmdVariableLengthCDB				= 0x7F
 };
@@ -280,6 +284,21 @@ enum
 	kSCSIServiceAction_WRITE_LONG_16		= 0x11	
 };
 
+// Service Action Definitions for the ZBC IN (95h) command
+enum
+{
+	kSCSIServiceAction_REPORT_ZONES			= 0x00
+};
+
+// Service Action Definitions for the ZBC OUT (94h) command
+enum
+{
+	kSCSIServiceAction_CLOSE_ZONE			= 0x01,
+	kSCSIServiceAction_FINISH_ZONE			= 0x02,
+	kSCSIServiceAction_OPEN_ZONE			= 0x03,
+	kSCSIServiceAction_RESET_WRITE_POINTER	= 0x04
+};
+
 #pragma mark -
 #pragma mark Command Definitions by Number
 #if 0
@@ -28,6 +28,7 @@
 
 // Libkern includes
 #include <libkern/c++/OSArray.h>
+#include <libkern/c++/OSCollectionIterator.h>
 #include <libkern/c++/OSNumber.h>
 
 // IOKit includes
@@ -75,6 +76,10 @@
 
 #define kPressurePathTableIncrement			16
 
+// Inactive paths are considered for a TEST_UNIT_READY probe once per tick.
+#define kPathProbeTickInMS					1000
+#define kPathProbeTimeoutInMS				10000
+
 
 #if DEBUG_STATS
 static thread_call_t	gThread;
@@ -373,6 +378,30 @@ SCSIPressurePathManager::free ( void )
 		
 	}
 	
+	if ( fPreferredPathSet != NULL )
+	{
+		
+		fPreferredPathSet->release ( );
+		fPreferredPathSet = NULL;
+		
+	}
+	
+	if ( fProbeTimer != NULL )
+	{
+		
+		thread_call_free ( fProbeTimer );
+		fProbeTimer = NULL;
+		
+	}
+	
+	if ( fAccessStateThread != NULL )
+	{
+		
+		thread_call_free ( fAccessStateThread );
+		fAccessStateThread = NULL;
+		
+	}
+	
 	if ( fLock != NULL )
 	{
 		
@@ -460,10 +489,24 @@ SCSIPressurePathManager::InitializePathManagerForTarget (
 	fInactivePathSet = SCSIPathSet::withCapacity ( 1 );
 	require_nonzero ( fInactivePathSet, ReleasePathSet );
 	
+	fPreferredPathSet = SCSIPathSet::withCapacity ( 1 );
+	require_nonzero ( fPreferredPathSet, ReleaseInactivePathSet );
+	
+	fProbeTimer = thread_call_allocate (
+					( thread_call_func_t ) SCSIPressurePathManager::sProbeTimerExpired,
+					( thread_call_param_t ) this );
+	require_nonzero ( fProbeTimer, ReleasePreferredPathSet );
+	
+	fAccessStateThread = thread_call_allocate (
+					( thread_call_func_t ) SCSIPressurePathManager::sEvaluateAccessStates,
+					( thread_call_param_t ) this );
+	require_nonzero ( fAccessStateThread, FreeProbeTimer );
+	
 	STATUS_LOG ( ( "allocated path set, adding intial path\n" ) );
 	
+	// AddPath schedules the first look at the target port groups.
 	result = AddPath ( initialPath );
-	require ( result, ReleaseInactivePathSet );
+	require ( result, FreeAccessStateThread );
 	
 	STATUS_LOG ( ( "added intial path, ready to go\n" ) );
 	STATUS_LOG ( ( "Called AddPath, fStatistics array has %ld members\n", fStatistics->getCount ( ) ) );
@@ -474,6 +517,30 @@ SCSIPressurePathManager::InitializePathManagerForTarget (
 	return result;
 	
 	
+FreeAccessStateThread:
+	
+	
+	require_nonzero_quiet ( fAccessStateThread, FreeProbeTimer );
+	thread_call_free ( fAccessStateThread );
+	fAccessStateThread = NULL;
+	
+	
+FreeProbeTimer:
+	
+	
+	require_nonzero_quiet ( fProbeTimer, ReleasePreferredPathSet );
+	thread_call_free ( fProbeTimer );
+	fProbeTimer = NULL;
+	
+	
+ReleasePreferredPathSet:
+	
+	
+	require_nonzero_quiet ( fPreferredPathSet, ReleaseInactivePathSet );
+	fPreferredPathSet->release ( );
+	fPreferredPathSet = NULL;
+	
+	
 ReleaseInactivePathSet:
 	
 	
@@ -545,11 +612,14 @@ SCSIPressurePathManager::AddPath ( IOSCSIProtocolServices * interface )
 	
 	IOLockLock ( fLock );
 	result = fPathSet->setObject ( path );
+	UpdatePreferredPaths ( );
 	IOLockUnlock ( fLock );
 	
 	path->release ( );
 	path = NULL;
 	
+	AccessStateChanged ( );
+	
 	
 ErrorExit:
 	
@@ -567,8 +637,9 @@ void
 SCSIPressurePathManager::ActivatePath ( IOSCSIProtocolServices * interface )
 {
 	
-	bool					result 	= false;
-	SCSITargetDevicePath *	path	= NULL;
+	bool					result 		= false;
+	bool					activated	= false;
+	SCSITargetDevicePath *	path		= NULL;
 	
 	STATUS_LOG ( ( "SCSIPressurePathManager::ActivatePath\n" ) );
 	
@@ -588,8 +659,10 @@ SCSIPressurePathManager::ActivatePath ( IOSCSIProtocolServices * interface )
 			path->Activate ( );
 			fInactivePathSet->removeObject ( interface );
 			fPathSet->setObject ( path );
+			UpdatePreferredPaths ( );
 			path->release ( );
 			path = NULL;
+			activated = true;
 			
 		}
 		
@@ -612,6 +685,12 @@ SCSIPressurePathManager::ActivatePath ( IOSCSIProtocolServices * interface )
 	
 	IOLockUnlock ( fLock );
 	
+	// The group's state may have changed while the path was away.
+	if ( activated == true )
+	{
+		AccessStateChanged ( );
+	}
+	
 	
 ErrorExit:
 Exit:
@@ -651,6 +730,7 @@ SCSIPressurePathManager::InactivatePath ( IOSCSIProtocolServices * interface )
 			path->Inactivate ( );
 			fPathSet->removeObject ( interface );
 			fInactivePathSet->setObject ( path );
+			UpdatePreferredPaths ( );
 			path->release ( );
 			path = NULL;
 			
@@ -660,6 +740,9 @@ SCSIPressurePathManager::InactivatePath ( IOSCSIProtocolServices * interface )
 	
 	IOLockUnlock ( fLock );
 	
+	// Probe the path in case it comes back without telling us.
+	ArmProbeTimer ( );
+	
 	
 ErrorExit:
 	
@@ -760,6 +843,7 @@ SCSIPressurePathManager::RemovePath ( IOSCSIProtocolServices * path )
 			
 			ERROR_LOG ( ( "Removing path from active path set, no notification came!!!\n" ) );
 			fPathSet->removeObject ( path );
+			UpdatePreferredPaths ( );
 			
 		}
 		
@@ -770,6 +854,518 @@ SCSIPressurePathManager::RemovePath ( IOSCSIProtocolServices * path )
 }
 
 
+//
+//	ReclaimTasks - Aborts the tasks still outstanding on an inactive path so
+//				   ReissueTask can send them down a surviving one.	  [PRIVATE]
+//
+
+void
+SCSIPressurePathManager::ReclaimTasks ( IOSCSIProtocolServices * interface )
+{
+	
+	SCSITargetDevicePath *	path		= NULL;
+	OSArray *				tasks		= NULL;
+	OSCollectionIterator *	iterator	= NULL;
+	SCSITaskIdentifier		request		= NULL;
+	
+	STATUS_LOG ( ( "SCSIPressurePathManager::ReclaimTasks\n" ) );
+	
+	require_nonzero ( interface, ErrorExit );
+	
+	IOLockLock ( fLock );
+	
+	path = fInactivePathSet->getObjectWithInterface ( interface );
+	if ( path != NULL )
+	{
+		
+		// Work from a copy. Aborted tasks complete (and may be reissued)
+		// while we walk the list.
+		path->retain ( );
+		tasks = path->CopyTasks ( );
+		
+	}
+	
+	IOLockUnlock ( fLock );
+	
+	require_nonzero_quiet ( path, ErrorExit );
+	require_nonzero ( tasks, ReleasePath );
+	
+	iterator = OSCollectionIterator::withCollection ( tasks );
+	require_nonzero ( iterator, ReleaseTasks );
+	
+	while ( ( request = iterator->getNextObject ( ) ) != NULL )
+	{
+		
+		// Skip tasks which completed and went out again since the copy
+		// was taken.
+		if ( GetTaskPath ( request ) == path )
+		{
+			AbortTaskOnPath ( request, path );
+		}
+		
+	}
+	
+	iterator->release ( );
+	iterator = NULL;
+	
+	// Tasks sent while this was the target's only path aren't on its list
+	// and can't be aborted here. The transport fails them once it notices
+	// the link is gone and PathTaskCallback reissues them from there.
+	if ( path->GetOutstandingCount ( ) > ( SInt32 ) tasks->getCount ( ) )
+	{
+		STATUS_LOG ( ( "Path %p has direct tasks outstanding\n", path ) );
+	}
+	
+	
+ReleaseTasks:
+	
+	
+	tasks->release ( );
+	tasks = NULL;
+	
+	
+ReleasePath:
+	
+	
+	path->release ( );
+	path = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	sProbeTimerExpired - C->C++ glue.						  [STATIC][PRIVATE]
+//
+
+void
+SCSIPressurePathManager::sProbeTimerExpired (
+						thread_call_param_t 	param0,
+						thread_call_param_t 	param1 )
+{
+	
+	SCSIPressurePathManager *	manager = NULL;
+	
+	manager = ( SCSIPressurePathManager * ) param0;
+	manager->ProbeInactivePaths ( );
+	
+	// Drop the reference ArmProbeTimer took.
+	manager->release ( );
+	
+}
+
+
+//
+//	ArmProbeTimer - Schedules the next probe tick. The manager is retained
+//					while the timer is armed.						  [PRIVATE]
+//
+
+void
+SCSIPressurePathManager::ArmProbeTimer ( void )
+{
+	
+	AbsoluteTime	time;
+	
+	retain ( );
+	
+	clock_interval_to_deadline ( kPathProbeTickInMS, kMillisecondScale, &time );
+	if ( thread_call_enter_delayed ( fProbeTimer, time ) == true )
+	{
+		
+		// Already armed, it holds its own reference.
+		release ( );
+		
+	}
+	
+}
+
+
+//
+//	ProbeInactivePaths - Sends a TEST_UNIT_READY down each inactive path
+//						 whose backoff has run out.					  [PRIVATE]
+//
+
+void
+SCSIPressurePathManager::ProbeInactivePaths ( void )
+{
+	
+	SCSITargetDevicePath *	path		= NULL;
+	SCSITaskIdentifier		request		= NULL;
+	OSArray *				probes		= NULL;
+	UInt32					count		= 0;
+	UInt32					index		= 0;
+	
+	STATUS_LOG ( ( "SCSIPressurePathManager::ProbeInactivePaths\n" ) );
+	
+	IOLockLock ( fLock );
+	
+	count = fInactivePathSet->getCount ( );
+	if ( count != 0 )
+	{
+		probes = OSArray::withCapacity ( count );
+	}
+	
+	for ( index = 0; ( probes != NULL ) && ( index < count ); index++ )
+	{
+		
+		path = fInactivePathSet->getObject ( index );
+		if ( path->IsProbeDue ( ) == false )
+			continue;
+		
+		request = CreateProbeTask ( path, kPathProbeTimeoutInMS );
+		if ( request == NULL )
+			continue;
+		
+		path->SetProbeTask ( request );
+		probes->setObject ( request );
+		
+	}
+	
+	IOLockUnlock ( fLock );
+	
+	require_quiet ( ( count != 0 ), Exit );
+	require_nonzero ( probes, RearmTimer );
+	
+	// Send the probes without the lock held since they may complete
+	// before ExecuteCommand returns.
+	count = probes->getCount ( );
+	for ( index = 0; index < count; index++ )
+	{
+		
+		request = probes->getObject ( index );
+		path = ( SCSITargetDevicePath * ) GetPathLayerReference ( request );
+		path->GetInterface ( )->ExecuteCommand ( request );
+		
+	}
+	
+	probes->release ( );
+	probes = NULL;
+	
+	
+RearmTimer:
+	
+	
+	ArmProbeTimer ( );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	ProbeCompletion - Reinstates an inactive path once enough probes in a
+//					  row have succeeded.							   [PUBLIC]
+//
+
+void
+SCSIPressurePathManager::ProbeCompletion ( SCSITaskIdentifier 		request,
+										   SCSITargetDevicePath * 	path )
+{
+	
+	bool	reinstate = false;
+	
+	IOLockLock ( fLock );
+	
+	path->SetProbeTask ( NULL );
+	
+	// Any answer from the device shows the path can carry commands again,
+	// even CHECK CONDITION.
+	if ( GetServiceResponse ( request ) == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		reinstate = path->ProbeSucceeded ( );
+	}
+	
+	else
+	{
+		path->ProbeFailed ( );
+	}
+	
+	// The path may have come back through a port event, or gone away,
+	// while the probe was out.
+	if ( ( reinstate == true ) && ( fInactivePathSet->member ( path ) == true ) )
+	{
+		
+		STATUS_LOG ( ( "Reinstating path %p after probing\n", path ) );
+		
+		path->retain ( );
+		path->Activate ( );
+		fInactivePathSet->removeObject ( path->GetInterface ( ) );
+		fPathSet->setObject ( path );
+		UpdatePreferredPaths ( );
+		path->release ( );
+		
+	}
+	
+	else
+	{
+		reinstate = false;
+	}
+	
+	IOLockUnlock ( fLock );
+	
+	if ( reinstate == true )
+	{
+		AccessStateChanged ( );
+	}
+	
+}
+
+
+//
+//	AccessStateRank - Orders asymmetric access states from most to least
+//					  preferred for I/O.							   [STATIC]
+//
+
+static UInt32
+AccessStateRank ( UInt8 accessState )
+{
+	
+	UInt32	rank = 4;
+	
+	switch ( accessState )
+	{
+		
+		case kSCSIPathAccessState_ActiveOptimized:
+			rank = 0;
+			break;
+		
+		case kSCSIPathAccessState_ActiveNonOptimized:
+			rank = 1;
+			break;
+		
+		case kSCSIPathAccessState_Standby:
+			rank = 2;
+			break;
+		
+		case kSCSIPathAccessState_Unavailable:
+			rank = 3;
+			break;
+		
+		default:
+			break;
+		
+	}
+	
+	return rank;
+	
+}
+
+
+//
+//	UpdatePreferredPaths - Rebuilds the set of active paths I/O is sent down:
+//						   those in the best asymmetric access state any
+//						   active path has. Called with fLock held.	  [PRIVATE]
+//
+
+void
+SCSIPressurePathManager::UpdatePreferredPaths ( void )
+{
+	
+	SCSITargetDevicePath *	path		= NULL;
+	UInt32					count		= 0;
+	UInt32					index		= 0;
+	UInt32					rank		= 0;
+	UInt32					bestRank	= 0xFFFFFFFF;
+	
+	fPreferredPathSet->flushCollection ( );
+	
+	count = fPathSet->getCount ( );
+	
+	// With a single active path there is nothing to choose between, so
+	// ExecuteCommand sends tasks straight to it without taking fLock. A
+	// second path coming up switches every new task back to the balanced
+	// route. Tasks already sent direct are reissued from PathTaskCallback
+	// if their path then fails.
+	if ( count == 1 )
+	{
+		fDirectPath = fPathSet->getObject ( 0 );
+	}
+	
+	else
+	{
+		fDirectPath = NULL;
+	}
+	
+	for ( index = 0; index < count; index++ )
+	{
+		
+		rank = AccessStateRank ( fPathSet->getObject ( index )->GetAccessState ( ) );
+		if ( rank < bestRank )
+		{
+			bestRank = rank;
+		}
+		
+	}
+	
+	// Standby and worse paths only get I/O when nothing better is left.
+	for ( index = 0; index < count; index++ )
+	{
+		
+		path = fPathSet->getObject ( index );
+		if ( AccessStateRank ( path->GetAccessState ( ) ) == bestRank )
+		{
+			fPreferredPathSet->setObject ( path );
+		}
+		
+	}
+	
+}
+
+
+//
+//	AccessStateChanged - Schedules a fresh look at the asymmetric access
+//						 state of every path.						   [PUBLIC]
+//
+
+void
+SCSIPressurePathManager::AccessStateChanged ( void )
+{
+	
+	STATUS_LOG ( ( "SCSIPressurePathManager::AccessStateChanged\n" ) );
+	
+	retain ( );
+	
+	if ( thread_call_enter ( fAccessStateThread ) == true )
+	{
+		
+		// Already scheduled, it holds its own reference.
+		release ( );
+		
+	}
+	
+}
+
+
+//
+//	PublishStatistics - Refreshes the statistics of every path.		   [PUBLIC]
+//
+
+void
+SCSIPressurePathManager::PublishStatistics ( void )
+{
+	
+	UInt32	count	= 0;
+	UInt32	index	= 0;
+	
+	IOLockLock ( fLock );
+	
+	count = fPathSet->getCount ( );
+	for ( index = 0; index < count; index++ )
+	{
+		fPathSet->getObject ( index )->PublishStatistics ( );
+	}
+	
+	count = fInactivePathSet->getCount ( );
+	for ( index = 0; index < count; index++ )
+	{
+		fInactivePathSet->getObject ( index )->PublishStatistics ( );
+	}
+	
+	IOLockUnlock ( fLock );
+	
+}
+
+
+//
+//	sEvaluateAccessStates - C->C++ glue.					  [STATIC][PRIVATE]
+//
+
+void
+SCSIPressurePathManager::sEvaluateAccessStates (
+						thread_call_param_t 	param0,
+						thread_call_param_t 	param1 )
+{
+	
+	SCSIPressurePathManager *	manager = NULL;
+	
+	manager = ( SCSIPressurePathManager * ) param0;
+	manager->EvaluateAccessStates ( );
+	
+	// Drop the reference AccessStateChanged took.
+	manager->release ( );
+	
+}
+
+
+//
+//	EvaluateAccessStates - Queries the asymmetric access state behind each
+//						   active path and updates the preferred paths.
+//						   Runs on its own thread since the commands are
+//						   sent synchronously.						  [PRIVATE]
+//
+
+void
+SCSIPressurePathManager::EvaluateAccessStates ( void )
+{
+	
+	OSArray *				paths		= NULL;
+	SCSITargetDevicePath *	path		= NULL;
+	UInt8					state		= kSCSIPathAccessState_ActiveOptimized;
+	UInt32					count		= 0;
+	UInt32					index		= 0;
+	
+	STATUS_LOG ( ( "+SCSIPressurePathManager::EvaluateAccessStates\n" ) );
+	
+	IOLockLock ( fLock );
+	
+	count = fPathSet->getCount ( );
+	paths = OSArray::withCapacity ( count + 1 );
+	if ( paths != NULL )
+	{
+		paths->merge ( fPathSet );
+	}
+	
+	IOLockUnlock ( fLock );
+	
+	require_nonzero ( paths, ErrorExit );
+	
+	count = paths->getCount ( );
+	
+	for ( index = 0; index < count; index++ )
+	{
+		
+		path = ( SCSITargetDevicePath * ) paths->getObject ( index );
+		
+		// Targets without target port groups keep every path
+		// active/optimized.
+		state = kSCSIPathAccessState_ActiveOptimized;
+		RetrievePathAccessState ( path, &state );
+		
+		STATUS_LOG ( ( "path %p access state = 0x%x\n", path, state ) );
+		
+		IOLockLock ( fLock );
+		path->SetAccessState ( state );
+		IOLockUnlock ( fLock );
+		
+	}
+	
+	IOLockLock ( fLock );
+	UpdatePreferredPaths ( );
+	IOLockUnlock ( fLock );
+	
+	paths->release ( );
+	paths = NULL;
+	
+	
+ErrorExit:
+	
+	
+	STATUS_LOG ( ( "-SCSIPressurePathManager::EvaluateAccessStates\n" ) );
+	
+	return;
+	
+}
+
+
 //
 //	PathStatusChanged - Notification for when a path status changes.   [PUBLIC]
 //
@@ -800,6 +1396,7 @@ SCSIPressurePathManager::PathStatusChanged (
 			
 			STATUS_LOG ( ( "kSPIPortStatus_Offline or kSPIPortStatus_Failure\n" ) );
 			InactivatePath ( path );
+			ReclaimTasks ( path );
 			
 		}
 		break;
@@ -827,6 +1424,22 @@ SCSIPressurePathManager::ExecuteCommand ( SCSITaskIdentifier request )
 	PortBandwidthGlobals *		bw			= NULL;
 	UInt32						numPaths	= 0;
 	
+	// With a single active path there is nothing to balance, so the task
+	// goes straight down it without fLock, bandwidth accounting or the
+	// path's task list. fDirectPath is read once. A task which reads it just
+	// before a second path comes up is still sent direct, which is safe:
+	// the path's outstanding count covers it, and if the path then fails
+	// PathTaskCallback reissues it when the transport fails it.
+	path = fDirectPath;
+	if ( path != NULL )
+	{
+		
+		SetPathLayerReference ( request, ( void * ) ( ( uintptr_t ) path | kPathLayerReferenceDirect ) );
+		StartTaskOnPath ( request, path );
+		return;
+		
+	}
+	
 	IOLockLock ( fLock );
 	
 	numPaths = fPathSet->getCount ( );
@@ -841,12 +1454,14 @@ SCSIPressurePathManager::ExecuteCommand ( SCSITaskIdentifier request )
 	}
 	
 	bw = PortBandwidthGlobals::GetSharedInstance ( );
-	path = bw->AllocateBandwidth ( fPathSet, GetRequestedDataTransferCount ( request ) );
+	path = bw->AllocateBandwidth ( fPreferredPathSet, GetRequestedDataTransferCount ( request ) );
+	
+	SetPathLayerReference ( request, ( void * ) path );
+	path->AddTask ( request );
 	
 	IOLockUnlock ( fLock );
 	
-	SetPathLayerReference ( request, ( void * ) path );
-	path->GetInterface ( )->ExecuteCommand ( request );
+	StartTaskOnPath ( request, path );
 	
 }
 
@@ -862,11 +1477,72 @@ SCSIPressurePathManager::TaskCompletion ( SCSITaskIdentifier 		request,
 	
 	PortBandwidthGlobals *	bw = NULL;
 	
+	bool					probe	= false;
+	
+	IOLockLock ( fLock );
+	probe = IsPathManagerTask ( request );
+	path->RemoveTask ( request );
+	IOLockUnlock ( fLock );
+	
+	// Probes and other commands the path manager sends itself never
+	// allocated bandwidth and aren't counted as I/O.
+	require_quiet ( ( probe == false ), Exit );
+	
 	bw = PortBandwidthGlobals::GetSharedInstance ( );
 	bw->DeallocateBandwidth ( path, GetRequestedDataTransferCount ( request ) );
 	
 	super::TaskCompletion ( request, path );
 	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	ReissueTask - Sends a task which failed along with its path down a
+//				  surviving path. 									   [PUBLIC]
+//
+
+bool
+SCSIPressurePathManager::ReissueTask ( SCSITaskIdentifier 		request,
+									   SCSITargetDevicePath * 	path )
+{
+	
+	bool	result = false;
+	
+	// Anything the device itself completed goes back to the target as is.
+	require_quiet ( ( GetServiceResponse ( request ) != kSCSIServiceResponse_TASK_COMPLETE ), Exit );
+	
+	IOLockLock ( fLock );
+	
+	if ( ( fInactivePathSet->member ( path ) == true ) &&
+		 ( fPathSet->getCount ( ) != 0 ) &&
+		 ( IsPathManagerTask ( request ) == false ) )
+	{
+		result = true;
+	}
+	
+	IOLockUnlock ( fLock );
+	
+	require_quiet ( result, Exit );
+	
+	STATUS_LOG ( ( "Reissuing task %p from failed path %p\n", request, path ) );
+	
+	// If every other path goes away before the task is sent, ExecuteCommand
+	// completes it with no path set and it is not reissued again.
+	PrepareTaskForReissue ( request );
+	ExecuteCommand ( request );
+	
+	
+Exit:
+	
+	
+	return result;
+	
 }
 
 
@@ -74,6 +74,28 @@ private:
 	IOLock *		fLock;
 	SCSIPathSet *	fPathSet;
 	SCSIPathSet *	fInactivePathSet;
+	SCSIPathSet *	fPreferredPathSet;
+	
+	// The only active path, or NULL if there are none or several. Written
+	// under fLock, read without it by ExecuteCommand.
+	SCSITargetDevicePath * volatile	fDirectPath;
+	
+	thread_call_t	fProbeTimer;
+	thread_call_t	fAccessStateThread;
+	
+	void	ReclaimTasks ( IOSCSIProtocolServices * interface );
+	
+	static void	sProbeTimerExpired (
+						thread_call_param_t 	param0,
+						thread_call_param_t 	param1 );
+	void	ArmProbeTimer ( void );
+	void	ProbeInactivePaths ( void );
+	
+	static void	sEvaluateAccessStates (
+						thread_call_param_t 	param0,
+						thread_call_param_t 	param1 );
+	void	EvaluateAccessStates ( void );
+	void	UpdatePreferredPaths ( void );
 	
 protected:
 	
@@ -97,6 +119,10 @@ public:
 	virtual SCSIServiceResponse		LogicalUnitReset ( SCSILogicalUnitNumber theLogicalUnit );
 	virtual SCSIServiceResponse		TargetReset ( void );
 	virtual void					TaskCompletion ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual bool					ReissueTask ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual void					ProbeCompletion ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual void					AccessStateChanged ( void );
+	virtual void					PublishStatistics ( void );
 	
 	bool		AddPath ( IOSCSIProtocolServices * path );
 	void		ActivatePath ( IOSCSIProtocolServices * path );
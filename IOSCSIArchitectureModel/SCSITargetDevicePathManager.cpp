@@ -27,14 +27,19 @@
 //
 
 // Libkern includes
+#include <libkern/OSByteOrder.h>
 #include <libkern/c++/OSDictionary.h>
 #include <libkern/c++/OSNumber.h>
 #include <libkern/c++/OSString.h>
 
+// IOKit includes
+#include <IOKit/IOBufferMemoryDescriptor.h>
+
 // Storage Family includes
 #include <IOKit/storage/IOStorageProtocolCharacteristics.h>
 
 // SCSI Architecture Model Family includes
+#include <IOKit/scsi/SCSICommandOperationCodes.h>
 #include "SCSITargetDevicePathManager.h"
 #include "SCSITaskDefinition.h"
 
@@ -79,6 +84,44 @@ OSDefineMetaClassAndStructors ( SCSITargetDevicePath, OSObject );
 #define kIOPropertyBytesTransmittedKey		"Bytes Transmitted"
 #define kIOPropertyBytesReceivedKey			"Bytes Received"
 #define kIOPropertyCommandsProcessedKey		"Commands Processed"
+#define kIOPropertyCommandsFailedKey		"Commands Failed"
+#define kIOPropertyTotalCommandTimeKey		"Total Command Time"
+#define kIOPropertyOutstandingCommandsKey	"Outstanding Commands"
+
+#define kIOPropertyProbeSuccessesKey		"Probe Successes"
+#define kIOPropertyProbeFailuresKey			"Probe Failures"
+#define kIOPropertyAccessStateKey			"Asymmetric Access State"
+
+// An inactive path is reinstated after this many probes in a row succeed.
+// Each flap doubles the number, up to kProbeMaximumFlapCount doublings.
+#define kProbeSuccessesToReinstate			3
+#define kProbeMaximumFlapCount				3
+
+// A failed probe doubles the number of probe timer ticks before the next
+// one, up to this limit.
+#define kProbeMaximumInterval				64
+
+// A path which fails again within this many seconds of being activated
+// is flapping.
+#define kFlapWindowInSeconds				60
+
+// Room for the REPORT TARGET PORT GROUPS data of a large array.
+#define kReportTargetPortGroupsDataSize		1024
+
+
+// REPORT TARGET PORT GROUPS target port group descriptor (SPC-3 6.25).
+// The descriptor is followed by TARGET_PORT_COUNT 4 byte target port
+// descriptors.
+typedef struct SCSITargetPortGroupDescriptor
+{
+	UInt8		ASYMMETRIC_ACCESS_STATE;			// 7 = PREF. 3-0 = Asymmetric access state
+	UInt8		SUPPORTED_STATES;
+	UInt16		TARGET_PORT_GROUP;
+	UInt8		RESERVED;
+	UInt8		STATUS_CODE;
+	UInt8		VENDOR_SPECIFIC;
+	UInt8		TARGET_PORT_COUNT;
+} SCSITargetPortGroupDescriptor;
 
 
 //
@@ -164,12 +207,48 @@ SCSITargetDevicePath::InitWithObjects (
 	fCommandsProcessed = number;
 	fStatistics->setObject ( kIOPropertyCommandsProcessedKey, number );
 	
+	number = OSNumber::withNumber ( ( UInt64 ) 0, 64 );
+	require_nonzero ( number, ReleaseStatistics );
+	fCommandsFailed = number;
+	fStatistics->setObject ( kIOPropertyCommandsFailedKey, number );
+	
+	// Nanoseconds from the path manager sending a command to its completion,
+	// summed over all completed commands.
+	number = OSNumber::withNumber ( ( UInt64 ) 0, 64 );
+	require_nonzero ( number, ReleaseStatistics );
+	fTotalCommandTime = number;
+	fStatistics->setObject ( kIOPropertyTotalCommandTimeKey, number );
+	
+	number = OSNumber::withNumber ( ( UInt64 ) 0, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	fOutstandingCommands = number;
+	fStatistics->setObject ( kIOPropertyOutstandingCommandsKey, number );
+	
 	fStatus = kIOPropertyPortStatusLinkEstablishedKey;
 	string = OSString::withCStringNoCopy ( fStatus );
 	require_nonzero ( string, ReleaseStatistics );
 	fPathStatus = string;
 	fStatistics->setObject ( kIOPropertyPortStatusKey, string );
 	
+	fTaskList	= NULL;
+	fTaskCount	= 0;
+	
+	number = OSNumber::withNumber ( ( UInt64 ) 0, 64 );
+	require_nonzero ( number, ReleaseStatistics );
+	fProbeSuccessCount = number;
+	fStatistics->setObject ( kIOPropertyProbeSuccessesKey, number );
+	
+	number = OSNumber::withNumber ( ( UInt64 ) 0, 64 );
+	require_nonzero ( number, ReleaseStatistics );
+	fProbeFailureCount = number;
+	fStatistics->setObject ( kIOPropertyProbeFailuresKey, number );
+	
+	fAccessState = kSCSIPathAccessState_ActiveOptimized;
+	number = OSNumber::withNumber ( fAccessState, 8 );
+	require_nonzero ( number, ReleaseStatistics );
+	fAccessStateNumber = number;
+	fStatistics->setObject ( kIOPropertyAccessStateKey, number );
+	
 	STATUS_LOG ( ( "stats has %ld entries\n", fStatistics->getCount ( ) ) );
 	
 	result = true;
@@ -235,6 +314,8 @@ SCSITargetDevicePath::Activate ( void )
 	fStatus = kIOPropertyPortStatusLinkEstablishedKey;
 	fPathStatus->initWithCStringNoCopy ( fStatus );
 	
+	clock_interval_to_deadline ( kFlapWindowInSeconds, kSecondScale, &fFlapDeadline );
+	
 }
 
 
@@ -246,9 +327,258 @@ void
 SCSITargetDevicePath::Inactivate ( void )
 {
 	
+	AbsoluteTime	now;
+	
 	fStatus = kIOPropertyPortStatusNoLinkEstablishedKey;
 	fPathStatus->initWithCStringNoCopy ( fStatus );
 	
+	// A path which fails again soon after coming back has to pass more
+	// probes before it is trusted again.
+	clock_get_uptime ( &now );
+	if ( CMP_ABSOLUTETIME ( &now, &fFlapDeadline ) < 0 )
+	{
+		
+		if ( fFlapCount < kProbeMaximumFlapCount )
+		{
+			fFlapCount++;
+		}
+		
+	}
+	
+	else
+	{
+		fFlapCount = 0;
+	}
+	
+	fProbeInterval	= 1;
+	fProbeCountdown	= 1;
+	fProbeSuccesses	= 0;
+	
+}
+
+
+//
+//	IsProbeDue - Called once per probe timer tick. Returns true if a probe
+//				 should be sent down this path now.					   [PUBLIC]
+//
+
+bool
+SCSITargetDevicePath::IsProbeDue ( void )
+{
+	
+	bool	result = false;
+	
+	require_quiet ( ( fProbeTask == NULL ), Exit );
+	
+	if ( fProbeCountdown > 1 )
+	{
+		
+		fProbeCountdown--;
+		goto Exit;
+		
+	}
+	
+	fProbeCountdown = fProbeInterval;
+	result = true;
+	
+	
+Exit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	ProbeSucceeded - Records a successful probe. Returns true if the path
+//					 may be reinstated.								   [PUBLIC]
+//
+
+bool
+SCSITargetDevicePath::ProbeSucceeded ( void )
+{
+	
+	fProbeSuccessCount->addValue ( 1 );
+	
+	fProbeSuccesses++;
+	fProbeInterval	= 1;
+	fProbeCountdown	= 1;
+	
+	return ( fProbeSuccesses >= ( kProbeSuccessesToReinstate << fFlapCount ) );
+	
+}
+
+
+//
+//	ProbeFailed - Records a failed probe and backs off.				   [PUBLIC]
+//
+
+void
+SCSITargetDevicePath::ProbeFailed ( void )
+{
+	
+	fProbeFailureCount->addValue ( 1 );
+	
+	fProbeSuccesses = 0;
+	
+	if ( fProbeInterval < kProbeMaximumInterval )
+	{
+		fProbeInterval = fProbeInterval << 1;
+	}
+	
+	fProbeCountdown = fProbeInterval;
+	
+}
+
+
+//
+//	CommandCompleted - Records the outcome of a command sent on this path.
+//																	   [PUBLIC]
+//
+
+void
+SCSITargetDevicePath::CommandCompleted ( UInt64 nanoseconds, bool failed )
+{
+	
+	OSAddAtomic64 ( nanoseconds, &fTotalCommandTimeCount );
+	
+	if ( failed == true )
+	{
+		OSIncrementAtomic64 ( &fCommandsFailedCount );
+	}
+	
+	OSDecrementAtomic ( &fOutstandingCount );
+	
+}
+
+
+//
+//	AddTask - Links a task into the list of tasks outstanding on this path.
+//																	   [PUBLIC]
+//
+
+void
+SCSITargetDevicePath::AddTask ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *	task = SCSITaskFromIdentifier ( request );
+	
+	task->SetPreviousPathTask ( NULL );
+	task->SetNextPathTask ( fTaskList );
+	
+	if ( fTaskList != NULL )
+	{
+		fTaskList->SetPreviousPathTask ( task );
+	}
+	
+	fTaskList = task;
+	fTaskCount++;
+	
+}
+
+
+//
+//	RemoveTask - Unlinks a task from the list of tasks outstanding on this
+//				 path. Tasks which are not on the list are ignored.	   [PUBLIC]
+//
+
+void
+SCSITargetDevicePath::RemoveTask ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *	task		= SCSITaskFromIdentifier ( request );
+	SCSITask *	previous	= NULL;
+	SCSITask *	next		= NULL;
+	
+	previous	= task->GetPreviousPathTask ( );
+	next		= task->GetNextPathTask ( );
+	
+	// Only the head of the list has no previous task.
+	require_quiet ( ( previous != NULL ) || ( fTaskList == task ), Exit );
+	
+	if ( previous != NULL )
+	{
+		previous->SetNextPathTask ( next );
+	}
+	
+	else
+	{
+		fTaskList = next;
+	}
+	
+	if ( next != NULL )
+	{
+		next->SetPreviousPathTask ( previous );
+	}
+	
+	task->SetNextPathTask ( NULL );
+	task->SetPreviousPathTask ( NULL );
+	fTaskCount--;
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	CopyTasks - Returns a retained array of the tasks outstanding on this
+//				path, or NULL if it could not be allocated.		   [PUBLIC]
+//
+
+OSArray *
+SCSITargetDevicePath::CopyTasks ( void ) const
+{
+	
+	OSArray *	tasks	= NULL;
+	SCSITask *	task	= NULL;
+	
+	tasks = OSArray::withCapacity ( ( fTaskCount != 0 ) ? fTaskCount : 1 );
+	require_nonzero ( tasks, ErrorExit );
+	
+	for ( task = fTaskList; task != NULL; task = task->GetNextPathTask ( ) )
+	{
+		
+		if ( tasks->setObject ( task ) == false )
+		{
+			
+			tasks->release ( );
+			tasks = NULL;
+			break;
+			
+		}
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return tasks;
+	
+}
+
+
+//
+//	PublishStatistics - Copies the counters into the statistics dictionary.
+//																	   [PUBLIC]
+//
+
+void
+SCSITargetDevicePath::PublishStatistics ( void )
+{
+	
+	fBytesTransmitted->setValue ( fBytesTransmittedCount );
+	fBytesReceived->setValue ( fBytesReceivedCount );
+	fCommandsProcessed->setValue ( fCommandsProcessedCount );
+	fCommandsFailed->setValue ( fCommandsFailedCount );
+	fTotalCommandTime->setValue ( fTotalCommandTimeCount );
+	fOutstandingCommands->setValue ( fOutstandingCount );
+	
 }
 
 
@@ -302,6 +632,30 @@ SCSITargetDevicePath::free ( void )
 		
 	}
 	
+	if ( fCommandsFailed != NULL )
+	{
+		
+		fCommandsFailed->release ( );
+		fCommandsFailed = NULL;
+		
+	}
+	
+	if ( fTotalCommandTime != NULL )
+	{
+		
+		fTotalCommandTime->release ( );
+		fTotalCommandTime = NULL;
+		
+	}
+	
+	if ( fOutstandingCommands != NULL )
+	{
+		
+		fOutstandingCommands->release ( );
+		fOutstandingCommands = NULL;
+		
+	}
+	
 	if ( fPathStatus != NULL )
 	{
 		
@@ -310,6 +664,30 @@ SCSITargetDevicePath::free ( void )
 		
 	}
 	
+	if ( fProbeSuccessCount != NULL )
+	{
+		
+		fProbeSuccessCount->release ( );
+		fProbeSuccessCount = NULL;
+		
+	}
+	
+	if ( fProbeFailureCount != NULL )
+	{
+		
+		fProbeFailureCount->release ( );
+		fProbeFailureCount = NULL;
+		
+	}
+	
+	if ( fAccessStateNumber != NULL )
+	{
+		
+		fAccessStateNumber->release ( );
+		fAccessStateNumber = NULL;
+		
+	}
+	
 	super::free ( );
 	
 	STATUS_LOG ( ( "-SCSITargetDevicePath::free\n" ) );
@@ -342,6 +720,9 @@ SCSITargetDevicePathManager::InitializePathManagerForTarget (
 	fStatistics = OSArray::withCapacity ( 1 );
 	require_nonzero ( fStatistics, ErrorExit );
 	
+	fCommandLock = IOLockAlloc ( );
+	require_nonzero ( fCommandLock, ReleaseStats );
+	
 	fTarget = target;	
 	result 	= true;
 	
@@ -378,22 +759,46 @@ SCSITargetDevicePathManager::PathTaskCallback ( SCSITaskIdentifier request )
 	
 	STATUS_LOG ( ( "SCSITargetDevicePathManager::PathTaskCallback\n" ) );
 	
-	path = ( SCSITargetDevicePath * ) GetPathLayerReference ( request );
-	require_nonzero_quiet ( path, ErrorExit );
+	path = GetTaskPath ( request );
+	require_nonzero_quiet ( path, CompleteTask );
 	
 	manager = path->GetPathManager ( );
-	require_nonzero ( manager, ErrorExit );
+	require_nonzero ( manager, CompleteTask );
+	
+	// A task sent straight down the target's only path had no path manager
+	// bookkeeping done, so only the path statistics need updating. If it
+	// failed because that path went away after a second one came up,
+	// ReissueTask sends it down the survivor. It returns without taking
+	// any lock for tasks the device completed.
+	if ( ( ( uintptr_t ) GetPathLayerReference ( request ) & kPathLayerReferenceDirect ) != 0 )
+	{
+		
+		RecordTaskStatistics ( request, path );
+		require_quiet ( ( manager->ReissueTask ( request, path ) == false ), Exit );
+		goto CompleteTask;
+		
+	}
 	
 	// Call path manager hook for task completion.
 	manager->TaskCompletion ( request, path );
 	
+	// A task which died with its path is sent down another one instead of
+	// being completed back to the target.
+	require_quiet ( ( manager->ReissueTask ( request, path ) == false ), Exit );
 	
-ErrorExit:
+	
+CompleteTask:
 	
 	
 	target = ( IOSCSITargetDevice * ) IOSCSITargetDevice::GetTargetLayerReference ( request );
 	target->TargetTaskCompletion ( request );
 	
+	
+Exit:
+	
+	
+	return;
+	
 }
 
 
@@ -406,32 +811,231 @@ SCSITargetDevicePathManager::TaskCompletion ( SCSITaskIdentifier 		request,
 											  SCSITargetDevicePath *	path )
 {
 	
-	UInt64					bytes	= 0;
-	IOSCSITargetDevice *	target	= NULL;
-	
 	STATUS_LOG ( ( "SCSITargetDevicePathManager::TaskCompletion\n" ) );
 	
-	target = ( IOSCSITargetDevice * ) IOSCSITargetDevice::GetTargetLayerReference ( request );
+	RecordTaskStatistics ( request, path );
 	
-	if ( IsTransmit ( request, target, &bytes ) == true )
+}
+
+
+//
+//	 StartTaskOnPath - Sends a task down a path and starts timing it.
+//													[PROTECTED][STATIC]
+//
+
+void
+SCSITargetDevicePathManager::StartTaskOnPath ( SCSITaskIdentifier		request,
+											   SCSITargetDevicePath *	path )
+{
+	
+	SCSITask *		scsiRequest = NULL;
+	AbsoluteTime	now;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	require_nonzero ( scsiRequest, ErrorExit );
+	
+	clock_get_uptime ( &now );
+	scsiRequest->SetPathEntryTime ( now );
+	
+	path->CommandStarted ( );
+	path->GetInterface ( )->ExecuteCommand ( request );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 RecordTaskStatistics - Charges a completed task to the path's
+//							 statistics.					[PROTECTED][STATIC]
+//
+
+void
+SCSITargetDevicePathManager::RecordTaskStatistics ( SCSITaskIdentifier		request,
+													SCSITargetDevicePath *	path )
+{
+	
+	SCSITask *		scsiRequest = NULL;
+	AbsoluteTime	now;
+	AbsoluteTime	entryTime;
+	UInt64			nanoseconds	= 0;
+	bool			failed		= false;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	require_nonzero ( scsiRequest, ErrorExit );
+	
+	clock_get_uptime ( &now );
+	entryTime = scsiRequest->GetPathEntryTime ( );
+	SUB_ABSOLUTETIME ( &now, &entryTime );
+	absolutetime_to_nanoseconds ( now, &nanoseconds );
+	
+	failed = ( scsiRequest->GetServiceResponse ( ) != kSCSIServiceResponse_TASK_COMPLETE );
+	path->CommandCompleted ( nanoseconds, failed );
+	
+	switch ( scsiRequest->GetDataTransferDirection ( ) )
 	{
 		
-		STATUS_LOG ( ( "path->AddBytesTransmitted\n" ) );
-		path->AddBytesTransmitted ( bytes );
+		case kSCSIDataTransfer_FromInitiatorToTarget:
+		{
+			
+			STATUS_LOG ( ( "path->AddBytesTransmitted\n" ) );
+			path->AddBytesTransmitted ( scsiRequest->GetRealizedDataTransferCount ( ) );
+			
+		}
+		break;
 		
-	}
-	
-	else if ( IsReceive ( request, target, &bytes ) == true )
-	{
+		case kSCSIDataTransfer_FromTargetToInitiator:
+		{
+			
+			STATUS_LOG ( ( "path->AddBytesReceived\n" ) );
+			path->AddBytesReceived ( scsiRequest->GetRealizedDataTransferCount ( ) );
+			
+		}
+		break;
 		
-		STATUS_LOG ( ( "path->AddBytesReceived\n" ) );
-		path->AddBytesReceived ( bytes );
+		default:
+		{
+			break;
+		}
 		
 	}
 	
 	STATUS_LOG ( ( "path->IncrementCommandsProcessed\n" ) );
 	path->IncrementCommandsProcessed ( );
 	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ReissueTask - Called after TaskCompletion to give the path manager a
+//					chance to send the task down another path. Returns true
+//					if the task was reissued and must not be completed.
+//																	   [PUBLIC]
+//
+
+bool
+SCSITargetDevicePathManager::ReissueTask ( SCSITaskIdentifier 		request,
+										   SCSITargetDevicePath *	path )
+{
+	return false;
+}
+
+
+//
+//	 ProbeTaskCallback - Completion for probes sent by CreateProbeTask.
+//																   [PUBLIC][STATIC]
+//
+
+void
+SCSITargetDevicePathManager::ProbeTaskCallback ( SCSITaskIdentifier request )
+{
+	
+	SCSITargetDevicePath *			path 	= NULL;
+	SCSITargetDevicePathManager *	manager	= NULL;
+	
+	STATUS_LOG ( ( "SCSITargetDevicePathManager::ProbeTaskCallback\n" ) );
+	
+	path = ( SCSITargetDevicePath * ) GetPathLayerReference ( request );
+	require_nonzero ( path, ErrorExit );
+	
+	manager = path->GetPathManager ( );
+	require_nonzero ( manager, ReleasePath );
+	
+	manager->ProbeCompletion ( request, path );
+	manager->fTarget->ReleaseSCSITask ( request );
+	
+	
+ReleasePath:
+	
+	
+	// Drop the reference CreateProbeTask took.
+	path->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ProbeCompletion - Called when a probe completes.				   [PUBLIC]
+//
+
+void
+SCSITargetDevicePathManager::ProbeCompletion ( SCSITaskIdentifier 		request,
+											   SCSITargetDevicePath *	path )
+{
+	return;
+}
+
+
+//
+//	 AccessStateChanged - Called by the target when the device reports that
+//						   the asymmetric access state of a target port
+//						   group changed.							   [PUBLIC]
+//
+
+void
+SCSITargetDevicePathManager::AccessStateChanged ( void )
+{
+	return;
+}
+
+
+//
+//	 PublishStatistics - Called before the target's properties are
+//						  serialized to refresh the path statistics.   [PUBLIC]
+//
+
+void
+SCSITargetDevicePathManager::PublishStatistics ( void )
+{
+	return;
+}
+
+
+//
+//	 PathCommandCallback - Completion for SendCommandOnPath.  [PUBLIC][STATIC]
+//
+
+void
+SCSITargetDevicePathManager::PathCommandCallback ( SCSITaskIdentifier request )
+{
+	
+	SCSITargetDevicePath *			path 	= NULL;
+	SCSITargetDevicePathManager *	manager	= NULL;
+	
+	path = ( SCSITargetDevicePath * ) GetPathLayerReference ( request );
+	require_nonzero ( path, ErrorExit );
+	
+	manager = path->GetPathManager ( );
+	require_nonzero ( manager, ErrorExit );
+	
+	// Clearing the path layer reference is what the sender waits on.
+	IOLockLock ( manager->fCommandLock );
+	SetPathLayerReference ( request, NULL );
+	IOLockWakeup ( manager->fCommandLock, request, true );
+	IOLockUnlock ( manager->fCommandLock );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
 }
 
 
@@ -501,7 +1105,7 @@ SCSITargetDevicePathManager::SetPathLayerReference (
 	SCSITask *	scsiRequest = NULL;
 	bool		result		= NULL;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	if ( scsiRequest != NULL )
 	{
 		result = scsiRequest->SetPathLayerReference ( newReference );
@@ -523,7 +1127,7 @@ SCSITargetDevicePathManager::GetPathLayerReference ( SCSITaskIdentifier request
 	SCSITask *	scsiRequest = NULL;
 	void *		result		= NULL;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	if ( scsiRequest != NULL )
 	{
 		result = scsiRequest->GetPathLayerReference ( );
@@ -534,6 +1138,23 @@ SCSITargetDevicePathManager::GetPathLayerReference ( SCSITaskIdentifier request
 }
 
 
+//
+//	 GetTaskPath -  Gets the path a task was sent on.		[PROTECTED][STATIC]
+//
+
+SCSITargetDevicePath *
+SCSITargetDevicePathManager::GetTaskPath ( SCSITaskIdentifier request )
+{
+	
+	uintptr_t	reference = 0;
+	
+	reference = ( uintptr_t ) GetPathLayerReference ( request );
+	
+	return ( SCSITargetDevicePath * ) ( reference & ~( ( uintptr_t ) kPathLayerReferenceDirect ) );
+	
+}
+
+
 //
 //	 GetRequestedDataTransferCount -  Gets data xfer count.		[PROTECTED]
 //
@@ -546,7 +1167,7 @@ SCSITargetDevicePathManager::GetRequestedDataTransferCount (
 	SCSITask *	scsiRequest = NULL;
 	UInt64		result		= NULL;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	if ( scsiRequest != NULL )
 	{
 		result = scsiRequest->GetRequestedDataTransferCount ( );
@@ -557,6 +1178,352 @@ SCSITargetDevicePathManager::GetRequestedDataTransferCount (
 }
 
 
+//
+//	 GetServiceResponse -  Gets the task's service response.		[PROTECTED]
+//
+
+SCSIServiceResponse
+SCSITargetDevicePathManager::GetServiceResponse ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *				scsiRequest = NULL;
+	SCSIServiceResponse		result		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	if ( scsiRequest != NULL )
+	{
+		result = scsiRequest->GetServiceResponse ( );
+	}
+	
+	return result;
+	
+}
+
+
+//
+//	 AbortTaskOnPath -  Asks the path's transport to abort the task.
+//																	[PROTECTED]
+//
+
+void
+SCSITargetDevicePathManager::AbortTaskOnPath ( SCSITaskIdentifier		request,
+											   SCSITargetDevicePath *	path )
+{
+	
+	SCSITask *	scsiRequest = NULL;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	
+	// The response is ignored. Transports which can't abort will fail the
+	// task themselves once they notice the link is gone.
+	path->GetInterface ( )->AbortTask ( scsiRequest->GetLogicalUnitNumber ( ),
+										scsiRequest->GetTaggedTaskIdentifier ( ) );
+	
+}
+
+
+//
+//	 PrepareTaskForReissue -  Clears the results of a task which ended on a
+//							   failed path so it can be sent again.	[PROTECTED]
+//
+
+void
+SCSITargetDevicePathManager::PrepareTaskForReissue ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *	scsiRequest = NULL;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	
+	// The old tag may still be known to the device through the failed
+	// port, so a tagged task gets a fresh one.
+	if ( scsiRequest->GetTaggedTaskIdentifier ( ) != kSCSIUntaggedTaskIdentifier )
+	{
+		scsiRequest->SetTaggedTaskIdentifier ( fTarget->GetUniqueTagID ( ) );
+	}
+	
+	scsiRequest->SetTaskState ( kSCSITaskState_NEW_TASK );
+	scsiRequest->SetTaskStatus ( kSCSITaskStatus_GOOD );
+	scsiRequest->SetServiceResponse ( kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
+	scsiRequest->SetRealizedDataTransferCount ( 0 );
+	scsiRequest->SetAutosenseRealizedDataCount ( 0 );
+	scsiRequest->SetAutosenseIsValid ( false );
+	scsiRequest->SetProtocolLayerReference ( NULL );
+	scsiRequest->SetPathLayerReference ( NULL );
+	
+}
+
+
+//
+//	 CreateProbeTask -  Builds a TEST_UNIT_READY to be sent straight down
+//						 the given path. The path is retained until the
+//						 probe completes.							[PROTECTED]
+//
+
+SCSITaskIdentifier
+SCSITargetDevicePathManager::CreateProbeTask ( SCSITargetDevicePath *	path,
+											   UInt32					timeoutDuration )
+{
+	
+	SCSITaskIdentifier	request = NULL;
+	
+	request = fTarget->GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	require ( fTarget->TEST_UNIT_READY ( request, 0x00 ), ReleaseTask );
+	
+	// The probe completes through PathTaskCallback and the target like any
+	// other task, then lands in ProbeTaskCallback.
+	fTarget->SetTimeoutDuration ( request, timeoutDuration );
+	fTarget->SetTaskCompletionCallback ( request, &SCSITargetDevicePathManager::ProbeTaskCallback );
+	fTarget->SetApplicationLayerReference ( request, ( void * ) this );
+	IOSCSITargetDevice::SetTargetLayerReference ( request, ( void * ) fTarget );
+	SetPathLayerReference ( request, ( void * ) path );
+	
+	path->retain ( );
+	
+	return request;
+	
+	
+ReleaseTask:
+	
+	
+	fTarget->ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return request;
+	
+}
+
+
+//
+//	 IsPathManagerTask -  Returns true for tasks the path manager sent
+//						   itself rather than on behalf of the target.
+//																	[PROTECTED]
+//
+
+bool
+SCSITargetDevicePathManager::IsPathManagerTask ( SCSITaskIdentifier request )
+{
+	
+	SCSITask *	scsiRequest = NULL;
+	bool		result		= false;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	result = ( scsiRequest->GetApplicationLayerReference ( ) == ( void * ) this );
+	
+	return result;
+	
+}
+
+
+//
+//	 SendCommandOnPath -  Sends a command down the given path and waits for
+//						   it to complete. The task does not count as I/O
+//						   on the path and is never reissued.		[PROTECTED]
+//
+
+SCSIServiceResponse
+SCSITargetDevicePathManager::SendCommandOnPath ( SCSITaskIdentifier		request,
+												 SCSITargetDevicePath *	path,
+												 UInt32					timeoutDuration )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	
+	fTarget->SetTimeoutDuration ( request, timeoutDuration );
+	fTarget->SetTaskCompletionCallback ( request, &SCSITargetDevicePathManager::PathCommandCallback );
+	fTarget->SetApplicationLayerReference ( request, ( void * ) this );
+	IOSCSITargetDevice::SetTargetLayerReference ( request, ( void * ) fTarget );
+	SetPathLayerReference ( request, ( void * ) path );
+	
+	path->retain ( );
+	path->GetInterface ( )->ExecuteCommand ( request );
+	
+	IOLockLock ( fCommandLock );
+	
+	while ( GetPathLayerReference ( request ) != NULL )
+	{
+		IOLockSleep ( fCommandLock, request, THREAD_UNINT );
+	}
+	
+	IOLockUnlock ( fCommandLock );
+	
+	path->release ( );
+	
+	serviceResponse = GetServiceResponse ( request );
+	
+	return serviceResponse;
+	
+}
+
+
+//
+//	 RetrievePathAccessState -  Finds the target port group the path leads
+//								 to from INQUIRY page 83h and looks up its
+//								 asymmetric access state with REPORT TARGET
+//								 PORT GROUPS, both sent down the path itself.
+//								 Returns false if the device doesn't report
+//								 target port groups.				[PROTECTED]
+//
+
+bool
+SCSITargetDevicePathManager::RetrievePathAccessState (
+								SCSITargetDevicePath *	path,
+								UInt8 *					accessState )
+{
+	
+	SCSITaskIdentifier									request			= NULL;
+	IOBufferMemoryDescriptor *							buffer			= NULL;
+	SCSICmd_INQUIRY_Page83_Header *						header			= NULL;
+	SCSICmd_INQUIRY_Page83_Identification_Descriptor *	descriptor		= NULL;
+	SCSITargetPortGroupDescriptor *						group			= NULL;
+	SCSIServiceResponse									serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt8 *												bytes			= NULL;
+	UInt32												length			= 0;
+	UInt32												offset			= 0;
+	UInt16												groupID			= 0;
+	bool												found			= false;
+	bool												result			= false;
+	
+	STATUS_LOG ( ( "+SCSITargetDevicePathManager::RetrievePathAccessState\n" ) );
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( kReportTargetPortGroupsDataSize, kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	bytes = ( UInt8 * ) buffer->getBytesNoCopy ( );
+	bzero ( bytes, kReportTargetPortGroupsDataSize );
+	
+	request = fTarget->GetSCSITask ( );
+	require_nonzero ( request, ReleaseBuffer );
+	
+	require ( fTarget->INQUIRY ( request,
+								 buffer,
+								 0,
+								 1,
+								 kINQUIRY_Page83_PageCode,
+								 kINQUIRY_MaximumDataSize,
+								 0 ), ReleaseTask );
+	
+	serviceResponse = SendCommandOnPath ( request, path, kTenSecondTimeoutInMS );
+	require_quiet ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ), ReleaseTask );
+	require_quiet ( ( fTarget->GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+	
+	header = ( SCSICmd_INQUIRY_Page83_Header * ) bytes;
+	require ( ( header->PAGE_CODE == kINQUIRY_Page83_PageCode ), ReleaseTask );
+	
+	length = header->PAGE_LENGTH + sizeof ( SCSICmd_INQUIRY_Page83_Header );
+	offset = sizeof ( SCSICmd_INQUIRY_Page83_Header );
+	
+	// Look for the target port group designator of the port we went
+	// through. Its last two bytes hold the group number.
+	while ( ( offset + offsetof ( SCSICmd_INQUIRY_Page83_Identification_Descriptor, IDENTIFIER ) ) <= length )
+	{
+		
+		descriptor = ( SCSICmd_INQUIRY_Page83_Identification_Descriptor * ) &bytes[offset];
+		
+		offset += descriptor->IDENTIFIER_LENGTH +
+			offsetof ( SCSICmd_INQUIRY_Page83_Identification_Descriptor, IDENTIFIER );
+		
+		if ( offset > length )
+			break;
+		
+		if ( ( ( descriptor->IDENTIFIER_TYPE & kINQUIRY_Page83_AssociationMask ) == kINQUIRY_Page83_AssociationTargetPort ) &&
+			 ( ( descriptor->IDENTIFIER_TYPE & kINQUIRY_Page83_IdentifierTypeMask ) == kINQUIRY_Page83_IdentifierTypeTargetPortGroup ) &&
+			 ( descriptor->IDENTIFIER_LENGTH >= 4 ) )
+		{
+			
+			groupID	= OSReadBigInt16 ( &descriptor->IDENTIFIER, 2 );
+			found	= true;
+			break;
+			
+		}
+		
+	}
+	
+	// No target port groups, no asymmetric access.
+	require_quiet ( found, ReleaseTask );
+	
+	bzero ( bytes, kReportTargetPortGroupsDataSize );
+	fTarget->ResetForNewTask ( request );
+	
+	fTarget->SetCommandDescriptorBlock ( request,
+										 kSCSICmd_MAINTENANCE_IN,
+										 kSCSIServiceAction_REPORT_TARGET_PORT_GROUPS,
+										 0x00,
+										 0x00,
+										 0x00,
+										 0x00,
+										 ( kReportTargetPortGroupsDataSize >> 24 ) & 0xFF,
+										 ( kReportTargetPortGroupsDataSize >> 16 ) & 0xFF,
+										 ( kReportTargetPortGroupsDataSize >>  8 ) & 0xFF,
+										   kReportTargetPortGroupsDataSize		   & 0xFF,
+										 0x00,
+										 0x00 );
+	fTarget->SetDataTransferDirection ( request, kSCSIDataTransfer_FromTargetToInitiator );
+	fTarget->SetRequestedDataTransferCount ( request, kReportTargetPortGroupsDataSize );
+	fTarget->SetDataBuffer ( request, buffer );
+	
+	serviceResponse = SendCommandOnPath ( request, path, kTenSecondTimeoutInMS );
+	require_quiet ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ), ReleaseTask );
+	require_quiet ( ( fTarget->GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+	
+	// RETURN DATA LENGTH doesn't count its own four bytes.
+	length = OSReadBigInt32 ( bytes, 0 ) + 4;
+	if ( length > kReportTargetPortGroupsDataSize )
+	{
+		length = kReportTargetPortGroupsDataSize;
+	}
+	
+	offset = 4;
+	
+	while ( ( offset + sizeof ( SCSITargetPortGroupDescriptor ) ) <= length )
+	{
+		
+		group = ( SCSITargetPortGroupDescriptor * ) &bytes[offset];
+		
+		if ( OSSwapBigToHostInt16 ( group->TARGET_PORT_GROUP ) == groupID )
+		{
+			
+			*accessState	= group->ASYMMETRIC_ACCESS_STATE & kSCSIPathAccessState_Mask;
+			result			= true;
+			break;
+			
+		}
+		
+		offset += sizeof ( SCSITargetPortGroupDescriptor ) + ( group->TARGET_PORT_COUNT * 4 );
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	fTarget->ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseBuffer:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	STATUS_LOG ( ( "-SCSITargetDevicePathManager::RetrievePathAccessState, result = %d\n", result ) );
+	
+	return result;
+	
+}
+
+
 //
 //	 free -  Called to free all resources.							[PROTECTED]
 //
@@ -575,6 +1542,14 @@ SCSITargetDevicePathManager::free ( void )
 		
 	}
 	
+	if ( fCommandLock != NULL )
+	{
+		
+		IOLockFree ( fCommandLock );
+		fCommandLock = NULL;
+		
+	}
+	
 	super::free ( );
 	
 	STATUS_LOG ( ( "-SCSITargetDevicePathManager::free\n" ) );
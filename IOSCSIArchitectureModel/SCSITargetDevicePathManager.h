@@ -33,6 +33,11 @@
 // Libkern includes
 #include <libkern/c++/OSObject.h>
 #include <libkern/c++/OSDictionary.h>
+#include <libkern/c++/OSSet.h>
+#include <libkern/OSAtomic.h>
+
+// IOKit includes
+#include <IOKit/IOLocks.h>
 
 // SCSI Architecture Model Family includes
 #include "IOSCSITargetDevice.h"
@@ -43,7 +48,20 @@
 //	Class declaration
 //
 
+// Asymmetric access states reported by REPORT TARGET PORT GROUPS.
+enum
+{
+	kSCSIPathAccessState_ActiveOptimized		= 0x0,
+	kSCSIPathAccessState_ActiveNonOptimized		= 0x1,
+	kSCSIPathAccessState_Standby				= 0x2,
+	kSCSIPathAccessState_Unavailable			= 0x3,
+	kSCSIPathAccessState_Offline				= 0xE,
+	kSCSIPathAccessState_Transitioning			= 0xF,
+	kSCSIPathAccessState_Mask					= 0xF
+};
+
 class SCSITargetDevicePathManager;
+class SCSITask;
 
 class SCSITargetDevicePath : public OSObject
 {
@@ -67,9 +85,35 @@ public:
 	void	Activate ( void );
 	void	Inactivate ( void );
 	
-	void	AddBytesTransmitted ( UInt64 bytes ) { fBytesTransmitted->addValue ( bytes ); }
-	void	AddBytesReceived ( UInt64 bytes )  { fBytesReceived->addValue ( bytes ); }
-	void	IncrementCommandsProcessed ( void )  { fCommandsProcessed->addValue ( 1 ); }
+	// Completion counters. These are only updated atomically and are copied
+	// into the statistics dictionary by PublishStatistics ( ).
+	void	AddBytesTransmitted ( UInt64 bytes ) { OSAddAtomic64 ( bytes, &fBytesTransmittedCount ); }
+	void	AddBytesReceived ( UInt64 bytes )  { OSAddAtomic64 ( bytes, &fBytesReceivedCount ); }
+	void	IncrementCommandsProcessed ( void )  { OSIncrementAtomic64 ( &fCommandsProcessedCount ); }
+	void	CommandStarted ( void ) { OSIncrementAtomic ( &fOutstandingCount ); }
+	SInt32	GetOutstandingCount ( void ) const { return fOutstandingCount; }
+	void	CommandCompleted ( UInt64 nanoseconds, bool failed );
+	void	PublishStatistics ( void );
+	
+	// Tasks currently outstanding on this path, linked through the tasks
+	// themselves so that adding or removing one neither allocates nor
+	// searches. CopyTasks ( ) returns a retained array of them. Guarded by
+	// the path manager.
+	void		AddTask ( SCSITaskIdentifier request );
+	void		RemoveTask ( SCSITaskIdentifier request );
+	OSArray *	CopyTasks ( void ) const;
+	
+	// Background probing of an inactive path. Guarded by the path manager.
+	SCSITaskIdentifier	GetProbeTask ( void ) const { return fProbeTask; }
+	void				SetProbeTask ( SCSITaskIdentifier request ) { fProbeTask = request; }
+	bool				IsProbeDue ( void );
+	bool				ProbeSucceeded ( void );
+	void				ProbeFailed ( void );
+	
+	// Asymmetric access state of the target port group behind this path.
+	// Paths to targets without ALUA stay active/optimized.
+	UInt8	GetAccessState ( void ) const { return fAccessState; }
+	void	SetAccessState ( UInt8 state ) { fAccessState = state; fAccessStateNumber->setValue ( state ); }
 	
 	void	free ( void );
 	
@@ -82,8 +126,29 @@ protected:
 	OSNumber *						fBytesTransmitted;
 	OSNumber *						fBytesReceived;
 	OSNumber *						fCommandsProcessed;
+	OSNumber *						fCommandsFailed;
+	OSNumber *						fTotalCommandTime;
+	OSNumber *						fOutstandingCommands;
+	volatile SInt64					fBytesTransmittedCount;
+	volatile SInt64					fBytesReceivedCount;
+	volatile SInt64					fCommandsProcessedCount;
+	volatile SInt64					fCommandsFailedCount;
+	volatile SInt64					fTotalCommandTimeCount;
+	volatile SInt32					fOutstandingCount;
 	OSString *						fPathStatus;
 	char *							fStatus;
+	SCSITask *						fTaskList;
+	UInt32							fTaskCount;
+	OSNumber *						fProbeSuccessCount;
+	OSNumber *						fProbeFailureCount;
+	SCSITaskIdentifier				fProbeTask;
+	UInt32							fProbeInterval;
+	UInt32							fProbeCountdown;
+	UInt32							fProbeSuccesses;
+	UInt32							fFlapCount;
+	AbsoluteTime					fFlapDeadline;
+	OSNumber *						fAccessStateNumber;
+	UInt8							fAccessState;
 };
 
 class SCSITargetDevicePathManager : public OSObject
@@ -97,7 +162,14 @@ protected:
 						IOSCSITargetDevice * 		target,
 						IOSCSIProtocolServices * 	initialPath );
 	
+	// Tasks sent straight down a target's only active path carry this bit in
+	// their path layer reference. Paths are OSObjects, so it is otherwise clear.
+	enum { kPathLayerReferenceDirect = 0x1 };
+	
 	static void		PathTaskCallback ( SCSITaskIdentifier request );
+	static void		StartTaskOnPath ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	static void		RecordTaskStatistics ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	static void		ProbeTaskCallback ( SCSITaskIdentifier request );
 	static bool		IsTransmit ( SCSITaskIdentifier 	request,
 								 IOSCSITargetDevice * 	target,
 								 UInt64 *				bytes );
@@ -107,10 +179,23 @@ protected:
 	
 	static bool		SetPathLayerReference ( SCSITaskIdentifier request, void * newReference );
 	static void *	GetPathLayerReference ( SCSITaskIdentifier request );
+	static SCSITargetDevicePath *	GetTaskPath ( SCSITaskIdentifier request );
 	static UInt64	GetRequestedDataTransferCount ( SCSITaskIdentifier request );
+	static SCSIServiceResponse	GetServiceResponse ( SCSITaskIdentifier request );
+	static void		AbortTaskOnPath ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	void			PrepareTaskForReissue ( SCSITaskIdentifier request );
+	SCSITaskIdentifier	CreateProbeTask ( SCSITargetDevicePath * path, UInt32 timeoutDuration );
+	bool			IsPathManagerTask ( SCSITaskIdentifier request );
+	
+	static void		PathCommandCallback ( SCSITaskIdentifier request );
+	SCSIServiceResponse	SendCommandOnPath ( SCSITaskIdentifier		request,
+											SCSITargetDevicePath *	path,
+											UInt32					timeoutDuration );
+	bool			RetrievePathAccessState ( SCSITargetDevicePath * path, UInt8 * accessState );
 	
 	IOSCSITargetDevice *	fTarget;
 	OSArray *				fStatistics;
+	IOLock *				fCommandLock;
 	
 	void	free ( void );
 	
@@ -124,6 +209,10 @@ public:
 	virtual SCSIServiceResponse		LogicalUnitReset ( SCSILogicalUnitNumber theLogicalUnit ) = 0;
 	virtual SCSIServiceResponse		TargetReset ( void ) = 0;
 	virtual void					TaskCompletion ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual bool					ReissueTask ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual void					ProbeCompletion ( SCSITaskIdentifier request, SCSITargetDevicePath * path );
+	virtual void					AccessStateChanged ( void );
+	virtual void					PublishStatistics ( void );
 	
 	virtual bool	AddPath ( IOSCSIProtocolServices * path ) = 0;
 	virtual void	RemovePath ( IOSCSIProtocolServices * path ) = 0;
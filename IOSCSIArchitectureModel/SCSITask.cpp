@@ -29,6 +29,7 @@
 // SCSI Architecture Model Family includes
 #include "SCSITask.h"
 #include "SCSITaskDefinition.h"
+#include "SCSICommandOperationCodes.h"
 
 
 //
@@ -65,6 +66,43 @@
 #endif
 
 
+// The fields used by every command live in fHotData, the autosense fields
+// live out of line in fAutosense.
+#define fCommandDescriptorBlock					fHotData.commandDescriptorBlock
+#define fTimeoutDuration						fHotData.timeoutDuration
+#define fSubmissionQueue						fHotData.submissionQueue
+#define fTaskState								fHotData.taskState
+#define fTaskStatus								fHotData.taskStatus
+#define fServiceResponse						fHotData.serviceResponse
+#define fTaskAttribute							fHotData.taskAttribute
+#define fTaskExecutionMode						fHotData.taskExecutionMode
+#define fCommandSize							fHotData.commandSize
+#define fTransferDirection						fHotData.transferDirection
+#define fLogicalUnitNumber						fHotData.logicalUnitNumber
+#define fAutosenseDataRequested					fHotData.autosenseDataRequested
+#define fAutoSenseDataIsValid					fHotData.autosenseDataIsValid
+#define fAutosenseAllocationLength				fHotData.autosenseAllocationLength
+#define fAutosenseCommandIsOutOfLine			fHotData.autosenseCommandIsOutOfLine
+#define fDataBufferOffset						fHotData.dataBufferOffset
+#define fRequestedByteCountOfTransfer			fHotData.requestedByteCountOfTransfer
+#define fRealizedByteCountOfTransfer			fHotData.realizedByteCountOfTransfer
+#define fTaskTagIdentifier						fHotData.taggedTaskIdentifier
+#define fDataBuffer								fHotData.dataBuffer
+#define fCompletionCallback						fHotData.completionCallback
+#define fNextTaskInQueue						fHotData.nextTaskInQueue
+#define fProtocolLayerReference					fHotData.protocolLayerReference
+#define fApplicationLayerReference				fHotData.applicationLayerReference
+#define fTargetLayerReference					fHotData.targetLayerReference
+#define fPathLayerReference						fHotData.pathLayerReference
+
+#define fAutosenseCDB							fAutosense->commandDescriptorBlock
+#define fAutoSenseDataSize						fAutosense->dataSize
+#define fAutoSenseData							fAutosense->data
+#define fAutoSenseRealizedByteCountOfTransfer	fAutosense->realizedByteCountOfTransfer
+#define fAutosenseDescriptor					fAutosense->descriptor
+#define fAutosenseTaskMap						fAutosense->taskMap
+
+
 #define super IOCommand
 OSDefineMetaClassAndStructors ( SCSITask, IOCommand );
 
@@ -84,14 +122,32 @@ bool
 SCSITask::init ( void )
 {
 	
-	bool	result = false;
+	bool				result = false;
+	SCSI_Sense_Data *	buffer = NULL;
+	
+	// The object header, the hot fields and fOwner must add up to exactly
+	// kSCSITaskHotFootprintSize, see SCSITask.h.
+	typedef char		HotFootprintCheck[ ( ( offsetof ( SCSITask, fOwner ) + sizeof ( fOwner ) ) == kSCSITaskHotFootprintSize ) ? 1 : -1 ] __attribute__ ( ( unused ) );
 	
 	require ( super::init ( ), ErrorExit );
 	
  	// Clear the owner here since it should be set when the object
  	// is instantiated and never reset.
  	fOwner					= NULL;
-	fAutosenseDescriptor 	= NULL;
+	
+	fNextPathTask			= NULL;
+	fPreviousPathTask		= NULL;
+	
+	fAutosense = IONew ( SCSITaskAutosenseData, 1 );
+	require_nonzero ( fAutosense, ErrorExit );
+	bzero ( fAutosense, sizeof ( SCSITaskAutosenseData ) );
+	
+	buffer = ( SCSI_Sense_Data * ) IOMalloc ( sizeof ( SCSI_Sense_Data ) );
+	require_nonzero ( buffer, ErrorExit );
+	bzero ( buffer, sizeof ( SCSI_Sense_Data ) );
+	
+	result = SetAutoSenseDataBuffer ( buffer, sizeof ( SCSI_Sense_Data ), kernel_task );
+	require ( result, ErrorExit );
 	
  	// Set this task to the default task state.  
 	fTaskState = kSCSITaskState_NEW_TASK;
@@ -121,19 +177,27 @@ SCSITask::free ( void )
 		fOwner->release ( );
 	}
 	
-	if ( fAutosenseDescriptor != NULL )
+	if ( fAutosense != NULL )
 	{
 		
-		fAutosenseDescriptor->release ( );
-		fAutosenseDescriptor = NULL;
+		if ( fAutosenseDescriptor != NULL )
+		{
+			
+			fAutosenseDescriptor->release ( );
+			fAutosenseDescriptor = NULL;
+			
+		}
 		
-	}
-	
-	if ( ( fAutosenseTaskMap == kernel_task ) && ( fAutoSenseData != NULL ) )
-	{
+		if ( ( fAutosenseTaskMap == kernel_task ) && ( fAutoSenseData != NULL ) )
+		{
+			
+			IOFree ( fAutoSenseData, fAutoSenseDataSize );
+			fAutoSenseData = NULL;
+			
+		}
 		
-		IOFree ( fAutoSenseData, fAutoSenseDataSize );
-		fAutoSenseData = NULL;
+		IODelete ( fAutosense, SCSITaskAutosenseData, 1 );
+		fAutosense = NULL;
 		
 	}
 	
@@ -153,8 +217,7 @@ bool
 SCSITask::ResetForNewTask ( void )
 {
 	
-	bool				result = false;
-	SCSI_Sense_Data *	buffer = NULL;
+	bool	result = false;
 	
 	// If this is a pending task, do not allow it to be reset until
 	// it has completed.
@@ -184,27 +247,23 @@ SCSITask::ResetForNewTask ( void )
 	
 	fProtocolLayerReference			= NULL;
 	fApplicationLayerReference		= NULL;
+	fApplicationLayerSplitReference	= NULL;
 	
-	// Autosense member variables
-   	fAutosenseDataRequested			= false;
-	fAutosenseCDBSize				= 0;
-	fAutoSenseDataIsValid			= false;
-	
-	bzero ( &fAutosenseCDB, kSCSICDBSize_Maximum );
-	
-	if ( fAutoSenseData == NULL )
+	// The out of line autosense fields are only written when the SCSI
+	// Protocol Layer had to send a REQUEST SENSE for the last command, which
+	// keeps their cache line out of the common path.
+	if ( fTaskExecutionMode == kSCSITaskMode_Autosense )
 	{
-		
-		fAutoSenseDataSize = sizeof ( SCSI_Sense_Data );
-		buffer = ( SCSI_Sense_Data * ) IOMalloc ( fAutoSenseDataSize );
-		require_nonzero ( buffer, ErrorExit );
-		bzero ( buffer, fAutoSenseDataSize );
-		result = SetAutoSenseDataBuffer ( buffer, fAutoSenseDataSize, kernel_task );
-		require ( result, ErrorExit );
-		
+		fAutoSenseRealizedByteCountOfTransfer = 0;
 	}
 	
-	fAutoSenseRealizedByteCountOfTransfer = 0;
+	fTaskExecutionMode				= kSCSITaskMode_CommandExecution;
+	
+   	fAutosenseDataRequested			= false;
+	fAutoSenseDataIsValid			= false;
+	fAutosenseAllocationLength		= 0;
+	fAutosenseCommandIsOutOfLine	= false;
+	
 	result = true;
 	
 	
@@ -339,7 +398,7 @@ SCSITask::SetTaskAttribute ( SCSITaskAttribute newAttributeValue )
 SCSITaskAttribute	
 SCSITask::GetTaskAttribute ( void )
 {
-	return fTaskAttribute;
+	return ( SCSITaskAttribute ) fTaskAttribute;
 }
 
 
@@ -366,54 +425,6 @@ SCSITask::GetTaggedTaskIdentifier ( void )
 }
 
 
-//
-//	 SetTaskState - Sets the SCSITaskState to the new value. 		   [PUBLIC]
-//
-
-bool
-SCSITask::SetTaskState ( SCSITaskState newTaskState )
-{
-	fTaskState = newTaskState;
-	return true;
-}
-
-
-//
-//	 GetTaskState - Gets the SCSITaskState. 						   [PUBLIC]
-//
-
-SCSITaskState	
-SCSITask::GetTaskState ( void )
-{
-	return fTaskState;
-}
-
-
-//
-//	 SetTaskStatus - Sets the SCSITaskStatus to the new value. 	   [PUBLIC]
-//
-
-bool
-SCSITask::SetTaskStatus ( SCSITaskStatus newTaskStatus )
-{
-	
-	fTaskStatus = newTaskStatus;
-	return true;
-	
-}
-
-
-//
-//	 GetTaskStatus - Gets the SCSITaskStatus.					 	   [PUBLIC]
-//
-
-SCSITaskStatus	
-SCSITask::GetTaskStatus ( void )
-{
-	return fTaskStatus;
-}
-
-
 //
 //	 SetCommandDescriptorBlock - Populate the 6 Byte Command Descriptor Block
 //																 	   [PUBLIC]
@@ -587,136 +598,79 @@ SCSITask::SetCommandDescriptorBlock (
 
 
 //
-//	 GetCommandDescriptorBlockSize - Gets the Command Descriptor Block size.
-//																 	   [PUBLIC]
+//	 SetCommandDescriptorBlock - Populate the Command Descriptor Block from
+//								  a packed CDB.						   [PUBLIC]
 //
 
-UInt8
-SCSITask::GetCommandDescriptorBlockSize ( void )
-{
-	return fCommandSize;
-}
-
-
-//
-//	 GetCommandDescriptorBlock - Gets the Command Descriptor Block.   [PUBLIC]
-//
-
-bool
-SCSITask::GetCommandDescriptorBlock ( SCSICommandDescriptorBlock * cdbData )
+bool 
+SCSITask::SetCommandDescriptorBlock ( 
+							const SCSICommandDescriptorBlock *	cdbData,
+							UInt8								cdbSize )
 {
 	
-	bcopy ( fCommandDescriptorBlock,
-			cdbData,
-			sizeof ( SCSICommandDescriptorBlock ) );
+	bool	result = false;
 	
-	return true;
+	require_nonzero ( cdbData, ErrorExit );
+	require ( ( cdbSize == kSCSICDBSize_6Byte ) ||
+			  ( cdbSize == kSCSICDBSize_10Byte ) ||
+			  ( cdbSize == kSCSICDBSize_12Byte ) ||
+			  ( cdbSize == kSCSICDBSize_16Byte ), ErrorExit );
 	
-}
-
-
-//
-//	 SetDataTransferDirection - Sets the data transfer direction.	   [PUBLIC]
-//
-
-bool
-SCSITask::SetDataTransferDirection ( UInt8 newDataTransferDirection )
-{
+	bcopy ( cdbData, fCommandDescriptorBlock, cdbSize );
+	bzero ( &fCommandDescriptorBlock[cdbSize],
+			sizeof ( SCSICommandDescriptorBlock ) - cdbSize );
 	
-	fTransferDirection = newDataTransferDirection;
-	return true;
+	fCommandSize = cdbSize;
+	result = true;
 	
-}
-
-
-//
-//	 GetDataTransferDirection - Gets the data transfer direction.	   [PUBLIC]
-//
-
-UInt8
-SCSITask::GetDataTransferDirection ( void )
-{
-	return fTransferDirection;
-}
-
-
-//
-//	 SetRequestedDataTransferCount - 	Sets the requested data transfer count
-//										in bytes.					   [PUBLIC]
-//
-
-bool	
-SCSITask::SetRequestedDataTransferCount ( UInt64 requestedTransferCountInBytes )
-{
 	
-	fRequestedByteCountOfTransfer = requestedTransferCountInBytes;
-	return true;
+ErrorExit:
 	
-}
-
-
-//
-//	 GetRequestedDataTransferCount - 	Gets the requested data transfer count
-//										in bytes.					   [PUBLIC]
-//
-
-UInt64
-SCSITask::GetRequestedDataTransferCount ( void )
-{
-	return fRequestedByteCountOfTransfer;
-}
-
-
-//
-//	 SetRealizedDataTransferCount - Sets the realized data transfer count
-//									 in bytes.						   [PUBLIC]
-//
-
-bool
-SCSITask::SetRealizedDataTransferCount ( UInt64 realizedTransferCountInBytes )
-{
 	
-	fRealizedByteCountOfTransfer = realizedTransferCountInBytes;
-	return true;
+	return result;
 	
 }
 
 
 //
-//	 GetRealizedDataTransferCount - Gets the realized data transfer count
-//									 in bytes.						   [PUBLIC]
+//	 GetCommandDescriptorBlockSize - Gets the Command Descriptor Block size.
+//																 	   [PUBLIC]
 //
 
-UInt64
-SCSITask::GetRealizedDataTransferCount ( void )
+UInt8
+SCSITask::GetCommandDescriptorBlockSize ( void )
 {
-	return fRealizedByteCountOfTransfer;
+	return fCommandSize;
 }
 
 
 //
-//	 SetDataBuffer - Sets the data transfer buffer.				   [PUBLIC]
+//	 GetCommandDescriptorBlock - Gets the Command Descriptor Block.   [PUBLIC]
 //
 
 bool
-SCSITask::SetDataBuffer ( IOMemoryDescriptor * newDataBuffer )
+SCSITask::GetCommandDescriptorBlock ( SCSICommandDescriptorBlock * cdbData )
 {
 	
-	fDataBuffer = newDataBuffer;
+	bcopy ( fCommandDescriptorBlock,
+			cdbData,
+			sizeof ( SCSICommandDescriptorBlock ) );
+	
 	return true;
 	
 }
 
 
 //
-//	 GetDataBuffer - Gets the data transfer buffer.				   [PUBLIC]
+//	 SetDataTransferDirection - Sets the data transfer direction.	   [PUBLIC]
 //
 
-IOMemoryDescriptor *
-SCSITask::GetDataBuffer ( void )
+bool
+SCSITask::SetDataTransferDirection ( UInt8 newDataTransferDirection )
 {
 	
-	return fDataBuffer;
+	fTransferDirection = newDataTransferDirection;
+	return true;
 	
 }
 
@@ -735,17 +689,6 @@ SCSITask::SetDataBufferOffset ( UInt64 newDataBufferOffset )
 }
 
 
-//
-//	 GetDataBufferOffset - Gets the data transfer buffer offset.	   [PUBLIC]
-//
-
-UInt64
-SCSITask::GetDataBufferOffset ( void )
-{
-	return fDataBufferOffset;
-}
-
-
 //
 //	 SetTimeoutDuration - 	Sets the command timeout value in milliseconds.
 //							Timeout values of zero indicate the largest
@@ -783,7 +726,7 @@ bool
 SCSITask::SetTaskCompletionCallback ( SCSITaskCompletion newCallback )
 {
 	
-	fCompletionCallback = newCallback;
+	fCompletionCallback = ( void * ) newCallback;
 	return true;
 	
 }
@@ -797,32 +740,7 @@ SCSITask::SetTaskCompletionCallback ( SCSITaskCompletion newCallback )
 void
 SCSITask::TaskCompletedNotification ( void )
 {
-	fCompletionCallback ( this );
-}
-
-
-//
-//	 SetServiceResponse - Sets the SCSIServiceResponse.			   [PUBLIC]
-//
-
-bool
-SCSITask::SetServiceResponse ( SCSIServiceResponse serviceResponse )
-{
-	
-	fServiceResponse = serviceResponse;
-	return true;
-	
-}
-
-
-//
-//	 GetServiceResponse - Gets the SCSIServiceResponse.			   [PUBLIC]
-//
-
-SCSIServiceResponse
-SCSITask::GetServiceResponse ( void )
-{
-	return fServiceResponse;
+	( ( SCSITaskCompletion ) fCompletionCallback ) ( this );
 }
 
 
@@ -1049,6 +967,35 @@ SCSITask::GetApplicationLayerReference ( void )
 }
 
 
+//
+//	 SetApplicationLayerSplitReference - Sets the split request reference.
+//																	   [PUBLIC]
+//
+
+bool	
+SCSITask::SetApplicationLayerSplitReference ( void * newReferenceValue )
+{
+	
+	fApplicationLayerSplitReference = newReferenceValue;
+	return true;
+	
+}
+
+
+//
+//	 GetApplicationLayerSplitReference - Gets the split request reference.
+//																	   [PUBLIC]
+//
+
+void *
+SCSITask::GetApplicationLayerSplitReference ( void )
+{
+	
+	return fApplicationLayerSplitReference;
+	
+}
+
+
 //
 //	 SetTargetLayerReference - Sets the target layer reference value.
 //																	   [PUBLIC]
@@ -1139,7 +1086,7 @@ SCSITask::SetTaskExecutionMode ( SCSITaskMode newTaskMode )
 SCSITaskMode
 SCSITask::GetTaskExecutionMode ( void )
 {
-	return fTaskExecutionMode;
+	return ( SCSITaskMode ) fTaskExecutionMode;
 }
 
 
@@ -1178,7 +1125,7 @@ SCSITask::SetAutosenseIsValid ( bool newAutosenseState )
 UInt8
 SCSITask::GetAutosenseCommandDescriptorBlockSize ( void )
 {
-	return fAutosenseCDBSize;
+	return kSCSICDBSize_6Byte;
 }
 
 
@@ -1191,7 +1138,23 @@ bool
 SCSITask::GetAutosenseCommandDescriptorBlock ( SCSICommandDescriptorBlock * cdbData )
 {
 	
-	bcopy ( &fAutosenseCDB, cdbData, sizeof ( SCSICommandDescriptorBlock ) );
+	// Unless the command is out of line, only the allocation length is
+	// stored, see SetAutosenseCommand.
+	bzero ( cdbData, sizeof ( SCSICommandDescriptorBlock ) );
+	
+	if ( fAutosenseCommandIsOutOfLine == true )
+	{
+		bcopy ( fAutosenseCDB, cdbData, kSCSICDBSize_6Byte );
+	}
+	
+	else
+	{
+		
+		( *cdbData )[0] = kSCSICmd_REQUEST_SENSE;
+		( *cdbData )[4] = fAutosenseAllocationLength;
+		
+	}
+	
 	return true;
 	
 }
@@ -1278,24 +1241,36 @@ SCSITask::SetAutosenseCommand (
 	
 	bool	result = false;
 	
-	fAutosenseCDB[0] = cdbByte0;
-	fAutosenseCDB[1] = cdbByte1;
-	fAutosenseCDB[2] = cdbByte2;
-	fAutosenseCDB[3] = cdbByte3;
-	fAutosenseCDB[4] = cdbByte4;
-	fAutosenseCDB[5] = cdbByte5;
-	fAutosenseCDB[6] = 0x00;
-	fAutosenseCDB[7] = 0x00;
-	fAutosenseCDB[8] = 0x00;
-	fAutosenseCDB[9] = 0x00;
-	fAutosenseCDB[10] = 0x00;
-	fAutosenseCDB[11] = 0x00;
-	fAutosenseCDB[12] = 0x00;
-	fAutosenseCDB[13] = 0x00;
-	fAutosenseCDB[14] = 0x00;
-	fAutosenseCDB[15] = 0x00;
-	
-	fAutosenseCDBSize = kSCSICDBSize_6Byte;
+	// The autosense command is nearly always a plain REQUEST SENSE, so only
+	// its allocation length is kept. This is called for every command, and
+	// writing just the bytes in fHotData keeps it off the out of line
+	// autosense fields. Any other command, e.g. a REQUEST SENSE with the
+	// DESC bit set, is copied to the out of line fields instead.
+	// GetAutosenseCommandDescriptorBlock rebuilds the CDB.
+	if ( ( cdbByte0 == kSCSICmd_REQUEST_SENSE ) &&
+		 ( ( cdbByte1 | cdbByte2 | cdbByte3 | cdbByte5 ) == 0 ) )
+	{
+		
+		fAutosenseAllocationLength		= cdbByte4;
+		fAutosenseCommandIsOutOfLine	= false;
+		
+	}
+	
+	else
+	{
+		
+		fAutosenseCDB[0] = cdbByte0;
+		fAutosenseCDB[1] = cdbByte1;
+		fAutosenseCDB[2] = cdbByte2;
+		fAutosenseCDB[3] = cdbByte3;
+		fAutosenseCDB[4] = cdbByte4;
+		fAutosenseCDB[5] = cdbByte5;
+		
+		fAutosenseAllocationLength		= cdbByte4;
+		fAutosenseCommandIsOutOfLine	= true;
+		
+	}
+	
 	fAutosenseDataRequested = true;
 	result = true;
 	
@@ -1337,7 +1312,7 @@ SCSITask *
 SCSITask::GetFollowingSCSITask ( void )
 {
 	
-	return fNextTaskInQueue;
+	return ( SCSITask * ) fNextTaskInQueue;
 	
 }
 
@@ -1354,7 +1329,7 @@ SCSITask::DequeueFollowingSCSITask ( void )
 	
 	SCSITask *	returnTask;
 	
-	returnTask 			= fNextTaskInQueue;
+	returnTask 			= ( SCSITask * ) fNextTaskInQueue;
 	fNextTaskInQueue 	= NULL;
 	
 	return returnTask;
@@ -1376,9 +1351,129 @@ SCSITask::ReplaceFollowingSCSITask ( SCSITask * newFollowingTask )
 	
 	SCSITask *	returnTask = NULL;
 	
-	returnTask 			= fNextTaskInQueue;
+	returnTask 			= ( SCSITask * ) fNextTaskInQueue;
 	fNextTaskInQueue 	= newFollowingTask;
 	
 	return returnTask;
 	
+}
+
+
+//
+//	 SetQueueEntryTime - Records the time at which the task was placed in
+//						  the SCSI Protocol Layer's queue.			   [PUBLIC]
+//
+
+void
+SCSITask::SetQueueEntryTime ( AbsoluteTime entryTime )
+{
+	fQueueEntryTime = entryTime;
+}
+
+
+//
+//	 GetQueueEntryTime - Returns the time at which the task was placed in
+//						  the SCSI Protocol Layer's queue.			   [PUBLIC]
+//
+
+AbsoluteTime
+SCSITask::GetQueueEntryTime ( void )
+{
+	return fQueueEntryTime;
+}
+
+
+//
+//	 SetPathEntryTime - Records the time at which the path manager sent the
+//						 task down a path.							   [PUBLIC]
+//
+
+void
+SCSITask::SetPathEntryTime ( AbsoluteTime entryTime )
+{
+	fPathEntryTime = entryTime;
+}
+
+
+//
+//	 GetPathEntryTime - Returns the time at which the path manager sent the
+//						 task down a path.							   [PUBLIC]
+//
+
+AbsoluteTime
+SCSITask::GetPathEntryTime ( void )
+{
+	return fPathEntryTime;
+}
+
+
+//
+//	 SetNextPathTask - Sets the next task outstanding on the same path.
+//																	   [PUBLIC]
+//
+
+void
+SCSITask::SetNextPathTask ( SCSITask * task )
+{
+	fNextPathTask = task;
+}
+
+
+//
+//	 GetNextPathTask - Returns the next task outstanding on the same path.
+//																	   [PUBLIC]
+//
+
+SCSITask *
+SCSITask::GetNextPathTask ( void )
+{
+	return fNextPathTask;
+}
+
+
+//
+//	 SetPreviousPathTask - Sets the previous task outstanding on the same
+//							path.									   [PUBLIC]
+//
+
+void
+SCSITask::SetPreviousPathTask ( SCSITask * task )
+{
+	fPreviousPathTask = task;
+}
+
+
+//
+//	 GetPreviousPathTask - Returns the previous task outstanding on the
+//							same path.								   [PUBLIC]
+//
+
+SCSITask *
+SCSITask::GetPreviousPathTask ( void )
+{
+	return fPreviousPathTask;
+}
+
+
+//
+//	 SetSubmissionQueue - Records the hardware submission queue the task is
+//						   sent on.									   [PUBLIC]
+//
+
+void
+SCSITask::SetSubmissionQueue ( UInt32 queue )
+{
+	fSubmissionQueue = queue;
+}
+
+
+//
+//	 GetSubmissionQueue - Returns the hardware submission queue the task is
+//						   sent on.									   [PUBLIC]
+//
+
+UInt32
+SCSITask::GetSubmissionQueue ( void )
+{
+	return fSubmissionQueue;
 }
\ No newline at end of file
@@ -232,6 +232,75 @@ enum
 	kSCSIDataTransfer_FromTargetToInitiator	= 0x02
 };
 
+// The fields of a SCSITask which are used by every command on its way to
+// the device and back. SCSITask keeps them together straight after the
+// object header, followed by the task owner, so that submitting and
+// completing a task touches as few cache lines as possible. The structure
+// is only used by SCSITask, it is declared here so that SAMStructSizes can
+// print its size. Pointers are stored as void * for the same reason,
+// SCSITask casts them back.
+typedef struct SCSITaskHotData
+{
+	SCSICommandDescriptorBlock	commandDescriptorBlock;
+	
+	// Milliseconds to wait for the task to complete, zero for the longest
+	// time the SCSI Protocol Layer allows.
+	UInt32						timeoutDuration;
+	
+	// The hardware submission queue the task is sent on. Only used by the
+	// SCSI Protocol Layer.
+	UInt32						submissionQueue;
+	
+	// SCSITaskState, SCSITaskStatus, SCSIServiceResponse, SCSITaskAttribute
+	// and SCSITaskMode values, all of which fit in a byte.
+	UInt8						taskState;
+	UInt8						taskStatus;
+	UInt8						serviceResponse;
+	UInt8						taskAttribute;
+	UInt8						taskExecutionMode;
+	
+	UInt8						commandSize;
+	UInt8						transferDirection;
+	
+	// Only single level LUN values are supported.
+	UInt8						logicalUnitNumber;
+	
+	// The REQUEST SENSE command used for autosense is built from its
+	// allocation length when the SCSI Protocol Layer asks for it, unless
+	// autosenseCommandIsOutOfLine is set, in which case the whole command
+	// is kept with the other autosense fields.
+	UInt8						autosenseDataRequested;
+	UInt8						autosenseDataIsValid;
+	UInt8						autosenseAllocationLength;
+	UInt8						autosenseCommandIsOutOfLine;
+	
+	UInt64						dataBufferOffset;
+	UInt64						requestedByteCountOfTransfer;
+	UInt64						realizedByteCountOfTransfer;
+	UInt64						taggedTaskIdentifier;
+	
+	// IOMemoryDescriptor *, SCSITaskCompletion and SCSITask *.
+	void *						dataBuffer;
+	void *						completionCallback;
+	void *						nextTaskInQueue;
+	
+	// Reference members for each layer.
+	void *						protocolLayerReference;
+	void *						applicationLayerReference;
+	void *						targetLayerReference;
+	void *						pathLayerReference;
+} SCSITaskHotData;
+
+// The bytes from the start of a SCSITask to the end of fOwner: the object
+// header, SCSITaskHotData and the owner. SCSITask.cpp does not compile if
+// this changes, so that growing the fields used by every command is never
+// an accident. It is three 64 byte cache lines on LP64.
+#if defined(__LP64__)
+#define kSCSITaskHotFootprintSize	168
+#else
+#define kSCSITaskHotFootprintSize	116
+#endif
+
 
 #if defined(KERNEL) && defined(__cplusplus)
 
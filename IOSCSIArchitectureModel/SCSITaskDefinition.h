@@ -37,6 +37,9 @@
 #include <IOKit/IOReturn.h>
 #include <IOKit/IOMemoryDescriptor.h>
 
+// Kernel includes
+#include <kern/assert.h>
+
 // SCSI Architecture Model Family includes
 #include <IOKit/scsi/SCSICmds_REQUEST_SENSE_Defs.h>
 
@@ -52,69 +55,46 @@ class SCSITask : public IOCommand
 	
 private:
 	
-	// Object that owns the instantiation of the SCSI Task object.
-	OSObject *					fOwner;
+	// The fields used by every command. These and fOwner come first so that
+	// they share the cache lines of the object header, see SCSITaskHotData.
+	SCSITaskHotData				fHotData;
 	
-    // The member variables that represent each part of the Task
-    // Task Management members
-    SCSITaskAttribute			fTaskAttribute;
-	SCSITaggedTaskIdentifier	fTaskTagIdentifier;
-    SCSITaskState				fTaskState;
-	SCSITaskStatus				fTaskStatus;
-	
-    // The intended Logical Unit Number for this Task.  Currently only single
-    // level LUN values are supported.
-    UInt8						fLogicalUnitNumber;
-	
-    SCSICommandDescriptorBlock	fCommandDescriptorBlock;
-    UInt8						fCommandSize;
-    UInt8						fTransferDirection;
-    IOMemoryDescriptor *		fDataBuffer;
-    UInt64						fDataBufferOffset;
-    UInt64						fRequestedByteCountOfTransfer;
-    UInt64						fRealizedByteCountOfTransfer;
-	
-	// Specifies the amount of time in milliseconds to wait for a task to
-	// complete.  A zero value indicates that the task should be given the
-	// longest duration possible by the Protocol Services Driver to complete.
-    UInt32						fTimeoutDuration;
-	
-	SCSIServiceResponse			fServiceResponse;    
-    
-    SCSITaskCompletion			fCompletionCallback;
-	
-    // Autosense related members
-    // This member indicates whether the client wants the SCSI Protocol
-    // Layer to request autosense data if the command completes with a
-    // CHECK_CONDITION status.
-    bool						fAutosenseDataRequested;
-	
-    SCSICommandDescriptorBlock	fAutosenseCDB;
-    UInt8						fAutosenseCDBSize;
-	
-    bool						fAutoSenseDataIsValid;
-    SCSI_Sense_Data *			fAutoSenseData;
-    UInt8						fAutoSenseDataSize;
-    UInt64						fAutoSenseRealizedByteCountOfTransfer;
-	
-	IOMemoryDescriptor *		fAutosenseDescriptor;
-	task_t						fAutosenseTaskMap;
-	
-    // Reference members for each layer.  Since these may contain a memory address, they
-    // are declared as void * so that they will scale to a 64-bit system.
-    void *						fProtocolLayerReference;
-    void *						fApplicationLayerReference;
-    void *						fTargetLayerReference;
-    void *						fPathLayerReference;
-    
-    // Pointer to the next SCSI Task in the queue.  This can only be used by the SCSI
-    // Protocol Layer
-    SCSITask *					fNextTaskInQueue;
+	// Object that owns the instantiation of the SCSI Task object. It is
+	// read on every completion.
+	OSObject *					fOwner;
 	
-	// The Task Execution mode is only used by the SCSI Protocol Layer for 
-	// indicating whether the command currently being executed is the client's
-	// command or the AutoSense RequestSense command.
-	SCSITaskMode				fTaskExecutionMode;
+	// Reference used by the SCSI Application Layer to tie a task back to
+	// the client request it was split from when a read or write had to be
+	// issued as more than one task. NULL for tasks that were not split.
+	void *						fApplicationLayerSplitReference;
+	
+	// The time at which the task was placed in the queue.  This can only be
+	// used by the SCSI Protocol Layer for measuring how long tasks wait
+	// before being sent to the device.
+	AbsoluteTime				fQueueEntryTime;
+	
+	// The time at which the path manager sent the task down a path. This
+	// can only be used by the path manager for its per path statistics.
+	AbsoluteTime				fPathEntryTime;
+	
+	// Links for the list of tasks outstanding on a path. These can only be
+	// used by the path manager.
+	SCSITask *					fNextPathTask;
+	SCSITask *					fPreviousPathTask;
+	
+	// Autosense related members, only used when a command completes with a
+	// CHECK_CONDITION status. They are kept out of line so that they do not
+	// take up room in the cache lines used by every command.
+	struct SCSITaskAutosenseData
+	{
+		UInt8						commandDescriptorBlock[kSCSICDBSize_6Byte];
+		UInt8						dataSize;
+		SCSI_Sense_Data *			data;
+		UInt64						realizedByteCountOfTransfer;
+		IOMemoryDescriptor *		descriptor;
+		task_t						taskMap;
+	};
+	SCSITaskAutosenseData *		fAutosense;
 	
 public:
     
@@ -224,6 +204,12 @@ public:
 							UInt8			cdbByte13,
 							UInt8			cdbByte14,
 							UInt8			cdbByte15 );
+
+	// Populate the Command Descriptor Block from an already packed CDB.
+	// Only the first cdbSize bytes are used, the rest are cleared.
+	bool	SetCommandDescriptorBlock ( 
+							const SCSICommandDescriptorBlock *	cdbData,
+							UInt8								cdbSize );
 	
 	UInt8	GetCommandDescriptorBlockSize ( void );
 	
@@ -300,6 +286,11 @@ public:
 	bool	SetApplicationLayerReference ( void * newReferenceValue );
 	void *	GetApplicationLayerReference ( void );
 	
+	// These are used by the SCSI Application Layer object for storing and
+	// retrieving the split request a task belongs to, if any.
+	bool	SetApplicationLayerSplitReference ( void * newReferenceValue );
+	void *	GetApplicationLayerSplitReference ( void );
+	
 	// These are used by the SCSI Target Layer object for storing and
 	// retrieving a reference number that is specific to that client.
 	bool	SetTargetLayerReference ( void * newReferenceValue );
@@ -373,7 +364,146 @@ public:
 	// task.
 	SCSITask * ReplaceFollowingSCSITask ( SCSITask * newFollowingTask );
 	
+	// These methods are only for the SCSI Protocol Layer to record and
+	// retrieve the time at which the task was placed in its queue.
+	void	SetQueueEntryTime ( AbsoluteTime entryTime );
+	AbsoluteTime GetQueueEntryTime ( void );
+	
+	// These methods are only for the path manager to record and retrieve
+	// the time at which the task was sent down a path.
+	void	SetPathEntryTime ( AbsoluteTime entryTime );
+	AbsoluteTime GetPathEntryTime ( void );
+	
+	// These methods are only for the path manager to link the task into
+	// the list of tasks outstanding on a path.
+	void		SetNextPathTask ( SCSITask * task );
+	SCSITask *	GetNextPathTask ( void );
+	void		SetPreviousPathTask ( SCSITask * task );
+	SCSITask *	GetPreviousPathTask ( void );
+	
+	// These methods are only for the SCSI Protocol Layer to record and
+	// retrieve the hardware submission queue the task is sent on.
+	void	SetSubmissionQueue ( UInt32 queue );
+	UInt32	GetSubmissionQueue ( void );
+	
 };
 
 
+//
+//	Inline Methods
+//
+
+// The accessors for the fields used by every command are inline so that
+// the submission and completion paths read the fields directly.
+
+inline bool
+SCSITask::SetTaskState ( SCSITaskState newTaskState )
+{
+	fHotData.taskState = newTaskState;
+	return true;
+}
+
+inline SCSITaskState
+SCSITask::GetTaskState ( void )
+{
+	return ( SCSITaskState ) fHotData.taskState;
+}
+
+inline bool
+SCSITask::SetTaskStatus ( SCSITaskStatus newTaskStatus )
+{
+	fHotData.taskStatus = newTaskStatus;
+	return true;
+}
+
+inline SCSITaskStatus
+SCSITask::GetTaskStatus ( void )
+{
+	return ( SCSITaskStatus ) fHotData.taskStatus;
+}
+
+inline UInt8
+SCSITask::GetDataTransferDirection ( void )
+{
+	return fHotData.transferDirection;
+}
+
+inline bool
+SCSITask::SetRequestedDataTransferCount ( UInt64 requestedTransferCountInBytes )
+{
+	fHotData.requestedByteCountOfTransfer = requestedTransferCountInBytes;
+	return true;
+}
+
+inline UInt64
+SCSITask::GetRequestedDataTransferCount ( void )
+{
+	return fHotData.requestedByteCountOfTransfer;
+}
+
+inline bool
+SCSITask::SetRealizedDataTransferCount ( UInt64 realizedTransferCountInBytes )
+{
+	fHotData.realizedByteCountOfTransfer = realizedTransferCountInBytes;
+	return true;
+}
+
+inline UInt64
+SCSITask::GetRealizedDataTransferCount ( void )
+{
+	return fHotData.realizedByteCountOfTransfer;
+}
+
+inline bool
+SCSITask::SetDataBuffer ( IOMemoryDescriptor * newDataBuffer )
+{
+	fHotData.dataBuffer = newDataBuffer;
+	return true;
+}
+
+inline IOMemoryDescriptor *
+SCSITask::GetDataBuffer ( void )
+{
+	return ( IOMemoryDescriptor * ) fHotData.dataBuffer;
+}
+
+inline UInt64
+SCSITask::GetDataBufferOffset ( void )
+{
+	return fHotData.dataBufferOffset;
+}
+
+inline bool
+SCSITask::SetServiceResponse ( SCSIServiceResponse serviceResponse )
+{
+	fHotData.serviceResponse = serviceResponse;
+	return true;
+}
+
+inline SCSIServiceResponse
+SCSITask::GetServiceResponse ( void )
+{
+	return ( SCSIServiceResponse ) fHotData.serviceResponse;
+}
+
+
+//
+//	Inline Functions
+//
+
+// Returns the SCSITask behind a SCSITaskIdentifier. Every identifier is a
+// SCSITask created by the family, and it is checked with OSDynamicCast
+// where it enters the protocol layer and where it comes back to its owner's
+// completion callback. Accessors past those points use this instead, which
+// only checks the type in builds with assertions enabled.
+inline SCSITask *
+SCSITaskFromIdentifier ( SCSITaskIdentifier request )
+{
+	
+	assert ( ( request == NULL ) || ( OSDynamicCast ( SCSITask, request ) != NULL ) );
+	return ( SCSITask * ) request;
+	
+}
+
+
 #endif /* _IOKIT_SCSI_TASK_DEFINITION_H_ */
\ No newline at end of file
@@ -99,6 +99,7 @@ struct BlockServicesClientData
 	UInt64 						clientStartingBlock;
 	UInt64 						clientRequestedBlockCount;
 	UInt32 						clientRequestedBlockSize;
+	bool						clientForceUnitAccess;
 	
 	// The internally needed parameters.
 	UInt32						retriesLeft;
@@ -196,6 +197,26 @@ IOBlockStorageServices::doAsyncReadWrite (
 				UInt64					nblks,
 				IOStorageCompletion		completion )
 {
+
+	return doAsyncReadWriteWithFUA ( buffer, block, nblks, false, completion );
+
+}
+
+
+//
+//	 doAsyncReadWriteWithFUA - Performs an asynchronous read or write,
+//								optionally writing through the cache
+//																	   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doAsyncReadWriteWithFUA (
+				IOMemoryDescriptor *	buffer,
+				UInt64					block,
+				UInt64					nblks,
+				bool					forceUnitAccess,
+				IOStorageCompletion		completion )
+{
 	
 	BlockServicesClientData	*	clientData			= NULL;
 	IOReturn					status 				= kIOReturnNotAttached;
@@ -234,13 +255,14 @@ IOBlockStorageServices::doAsyncReadWrite (
 	clientData->clientStartingBlock 		= block;
 	clientData->clientRequestedBlockCount 	= nblks;
 	clientData->clientRequestedBlockSize 	= requestBlockSize;
+	clientData->clientForceUnitAccess		= forceUnitAccess;
 	
 	// Set the retry limit to the maximum
 	clientData->retriesLeft = kNumberRetries;
 	
 	fProvider->CheckPowerState ( );
 	
-	status = fProvider->AsyncReadWrite ( buffer, block, nblks, (UInt64) requestBlockSize, (void *) clientData );
+	status = fProvider->AsyncReadWriteWithFUA ( buffer, block, nblks, (UInt64) requestBlockSize, forceUnitAccess, (void *) clientData );
 	require_success ( status, ReleaseClientDataAndRetain );
 	
 	
@@ -451,6 +473,173 @@ ErrorExit:
 }
 
 
+//
+//	 doSynchronizeCacheRange - Synchronizes a range of the write cache
+//																	   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doSynchronizeCacheRange ( UInt64 block, UInt64 nblks )
+{
+	
+	IOReturn	status = kIOReturnNotAttached;
+	
+	// Return an error for incoming activity if we have been terminated
+	require ( isInactive ( ) == false, ErrorExit );
+	
+	// Make sure we don't away while the command in being executed.
+	retain ( );
+	fProvider->retain ( );
+	
+	// Make sure our provider is in the correct power state to handle the I/O.	
+	fProvider->CheckPowerState ( );
+	
+	// Execute the command
+	status = fProvider->SynchronizeCacheRange ( block, nblks );
+	
+	// Release the retain for this command.	
+	fProvider->release ( );
+	release ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 doWriteSame - Fills a range of blocks with one block of data	   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doWriteSame ( UInt64 block, UInt64 nblks, IOMemoryDescriptor * pattern )
+{
+	
+	IOReturn	status = kIOReturnNotAttached;
+	
+	// Return an error for incoming activity if we have been terminated
+	require ( isInactive ( ) == false, ErrorExit );
+	
+	// Make sure we don't away while the command in being executed.
+	retain ( );
+	fProvider->retain ( );
+	
+	// Make sure our provider is in the correct power state to handle the I/O.	
+	fProvider->CheckPowerState ( );
+	
+	// Execute the command
+	status = fProvider->WriteSameBlocks ( block, nblks, pattern );
+	
+	// Release the retain for this command.	
+	fProvider->release ( );
+	release ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 doCompareAndWrite - Atomically compares and writes a range of blocks
+//																	   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doCompareAndWrite ( UInt64					block,
+											UInt64					nblks,
+											IOMemoryDescriptor *	buffer,
+											UInt64 *				miscompareOffset )
+{
+	
+	IOReturn	status = kIOReturnNotAttached;
+	
+	// Return an error for incoming activity if we have been terminated
+	require ( isInactive ( ) == false, ErrorExit );
+	
+	// Make sure we don't away while the command in being executed.
+	retain ( );
+	fProvider->retain ( );
+	
+	// Make sure our provider is in the correct power state to handle the I/O.	
+	fProvider->CheckPowerState ( );
+	
+	// Execute the command
+	status = fProvider->CompareAndWriteBlocks ( block, nblks, buffer, miscompareOffset );
+	
+	// Release the retain for this command.	
+	fProvider->release ( );
+	release ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 doDiscard - Discards a range of blocks on the medium			   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doDiscard ( UInt64 block, UInt64 nblks )
+{
+	
+	SBCBlockExtent	extent;
+	
+	extent.blockStart	= block;
+	extent.blockCount	= nblks;
+	
+	return doUnmap ( &extent, 1 );
+	
+}
+
+
+//
+//	 doUnmap - Discards several ranges of blocks on the medium		   [PUBLIC]
+//
+
+IOReturn
+IOBlockStorageServices::doUnmap ( SBCBlockExtent * extents, UInt32 extentsCount )
+{
+	
+	IOReturn	status = kIOReturnNotAttached;
+	
+	// Return an error for incoming activity if we have been terminated
+	require ( isInactive ( ) == false, ErrorExit );
+	
+	// Make sure we don't away while the command in being executed.
+	retain ( );
+	fProvider->retain ( );
+	
+	// Make sure our provider is in the correct power state to handle the I/O.	
+	fProvider->CheckPowerState ( );
+	
+	// Execute the command
+	status = fProvider->UnmapBlocks ( extents, extentsCount );
+	
+	// Release the retain for this command.	
+	fProvider->release ( );
+	release ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 getVendorString - Gets the vendor string for the device		   [PUBLIC]
 //
@@ -822,11 +1011,12 @@ IOBlockStorageServices::AsyncReadWriteComplete (
 		// An error occurred, but it is one on which the command should be retried.
 		// Decrement the retry counter and try again.
 		servicesData->retriesLeft--;
-		requestStatus = owner->fProvider->AsyncReadWrite ( 
+		requestStatus = owner->fProvider->AsyncReadWriteWithFUA ( 
 										servicesData->clientBuffer, 
 										servicesData->clientStartingBlock, 
 										servicesData->clientRequestedBlockCount, 
 										servicesData->clientRequestedBlockSize, 
+										servicesData->clientForceUnitAccess,
 										clientData );
 		
 		if ( requestStatus == kIOReturnSuccess )
@@ -859,12 +1049,13 @@ IOBlockStorageServices::AsyncReadWriteComplete (
 #endif
 
 
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 1 );	/* doDiscard */
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 2 );	/* doUnmap */
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 3 );	/* doAsyncReadWriteWithFUA */
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 4 );	/* doSynchronizeCacheRange */
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 5 );	/* doWriteSame */
+OSMetaClassDefineReservedUsed ( IOBlockStorageServices, 6 );	/* doCompareAndWrite */
+
 // Space reserved for future expansion.
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 1 );
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 2 );
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 3 );
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 4 );
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 5 );
-OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 6 );
 OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 7 );
 OSMetaClassDefineReservedUnused ( IOBlockStorageServices, 8 );
\ No newline at end of file
@@ -132,13 +132,56 @@ public:
 	
 	virtual IOReturn	setWriteCacheState ( bool enabled );
 	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 1 );
+	
+	// Discards a single range of blocks on a thin provisioned medium.
+	virtual IOReturn	doDiscard ( UInt64 block, UInt64 nblks );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 2 );
+	
+	// Discards several ranges of blocks at once. The provider batches them
+	// into as few commands as the device allows.
+	virtual IOReturn	doUnmap ( SBCBlockExtent * extents, UInt32 extentsCount );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 3 );
+	
+	// Same as doAsyncReadWrite ( ), but a write with forceUnitAccess set is
+	// written through the device's cache before it completes. It has its
+	// own name so that overriding doAsyncReadWrite ( ) does not hide it.
+	virtual IOReturn	doAsyncReadWriteWithFUA (	IOMemoryDescriptor *	buffer,
+											UInt64 					block,
+											UInt64 					nblks,
+											bool					forceUnitAccess,
+											IOStorageCompletion 	completion );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 4 );
+	
+	// Synchronizes only the given range of the write cache.
+	virtual IOReturn	doSynchronizeCacheRange ( UInt64 block, UInt64 nblks );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 5 );
+	
+	// Writes one block of data to every block in a range. pattern is NULL
+	// to zero the range.
+	virtual IOReturn	doWriteSame ( UInt64 block, UInt64 nblks, IOMemoryDescriptor * pattern );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOBlockStorageServices, 6 );
+	
+	// Writes the second half of buffer to a range of blocks only if the
+	// range holds the data in the first half. Returns
+	// kIOReturnSCSIMiscompare if it does not.
+	virtual IOReturn	doCompareAndWrite ( UInt64					block,
+											UInt64					nblks,
+											IOMemoryDescriptor *	buffer,
+											UInt64 *				miscompareOffset );
+	
 	// Space reserved for future expansion.
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 1 );
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 2 );
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 3 );
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 4 );
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 5 );
-    OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 6 );
     OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 7 );
     OSMetaClassDeclareReservedUnused ( IOBlockStorageServices, 8 );
 	
@@ -47,6 +47,74 @@
 #include "IOSCSIArchitectureModelFamilyDebugging.h"
 
 
+//
+//	Command Descriptor Block Layouts
+//
+
+// SBC-2 READ (10) and WRITE (10), sections 5.10 and 5.26.
+struct SBCReadWrite10CDB
+{
+	typedef SCSICDBField < 0, 0, 8 >	OPERATION_CODE;
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 32 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 6, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 7, 0, 16 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 9, 0, 8 >	CONTROL;
+	enum { kSize = kSCSICDBSize_10Byte };
+};
+
+// SBC-2 READ (12) and WRITE (12), sections 5.11 and 5.27.
+struct SBCReadWrite12CDB
+{
+	typedef SCSICDBField < 0, 0, 8 >	OPERATION_CODE;
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 32 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 6, 0, 32 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 10, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 11, 0, 8 >	CONTROL;
+	enum { kSize = kSCSICDBSize_12Byte };
+};
+
+// SBC-2 READ (16) and WRITE (16), sections 5.12 and 5.28.
+struct SBCReadWrite16CDB
+{
+	typedef SCSICDBField < 0, 0, 8 >	OPERATION_CODE;
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 64 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 10, 0, 32 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 14, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 15, 0, 8 >	CONTROL;
+	enum { kSize = kSCSICDBSize_16Byte };
+};
+
+
+//
+//	Prototypes
+//
+
+template < typename LAYOUT >
+static inline bool
+BuildReadWriteCDB ( SCSICommandDescriptorBlock *	cdb,
+					SCSICmdField1Byte				OPERATION_CODE,
+					SCSICmdField3Bit				PROTECT,
+					SCSICmdField1Bit				DPO,
+					SCSICmdField1Bit				FUA,
+					SCSICmdField1Bit				FUA_NV,
+					SCSICmdField8Byte				LOGICAL_BLOCK_ADDRESS,
+					SCSICmdField4Byte				TRANSFER_LENGTH,
+					SCSICmdField5Bit				GROUP_NUMBER,
+					SCSICmdField1Byte				CONTROL );
+
+
 #if 0
 #pragma mark -
 #pragma mark  Block Commands Builders
@@ -54,6 +122,136 @@
 #endif
 
 
+//
+//	 CLOSE_ZONE - Builds a CLOSE_ZONE command.					[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::CLOSE_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status = false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ZONE_ID, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( ALL, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// This is a 16-Byte ZBC OUT command, close the zone.
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_ZBC_OUT,
+								kSCSIServiceAction_CLOSE_ZONE,
+								( ZONE_ID >> 56 ) & 0xFF,
+								( ZONE_ID >> 48 ) & 0xFF,
+								( ZONE_ID >> 40 ) & 0xFF,
+								( ZONE_ID >> 32 ) & 0xFF,
+								( ZONE_ID >> 24 ) & 0xFF,
+								( ZONE_ID >> 16 ) & 0xFF,
+								( ZONE_ID >> 8 ) & 0xFF,
+								ZONE_ID & 0xFF,
+								0x00,
+								0x00,
+								0x00,
+								0x00,
+								ALL,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_NoDataTransfer );
+	SetTimeoutDuration ( request, 0 );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 COMPARE_AND_WRITE - Builds a COMPARE_AND_WRITE command.		[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::COMPARE_AND_WRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit			DPO,
+						SCSICmdField1Bit			FUA,
+						SCSICmdField8Byte			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField1Byte			NUMBER_OF_LOGICAL_BLOCKS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status 				= false;
+	UInt64		requestedByteCount	= 0;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
+	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( NUMBER_OF_LOGICAL_BLOCKS, kSCSICmdFieldMask1Byte ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// The data-out buffer holds the compare data and then the write data.
+	requestedByteCount = ( UInt64 ) NUMBER_OF_LOGICAL_BLOCKS * blockSize * 2;
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	// This is a 16-Byte command, fill out the cdb appropriately
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_COMPARE_AND_WRITE,
+								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ),
+								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
+								LOGICAL_BLOCK_ADDRESS & 0xFF,
+								0x00,
+								0x00,
+								0x00,
+								NUMBER_OF_LOGICAL_BLOCKS,
+								GROUP_NUMBER,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 ERASE_10 - 	Builds a ERASE_10 command.						[PROTECTED]
 //
@@ -130,6 +328,61 @@ ErrorExit:
 }
 
 
+//
+//	 FINISH_ZONE - Builds a FINISH_ZONE command.					[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::FINISH_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status = false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ZONE_ID, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( ALL, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// This is a 16-Byte ZBC OUT command, finish the zone.
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_ZBC_OUT,
+								kSCSIServiceAction_FINISH_ZONE,
+								( ZONE_ID >> 56 ) & 0xFF,
+								( ZONE_ID >> 48 ) & 0xFF,
+								( ZONE_ID >> 40 ) & 0xFF,
+								( ZONE_ID >> 32 ) & 0xFF,
+								( ZONE_ID >> 24 ) & 0xFF,
+								( ZONE_ID >> 16 ) & 0xFF,
+								( ZONE_ID >> 8 ) & 0xFF,
+								ZONE_ID & 0xFF,
+								0x00,
+								0x00,
+								0x00,
+								0x00,
+								ALL,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_NoDataTransfer );
+	SetTimeoutDuration ( request, 0 );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 FORMAT_UNIT - Builds a FORMAT_UNIT command.					[PROTECTED]
 //
@@ -451,6 +704,61 @@ ErrorExit:
 }
 
 
+//
+//	 OPEN_ZONE - Builds a OPEN_ZONE command.						[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::OPEN_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status = false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ZONE_ID, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( ALL, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// This is a 16-Byte ZBC OUT command, open the zone.
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_ZBC_OUT,
+								kSCSIServiceAction_OPEN_ZONE,
+								( ZONE_ID >> 56 ) & 0xFF,
+								( ZONE_ID >> 48 ) & 0xFF,
+								( ZONE_ID >> 40 ) & 0xFF,
+								( ZONE_ID >> 32 ) & 0xFF,
+								( ZONE_ID >> 24 ) & 0xFF,
+								( ZONE_ID >> 16 ) & 0xFF,
+								( ZONE_ID >> 8 ) & 0xFF,
+								ZONE_ID & 0xFF,
+								0x00,
+								0x00,
+								0x00,
+								0x00,
+								ALL,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_NoDataTransfer );
+	SetTimeoutDuration ( request, 0 );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 PREFETCH - Builds a PREFETCH command.							[PROTECTED]
 //
@@ -727,6 +1035,7 @@ IOSCSIBlockCommandsDevice::READ_10 (
 {
 
 	bool		status 				= false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64		requestedByteCount	= 0;
 	
 	require_nonzero ( request, ErrorExit );
@@ -737,29 +1046,21 @@ IOSCSIBlockCommandsDevice::READ_10 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount  ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 10-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite10CDB > ( &cdb,
+														 kSCSICmd_READ_10,
+														 RDPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 10-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_READ_10,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								GROUP_NUMBER,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								  TRANSFER_LENGTH		 & 0xFF,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite10CDB::kSize );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
@@ -848,6 +1149,7 @@ IOSCSIBlockCommandsDevice::READ_12 (
 {
 	
 	bool		status 				= false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64 		requestedByteCount	= 0;
 
 	require_nonzero ( request, ErrorExit );
@@ -858,31 +1160,21 @@ IOSCSIBlockCommandsDevice::READ_12 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount  ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 12-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite12CDB > ( &cdb,
+														 kSCSICmd_READ_12,
+														 RDPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 12-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_READ_12,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								( TRANSFER_LENGTH >> 24 ) 		& 0xFF,
-								( TRANSFER_LENGTH >> 16 ) 		& 0xFF,
-								( TRANSFER_LENGTH >> 8  ) 		& 0xFF,
-								  TRANSFER_LENGTH				& 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite12CDB::kSize );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
@@ -920,6 +1212,7 @@ IOSCSIBlockCommandsDevice::READ_16 (
 {
 
 	bool		status = false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64 		requestedByteCount	= 0;
 	
 	require_nonzero ( request, ErrorExit );
@@ -930,36 +1223,22 @@ IOSCSIBlockCommandsDevice::READ_16 (
 
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 16-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite16CDB > ( &cdb,
+														 kSCSICmd_READ_16,
+														 RDPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 16-Byte command, fill out the cdb appropriately
-	SetCommandDescriptorBlock ( request,
-								kSCSICmd_READ_16,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
-								LOGICAL_BLOCK_ADDRESS & 0xFF,
-								( TRANSFER_LENGTH >> 24 ) & 0xFF,
-								( TRANSFER_LENGTH >> 16 ) & 0xFF,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								TRANSFER_LENGTH & 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
-								
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite16CDB::kSize );
+	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
 	SetDataBuffer ( request, dataBuffer );
@@ -1505,14 +1784,132 @@ ErrorExit:
 
 
 //
-//	 REZERO_UNIT - Builds a REZERO_UNIT command.					[PROTECTED]
+//	 REPORT_ZONES - Builds a REPORT_ZONES command.				[PROTECTED]
 //
 
 bool
-IOSCSIBlockCommandsDevice::REZERO_UNIT ( 
+IOSCSIBlockCommandsDevice::REPORT_ZONES (
 						SCSITaskIdentifier			request,
-						SCSICmdField1Byte 			CONTROL )
-{
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField8Byte			ZONE_START_LBA,
+						SCSICmdField4Byte			ALLOCATION_LENGTH,
+						SCSICmdField1Bit			PARTIAL,
+						SCSICmdField6Bit			REPORTING_OPTIONS,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status = false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ZONE_START_LBA, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( ALLOCATION_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
+	require ( IsParameterValid ( PARTIAL, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( REPORTING_OPTIONS, kSCSICmdFieldMask6Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, ALLOCATION_LENGTH ), ErrorExit );
+	
+	// This is a 16-Byte ZBC IN command, fill out the cdb appropriately
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_ZBC_IN,
+								kSCSIServiceAction_REPORT_ZONES,
+								( ZONE_START_LBA >> 56 ) & 0xFF,
+								( ZONE_START_LBA >> 48 ) & 0xFF,
+								( ZONE_START_LBA >> 40 ) & 0xFF,
+								( ZONE_START_LBA >> 32 ) & 0xFF,
+								( ZONE_START_LBA >> 24 ) & 0xFF,
+								( ZONE_START_LBA >> 16 ) & 0xFF,
+								( ZONE_START_LBA >> 8 ) & 0xFF,
+								ZONE_START_LBA & 0xFF,
+								( ALLOCATION_LENGTH >> 24 ) & 0xFF,
+								( ALLOCATION_LENGTH >> 16 ) & 0xFF,
+								( ALLOCATION_LENGTH >> 8 ) & 0xFF,
+								ALLOCATION_LENGTH & 0xFF,
+								( PARTIAL << 7 ) | REPORTING_OPTIONS,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, ALLOCATION_LENGTH );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 RESET_WRITE_POINTER - Builds a RESET_WRITE_POINTER command.	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::RESET_WRITE_POINTER (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status = false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ZONE_ID, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( ALL, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// This is a 16-Byte ZBC OUT command, rewind the write pointer.
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_ZBC_OUT,
+								kSCSIServiceAction_RESET_WRITE_POINTER,
+								( ZONE_ID >> 56 ) & 0xFF,
+								( ZONE_ID >> 48 ) & 0xFF,
+								( ZONE_ID >> 40 ) & 0xFF,
+								( ZONE_ID >> 32 ) & 0xFF,
+								( ZONE_ID >> 24 ) & 0xFF,
+								( ZONE_ID >> 16 ) & 0xFF,
+								( ZONE_ID >> 8 ) & 0xFF,
+								ZONE_ID & 0xFF,
+								0x00,
+								0x00,
+								0x00,
+								0x00,
+								ALL,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_NoDataTransfer );
+	SetTimeoutDuration ( request, 0 );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 REZERO_UNIT - Builds a REZERO_UNIT command.					[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::REZERO_UNIT ( 
+						SCSITaskIdentifier			request,
+						SCSICmdField1Byte 			CONTROL )
+{
 	
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
@@ -1995,6 +2392,61 @@ ErrorExit:
 	
 }
 						
+//
+//	 UNMAP - Builds an UNMAP command.								[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::UNMAP (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField1Bit			ANCHOR,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte			PARAMETER_LIST_LENGTH,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status 		= false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( ANCHOR, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( PARAMETER_LIST_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, PARAMETER_LIST_LENGTH ), ErrorExit );
+	
+	// This is a 10-Byte command, fill out the cdb appropriately
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_UNMAP,
+								ANCHOR,
+								0x00,
+								0x00,
+								0x00,
+								0x00,
+								GROUP_NUMBER,
+								( PARAMETER_LIST_LENGTH >> 8 ) & 0xFF,
+								PARAMETER_LIST_LENGTH & 0xFF,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, PARAMETER_LIST_LENGTH );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 UPDATE_BLOCK - Builds a UPDATE_BLOCK command.					[PROTECTED]
 //
@@ -2428,6 +2880,7 @@ IOSCSIBlockCommandsDevice::WRITE_10 (
 {
 
 	bool		status 				= false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64 		requestedByteCount	= 0;
 	
 	require_nonzero ( request, ErrorExit );
@@ -2438,29 +2891,21 @@ IOSCSIBlockCommandsDevice::WRITE_10 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 10-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite10CDB > ( &cdb,
+														 kSCSICmd_WRITE_10,
+														 WRPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 10-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_WRITE_10,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								GROUP_NUMBER,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								  TRANSFER_LENGTH		 & 0xFF,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite10CDB::kSize );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -2552,6 +2997,7 @@ IOSCSIBlockCommandsDevice::WRITE_12 (
 {
 
 	bool		status 				= false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64 		requestedByteCount	= 0;
 	
 	require_nonzero ( request, ErrorExit );
@@ -2562,31 +3008,21 @@ IOSCSIBlockCommandsDevice::WRITE_12 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 12-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite12CDB > ( &cdb,
+														 kSCSICmd_WRITE_12,
+														 WRPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 12-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_WRITE_12,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								( TRANSFER_LENGTH >> 24 )		& 0xFF,
-								( TRANSFER_LENGTH >> 16 )		& 0xFF,
-								( TRANSFER_LENGTH >>  8 )		& 0xFF,
-								  TRANSFER_LENGTH				& 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite12CDB::kSize );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -2625,6 +3061,7 @@ IOSCSIBlockCommandsDevice::WRITE_16 (
 {
 
 	bool		status 				= false;
+	SCSICommandDescriptorBlock	cdb;
 	UInt64 		requestedByteCount	= 0;
 	
 	require_nonzero ( request, ErrorExit );
@@ -2635,35 +3072,21 @@ IOSCSIBlockCommandsDevice::WRITE_16 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Do the pre-flight check on the passed in parameters and pack the
+	// 16-Byte cdb, both from the SBC-2 layout.
+	require ( BuildReadWriteCDB < SBCReadWrite16CDB > ( &cdb,
+														 kSCSICmd_WRITE_16,
+														 WRPROTECT,
+														 DPO,
+														 FUA,
+														 FUA_NV,
+														 LOGICAL_BLOCK_ADDRESS,
+														 TRANSFER_LENGTH,
+														 GROUP_NUMBER,
+														 CONTROL ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 16-Byte command, fill out the cdb appropriately
-	SetCommandDescriptorBlock ( request,
-								kSCSICmd_WRITE_16,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
-								LOGICAL_BLOCK_ADDRESS & 0xFF,
-								( TRANSFER_LENGTH >> 24 ) & 0xFF,
-								( TRANSFER_LENGTH >> 16 ) & 0xFF,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								TRANSFER_LENGTH & 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, &cdb, SBCReadWrite16CDB::kSize );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -3274,6 +3697,83 @@ ErrorExit:
 }
 
 
+//
+//	 WRITE_SAME_16 - Builds an SBC-3 WRITE_SAME_16 command.		[PROTECTED]
+//
+
+bool 
+IOSCSIBlockCommandsDevice::WRITE_SAME_16 (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit			ANCHOR,
+						SCSICmdField1Bit			UNMAP,
+						SCSICmdField8Byte			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField4Byte			NUMBER_OF_LOGICAL_BLOCKS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField1Byte			CONTROL )
+{
+
+	bool		status 		= false;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
+	require ( IsParameterValid ( ANCHOR, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( UNMAP, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
+	require ( IsParameterValid ( NUMBER_OF_LOGICAL_BLOCKS, kSCSICmdFieldMask4Byte ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// The data-out buffer holds the single logical block that is written
+	// to every block in the range.
+	require ( IsMemoryDescriptorValid ( dataBuffer, blockSize ), ErrorExit );
+	
+	// An ANCHOR request only makes sense with UNMAP set
+	require ( ( ANCHOR == 0 ) || ( UNMAP == 1 ), ErrorExit );
+	
+	// This is a 16-Byte command, fill out the cdb appropriately
+	SetCommandDescriptorBlock ( request,
+								kSCSICmd_WRITE_SAME_16,
+								( WRPROTECT << 5 ) | ( ANCHOR << 4 ) | ( UNMAP << 3 ),
+								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
+								LOGICAL_BLOCK_ADDRESS & 0xFF,
+								( NUMBER_OF_LOGICAL_BLOCKS >> 24 ) & 0xFF,
+								( NUMBER_OF_LOGICAL_BLOCKS >> 16 ) & 0xFF,
+								( NUMBER_OF_LOGICAL_BLOCKS >> 8 ) & 0xFF,
+								NUMBER_OF_LOGICAL_BLOCKS & 0xFF,
+								GROUP_NUMBER,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, blockSize );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 XDREAD - Builds a XDREAD command.								[PROTECTED]
 //
@@ -3368,6 +3868,72 @@ ErrorExit:
 }
 
 
+//
+//	 XDREAD - Builds an SBC-2 XDREAD command with a block size.
+//																	[PROTECTED]
+//
+
+bool 
+IOSCSIBlockCommandsDevice::XDREAD (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField1Bit			XORPINFO,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL )
+{
+
+	bool		status 				= false;
+	UInt64		requestedByteCount	= 0;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( XORPINFO, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// The XOR data held by the device for the range is read into the buffer.
+	requestedByteCount = ( UInt64 ) TRANSFER_LENGTH * blockSize;
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	// This is a 10-Byte command, fill out the cdb appropriately  
+	SetCommandDescriptorBlock (	request,
+								kSCSICmd_XDREAD,
+								XORPINFO,
+								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
+								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
+								GROUP_NUMBER,
+								( TRANSFER_LENGTH >> 8 )		& 0xFF,
+								  TRANSFER_LENGTH				& 0xFF,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 XDWRITE - Builds a XDWRITE command.							[PROTECTED]
 //
@@ -3477,6 +4043,80 @@ ErrorExit:
 }
 
 
+//
+//	 XDWRITE - Builds an SBC-2 XDWRITE command with a block size.
+//																	[PROTECTED]
+//
+
+bool 
+IOSCSIBlockCommandsDevice::XDWRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit 			DPO,
+						SCSICmdField1Bit 			FUA,
+						SCSICmdField1Bit 			DISABLE_WRITE,
+						SCSICmdField1Bit			FUA_NV,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL )
+{
+
+	bool		status 				= false;
+	UInt64		requestedByteCount	= 0;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
+	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( DISABLE_WRITE, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// The buffer holds the new data for the range.
+	requestedByteCount = ( UInt64 ) TRANSFER_LENGTH * blockSize;
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	// This is a 10-Byte command, fill out the cdb appropriately  
+	SetCommandDescriptorBlock (	request,
+								kSCSICmd_XDWRITE,
+								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( DISABLE_WRITE << 2 ) | ( FUA_NV << 1 ),
+								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
+								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
+								GROUP_NUMBER,
+								( TRANSFER_LENGTH >> 8 )		& 0xFF,
+								  TRANSFER_LENGTH				& 0xFF,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 XDWRITE_EXTENDED - Builds a XDWRITE_EXTENDED command.			[PROTECTED]
 //
@@ -3692,3 +4332,137 @@ ErrorExit:
 	return status;
 	
 }
+
+
+//
+//	 XPWRITE - Builds an SBC-2 XPWRITE command with a block size.
+//																	[PROTECTED]
+//
+
+bool 
+IOSCSIBlockCommandsDevice::XPWRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField1Bit 			DPO,
+						SCSICmdField1Bit 			FUA,
+						SCSICmdField1Bit 			FUA_NV,
+						SCSICmdField1Bit 			XORPINFO,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL )
+{
+
+	bool		status 				= false;
+	UInt64		requestedByteCount	= 0;
+	
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
+	
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// Do the pre-flight check on the passed in parameters
+	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( XORPINFO, kSCSICmdFieldMask1Bit ), ErrorExit );
+	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
+	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
+	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	
+	// The buffer holds the data to XOR with the range.
+	requestedByteCount = ( UInt64 ) TRANSFER_LENGTH * blockSize;
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	// This is a 10-Byte command, fill out the cdb appropriately  
+	SetCommandDescriptorBlock (	request,
+								kSCSICmd_XPWRITE,
+								( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ) | XORPINFO,
+								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
+								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
+								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
+								GROUP_NUMBER,
+								( TRANSFER_LENGTH >> 8 )		& 0xFF,
+								  TRANSFER_LENGTH				& 0xFF,
+								CONTROL );
+	
+	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Static Helpers
+#pragma mark -
+#endif
+
+
+//
+//	 BuildReadWriteCDB - Checks the parameters of an SBC-2 READ or WRITE
+//						  command against LAYOUT and packs its cdb.	   [STATIC]
+//
+
+template < typename LAYOUT >
+static inline bool
+BuildReadWriteCDB ( SCSICommandDescriptorBlock *	cdb,
+					SCSICmdField1Byte				OPERATION_CODE,
+					SCSICmdField3Bit				PROTECT,
+					SCSICmdField1Bit				DPO,
+					SCSICmdField1Bit				FUA,
+					SCSICmdField1Bit				FUA_NV,
+					SCSICmdField8Byte				LOGICAL_BLOCK_ADDRESS,
+					SCSICmdField4Byte				TRANSFER_LENGTH,
+					SCSICmdField5Bit				GROUP_NUMBER,
+					SCSICmdField1Byte				CONTROL )
+{
+	
+	bool	result = false;
+	
+	// The fields no narrower than their parameter types fold away, so this
+	// comes down to one test of the bit fields and, for the shorter
+	// commands, of the logical block address and transfer length.
+	require ( ( LAYOUT::PROTECT::IsValid ( PROTECT ) &
+				LAYOUT::DPO::IsValid ( DPO ) &
+				LAYOUT::FUA::IsValid ( FUA ) &
+				LAYOUT::FUA_NV::IsValid ( FUA_NV ) &
+				LAYOUT::LOGICAL_BLOCK_ADDRESS::IsValid ( LOGICAL_BLOCK_ADDRESS ) &
+				LAYOUT::TRANSFER_LENGTH::IsValid ( TRANSFER_LENGTH ) &
+				LAYOUT::GROUP_NUMBER::IsValid ( GROUP_NUMBER ) ), ErrorExit );
+	
+	bzero ( cdb, sizeof ( SCSICommandDescriptorBlock ) );
+	
+	LAYOUT::OPERATION_CODE::Pack ( *cdb, OPERATION_CODE );
+	LAYOUT::PROTECT::Pack ( *cdb, PROTECT );
+	LAYOUT::DPO::Pack ( *cdb, DPO );
+	LAYOUT::FUA::Pack ( *cdb, FUA );
+	LAYOUT::FUA_NV::Pack ( *cdb, FUA_NV );
+	LAYOUT::LOGICAL_BLOCK_ADDRESS::Pack ( *cdb, LOGICAL_BLOCK_ADDRESS );
+	LAYOUT::TRANSFER_LENGTH::Pack ( *cdb, TRANSFER_LENGTH );
+	LAYOUT::GROUP_NUMBER::Pack ( *cdb, GROUP_NUMBER );
+	LAYOUT::CONTROL::Pack ( *cdb, CONTROL );
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
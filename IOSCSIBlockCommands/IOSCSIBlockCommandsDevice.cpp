@@ -100,6 +100,450 @@ OSDefineAbstractStructors ( IOSCSIBlockCommandsDevice, IOSCSIPrimaryCommandsDevi
 #define kUSBHDIconKey						"USBHD.icns"
 #define	kDefaultMaxBlocksPerIO				65535
 
+// Elevator constants
+#define kSBCElevatorEntryCount				128
+#define kSBCElevatorMaximumOutstanding		1
+#define kSBCElevatorReadDeadlineInMS		500
+#define kSBCElevatorWriteDeadlineInMS		5000
+
+#define kIOPropertyElevatorStatisticsKey				"Elevator Statistics"
+#define kIOPropertyElevatorSortedSeekDistanceKey		"Sorted Seek Distance"
+#define kIOPropertyElevatorArrivalSeekDistanceKey		"Arrival Order Seek Distance"
+#define kIOPropertyElevatorSeekDistanceSavedKey			"Seek Distance Saved"
+#define kIOPropertyElevatorDispatchCountKey				"Requests Dispatched"
+#define kIOPropertyElevatorDeadlineDispatchCountKey		"Deadline Dispatches"
+
+#define fElevatorLock					fIOSCSIBlockCommandsDeviceReserved->fElevatorLock
+#define fElevatorEntries				fIOSCSIBlockCommandsDeviceReserved->fElevatorEntries
+#define fElevatorFreeList				fIOSCSIBlockCommandsDeviceReserved->fElevatorFreeList
+#define fElevatorQueue					fIOSCSIBlockCommandsDeviceReserved->fElevatorQueue
+#define fElevatorInFlight				fIOSCSIBlockCommandsDeviceReserved->fElevatorInFlight
+#define fElevatorOutstandingCount		fIOSCSIBlockCommandsDeviceReserved->fElevatorOutstandingCount
+#define fElevatorDispatching			fIOSCSIBlockCommandsDeviceReserved->fElevatorDispatching
+#define fElevatorHeadPosition			fIOSCSIBlockCommandsDeviceReserved->fElevatorHeadPosition
+#define fElevatorArrivalPosition		fIOSCSIBlockCommandsDeviceReserved->fElevatorArrivalPosition
+#define fElevatorSortedSeekDistance		fIOSCSIBlockCommandsDeviceReserved->fElevatorSortedSeekDistance
+#define fElevatorArrivalSeekDistance	fIOSCSIBlockCommandsDeviceReserved->fElevatorArrivalSeekDistance
+#define fElevatorDeadlineDispatchCount	fIOSCSIBlockCommandsDeviceReserved->fElevatorDeadlineDispatchCount
+#define fElevatorTotalDispatchCount		fIOSCSIBlockCommandsDeviceReserved->fElevatorTotalDispatchCount
+
+// Logical block provisioning constants
+#define kSBCUnmapMaximumBlockDescriptorCount	255
+#define kSBCWriteSameMaximumBlockCount			0xFFFFFFFF
+#define kSBCBlockVPDPageCount					16
+
+// The largest ranges SYNCHRONIZE CACHE (10) and (16) can name.
+#define kSBCSynchronizeCache10MaximumBlockCount	0xFFFF
+#define kSBCSynchronizeCache16MaximumBlockCount	0xFFFFFFFF
+
+#define kIOPropertyLogicalBlockProvisioningKey			"Logical Block Provisioning"
+#define kIOPropertyProvisioningManagementEnabledKey		"Provisioning Management Enabled"
+#define kIOPropertyUnmappedBlocksReadZerosKey			"Unmapped Blocks Read Zeros"
+#define kIOPropertyUnmapSupportedKey					"UNMAP Supported"
+#define kIOPropertyWriteSameUnmapSupportedKey			"WRITE SAME UNMAP Supported"
+#define kIOPropertyMaximumUnmapLBACountKey				"Maximum UNMAP LBA Count"
+#define kIOPropertyMaximumUnmapDescriptorCountKey		"Maximum UNMAP Block Descriptor Count"
+
+#define kIOPropertyOptimalTransferByteCountKey			"Optimal Transfer Byte Count"
+#define kIOPropertyOptimalTransferGranularityKey		"Optimal Transfer Granularity Byte Count"
+#define kIOPropertyPhysicalBlockSizeKey					"Physical Block Size"
+#define kIOPropertyPhysicalBlockAlignmentOffsetKey		"Physical Block Alignment Offset"
+
+#define fSupportedBlockVPDPages				fIOSCSIBlockCommandsDeviceReserved->fSupportedBlockVPDPages
+#define fMediumLBPME						fIOSCSIBlockCommandsDeviceReserved->fMediumLBPME
+#define fMediumLBPRZ						fIOSCSIBlockCommandsDeviceReserved->fMediumLBPRZ
+#define fUnmapSupported						fIOSCSIBlockCommandsDeviceReserved->fUnmapSupported
+#define fWriteSameUnmapSupported			fIOSCSIBlockCommandsDeviceReserved->fWriteSameUnmapSupported
+#define fMaximumUnmapLBACount				fIOSCSIBlockCommandsDeviceReserved->fMaximumUnmapLBACount
+#define fMaximumUnmapBlockDescriptorCount	fIOSCSIBlockCommandsDeviceReserved->fMaximumUnmapBlockDescriptorCount
+#define fMaximumWriteSameLength				fIOSCSIBlockCommandsDeviceReserved->fMaximumWriteSameLength
+#define fOptimalTransferLength				fIOSCSIBlockCommandsDeviceReserved->fOptimalTransferLength
+#define fOptimalTransferLengthGranularity	fIOSCSIBlockCommandsDeviceReserved->fOptimalTransferLengthGranularity
+#define fMediumPhysicalBlockExponent		fIOSCSIBlockCommandsDeviceReserved->fMediumPhysicalBlockExponent
+#define fMediumLowestAlignedBlock			fIOSCSIBlockCommandsDeviceReserved->fMediumLowestAlignedBlock
+#define fDPOFUASupported					fIOSCSIBlockCommandsDeviceReserved->fDPOFUASupported
+#define fReadStreamLock						fIOSCSIBlockCommandsDeviceReserved->fReadStreamLock
+#define fReadStreams						fIOSCSIBlockCommandsDeviceReserved->fReadStreams
+#define fReadStreamSequence					fIOSCSIBlockCommandsDeviceReserved->fReadStreamSequence
+#define fReadStreamScore					fIOSCSIBlockCommandsDeviceReserved->fReadStreamScore
+#define fReadStreamPrefetchSupported		fIOSCSIBlockCommandsDeviceReserved->fReadStreamPrefetchSupported
+#define fReadStreamPrefetchCount			fIOSCSIBlockCommandsDeviceReserved->fReadStreamPrefetchCount
+#define fReadStreamHitCount					fIOSCSIBlockCommandsDeviceReserved->fReadStreamHitCount
+#define fReadStreamMissCount				fIOSCSIBlockCommandsDeviceReserved->fReadStreamMissCount
+#define fReadStreamWastedBlockCount			fIOSCSIBlockCommandsDeviceReserved->fReadStreamWastedBlockCount
+#define fWriteSameFillSupported				fIOSCSIBlockCommandsDeviceReserved->fWriteSameFillSupported
+#define fExtendedCopySupported				fIOSCSIBlockCommandsDeviceReserved->fExtendedCopySupported
+#define fExtendedCopyParametersValid		fIOSCSIBlockCommandsDeviceReserved->fExtendedCopyParametersValid
+#define fExtendedCopySegmentCount			fIOSCSIBlockCommandsDeviceReserved->fExtendedCopySegmentCount
+#define fExtendedCopySegmentByteCount		fIOSCSIBlockCommandsDeviceReserved->fExtendedCopySegmentByteCount
+#define fExtendedCopyConcurrentCount		fIOSCSIBlockCommandsDeviceReserved->fExtendedCopyConcurrentCount
+#define fExtendedCopyListIdentifier			fIOSCSIBlockCommandsDeviceReserved->fExtendedCopyListIdentifier
+#define fMaximumCompareAndWriteLength		fIOSCSIBlockCommandsDeviceReserved->fMaximumCompareAndWriteLength
+#define fXORCommandsSupported				fIOSCSIBlockCommandsDeviceReserved->fXORCommandsSupported
+#define fZonedModel							fIOSCSIBlockCommandsDeviceReserved->fZonedModel
+#define fZones								fIOSCSIBlockCommandsDeviceReserved->fZones
+#define fZoneCount							fIOSCSIBlockCommandsDeviceReserved->fZoneCount
+#define fZoneLock							fIOSCSIBlockCommandsDeviceReserved->fZoneLock
+#define fZoneWriteTimer						fIOSCSIBlockCommandsDeviceReserved->fZoneWriteTimer
+#define fCompletionCoalescingSupported		fIOSCSIBlockCommandsDeviceReserved->fCompletionCoalescingSupported
+#define fCompletionCoalescingLevel			fIOSCSIBlockCommandsDeviceReserved->fCompletionCoalescingLevel
+#define fCompletionCoalescingProgrammedLevel	fIOSCSIBlockCommandsDeviceReserved->fCompletionCoalescingProgrammedLevel
+#define fCompletionCoalescingProgramming	fIOSCSIBlockCommandsDeviceReserved->fCompletionCoalescingProgramming
+#define fReadWriteOutstandingCount			fIOSCSIBlockCommandsDeviceReserved->fReadWriteOutstandingCount
+#define fCoalescingNextBlock				fIOSCSIBlockCommandsDeviceReserved->fCoalescingNextBlock
+#define fCoalescingSequentialCount			fIOSCSIBlockCommandsDeviceReserved->fCoalescingSequentialCount
+
+// Completion coalescing constants. Deep queues get moderate coalescing,
+// and deep queues of sequential requests get aggressive coalescing. A queue
+// depth of one always runs without, since its latency is all that matters.
+// Depths between one and the moderate depth keep the current setting so
+// that the transport is not reprogrammed on every request.
+#define kSBCCoalescingModerateDepth				4
+#define kSBCCoalescingStreamingDepth			8
+#define kSBCCoalescingStreamingSequentialCount	8
+
+// Read-ahead constants
+#define kSBCReadStreamCount						4
+#define kSBCReadStreamSequentialThreshold		2
+#define kSBCReadStreamMinimumWindowBytes		( 128 * 1024 )
+#define kSBCReadStreamMaximumWindowBytes		( 2 * 1024 * 1024 )
+#define kSBCReadStreamScoreLimit				8
+#define kSBCPrefetch10MaximumBlockCount			0xFFFF
+
+// Fill constants. A WRITE SAME (16) is kept short enough that the device
+// can write it out within the command timeout even if it is not thin
+// provisioned.
+#define kSBCFillOutstandingCount				4
+#define kSBCWriteSameFillMaximumBytes			( 256 * 1024 * 1024 )
+#define kSBCFillBufferMaximumBytes				( 1024 * 1024 )
+
+// EXTENDED COPY constants. Like WRITE SAME, each command is kept short
+// enough to finish within the command timeout.
+#define kSBCExtendedCopyOutstandingCount		4
+#define kSBCExtendedCopyMaximumSegmentCount		16
+#define kSBCExtendedCopyMaximumBlocksPerSegment	0xFFFF
+#define kSBCExtendedCopyMaximumBytes			( 256 * 1024 * 1024 )
+#define kSBCExtendedCopyCSCDCount				2
+#define kSBCExtendedCopyDesignatorSize			20
+#define kSBCExtendedCopyMaximumDesignatorLength	16
+#define kSBCCopyBufferMaximumBytes				( 1024 * 1024 )
+
+// EXTENDED COPY descriptor type codes and RECEIVE COPY RESULTS service
+// actions (SPC-3).
+#define kSBCExtendedCopyBlockToBlockSegment		0x02
+#define kSBCExtendedCopyIdentificationCSCD		0xE4
+#define kSBCReceiveCopyResultsCopyStatus		0x00
+#define kSBCReceiveCopyResultsOperatingParameters	0x03
+#define kSBCCopyManagerStatusMask				0x7F
+#define kSBCCopyManagerStatusCompletedWithErrors	0x02
+#define kSENSE_ASC_InvalidCommandOperationCode	0x20
+#define kSENSE_ASC_InvalidFieldInCDB			0x24
+
+// Parity update constants. The XOR commands are 10-byte commands, so an
+// operation is limited to what a 10-byte CDB can describe.
+#define kSBCParityOutstandingCount				4
+#define kSBCParityBufferMaximumBytes			( 1024 * 1024 )
+#define kSBCParityMaximumBlockCount				0xFFFF
+#define kSBCParityMaximumLBA					0xFFFFFFFFULL
+#define kSBCParityRetryCount					3
+
+// Zoned block device constants. A write queued behind a gap is sent anyway
+// once it has waited for the gap to be filled for the deadline, and fails
+// at the device if the gap is still there.
+#define kSBCZonedModelNone						0
+#define kSBCZonedModelHostAware					1
+#define kSBCZonedModelHostManaged				2
+#define kSBCZoneReportBatchCount				256
+#define kSBCZoneWriteDeadlineInMS				5000
+#define kSBCZoneTypeMask						0x0F
+#define kSBCZoneConditionShift					4
+
+#define kIOPropertyZonedBlockDeviceKey					"Zoned Block Device"
+#define kIOPropertyZoneModelKey							"Zone Model"
+#define kIOPropertyZoneModelHostAware					"Host Aware"
+#define kIOPropertyZoneModelHostManaged					"Host Managed"
+#define kIOPropertyZoneCountKey							"Zone Count"
+#define kIOPropertyZoneSizeKey							"Zone Size"
+#define kIOPropertyConventionalZoneCountKey				"Conventional Zone Count"
+#define kIOPropertySequentialWriteZoneCountKey			"Sequential Write Required Zone Count"
+
+#define kIOPropertyReadAheadStatisticsKey				"Read-Ahead Statistics"
+#define kIOPropertyReadAheadEnabledKey					"Read-Ahead Enabled"
+#define kIOPropertyReadAheadPrefetchCountKey			"Prefetches Sent"
+#define kIOPropertyReadAheadHitCountKey					"Read-Ahead Hits"
+#define kIOPropertyReadAheadMissCountKey				"Read-Ahead Misses"
+#define kIOPropertyReadAheadWastedBlockCountKey			"Prefetched Blocks Not Read"
+
+// An elevator entry holds a read or write request until it is sent to the
+// device. Entries are kept on a list sorted by starting block.
+struct SBCElevatorEntry
+{
+	SBCElevatorEntry *		next;
+	SCSITaskIdentifier		request;
+	UInt64					startBlock;
+	UInt64					blockCount;
+	AbsoluteTime			deadline;
+	SCSITaskCompletion		completion;
+	bool					isWrite;
+};
+
+// A read stream is a run of reads that each start where the last one ended.
+// prefetchStart and prefetchEnd cover the window most recently prefetched
+// for it. A stream whose lastUsed is 0 (zero) is free.
+struct SBCReadStream
+{
+	UInt64					nextBlock;
+	UInt64					prefetchStart;
+	UInt64					prefetchEnd;
+	UInt64					window;
+	UInt64					lastUsed;
+	UInt32					sequentialCount;
+};
+
+// State shared by the commands sent for one fill. Each command holds a
+// reference to it until it completes.
+struct SBCFillContext
+{
+	IOLock *				lock;
+	UInt32					outstanding;
+	IOReturn				status;
+	bool					writeSame;
+	bool					writeSameRejected;
+};
+
+// One EXTENDED COPY command sent by SendExtendedCopyCommands ( ). The range
+// is kept so that it can be copied through the host if the command fails.
+enum
+{
+	kSBCExtendedCopyIdle		= 0,
+	kSBCExtendedCopyInFlight	= 1,
+	kSBCExtendedCopyComplete	= 2
+};
+
+struct SBCExtendedCopyOperation
+{
+	IOLock *					lock;
+	IOBufferMemoryDescriptor *	parameterList;
+	UInt64						sourceBlock;
+	UInt64						destinationBlock;
+	UInt64						blockCount;
+	UInt64						segmentBlockCount;
+	UInt8						listIdentifier;
+	UInt8						state;
+	bool						failed;
+	bool						unsupported;
+};
+
+// One piece of a stripe unit update, sent by UpdateParity ( ). The step is
+// the command in flight or last completed.
+enum
+{
+	kSBCParityStepIdle		= 0,
+	kSBCParityStepXDWRITE	= 1,
+	kSBCParityStepXDREAD	= 2,
+	kSBCParityStepXPWRITE	= 3
+};
+
+struct SBCParityOperation
+{
+	IOLock *					lock;
+	IOBufferMemoryDescriptor *	xorBuffer;
+	IOMemoryDescriptor *		dataBuffer;
+	IOSCSIBlockCommandsDevice *	parityDevice;
+	UInt64						dataBlock;
+	UInt64						parityBlock;
+	UInt64						blockCount;
+	UInt8						step;
+	UInt8						retries;
+	bool						inFlight;
+	bool						failed;
+	bool						unsupported;
+};
+
+// A write to a sequential write required zone. Writes wait on their zone's
+// queue, sorted by starting block, until they start at the write pointer.
+// A write longer than one task is sent one task at a time. Appends have no
+// clientData and their caller sleeps until complete is set. append is kept
+// for writes held while their zone is stale.
+struct SBCZoneWrite
+{
+	SBCZoneWrite *			next;
+	IOMemoryDescriptor *	buffer;
+	IOMemoryDescriptor *	taskBuffer;
+	UInt64					startBlock;
+	UInt64					blockCount;
+	UInt64					blocksWritten;
+	UInt64					taskBlockCount;
+	void *					clientData;
+	AbsoluteTime			deadline;
+	IOReturn				status;
+	bool					forceUnitAccess;
+	bool					append;
+	bool					complete;
+};
+
+// One entry of the zone table. The start and length never change once the
+// table is read. appendPointer is where the next append goes, past the
+// write pointer and every write already queued. A stale zone's write
+// pointer is unknown until the zone is read again, and the writes that
+// arrive meanwhile are held, in the order they came, until it has been. A
+// busy zone is being managed and takes no writes.
+struct SBCZone
+{
+	UInt64					start;
+	UInt64					length;
+	UInt64					writePointer;
+	UInt64					appendPointer;
+	SBCZoneWrite *			queue;
+	SBCZoneWrite *			inFlight;
+	SBCZoneWrite *			held;
+	UInt8					type;
+	UInt8					condition;
+	bool					stale;
+	bool					busy;
+};
+
+#pragma pack(1)
+
+// EXTENDED COPY (LID1) parameter list header (SPC-3 section 6.3).
+struct SBCExtendedCopyParameterListHeader
+{
+	UInt8					LIST_IDENTIFIER;
+	UInt8					FLAGS;							// 5 = STR, 4 = NRCR, 2-0 = PRIORITY
+	UInt16					CSCD_DESCRIPTOR_LIST_LENGTH;
+	UInt32					RESERVED;
+	UInt32					SEGMENT_DESCRIPTOR_LIST_LENGTH;
+	UInt32					INLINE_DATA_LENGTH;
+};
+
+// Identification descriptor CSCD descriptor for a block device. The
+// designation descriptor takes bytes 4 to 23, and bytes 28 to 31 hold the
+// block device type specific parameters.
+struct SBCExtendedCopyIdentificationDescriptor
+{
+	UInt8					DESCRIPTOR_TYPE_CODE;			// E4h
+	UInt8					PERIPHERAL_DEVICE_TYPE;			// 5 = NUL, 4-0 = Peripheral device type
+	UInt16					RELATIVE_INITIATOR_PORT_IDENTIFIER;
+	UInt8					DESIGNATOR[kSBCExtendedCopyDesignatorSize];
+	UInt8					RESERVED[4];
+	UInt8					FLAGS;							// 2 = PAD
+	UInt8					DISK_BLOCK_LENGTH[3];
+};
+
+// Block device to block device segment descriptor.
+struct SBCExtendedCopyBlockSegmentDescriptor
+{
+	UInt8					DESCRIPTOR_TYPE_CODE;			// 02h
+	UInt8					FLAGS;							// 1 = DC, 0 = CAT
+	UInt16					DESCRIPTOR_LENGTH;
+	UInt16					SOURCE_CSCD_DESCRIPTOR_ID;
+	UInt16					DESTINATION_CSCD_DESCRIPTOR_ID;
+	UInt16					RESERVED;
+	UInt16					NUMBER_OF_BLOCKS;
+	UInt64					SOURCE_LOGICAL_BLOCK_ADDRESS;
+	UInt64					DESTINATION_LOGICAL_BLOCK_ADDRESS;
+};
+
+// RECEIVE COPY RESULTS operating parameters data (SPC-3 section 6.18.4),
+// followed by the list of implemented descriptor type codes.
+struct SBCCopyOperatingParameters
+{
+	UInt32					AVAILABLE_DATA;
+	UInt8					FLAGS;							// 0 = SNLID
+	UInt8					RESERVED[3];
+	UInt16					MAXIMUM_CSCD_DESCRIPTOR_COUNT;
+	UInt16					MAXIMUM_SEGMENT_DESCRIPTOR_COUNT;
+	UInt32					MAXIMUM_DESCRIPTOR_LIST_LENGTH;
+	UInt32					MAXIMUM_SEGMENT_LENGTH;
+	UInt32					MAXIMUM_INLINE_DATA_LENGTH;
+	UInt32					HELD_DATA_LIMIT;
+	UInt32					MAXIMUM_STREAM_DEVICE_TRANSFER_SIZE;
+	UInt16					RESERVED2;
+	UInt16					TOTAL_CONCURRENT_COPIES;
+	UInt8					MAXIMUM_CONCURRENT_COPIES;
+	UInt8					DATA_SEGMENT_GRANULARITY;
+	UInt8					INLINE_DATA_GRANULARITY;
+	UInt8					HELD_DATA_GRANULARITY;
+	UInt8					RESERVED3[3];
+	UInt8					IMPLEMENTED_DESCRIPTOR_LIST_LENGTH;
+	UInt8					IMPLEMENTED_DESCRIPTOR_TYPE_CODES[32];
+};
+
+// RECEIVE COPY RESULTS copy status data (SPC-3 section 6.18.2).
+struct SBCCopyStatus
+{
+	UInt32					AVAILABLE_DATA;
+	UInt8					COPY_MANAGER_STATUS;			// 7 = HDD, 6-0 = Copy manager status
+	UInt16					SEGMENTS_PROCESSED;
+	UInt8					TRANSFER_COUNT_UNITS;
+	UInt32					TRANSFER_COUNT;
+};
+
+// REPORT ZONES parameter data header and zone descriptor (ZBC).
+struct SBCReportZonesHeader
+{
+	UInt32					ZONE_LIST_LENGTH;
+	UInt8					SAME;							// 3-0 = SAME
+	UInt8					RESERVED[3];
+	UInt64					MAXIMUM_LBA;
+	UInt8					RESERVED2[48];
+};
+
+struct SBCZoneDescriptor
+{
+	UInt8					ZONE_TYPE;						// 3-0 = Zone type
+	UInt8					ZONE_CONDITION;					// 7-4 = Zone condition, 1 = NON_SEQ, 0 = RESET
+	UInt8					RESERVED[6];
+	UInt64					ZONE_LENGTH;
+	UInt64					ZONE_START_LBA;
+	UInt64					WRITE_POINTER_LBA;
+	UInt8					RESERVED2[32];
+};
+
+#pragma options align=reset
+
+// The UNMAP parameter list is a header followed by up to
+// kSBCUnmapMaximumBlockDescriptorCount block descriptors (SBC-3).
+struct SBCUnmapParameterListHeader
+{
+	UInt16					UNMAP_DATA_LENGTH;
+	UInt16					UNMAP_BLOCK_DESCRIPTOR_DATA_LENGTH;
+	UInt32					RESERVED;
+};
+
+struct SBCUnmapBlockDescriptor
+{
+	UInt64					LOGICAL_BLOCK_ADDRESS;
+	UInt32					NUMBER_OF_LOGICAL_BLOCKS;
+	UInt32					RESERVED;
+};
+
+// Completion coalescing levels, indexing sCompletionCoalescingSettings.
+enum
+{
+	kSBCCoalescingLevel_Off			= 0,
+	kSBCCoalescingLevel_Moderate	= 1,
+	kSBCCoalescingLevel_Streaming	= 2
+};
+
+static const SCSICompletionCoalescing sCompletionCoalescingSettings[] =
+{
+	{ 0,	0	},		// kSBCCoalescingLevel_Off
+	{ 4,	20	},		// kSBCCoalescingLevel_Moderate
+	{ 16,	100	}		// kSBCCoalescingLevel_Streaming
+};
+
+
+//
+//	Prototypes
+//
+
+static inline UInt64
+SeekDistance ( UInt64 from, UInt64 to );
+
+static void
+XORBytes ( UInt8 * destination, const UInt8 * source, UInt64 byteCount );
+
 
 #if 0
 #pragma mark -
@@ -137,8 +581,37 @@ IOSCSIBlockCommandsDevice::AsyncReadWrite (	IOMemoryDescriptor *	buffer,
 											void *					clientData )
 {
 	
+	return AsyncReadWriteWithFUA ( buffer,
+								   startBlock,
+								   blockCount,
+								   blockSize,
+								   false,
+								   clientData );
+	
+}
+
+
+//
+//	 AsyncReadWriteWithFUA - Translates an asynchronous I/O request into a
+//							  read or a write, writing through the cache
+//							  if forceUnitAccess is set.			   [PUBLIC]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::AsyncReadWriteWithFUA (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							UInt64					blockSize,
+							bool					forceUnitAccess,
+							void *					clientData )
+{
+	
 	IODirection		direction;
-	IOReturn		status = kIOReturnBadArgument;
+	IOReturn		status	= kIOReturnBadArgument;
+	SBCZone *		zone	= NULL;
+	SBCZoneWrite *	write	= NULL;
+	SInt32			depth	= 0;
 	
 	require_action ( IsProtocolAccessEnabled ( ),
 					 ErrorExit,
@@ -149,6 +622,52 @@ IOSCSIBlockCommandsDevice::AsyncReadWrite (	IOMemoryDescriptor *	buffer,
 					 status = kIOReturnOffline );
 	
 	direction = buffer->getDirection ( );
+	
+	// Writes to sequential write required zones must arrive at the zone's
+	// write pointer, so they are queued and sent in order by the zone.
+	if ( ( direction == kIODirectionOut ) && ( fZones != NULL ) )
+	{
+		
+		zone = FindZone ( startBlock );
+		if ( ( zone != NULL ) && ( zone->type == kSBCZoneTypeSequentialWriteRequired ) )
+		{
+			
+			forceUnitAccess = ( forceUnitAccess == true ) && ( fWriteCacheEnabled == true );
+			require_action ( ( forceUnitAccess == false ) || ( fDPOFUASupported == true ),
+							 ErrorExit,
+							 status = kIOReturnUnsupported );
+			
+			write = IONew ( SBCZoneWrite, 1 );
+			require_nonzero_action ( write, ErrorExit, status = kIOReturnNoResources );
+			
+			bzero ( write, sizeof ( SBCZoneWrite ) );
+			write->buffer			= buffer;
+			write->startBlock		= startBlock;
+			write->blockCount		= blockCount;
+			write->clientData		= clientData;
+			write->forceUnitAccess	= forceUnitAccess;
+			
+			status = EnqueueZoneWrite ( zone, write, false );
+			if ( status != kIOReturnSuccess )
+			{
+				IODelete ( write, SBCZoneWrite, 1 );
+			}
+			
+			goto ErrorExit;
+			
+		}
+		
+	}
+	
+	// Count the request before it is sent, since it may complete before
+	// the send returns.
+	depth = OSIncrementAtomic ( &fReadWriteOutstandingCount ) + 1;
+	
+	if ( fCompletionCoalescingSupported == true )
+	{
+		UpdateCompletionCoalescing ( depth, startBlock, blockCount );
+	}
+	
 	if ( direction == kIODirectionIn )
 	{
 		
@@ -159,10 +678,34 @@ IOSCSIBlockCommandsDevice::AsyncReadWrite (	IOMemoryDescriptor *	buffer,
 	else if ( direction == kIODirectionOut )
 	{
 		
-		status = IssueWrite ( buffer, startBlock, blockCount, clientData );
+		// Without a write cache every write is already written through, so
+		// only ask for FUA when the cache is on. If the device can't honour
+		// it, let the client fall back to a write and a cache flush rather
+		// than silently leaving the data in the cache.
+		if ( ( forceUnitAccess == true ) && ( fWriteCacheEnabled == true ) )
+		{
+			
+			status = kIOReturnUnsupported;
+			
+			if ( fDPOFUASupported == true )
+			{
+				status = IssueWriteRequest ( buffer, startBlock, blockCount, true, clientData );
+			}
+			
+		}
+		
+		else
+		{
+			status = IssueWrite ( buffer, startBlock, blockCount, clientData );
+		}
 		
 	}
 	
+	if ( status != kIOReturnSuccess )
+	{
+		OSDecrementAtomic ( &fReadWriteOutstandingCount );
+	}
+	
 	
 ErrorExit:
 	
@@ -456,1313 +999,1584 @@ ErrorExit:
 
 
 //
-//	 ReportBlockSize - Reports the medium block size.				   [PUBLIC]
-//
-
-UInt64
-IOSCSIBlockCommandsDevice::ReportMediumBlockSize ( void )
-{
-	
-	return fMediumBlockSize;
-	
-}
-
-
-//
-//	 ReportMediumTotalBlockCount - Reports total number of blocks on medium.
+//	 SynchronizeCacheRange - Synchronizes a range of the write cache.
 //																	   [PUBLIC]
 //
 
-UInt64
-IOSCSIBlockCommandsDevice::ReportMediumTotalBlockCount ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::SynchronizeCacheRange ( UInt64	startBlock,
+												   UInt64	blockCount )
 {
 	
-	return fMediumBlockCount64;
+	IOReturn				status			= kIOReturnSuccess;
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	bool					cmdStatus		= false;
 	
-}
-
-
-//
-//	 ReportMediumWriteProtection - Reports write protection characteristic
-//									of medium						   [PUBLIC]
-//
-
-bool
-IOSCSIBlockCommandsDevice::ReportMediumWriteProtection ( void )
-{
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::SynchronizeCacheRange called, startBlock = %lld, blockCount = %lld\n",
+				   startBlock, blockCount ) );
 	
-	return fMediumIsWriteProtected;
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
 	
-}
-
-
-//
-//	 ReportDeviceMaxBlocksReadTransfer - Reports maximum read transfer blocks.
-//																	   [PUBLIC]
-//
-
-UInt64
-IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksReadTransfer ( void )
-{
-
-	UInt32	maxBlockCount 	= kDefaultMaxBlocksPerIO;
-	UInt64	maxByteCount	= 0;
-	bool	supported		= false;
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
 	
-	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksWriteTransfer.\n" ) );
+	require_action ( ( startBlock < fMediumBlockCount64 ) &&
+					 ( blockCount <= ( fMediumBlockCount64 - startBlock ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
 	
-	// See if the transport driver wants us to limit the block transfer count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumReadBlockTransferCount,
-						&maxBlockCount );
+	require ( fWriteCacheEnabled, ErrorExit );
 	
-	if ( supported == false )
-		maxBlockCount = kDefaultMaxBlocksPerIO;
+	request = GetSCSITask ( );
+	require_nonzero_action ( request,
+							 ErrorExit,
+							 status = kIOReturnNoResources );
 	
-	// See if the transport driver wants us to limit the transfer byte count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumReadTransferByteCount,
-						&maxByteCount );	
+	// A range that does not fit in the command's NUMBER OF BLOCKS field is
+	// rounded up to the end of the medium, which the device takes a value
+	// of 0 (zero) to mean.
+	if ( startBlock <= kREPORT_CAPACITY_MaximumLBA )
+	{
+		
+		if ( blockCount > kSBCSynchronizeCache10MaximumBlockCount )
+			blockCount = 0;
+		
+		cmdStatus = SYNCHRONIZE_CACHE ( request,
+										0,
+										0,
+										( SCSICmdField4Byte ) startBlock,
+										0,
+										( SCSICmdField2Byte ) blockCount,
+										0 );
+		
+	}
 	
-	if ( ( supported == true ) && ( maxByteCount > 0 ) )
+	else
 	{
 		
-		setProperty ( kIOMaximumByteCountReadKey, maxByteCount, 64 );
+		if ( blockCount > kSBCSynchronizeCache16MaximumBlockCount )
+			blockCount = 0;
 		
-		if ( fMediumBlockSize > 0 )
-			maxBlockCount = min ( maxBlockCount, ( maxByteCount / fMediumBlockSize ) );
+		cmdStatus = SYNCRONIZE_CACHE_16 ( request,
+										  0,
+										  0,
+										  startBlock,
+										  ( SCSICmdField4Byte ) blockCount,
+										  0,
+										  0 );
 		
 	}
 	
-	return maxBlockCount;
+	if ( cmdStatus == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		status = kIOReturnSuccess;
+	}
+	
+	else
+	{
+		status = kIOReturnError;
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
 	
 }
 
 
 //
-//	 ReportDeviceMaxBlocksWriteTransfer -	Reports maximum write transfer
-//											in blocks.				   [PUBLIC]
+//	 UnmapBlocks - Unmaps ranges of logical blocks.				   [PUBLIC]
 //
 
-UInt64
-IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksWriteTransfer ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::UnmapBlocks (
+							SBCBlockExtent *	extents,
+							UInt32				extentCount )
 {
-
-	UInt32	maxBlockCount 	= kDefaultMaxBlocksPerIO;
-	UInt64	maxByteCount	= 0;
-	bool	supported		= false;
 	
-	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksWriteTransfer.\n" ) );
+	IOReturn		status		= kIOReturnSuccess;
+	UInt32			index		= 0;
+	
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::UnmapBlocks called, extentCount = %ld\n", extentCount ) );
+	
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
 	
-	// See if the transport driver wants us to limit the block transfer count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumWriteBlockTransferCount,
-						&maxBlockCount );
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
 	
-	if ( supported == false )
-		maxBlockCount = kDefaultMaxBlocksPerIO;
+	require_action ( fMediumPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_action_quiet ( fMediumLBPME, ErrorExit, status = kIOReturnUnsupported );
+	require_action ( ( fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
 	
-	// See if the transport driver wants us to limit the transfer byte count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumWriteTransferByteCount,
-						&maxByteCount );	
+	require_nonzero_action ( extents, ErrorExit, status = kIOReturnBadArgument );
+	require_nonzero_action ( extentCount, ErrorExit, status = kIOReturnBadArgument );
 	
-	if ( ( supported == true ) && ( maxByteCount > 0 ) )
+	// Make sure every extent lies on the medium before any of them are
+	// unmapped.
+	for ( index = 0; index < extentCount; index++ )
 	{
 		
-		setProperty ( kIOMaximumByteCountWriteKey, maxByteCount, 64 );
+		require_nonzero_action ( extents[index].blockCount,
+								 ErrorExit,
+								 status = kIOReturnBadArgument );
 		
-		if ( fMediumBlockSize > 0 )
-			maxBlockCount = min ( maxBlockCount, ( maxByteCount / fMediumBlockSize ) );
+		require_action ( ( extents[index].blockStart < fMediumBlockCount64 ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+		require_action ( ( extents[index].blockCount <= ( fMediumBlockCount64 - extents[index].blockStart ) ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
 		
 	}
 	
-	return maxBlockCount;
+	if ( fUnmapSupported == true )
+	{
+		status = SendUnmapCommands ( extents, extentCount );
+	}
 	
-}
-
-
-//
-//	 ReportDeviceMediaRemovability -	Reports removability characteristic
-//										of media					   [PUBLIC]
-//
-
-bool
-IOSCSIBlockCommandsDevice::ReportDeviceMediaRemovability ( void )
-{
+	else if ( fWriteSameUnmapSupported == true )
+	{
+		status = SendWriteSameUnmapCommands ( extents, extentCount );
+	}
 	
-	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportMediaRemovability fMediaIsRemovable = %d\n",
-					( int ) fMediaIsRemovable ) );
+	else
+	{
+		status = kIOReturnUnsupported;
+	}
+	
+	
+ErrorExit:
 	
-	return fMediaIsRemovable;
+	
+	return status;
 	
 }
 
 
-#if 0
-#pragma mark -
-#pragma mark  Protected Methods - Methods used by this class and subclasses
-#pragma mark -
-#endif
-
-
 //
-//	 InitializeDeviceSupport - Initializes device support			[PROTECTED]
+//	 WriteSameBlocks - Writes one block of data to a range of blocks.
+//																	   [PUBLIC]
 //
 
-bool
-IOSCSIBlockCommandsDevice::InitializeDeviceSupport ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::WriteSameBlocks (
+							UInt64					startBlock,
+							UInt64					blockCount,
+							IOMemoryDescriptor *	pattern )
 {
 	
-	bool	setupSuccessful = false;
+	IOReturn					status			= kIOReturnSuccess;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	UInt8 *						bytes			= NULL;
+	UInt64						bufferBlocks	= 0;
+	UInt64						commandLimit	= 0;
+	UInt64						index			= 0;
 	
-	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::WriteSameBlocks called, startBlock = %lld, blockCount = %lld\n",
+				   startBlock, blockCount ) );
 	
-	// Allocate space for our reserved data.
-	// Do this first to make sure that all expansion data is available before
-	// any real work is done since that work may need these.
-	fIOSCSIBlockCommandsDeviceReserved = IONew ( IOSCSIBlockCommandsDeviceExpansionData, 1 );
-	require_nonzero ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
 	
-	bzero ( fIOSCSIBlockCommandsDeviceReserved,
-			sizeof ( IOSCSIBlockCommandsDeviceExpansionData ) );
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
 	
-	// Initialize the device characteristics flags
-	fMediaIsRemovable 		= false;
-	fKnownManualEject		= false;
+	require_action ( fMediumPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_action ( ( fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
 	
-	// Initialize the medium characteristics
-	ResetMediumCharacteristics ( );
+	require_nonzero_action ( blockCount, ErrorExit, status = kIOReturnBadArgument );
+	require_action ( ( startBlock < fMediumBlockCount64 ) &&
+					 ( blockCount <= ( fMediumBlockCount64 - startBlock ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
 	
-	// Grab any device information from the IORegistry
-	if ( getProperty ( kIOPropertySCSIDeviceCharacteristicsKey ) != NULL )
+	// The fill is not sequenced with the zone's other writes.
+	require_action ( ( IsSequentialWriteRequiredRange ( startBlock, blockCount ) == false ),
+					 ErrorExit,
+					 status = kIOReturnUnsupported );
+	
+	if ( pattern != NULL )
 	{
 		
-		// There is a characteristics property for this device, check for known entries.
-		OSDictionary * characterDict = NULL;
-		
-		characterDict = OSDynamicCast (
-					OSDictionary,
-					getProperty ( kIOPropertySCSIDeviceCharacteristicsKey ) );
-		
-		// Check if the personality for this device specifies that this is known to be manual ejectable.
-		if ( characterDict->getObject ( kIOPropertySCSIManualEjectKey ) != NULL )
-		{
-			
-			STATUS_LOG ( ( "%s: found a Manual Eject property.\n", getName ( ) ) );
-			fKnownManualEject = true;
-			fDeviceIsShared = true;		
-			
-		}
+		require_action ( ( pattern->getLength ( ) >= fMediumBlockSize ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
 		
 	}
 	
-	if ( GetProtocolDriver ( )->getProperty ( kIOPropertyProtocolCharacteristicsKey ) != NULL )
+	if ( fWriteSameFillSupported == true )
 	{
 		
-		// There is a characteristics property for this device, check for known entries.
-		OSDictionary * characterDict = NULL;
+		buffer = IOBufferMemoryDescriptor::withCapacity ( fMediumBlockSize, kIODirectionOut );
+		require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoMemory );
 		
-		characterDict = OSDynamicCast (
-					OSDictionary,
-					GetProtocolDriver ( )->getProperty ( kIOPropertyProtocolCharacteristicsKey ) );
+		bytes = ( UInt8 * ) buffer->getBytesNoCopy ( );
+		require_nonzero_action ( bytes, ReleaseDescriptor, status = kIOReturnNoMemory );
 		
-		// Check if the personality for this device specifies that this is known to be manual ejectable.
-		if ( characterDict->getObject ( kIOPropertySCSIProtocolMultiInitKey ) != NULL )
+		if ( pattern != NULL )
 		{
 			
-			fDeviceIsShared = true;		
+			require_action ( ( pattern->readBytes ( 0, bytes, fMediumBlockSize ) == fMediumBlockSize ),
+							 ReleaseDescriptor,
+							 status = kIOReturnBadArgument );
 			
 		}
 		
+		else
+		{
+			bzero ( bytes, fMediumBlockSize );
+		}
+		
+		commandLimit = kSBCWriteSameFillMaximumBytes / fMediumBlockSize;
+		if ( commandLimit > fMaximumWriteSameLength )
+			commandLimit = fMaximumWriteSameLength;
+		if ( commandLimit == 0 )
+			commandLimit = 1;
+		
+		status = SendFillCommands ( startBlock, blockCount, buffer, commandLimit, true );
+		
+		buffer->release ( );
+		buffer = NULL;
+		
+		// Only fall back to writing the data ourselves if the device
+		// does not implement WRITE SAME (16). Any blocks it did write are
+		// simply written again.
+		require_quiet ( ( status == kIOReturnUnsupported ), ErrorExit );
+		
+		ERROR_LOG ( ( "%s: WRITE SAME (16) rejected, filling with writes.\n", getName ( ) ) );
+		fWriteSameFillSupported = false;
+		
 	}
 	
-	// Make sure the drive is ready for us!
-	require ( ClearNotReadyStatus ( ), ReleaseReservedMemory );
+	// Write the pattern from a buffer of repeated blocks, one task's worth
+	// at most.
+	commandLimit = GetReadWriteTaskBlockLimit ( startBlock + blockCount - 1, fMediumBlockSize, true );
+	require_nonzero_action ( commandLimit, ErrorExit, status = kIOReturnUnsupported );
 	
-	setupSuccessful = DetermineDeviceCharacteristics ( );
+	bufferBlocks = kSBCFillBufferMaximumBytes / fMediumBlockSize;
+	if ( bufferBlocks > commandLimit )
+		bufferBlocks = commandLimit;
+	if ( bufferBlocks > blockCount )
+		bufferBlocks = blockCount;
+	if ( bufferBlocks == 0 )
+		bufferBlocks = 1;
 	
-	if ( setupSuccessful == true )
-	{		
-		
-		fPollingMode = kPollingMode_NewMedia;
-		fPollingThread = thread_call_allocate (
-						( thread_call_func_t ) IOSCSIBlockCommandsDevice::sProcessPoll,
-						( thread_call_param_t ) this );
+	buffer = IOBufferMemoryDescriptor::withCapacity ( bufferBlocks * fMediumBlockSize, kIODirectionOut );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoMemory );
+	
+	bytes = ( UInt8 * ) buffer->getBytesNoCopy ( );
+	require_nonzero_action ( bytes, ReleaseDescriptor, status = kIOReturnNoMemory );
+	
+	if ( pattern != NULL )
+	{
 		
-		require_nonzero_action_string ( fPollingThread,
-										ErrorExit,
-										setupSuccessful = false,
-										"fPollingThread allocation failed.\n" );
+		require_action ( ( pattern->readBytes ( 0, bytes, fMediumBlockSize ) == fMediumBlockSize ),
+						 ReleaseDescriptor,
+						 status = kIOReturnBadArgument );
 		
-		InitializePowerManagement ( GetProtocolDriver ( ) );
+		for ( index = 1; index < bufferBlocks; index++ )
+		{
+			bcopy ( bytes, &bytes[index * fMediumBlockSize], fMediumBlockSize );
+		}
 		
 	}
 	
-	STATUS_LOG ( ( "%s::%s setupSuccessful = %d\n", getName ( ),
-					__FUNCTION__, setupSuccessful ) );
-
-	// This needs to be called regardless of the state of the Medium Characteristics
-	// to insure that the IORegistry properties for the maximum transfers are set, otherwise,
-	// the IOStorageFamily will use the defaults.
-	SetMediumCharacteristics ( ( UInt64 ) 0, ( UInt64 ) 0 );
+	else
+	{
+		bzero ( bytes, bufferBlocks * fMediumBlockSize );
+	}
 	
-	return setupSuccessful;
+	status = SendFillCommands ( startBlock, blockCount, buffer, bufferBlocks, false );
 	
 	
-ReleaseReservedMemory:
+ReleaseDescriptor:
 	
 	
-	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
-	IODelete ( fIOSCSIBlockCommandsDeviceReserved, IOSCSIBlockCommandsDeviceExpansionData, 1 );
-	fIOSCSIBlockCommandsDeviceReserved = NULL;	
+	require_nonzero_quiet ( buffer, ErrorExit );
+	buffer->release ( );
+	buffer = NULL;
 	
 	
 ErrorExit:
 	
 	
-	return setupSuccessful;
+	return status;
 	
 }
 
 
 //
-//	 StartDeviceSupport - Starts device support					[PROTECTED]
+//	 CompareAndWriteBlocks - Writes blocks only if the medium holds the
+//							  expected data.						   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::StartDeviceSupport ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::CompareAndWriteBlocks (
+							UInt64					startBlock,
+							UInt64					blockCount,
+							IOMemoryDescriptor *	buffer,
+							UInt64 *				miscompareOffset )
 {
 	
-	// Start polling
-	EnablePolling ( );
+	SCSIServiceResponse		serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	SCSI_Sense_Data			senseDataBuffer	= { 0 };
+	IOReturn				status			= kIOReturnSuccess;
+	UInt8					senseKey		= 0;
 	
-	CreateStorageServiceNub ( );
-}
-
-
-//
-//	 SuspendDeviceSupport - Suspends device support				[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::SuspendDeviceSupport ( void )
-{
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::CompareAndWriteBlocks called, startBlock = %lld, blockCount = %lld\n",
+				   startBlock, blockCount ) );
 	
-	if ( fPollingMode != kPollingMode_Suspended )
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
+	
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
+	
+	require_action ( fMediumPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_action ( ( fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
+	
+	require_action ( ( fMaximumCompareAndWriteLength != 0 ),
+					 ErrorExit,
+					 status = kIOReturnUnsupported );
+	
+	// The whole compare and write must be one command to be atomic, so
+	// there is no splitting a request that is too long.
+	require_nonzero_action ( blockCount, ErrorExit, status = kIOReturnBadArgument );
+	require_action ( ( blockCount <= fMaximumCompareAndWriteLength ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	require_action ( ( startBlock < fMediumBlockCount64 ) &&
+					 ( blockCount <= ( fMediumBlockCount64 - startBlock ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnBadArgument );
+	
+	// A compare and write is not sequenced with the zone's other writes.
+	require_action ( ( IsSequentialWriteRequiredRange ( startBlock, blockCount ) == false ),
+					 ErrorExit,
+					 status = kIOReturnUnsupported );
+	
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
+	
+	if ( COMPARE_AND_WRITE ( request,
+							 buffer,
+							 fMediumBlockSize,
+							 0,
+							 0,
+							 0,
+							 startBlock,
+							 blockCount,
+							 0,
+							 0 ) == true )
 	{
-		DisablePolling ( );
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
 	}
 	
-}
-
-
-//
-//	 ResumeDeviceSupport - Resumes device support					[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::ResumeDeviceSupport ( void )
-{
+	else
+	{
+		
+		status = kIOReturnBadArgument;
+		goto ReleaseTask;
+		
+	}
 	
-	if ( fMediumPresent == false )
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
 	{
 		
-		// The driver has not found media in the device, restart
-		// the polling for new media.
-		fPollingMode = kPollingMode_NewMedia;
-		EnablePolling ( );
+		status = kIOReturnSuccess;
+		goto ReleaseTask;
 		
 	}
 	
-}
-
-
-//
-//	 StopDeviceSupport - Stops device support						[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::StopDeviceSupport ( void )
-{
-	DisablePolling ( );
-}
-
-
-//
-//	 TerminateDeviceSupport - Terminates device support			[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::TerminateDeviceSupport ( void )
-{
+	status = kIOReturnIOError;
 	
-	if ( fPollingThread != NULL )
+	require_quiet ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+					( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION ), ReleaseTask );
+	require_quiet ( GetAutoSenseData ( request, &senseDataBuffer, sizeof ( senseDataBuffer ) ), ReleaseTask );
+	
+	senseKey = senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask;
+	
+	if ( senseKey == kSENSE_KEY_MISCOMPARE )
 	{
 		
-		thread_call_free ( fPollingThread );
-		fPollingThread = NULL;
+		// A lost race for the blocks, not an error. The INFORMATION field
+		// holds the offset of the first byte that did not match.
+		status = kIOReturnSCSIMiscompare;
+		
+		if ( ( miscompareOffset != NULL ) &&
+			 ( senseDataBuffer.VALID_RESPONSE_CODE & kSENSE_DATA_VALID ) )
+		{
+			
+			*miscompareOffset = ( ( UInt64 ) senseDataBuffer.INFORMATION_1 << 24 ) |
+								( ( UInt64 ) senseDataBuffer.INFORMATION_2 << 16 ) |
+								( ( UInt64 ) senseDataBuffer.INFORMATION_3 << 8 ) |
+								( ( UInt64 ) senseDataBuffer.INFORMATION_4 );
+			
+		}
 		
 	}
 	
-	// Release all memory/objects associated with the reserved fields.
-	if ( fPowerDownNotifier != NULL )
+	else if ( senseKey == kSENSE_KEY_ILLEGAL_REQUEST )
 	{
 		
-		// remove() will also call release() on this object (IONotifier).
-		// See IONotifier.h for more info.
-		fPowerDownNotifier->remove ( );
-		fPowerDownNotifier = NULL;
+		// Don't try again if the device turns out not to support it
+		// after all.
+		if ( senseDataBuffer.ADDITIONAL_SENSE_CODE == kSENSE_ASC_InvalidCommandOperationCode )
+		{
+			
+			ERROR_LOG ( ( "%s: COMPARE AND WRITE rejected.\n", getName ( ) ) );
+			fMaximumCompareAndWriteLength = 0;
+			status = kIOReturnUnsupported;
+			
+		}
 		
 	}
 	
-}
-
-
-//
-//	 CreateCommandSetObjects - Creates command set objects			[PROTECTED]
-//
-
-bool
-IOSCSIBlockCommandsDevice::CreateCommandSetObjects ( void )
-{
 	
-	bool	result = false;
+ReleaseTask:
 	
-	fSCSIBlockCommandObject =
-		SCSIBlockCommands::CreateSCSIBlockCommandObject ( );
-	require_nonzero ( fSCSIBlockCommandObject, ErrorExit );
 	
-	result = true;
+	ReleaseSCSITask ( request );
+	request = NULL;
 	
 	
 ErrorExit:
 	
 	
-	return result;
+	return status;
 	
 }
 
 
 //
-//	 FreeCommandSetObjects - Releases command set objects			[PROTECTED]
+//	 UpdateParity - Writes new data and updates the parity for it.  [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::FreeCommandSetObjects ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::UpdateParity (
+							IOSCSIBlockCommandsDevice *	parityDevice,
+							SBCParityUpdate *			updates,
+							UInt32						updateCount )
 {
 	
-	if ( fSCSIBlockCommandObject != NULL )
+	SBCParityOperation			operations[kSBCParityOutstandingCount];
+	SBCParityOperation *		operation			= NULL;
+	IOBufferMemoryDescriptor *	hostBuffer			= NULL;
+	IOLock *					lock				= NULL;
+	IOReturn					status				= kIOReturnSuccess;
+	IOReturn					operationStatus		= kIOReturnSuccess;
+	UInt64						bufferBlocks		= 0;
+	UInt64						offset				= 0;
+	UInt64						blockCount			= 0;
+	UInt64						limit				= 0;
+	UInt32						updateIndex			= 0;
+	UInt32						index				= 0;
+	bool						busy				= false;
+	
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::UpdateParity called, updateCount = %ld\n", updateCount ) );
+	
+	bzero ( operations, sizeof ( operations ) );
+	
+	require_nonzero_action ( parityDevice, ErrorExit, status = kIOReturnBadArgument );
+	require_nonzero_action ( updates, ErrorExit, status = kIOReturnBadArgument );
+	
+	require_action ( IsProtocolAccessEnabled ( ) && parityDevice->IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
+	
+	require_action ( IsDeviceAccessEnabled ( ) && parityDevice->IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
+	
+	require_action ( fMediumPresent && parityDevice->fMediumPresent,
+					 ErrorExit,
+					 status = kIOReturnNoMedia );
+	
+	require_action ( ( fMediumIsWriteProtected == false ) &&
+					 ( parityDevice->fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
+	
+	// The parity of a block is the XOR of the blocks at the same offset, so
+	// the block sizes must match.
+	require_action ( ( fMediumBlockSize == parityDevice->fMediumBlockSize ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	
+	// Check every update before anything is written.
+	for ( updateIndex = 0; updateIndex < updateCount; updateIndex++ )
 	{
 		
-		fSCSIBlockCommandObject->release ( );
-		fSCSIBlockCommandObject = NULL;
-  		
+		require_action ( ( updates[updateIndex].blockCount > 0 ) &&
+						 ( updates[updateIndex].data != NULL ) &&
+						 ( updates[updateIndex].data->getLength ( ) >= ( updates[updateIndex].blockCount * fMediumBlockSize ) ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+		require_action ( ( updates[updateIndex].dataBlock < fMediumBlockCount64 ) &&
+						 ( updates[updateIndex].blockCount <= ( fMediumBlockCount64 - updates[updateIndex].dataBlock ) ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+		require_action ( ( updates[updateIndex].parityBlock < parityDevice->fMediumBlockCount64 ) &&
+						 ( updates[updateIndex].blockCount <= ( parityDevice->fMediumBlockCount64 - updates[updateIndex].parityBlock ) ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+		// XDWRITE and XPWRITE are not sequenced with the zones' other writes.
+		require_action ( ( IsSequentialWriteRequiredRange ( updates[updateIndex].dataBlock,
+															updates[updateIndex].blockCount ) == false ) &&
+						 ( parityDevice->IsSequentialWriteRequiredRange ( updates[updateIndex].parityBlock,
+																		  updates[updateIndex].blockCount ) == false ),
+						 ErrorExit,
+						 status = kIOReturnUnsupported );
+		
 	}
 	
-	// Release the reserved structure.
-	if ( fIOSCSIBlockCommandsDeviceReserved != NULL )
+	bufferBlocks = kSBCParityBufferMaximumBytes / fMediumBlockSize;
+	if ( bufferBlocks > kSBCParityMaximumBlockCount )
+		bufferBlocks = kSBCParityMaximumBlockCount;
+	if ( bufferBlocks == 0 )
+		bufferBlocks = 1;
+	
+	lock = IOLockAlloc ( );
+	require_nonzero_action ( lock, ErrorExit, status = kIOReturnNoResources );
+	
+	// The host buffer is only used by this thread, for whichever operation
+	// has to be done in host memory.
+	hostBuffer = IOBufferMemoryDescriptor::withCapacity ( bufferBlocks * fMediumBlockSize, kIODirectionOutIn );
+	require_nonzero_action ( hostBuffer, ReleaseLock, status = kIOReturnNoMemory );
+	
+	for ( index = 0; index < kSBCParityOutstandingCount; index++ )
 	{
 		
-		IODelete ( fIOSCSIBlockCommandsDeviceReserved, IOSCSIBlockCommandsDeviceExpansionData, 1 );
-		fIOSCSIBlockCommandsDeviceReserved = NULL;
+		operations[index].lock			= lock;
+		operations[index].parityDevice	= parityDevice;
+		operations[index].xorBuffer		= IOBufferMemoryDescriptor::withCapacity ( bufferBlocks * fMediumBlockSize,
+																				   kIODirectionOutIn );
+		require_nonzero_action ( operations[index].xorBuffer, ReleaseOperations, status = kIOReturnNoMemory );
 		
 	}
 	
-}
-
-
-//
-//	 GetSCSIBlockCommandObject - Accessor method					[PROTECTED]
-//
-
-SCSIBlockCommands *
-IOSCSIBlockCommandsDevice::GetSCSIBlockCommandObject ( void )
-{
-	
-	check ( fSCSIBlockCommandObject );
-	return fSCSIBlockCommandObject;
+	updateIndex = 0;
+	offset		= 0;
 	
-}
-
-
-//
-//	 GetSCSIPrimaryCommandObject - Accessor method					[PROTECTED]
-//
-
-SCSIPrimaryCommands	*
-IOSCSIBlockCommandsDevice::GetSCSIPrimaryCommandObject ( void )
-{
-	
-	check ( fSCSIBlockCommandObject );
-	return OSDynamicCast ( SCSIPrimaryCommands,
-						   GetSCSIBlockCommandObject ( ) );
-	
-}
-
-
-//
-//	 ClearNotReadyStatus - Clears any NOT_READY status on device	[PROTECTED]
-//
-
-bool
-IOSCSIBlockCommandsDevice::ClearNotReadyStatus ( void )
-{
-	
-	SCSI_Sense_Data				senseBuffer		= { 0 };
-	IOMemoryDescriptor *		bufferDesc		= NULL;
-	SCSIServiceResponse 		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier			request			= NULL;
-	bool						driveReady 		= false;
-	bool						result 			= true;
-	
-	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
-	
-	bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
-													kSenseDefaultSize,
-													kIODirectionIn );
-	
-	check ( bufferDesc );
-	
-	request = GetSCSITask ( );
-	
-	check ( request );
-	
-	do
+	for ( ;; )
 	{
 		
-		if ( TEST_UNIT_READY ( request, 0 ) == true )
+		// Wait until at least one operation has nothing in flight.
+		IOLockLock ( lock );
+		
+		for ( ;; )
 		{
 			
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+			busy = true;
+			for ( index = 0; index < kSBCParityOutstandingCount; index++ )
+			{
+				
+				if ( operations[index].inFlight == false )
+				{
+					
+					busy = false;
+					break;
+					
+				}
+				
+			}
+			
+			if ( busy == false )
+				break;
+			
+			IOLockSleep ( lock, lock, THREAD_UNINT );
 			
 		}
 		
-		if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+		IOLockUnlock ( lock );
+		
+		busy = false;
+		
+		for ( index = 0; index < kSBCParityOutstandingCount; index++ )
 		{
 			
-			bool validSense = false;
+			operation = &operations[index];
 			
-			if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
+			// Completions only ever clear inFlight, so this can be looked at
+			// without the lock.
+			if ( operation->inFlight == true )
 			{
 				
-				validSense = GetAutoSenseData ( request, &senseBuffer );
-				if ( validSense == false )
+				busy = true;
+				continue;
+				
+			}
+			
+			// Move a finished command on to its next step.
+			if ( operation->step != kSBCParityStepIdle )
+			{
+				
+				operationStatus = AdvanceParityOperation ( parityDevice, operation, hostBuffer );
+				if ( ( operationStatus != kIOReturnSuccess ) && ( status == kIOReturnSuccess ) )
+					status = operationStatus;
+				
+			}
+			
+			// Start the next piece of work on an idle operation, unless
+			// something has already failed.
+			if ( ( operation->step == kSBCParityStepIdle ) &&
+				 ( status == kIOReturnSuccess ) &&
+				 ( updateIndex < updateCount ) )
+			{
+				
+				blockCount = updates[updateIndex].blockCount - offset;
+				if ( blockCount > bufferBlocks )
+					blockCount = bufferBlocks;
+				
+				limit = GetReadWriteTaskBlockLimit ( updates[updateIndex].dataBlock + offset, fMediumBlockSize, true );
+				if ( ( limit != 0 ) && ( blockCount > limit ) )
+					blockCount = limit;
+				
+				limit = parityDevice->GetReadWriteTaskBlockLimit ( updates[updateIndex].parityBlock + offset, fMediumBlockSize, true );
+				if ( ( limit != 0 ) && ( blockCount > limit ) )
+					blockCount = limit;
+				
+				operation->dataBlock	= updates[updateIndex].dataBlock + offset;
+				operation->parityBlock	= updates[updateIndex].parityBlock + offset;
+				operation->blockCount	= blockCount;
+				operation->dataBuffer	= IOMemoryDescriptor::withSubRange ( updates[updateIndex].data,
+																			 offset * fMediumBlockSize,
+																			 blockCount * fMediumBlockSize,
+																			 kIODirectionOut );
+				
+				offset += blockCount;
+				if ( offset == updates[updateIndex].blockCount )
 				{
 					
-					if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0  ) == true )
-					{
-						
-						// The command was successfully built, now send it
-						serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-						
-					}
-					
-					if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
-					{
-						
-						validSense = true;
-						
-					}
+					updateIndex++;
+					offset = 0;
 					
 				}
 				
-				if ( validSense == true )
+				if ( operation->dataBuffer == NULL )
 				{
 					
-					if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY ) &&
-								( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
-							( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x01 ) )
-					{
-						
-						STATUS_LOG ( ( "%s::drive not ready\n", getName ( ) ) );
-						driveReady = false;
-						IOSleep ( 200 );
-						
-					}
-					
-					else if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY  ) &&
-							( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
-							( ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ||
-							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x02 ) ||
-							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x03 ) ) )
-					{
-						
-						// The drive needs to be spun up. Issue a START_STOP_UNIT to it.
-						if ( START_STOP_UNIT ( request, 0x00, 0x00, 0x00, 0x01, 0x00 ) == true )
-						{
-							
-							serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-							
-						}
-						
-					}
+					status = kIOReturnNoMemory;
 					
-					else
-					{
-						
-						driveReady = true;
-						STATUS_LOG ( ( "%s::drive READY\n", getName ( ) ) );
-						
-					}
+				}
+				
+				else
+				{
 					
-					STATUS_LOG ( ( "sense data: %01x, %02x, %02x\n",
-								 ( senseBuffer.SENSE_KEY  & kSENSE_KEY_Mask ),
-								   senseBuffer.ADDITIONAL_SENSE_CODE,
-								   senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+					// Idle to the first step.
+					operationStatus = AdvanceParityOperation ( parityDevice, operation, hostBuffer );
+					if ( ( operationStatus != kIOReturnSuccess ) && ( status == kIOReturnSuccess ) )
+						status = operationStatus;
 					
 				}
 				
 			}
 			
-			else
-			{
-				
-				driveReady = true;
-				
-			}
+			if ( ( operation->inFlight == true ) || ( operation->step != kSBCParityStepIdle ) )
+				busy = true;
 			
 		}
 		
-		else
+		if ( ( busy == false ) &&
+			 ( ( updateIndex == updateCount ) || ( status != kIOReturnSuccess ) ) )
+			break;
+		
+	}
+	
+	
+ReleaseOperations:
+	
+	
+	for ( index = 0; index < kSBCParityOutstandingCount; index++ )
+	{
+		
+		if ( operations[index].xorBuffer != NULL )
 		{
 			
-			// the command failed - perhaps the device was hot unplugged
-			// give other threads some time to run.
-			IOSleep ( 200 );
+			operations[index].xorBuffer->release ( );
+			operations[index].xorBuffer = NULL;
 			
 		}
+		
+	}
 	
-	// check isInactive in case device was hot unplugged during sleep
-	// and we are in an infinite loop here
-	} while ( ( driveReady == false ) && ( isInactive ( ) == false ) );
+	hostBuffer->release ( );
+	hostBuffer = NULL;
 	
-	bufferDesc->release ( );
-	bufferDesc = NULL;
 	
-	ReleaseSCSITask ( request );
+ReleaseLock:
 	
-	result = isInactive ( ) ? false : true;
 	
-	return result;
+	IOLockFree ( lock );
+	lock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
 	
 }
 
 
 //
-//	 EnablePolling - Schedules the polling thread to run			[PROTECTED]
+//	 CopyBlocks - Copies a range of blocks to a range on another device.
+//																	   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::EnablePolling ( void )
-{		
+IOReturn
+IOSCSIBlockCommandsDevice::CopyBlocks (
+							IOSCSIBlockCommandsDevice *	destination,
+							UInt64						sourceBlock,
+							UInt64						destinationBlock,
+							UInt64						blockCount )
+{
 	
-	AbsoluteTime	time;
+	IOReturn	status = kIOReturnSuccess;
 	
-	// No reason to start a thread if we've been terminatated
-	require ( ( isInactive ( ) == false ), Exit );
-	require ( fPollingThread, Exit );
-	require ( ( fPollingMode != kPollingMode_Suspended ), Exit );
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::CopyBlocks called, sourceBlock = %lld, destinationBlock = %lld, blockCount = %lld\n",
+				   sourceBlock, destinationBlock, blockCount ) );
 	
-	// Retain ourselves so that this object doesn't go away
-	// while we are polling
+	require_nonzero_action ( destination, ErrorExit, status = kIOReturnBadArgument );
 	
-	retain ( );
+	require_action ( IsProtocolAccessEnabled ( ) && destination->IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
 	
-	clock_interval_to_deadline ( 1000, kMillisecondScale, &time );
-	thread_call_enter_delayed ( fPollingThread, time );
+	require_action ( IsDeviceAccessEnabled ( ) && destination->IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
 	
+	require_action ( fMediumPresent && destination->fMediumPresent,
+					 ErrorExit,
+					 status = kIOReturnNoMedia );
 	
-Exit:
+	require_action ( ( destination->fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
 	
+	// Blocks are copied one for one, so the block sizes must match.
+	require_action ( ( fMediumBlockSize == destination->fMediumBlockSize ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
 	
-	return;
+	require_nonzero_action ( blockCount, ErrorExit, status = kIOReturnBadArgument );
+	require_action ( ( sourceBlock < fMediumBlockCount64 ) &&
+					 ( blockCount <= ( fMediumBlockCount64 - sourceBlock ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	require_action ( ( destinationBlock < destination->fMediumBlockCount64 ) &&
+					 ( blockCount <= ( destination->fMediumBlockCount64 - destinationBlock ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
 	
-}
-
-
-//
-//	 DisablePolling - Unschedules the polling thread if it hasn't run yet
-//																	[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::DisablePolling ( void )
-{		
+	// Neither EXTENDED COPY nor the host copy is sequenced with the
+	// destination zone's other writes.
+	require_action ( ( destination->IsSequentialWriteRequiredRange ( destinationBlock, blockCount ) == false ),
+					 ErrorExit,
+					 status = kIOReturnUnsupported );
 	
-	fPollingMode = kPollingMode_Suspended;
+	// Neither the copy manager nor the host copy can be relied upon to
+	// handle overlapping ranges on the same medium.
+	if ( destination == this )
+	{
+		
+		require_action ( ( ( sourceBlock + blockCount ) <= destinationBlock ) ||
+						 ( ( destinationBlock + blockCount ) <= sourceBlock ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+	}
 	
-	// Cancel the thread if it is scheduled to run
-	require ( thread_call_cancel ( fPollingThread ), Exit );
+	if ( ( fExtendedCopySupported == true ) && ( DetermineExtendedCopyParameters ( ) == true ) )
+	{
+		
+		// Sends as much of the copy as the device will take and leaves the
+		// range that is still to be copied, if any.
+		status = SendExtendedCopyCommands ( destination,
+											&sourceBlock,
+											&destinationBlock,
+											&blockCount );
+		require_success ( status, ErrorExit );
+		
+	}
 	
-	// It was running, so we balance out the retain()
-	// with a release()
-	release ( );
+	if ( blockCount > 0 )
+	{
+		status = CopyBlocksThroughHost ( destination, sourceBlock, destinationBlock, blockCount );
+	}
 	
 	
-Exit:
+ErrorExit:
 	
 	
-	return;
+	return status;
 	
 }
 
 
 //
-//	 DetermineDeviceCharacteristics - Determines device characteristics
-//																	[PROTECTED]
+//	 ManageZones - Opens, closes, finishes or resets zones.		   [PUBLIC]
 //
 
-bool
-IOSCSIBlockCommandsDevice::DetermineDeviceCharacteristics ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::ManageZones (
+							UInt8					action,
+							UInt64					zoneStartBlock,
+							bool					allZones )
 {
 	
-	SCSIServiceResponse 			serviceResponse 	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier				request 			= NULL;
-	IOBufferMemoryDescriptor *		buffer	 			= NULL;
-	IOReturn						status				= kIOReturnSuccess;
-	SCSICmd_INQUIRY_StandardData * 	inquiryBuffer 		= NULL;
-	UInt8							inquiryBufferSize	= 0;
-	UInt8							loop				= 0;
-	bool							succeeded			= false;
-	bool							WCEBit				= false;
-
-	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
+	SCSIServiceResponse		serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOReturn				status			= kIOReturnSuccess;
+	SBCZone *				zone			= NULL;
+	UInt32					firstZone		= 0;
+	UInt32					zoneCount		= 0;
+	UInt32					index			= 0;
+	bool					cmdStatus		= false;
 	
-	if ( fDefaultInquiryCount == 0 )
-	{
-		
-		// There is no default Inquiry count for this device, use the standard
-		// structure size.
-		STATUS_LOG ( ( "%s: use sizeof(SCSICmd_INQUIRY_StandardData) for Inquiry.\n", getName ( ) ) );
-		inquiryBufferSize = sizeof ( SCSICmd_INQUIRY_StandardData );
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ManageZones called, action = %d, zoneStartBlock = %lld\n",
+				   action, zoneStartBlock ) );
+	
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
+	
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
+	
+	require_action ( fMediumPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_nonzero_action ( fZones, ErrorExit, status = kIOReturnUnsupported );
+	require_action ( ( action >= kSBCZoneActionClose ) &&
+					 ( action <= kSBCZoneActionResetWritePointer ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	
+	if ( allZones == true )
+	{
+		
+		firstZone	= 0;
+		zoneCount	= fZoneCount;
 		
 	}
 	
 	else
 	{
 		
-		// This device has a default inquiry count, use it.
-		STATUS_LOG ( ( "%s: use fDefaultInquiryCount for Inquiry.\n", getName ( ) ) );
-		inquiryBufferSize = fDefaultInquiryCount;
+		zone = FindZone ( zoneStartBlock );
+		require_action ( ( zone != NULL ) &&
+						 ( zone->start == zoneStartBlock ) &&
+						 ( zone->type != kSBCZoneTypeConventional ),
+						 ErrorExit,
+						 status = kIOReturnBadArgument );
+		
+		firstZone	= zone - fZones;
+		zoneCount	= 1;
 		
 	}
 	
-	buffer = IOBufferMemoryDescriptor::withCapacity ( inquiryBufferSize, kIODirectionIn );
-	require_nonzero_string ( buffer, ErrorExit,
-							 "Couldn't allocate INQUIRY memory descriptor" );
-	
-	inquiryBuffer = ( SCSICmd_INQUIRY_StandardData * ) buffer->getBytesNoCopy ( );
-	require_nonzero_string ( inquiryBuffer, ReleaseDescriptor,
-							 "Couldn't allocate INQUIRY buffer" );
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ReleaseDescriptor );
+	// Writes queued for a zone were sent expecting its write pointer to
+	// stay where it is, so a zone must be idle to be managed. Marking the
+	// zones busy keeps new writes out until the command has completed.
+	IOLockLock ( fZoneLock );
 	
-	for ( loop = 0; ( ( loop < kMaxRetryCount ) && ( isInactive ( ) == false ) ); loop++ )
+	for ( index = firstZone; index < ( firstZone + zoneCount ); index++ )
 	{
 		
-		if ( INQUIRY ( 	request,
-						buffer,
-						0,
-						0,
-						0x00,
-						inquiryBufferSize,
-						0 ) == true )
-		{
-			
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-			
-		}
-		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		zone = &fZones[index];
+		if ( ( zone->busy == true ) || ( zone->queue != NULL ) ||
+			 ( zone->inFlight != NULL ) || ( zone->held != NULL ) )
 		{
 			
-			succeeded = true;
+			status = kIOReturnBusy;
 			break;
 			
 		}
 		
-		ERROR_LOG ( ( "!!! INQUIRY failed !!!, serviceResponse = %d, taskStatus = %d\n",
-					  serviceResponse, GetTaskStatus ( request ) ) );
+	}
+	
+	if ( status == kIOReturnSuccess )
+	{
 		
-		// Sleep for 1 second to try to let the device come online in case it
-		// just failed by freak occurrence (INQUIRY should NEVER fail, but apparently
-		// it sometimes does...)
-		IOSleep ( 1000 );
+		for ( index = firstZone; index < ( firstZone + zoneCount ); index++ )
+		{
+			fZones[index].busy = true;
+		}
 		
 	}
 	
-	require ( succeeded, ReleaseTask );
+	IOLockUnlock ( fZoneLock );
 	
-	// Save ANSI version of the device
-	SetANSIVersion ( inquiryBuffer->VERSION & kINQUIRY_ANSI_VERSION_Mask );
+	require_success ( status, ErrorExit );
 	
-	// Deprecated, but left here for sake of compatibility
-	fANSIVersion = GetANSIVersion ( );
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ClearBusy, status = kIOReturnNoResources );
 	
-	if ( ( inquiryBuffer->RMB & kINQUIRY_PERIPHERAL_RMB_BitMask ) ==
-		   kINQUIRY_PERIPHERAL_RMB_MediumRemovable )
+	switch ( action )
 	{
 		
-		STATUS_LOG ( ( "Media is removable\n" ) );
-		fMediaIsRemovable = true;
+		case kSBCZoneActionClose:
+			cmdStatus = CLOSE_ZONE ( request, zoneStartBlock, allZones, 0 );
+			break;
+		
+		case kSBCZoneActionFinish:
+			cmdStatus = FINISH_ZONE ( request, zoneStartBlock, allZones, 0 );
+			break;
+		
+		case kSBCZoneActionOpen:
+			cmdStatus = OPEN_ZONE ( request, zoneStartBlock, allZones, 0 );
+			break;
+		
+		case kSBCZoneActionResetWritePointer:
+			cmdStatus = RESET_WRITE_POINTER ( request, zoneStartBlock, allZones, 0 );
+			break;
+		
+		default:
+			break;
 		
 	}
 	
-	else
+	if ( cmdStatus == true )
 	{
 		
-		STATUS_LOG ( ( "Media is NOT removable\n" ) );
-		fMediaIsRemovable = false;
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
 		
 	}
 	
-	// Set the CMDQUE value so we know whether or not to enable TCQ.
-	SetCMDQUE ( inquiryBuffer->flags2 & kINQUIRY_Byte7_CMDQUE_Mask );
-	
-	buffer->release ( );
-	buffer = NULL;
-	
-	// Check the current state of the write cache.
-	status = GetWriteCacheState ( &WCEBit );
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		status = kIOReturnSuccess;
+	}
 	
-	// Is the write cache turned off?
-	if ( ( WCEBit == false ) && ( status == kIOReturnSuccess ) )
+	else
 	{
 		
-		// Try to turn the write cache on.
-		status = SetWriteCacheState ( true );
-		if ( status == kIOReturnSuccess )
-		{
-			
-			// We succeeded turning the write cache on.
-			WCEBit = true;
-			
-		}
+		ERROR_LOG ( ( "%s: zone action %d failed.\n", getName ( ), action ) );
+		status = ( cmdStatus == true ) ? kIOReturnIOError : kIOReturnBadArgument;
 		
 	}
 	
-	fWriteCacheEnabled = WCEBit;
-	
+	ReleaseSCSITask ( request );
+	request = NULL;
 	
-ReleaseTask:
 	
+ClearBusy:
 	
-	require_nonzero_quiet ( request, ReleaseDescriptor );
-	ReleaseSCSITask ( request );
-	request = NULL;
 	
+	// Whatever happened, the write pointers are no longer known.
+	IOLockLock ( fZoneLock );
 	
-ReleaseDescriptor:
+	for ( index = firstZone; index < ( firstZone + zoneCount ); index++ )
+	{
+		
+		fZones[index].stale	= true;
+		fZones[index].busy	= false;
+		
+	}
 	
+	IOLockUnlock ( fZoneLock );
 	
-	require_nonzero_quiet ( buffer, ErrorExit );
-	buffer->release ( );
-	buffer = NULL;
+	RefreshZones ( firstZone, zoneCount );
 	
 	
 ErrorExit:
 	
 	
-	STATUS_LOG ( ( "%s::%s succeeded = %d\n", getName ( ), __FUNCTION__, succeeded ) );
-	
-	return succeeded;
+	return status;
 	
 }
 
 
 //
-//	 SetMediumCharacteristics - Sets medium characteristics		[PROTECTED]
+//	 AppendToZone - Writes blocks at the write pointer of a zone.	   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::SetMediumCharacteristics (
-							UInt32	blockSize,
-							UInt32	blockCount )
+IOReturn
+IOSCSIBlockCommandsDevice::AppendToZone (
+							UInt64					zoneStartBlock,
+							IOMemoryDescriptor *	buffer,
+							UInt64					blockCount,
+							UInt64 *				startBlock )
 {
 	
-	SetMediumCharacteristics ( ( UInt64 ) blockSize, ( UInt64 ) blockCount );
+	SBCZone *		zone	= NULL;
+	SBCZoneWrite *	write	= NULL;
+	IOReturn		status	= kIOReturnSuccess;
+	
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::AppendToZone called, zoneStartBlock = %lld, blockCount = %lld\n",
+				   zoneStartBlock, blockCount ) );
+	
+	require_action ( IsProtocolAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnNotAttached );
+	
+	require_action ( IsDeviceAccessEnabled ( ),
+					 ErrorExit,
+					 status = kIOReturnOffline );
+	
+	require_action ( fMediumPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_action ( ( fMediumIsWriteProtected == false ),
+					 ErrorExit,
+					 status = kIOReturnNotWritable );
+	
+	require_nonzero_action ( fZones, ErrorExit, status = kIOReturnUnsupported );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnBadArgument );
+	require_nonzero_action ( blockCount, ErrorExit, status = kIOReturnBadArgument );
+	require_nonzero_action ( startBlock, ErrorExit, status = kIOReturnBadArgument );
+	require_action ( ( buffer->getLength ( ) >= ( blockCount * fMediumBlockSize ) ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	
+	zone = FindZone ( zoneStartBlock );
+	require_action ( ( zone != NULL ) &&
+					 ( zone->start == zoneStartBlock ) &&
+					 ( zone->type == kSBCZoneTypeSequentialWriteRequired ),
+					 ErrorExit,
+					 status = kIOReturnBadArgument );
+	
+	write = IONew ( SBCZoneWrite, 1 );
+	require_nonzero_action ( write, ErrorExit, status = kIOReturnNoResources );
+	
+	bzero ( write, sizeof ( SBCZoneWrite ) );
+	write->buffer		= buffer;
+	write->blockCount	= blockCount;
+	
+	status = EnqueueZoneWrite ( zone, write, true );
+	require_success ( status, ReleaseWrite );
+	
+	// Wait for the zone to get to it.
+	IOLockLock ( fZoneLock );
+	
+	while ( write->complete == false )
+	{
+		IOLockSleep ( fZoneLock, write, THREAD_UNINT );
+	}
+	
+	IOLockUnlock ( fZoneLock );
+	
+	status		= write->status;
+	*startBlock	= write->startBlock;
+	
+	
+ReleaseWrite:
+	
+	
+	IODelete ( write, SBCZoneWrite, 1 );
+	write = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
 	
 }
 
 
 //
-//	 SetMediumCharacteristics64 - Sets medium characteristics		[PROTECTED]
+//	 ReportZone - Reports the zone containing a block.				   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::SetMediumCharacteristics (
-							UInt64	blockSize,
-							UInt64	blockCount )
+IOReturn
+IOSCSIBlockCommandsDevice::ReportZone (
+							UInt64					block,
+							SBCZoneInformation *	zoneInformation )
 {
 	
-	UInt64		maxBlocksRead	= 0;
-	UInt64		maxBlocksWrite	= 0;
+	SBCZone *	zone	= NULL;
+	IOReturn	status	= kIOReturnSuccess;
 	
-	STATUS_LOG ( ( "mediumBlockSize = %qd, blockCount = %qd\n",
-					blockSize, blockCount ) );
+	require_nonzero_action ( fZones, ErrorExit, status = kIOReturnUnsupported );
+	require_nonzero_action ( zoneInformation, ErrorExit, status = kIOReturnBadArgument );
 	
-	fMediumBlockSize	= blockSize;
-	fMediumBlockCount64 = blockCount;
+	zone = FindZone ( block );
+	require_nonzero_action ( zone, ErrorExit, status = kIOReturnBadArgument );
 	
-	if ( fMediumBlockCount64 > kREPORT_CAPACITY_MaximumLBA )
+	if ( zone->stale == true )
 	{
-		
-		// The medium has more LBAs than can be reported in the 32 bit
-		// fMediumBlockCount variable, so set it to the maximum that it can report.
-		fMediumBlockCount = kREPORT_CAPACITY_MaximumLBA;
-		
+		RefreshZones ( zone - fZones, 1 );
 	}
 	
-	else
-	{
-		fMediumBlockCount = blockCount;
-	}
+	IOLockLock ( fZoneLock );
 	
-	maxBlocksRead	= ReportDeviceMaxBlocksReadTransfer ( );
-	maxBlocksWrite	= ReportDeviceMaxBlocksWriteTransfer ( );
+	zoneInformation->zoneStart		= zone->start;
+	zoneInformation->zoneLength		= zone->length;
+	zoneInformation->writePointer	= zone->writePointer;
+	zoneInformation->zoneType		= zone->type;
+	zoneInformation->zoneCondition	= zone->condition;
 	
-	setProperty ( kIOMaximumBlockCountReadKey, maxBlocksRead, 64 );
-	setProperty ( kIOMaximumBlockCountWriteKey, maxBlocksWrite, 64 );
+	IOLockUnlock ( fZoneLock );
+	
+	
+ErrorExit:
+	
+	
+	return status;
 	
 }
 
 
 //
-//	 ResetMediumCharacteristics -	Resets medium characteristics to known
-//									values							[PROTECTED]
+//	 ReportBlockSize - Reports the medium block size.				   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::ResetMediumCharacteristics ( void )
+UInt64
+IOSCSIBlockCommandsDevice::ReportMediumBlockSize ( void )
 {
 	
-	fMediumBlockSize		= 0;
-	fMediumBlockCount 		= 0;
-	fMediumBlockCount64		= 0;
-	fMediumPresent			= false;
-	fMediumIsWriteProtected	= true;
-	fMediumRemovalPrevented	= false;
-
+	return fMediumBlockSize;
+	
 }
 
 
 //
-//	 CreateStorageServiceNub - Creates the linkage object for IOStorageFamily
-//								to use.								[PROTECTED]
+//	 ReportMediumTotalBlockCount - Reports total number of blocks on medium.
+//																	   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::CreateStorageServiceNub ( void )
+UInt64
+IOSCSIBlockCommandsDevice::ReportMediumTotalBlockCount ( void )
 {
 	
-	IOService * 	nub = NULL;
-	
-	nub = OSTypeAlloc ( IOBlockStorageServices );
-	require_nonzero ( nub, ErrorExit );
-	
-	nub->init ( );
-	require ( nub->attach ( this ), ErrorExit );
-	
-	nub->registerService ( );
-	nub->release ( );
-	
-	return;
-	
-	
-ErrorExit:
-	
-	
-	PANIC_NOW ( ( "IOSCSIBlockCommandsDevice::CreateStorageServiceNub failed" ) );
-	return;
+	return fMediumBlockCount64;
 	
 }
 
 
 //
-//	 ProcessPoll - Processes a poll for media.						[PROTECTED]
+//	 ReportMediumWriteProtection - Reports write protection characteristic
+//									of medium						   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::ProcessPoll ( void )
+bool
+IOSCSIBlockCommandsDevice::ReportMediumWriteProtection ( void )
 {
 	
-	switch ( fPollingMode )
-	{
-		
-		case kPollingMode_NewMedia:
-		{
-			PollForNewMedia ( );
-		}
-		break;
-		
-		case kPollingMode_MediaRemoval:
-		{
-			PollForMediaRemoval ( );
-		}
-		break;
-		
-		default:
-		{
-			
-			// This is an unknown polling mode -- do nothing.
-			ERROR_LOG ( ( "%s:ProcessPoll Unknown polling mode.\n", getName ( ) ) );
-			
-		}
-		break;
-		
-	}
+	return fMediumIsWriteProtected;
 	
 }
 
 
 //
-//	 PollForNewMedia - Polls for new media insertion.				[PROTECTED]
+//	 ReportDeviceMaxBlocksReadTransfer - Reports maximum read transfer blocks.
+//																	   [PUBLIC]
 //
 
-void
-IOSCSIBlockCommandsDevice::PollForNewMedia ( void )
+UInt64
+IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksReadTransfer ( void )
 {
+
+	UInt64	maxBlockCount 	= kDefaultMaxBlocksPerIO;
 	
-	bool			result	 	= false;
-	UInt64			blockCount	= 0;
-	UInt64			blockSize	= 0;
-	
-	// Since this is a poll for new media...	
-	fMediumPresent = false;
-	
-	result = DetermineMediaPresence ( );
-	require_quiet ( result, Exit );
-	
-	// If we got here, then we have found media
-	if ( fMediaIsRemovable == true )
-	{
-		fMediumRemovalPrevented = PreventMediumRemoval ( );
-	}
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksReadTransfer.\n" ) );
 	
-	else
+	// The transport's limits apply to each task. Larger requests are split
+	// by SendReadWriteRequest ( ), so report the request limit instead.
+	if ( fMediumBlockSize > 0 )
 	{
-		fMediumRemovalPrevented = true;
+		
+		maxBlockCount = GetReadWriteRequestBlockLimit ( fMediumBlockSize );
+		setProperty ( kIOMaximumByteCountReadKey, maxBlockCount * fMediumBlockSize, 64 );
+		
 	}
 	
-	result = DetermineMediumCapacity ( &blockSize, &blockCount );
-	require ( result, Exit );
-	
-	// Attempt to determine its geometry now.
-	DetermineMediumGeometry ( );
-	
-	// What happens if the medium is unformatted?
-	// A check should be added to handle this case.
-	
-	SetMediumCharacteristics ( blockSize, blockCount );
-	
-	fMediumIsWriteProtected = DetermineMediumWriteProtectState ( );
-	
-	fMediumPresent	= true;
-	fPollingMode	= kPollingMode_Suspended;
+	return maxBlockCount;
 	
-	// Set the icon for this type of media.
-	SetMediumIcon ( );
+}
+
+
+//
+//	 ReportDeviceMaxBlocksWriteTransfer -	Reports maximum write transfer
+//											in blocks.				   [PUBLIC]
+//
+
+UInt64
+IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksWriteTransfer ( void )
+{
+
+	UInt64	maxBlockCount 	= kDefaultMaxBlocksPerIO;
 	
-	// Message up the chain that we have media
-	messageClients ( kIOMessageMediaStateHasChanged,
-					 ( void * ) kIOMediaStateOnline,
-					 0 );
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportDeviceMaxBlocksWriteTransfer.\n" ) );
 	
-	if ( fMediumRemovalPrevented == false )
+	// The transport's limits apply to each task. Larger requests are split
+	// by SendReadWriteRequest ( ), so report the request limit instead.
+	if ( fMediumBlockSize > 0 )
 	{
 		
-		// Media is not locked into the drive, so this is most likely
-		// a manually ejectable device, start polling for media removal.
-		fPollingMode = kPollingMode_MediaRemoval;
-		fKnownManualEject = true;
-		fDeviceIsShared = true;
+		maxBlockCount = GetReadWriteRequestBlockLimit ( fMediumBlockSize );
+		setProperty ( kIOMaximumByteCountWriteKey, maxBlockCount * fMediumBlockSize, 64 );
 		
 	}
 	
+	return maxBlockCount;
 	
-Exit:
+}
+
+
+//
+//	 ReportDeviceMediaRemovability -	Reports removability characteristic
+//										of media					   [PUBLIC]
+//
+
+bool
+IOSCSIBlockCommandsDevice::ReportDeviceMediaRemovability ( void )
+{
 	
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::ReportMediaRemovability fMediaIsRemovable = %d\n",
+					( int ) fMediaIsRemovable ) );
 	
-	return;
+	return fMediaIsRemovable;
 	
 }
 
 
 //
-//	 DetermineMediaPresence - Checks if media has been inserted.	[PROTECTED]
+//	 serializeProperties - Refreshes the elevator and read-ahead statistics
+//							before the properties are serialized.	   [PUBLIC]
 //
 
 bool
-IOSCSIBlockCommandsDevice::DetermineMediaPresence ( void )
+IOSCSIBlockCommandsDevice::serializeProperties ( OSSerialize * s ) const
 {
 	
-	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier		request			= NULL;
-	bool					mediaFound 		= false;
-	OSBoolean *				keySwitchLocked = NULL;
+	( ( IOSCSIBlockCommandsDevice * ) this )->PublishElevatorStatistics ( );
+	( ( IOSCSIBlockCommandsDevice * ) this )->PublishReadStreamStatistics ( );
+	return super::serializeProperties ( s );
 	
-	keySwitchLocked = OSDynamicCast (
-							OSBoolean,
-							getProperty ( kAppleKeySwitchProperty ) );
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Protected Methods - Methods used by this class and subclasses
+#pragma mark -
+#endif
+
+
+//
+//	 InitializeDeviceSupport - Initializes device support			[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::InitializeDeviceSupport ( void )
+{
 	
-	if ( keySwitchLocked != NULL )
+	bool	setupSuccessful = false;
+	
+	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
+	
+	// Allocate space for our reserved data.
+	// Do this first to make sure that all expansion data is available before
+	// any real work is done since that work may need these.
+	fIOSCSIBlockCommandsDeviceReserved = IONew ( IOSCSIBlockCommandsDeviceExpansionData, 1 );
+	require_nonzero ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	
+	bzero ( fIOSCSIBlockCommandsDeviceReserved,
+			sizeof ( IOSCSIBlockCommandsDeviceExpansionData ) );
+	
+	// Initialize the device characteristics flags
+	fMediaIsRemovable 		= false;
+	fKnownManualEject		= false;
+	
+	// Initialize the medium characteristics
+	ResetMediumCharacteristics ( );
+	
+	// Grab any device information from the IORegistry
+	if ( getProperty ( kIOPropertySCSIDeviceCharacteristicsKey ) != NULL )
 	{
 		
-		// See if we should poll for media.
-		if ( keySwitchLocked->isTrue ( ) )
+		// There is a characteristics property for this device, check for known entries.
+		OSDictionary * characterDict = NULL;
+		
+		characterDict = OSDynamicCast (
+					OSDictionary,
+					getProperty ( kIOPropertySCSIDeviceCharacteristicsKey ) );
+		
+		// Check if the personality for this device specifies that this is known to be manual ejectable.
+		if ( characterDict->getObject ( kIOPropertySCSIManualEjectKey ) != NULL )
 		{
-			goto ErrorExit;
+			
+			STATUS_LOG ( ( "%s: found a Manual Eject property.\n", getName ( ) ) );
+			fKnownManualEject = true;
+			fDeviceIsShared = true;		
+			
+		}
+		
+		// Check if the personality for this device specifies that it uses solid state media.
+		if ( characterDict->getObject ( kIOPropertySCSISolidStateKey ) != NULL )
+		{
+			
+			STATUS_LOG ( ( "%s: found a Solid State property.\n", getName ( ) ) );
+			fDeviceIsSolidState = true;
+			
 		}
 		
 	}
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
-	
-	// Do a TEST_UNIT_READY to generate sense data
-	if ( TEST_UNIT_READY ( request, 0 ) == true )
+	if ( GetProtocolDriver ( )->getProperty ( kIOPropertyProtocolCharacteristicsKey ) != NULL )
 	{
 		
-		// The command was successfully built, now send it, set timeout to 10 seconds.
-		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		// There is a characteristics property for this device, check for known entries.
+		OSDictionary * characterDict = NULL;
+		
+		characterDict = OSDynamicCast (
+					OSDictionary,
+					GetProtocolDriver ( )->getProperty ( kIOPropertyProtocolCharacteristicsKey ) );
+		
+		// Check if the personality for this device specifies that this is known to be manual ejectable.
+		if ( characterDict->getObject ( kIOPropertySCSIProtocolMultiInitKey ) != NULL )
+		{
+			
+			fDeviceIsShared = true;		
+			
+		}
 		
 	}
 	
-	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
-	{
+	// Make sure the drive is ready for us!
+	require ( ClearNotReadyStatus ( ), ReleaseReservedMemory );
+	
+	setupSuccessful = DetermineDeviceCharacteristics ( );
+	
+	if ( setupSuccessful == true )
+	{		
 		
-		if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
+		fPollingMode = kPollingMode_NewMedia;
+		fPollingThread = thread_call_allocate (
+						( thread_call_func_t ) IOSCSIBlockCommandsDevice::sProcessPoll,
+						( thread_call_param_t ) this );
+		
+		require_nonzero_action_string ( fPollingThread,
+										ErrorExit,
+										setupSuccessful = false,
+										"fPollingThread allocation failed.\n" );
+		
+		// Devices without tagged queueing can not reorder requests themselves,
+		// so sort them here unless the medium has no seek penalty. The device
+		// still works without the elevator if it can not be allocated.
+		if ( ( GetCMDQUE ( ) == false ) && ( fDeviceIsSolidState == false ) )
 		{
 			
-			bool					validSense 	= false;
-			SCSI_Sense_Data			senseBuffer	= { 0 };
-			IOMemoryDescriptor *	bufferDesc	= NULL;
+			if ( InitializeElevator ( ) == false )
+			{
+				ERROR_LOG ( ( "%s: elevator allocation failed.\n", getName ( ) ) );
+			}
 			
-			validSense = GetAutoSenseData ( request, &senseBuffer );
-			if ( validSense == false )
+		}
+		
+		// Read-ahead is an optimization only, so carry on without it.
+		if ( InitializeReadStreams ( ) == false )
+		{
+			ERROR_LOG ( ( "%s: read stream allocation failed.\n", getName ( ) ) );
+		}
+		
+		// Start with completion coalescing off, as for a queue depth of one.
+		{
+			
+			SCSICompletionCoalescing	settings = { 0, 0 };
+			
+			fCompletionCoalescingSupported = GetProtocolDriver ( )->IsProtocolServiceSupported (
+													kSCSIProtocolFeature_CompletionCoalescing,
+													&settings );
+			
+			if ( fCompletionCoalescingSupported == true )
 			{
 				
-				bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
-																kSenseDefaultSize,
-																kIODirectionIn );
-				require_nonzero ( bufferDesc, ReleaseTask );
-				
-				// Get the sense data to determine if media is present.
-				if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
-				{
-					
-					// The command was successfully built, now send it
-					serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-					
-				}
-				
-				bufferDesc->release ( );
-				bufferDesc = NULL;
-				
-				if ( ( serviceResponse != kSCSIServiceResponse_TASK_COMPLETE ) ||
-		 			 ( GetTaskStatus ( request ) != kSCSITaskStatus_GOOD ) )
-		 		{
-					
-					ERROR_LOG ( ( "%s: REQUEST_SENSE failed\n", getName ( ) ) );
-					goto ReleaseTask;
-					
-		 		}
-				
-			}
-			
-			if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x00 ) &&
-				 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) )
-			{
-				
-				STATUS_LOG ( ( "Media found\n" ) );
-				mediaFound = true;
-				
-			}
-			
-			else
-			{
-				
-				ERROR_LOG ( ( "ASC = 0x%02x, ASCQ = 0x%02x\n",
-								senseBuffer.ADDITIONAL_SENSE_CODE,
-								senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+				settings = sCompletionCoalescingSettings[kSBCCoalescingLevel_Off];
+				fCompletionCoalescingLevel				= kSBCCoalescingLevel_Off;
+				fCompletionCoalescingProgrammedLevel	= kSBCCoalescingLevel_Off;
+				fCompletionCoalescingProgramming		= 0;
+				GetProtocolDriver ( )->HandleProtocolServiceFeature (
+													kSCSIProtocolFeature_CompletionCoalescing,
+													&settings );
 				
 			}
 			
 		}
 		
-		else
-		{
-			
-			STATUS_LOG ( ( "Media found\n" ) );
-			mediaFound = true;
-			
-		}
+		InitializePowerManagement ( GetProtocolDriver ( ) );
 		
 	}
 	
+	STATUS_LOG ( ( "%s::%s setupSuccessful = %d\n", getName ( ),
+					__FUNCTION__, setupSuccessful ) );
+
+	// This needs to be called regardless of the state of the Medium Characteristics
+	// to insure that the IORegistry properties for the maximum transfers are set, otherwise,
+	// the IOStorageFamily will use the defaults.
+	SetMediumCharacteristics ( ( UInt64 ) 0, ( UInt64 ) 0 );
+	
+	return setupSuccessful;
+	
 	
-ReleaseTask:
+ReleaseReservedMemory:
 	
 	
-	require_nonzero_quiet ( request, ErrorExit );
-	ReleaseSCSITask ( request );
-	request = NULL;
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	IODelete ( fIOSCSIBlockCommandsDeviceReserved, IOSCSIBlockCommandsDeviceExpansionData, 1 );
+	fIOSCSIBlockCommandsDeviceReserved = NULL;	
 	
 	
 ErrorExit:
 	
 	
-	return mediaFound;
+	return setupSuccessful;
 	
 }
 
 
 //
-//	 PreventMediumRemoval - Prevents Medium Removal.				[PROTECTED]
+//	 StartDeviceSupport - Starts device support					[PROTECTED]
 //
 
-bool
-IOSCSIBlockCommandsDevice::PreventMediumRemoval ( void )
+void
+IOSCSIBlockCommandsDevice::StartDeviceSupport ( void )
 {
 	
-	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier		request			= NULL;
-	bool  					mediumLocked	= false;
-	
-	// Before forcing work to be done, verify that it is necessary by checking
-	// if this is a known manual eject device.
-	require ( ( fKnownManualEject == false ), Exit );
+	// Start polling
+	EnablePolling ( );
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, Exit );
+	CreateStorageServiceNub ( );
+}
+
+
+//
+//	 SuspendDeviceSupport - Suspends device support				[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::SuspendDeviceSupport ( void )
+{
 	
-	if ( PREVENT_ALLOW_MEDIUM_REMOVAL ( request, kMediaStateLocked, 0 ) == true )
+	if ( fPollingMode != kPollingMode_Suspended )
 	{
-		
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-		
+		DisablePolling ( );
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-	 	 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+}
+
+
+//
+//	 ResumeDeviceSupport - Resumes device support					[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::ResumeDeviceSupport ( void )
+{
+	
+	if ( fMediumPresent == false )
 	{
 		
-		mediumLocked = true;
+		// The driver has not found media in the device, restart
+		// the polling for new media.
+		fPollingMode = kPollingMode_NewMedia;
+		EnablePolling ( );
 		
 	}
 	
-	ReleaseSCSITask ( request );
-	
-	
-Exit:
-	
-	
-	return mediumLocked;
-	
 }
 
 
 //
-//	 DetermineMediumCapacity - Determines capacity of the medium.	[PROTECTED]
+//	 StopDeviceSupport - Stops device support						[PROTECTED]
 //
 
-bool
-IOSCSIBlockCommandsDevice::DetermineMediumCapacity (
-					UInt64 * blockSize,
-					UInt64 * blockCount )
+void
+IOSCSIBlockCommandsDevice::StopDeviceSupport ( void )
+{
+	DisablePolling ( );
+}
+
+
+//
+//	 TerminateDeviceSupport - Terminates device support			[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::TerminateDeviceSupport ( void )
 {
 	
-	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSI_Capacity_Data		capacityData	= { 0 };
-	IOMemoryDescriptor *	bufferDesc		= NULL;
-	SCSITaskIdentifier		request			= NULL;
-	bool					result			= false;
-	
-	*blockSize 	= 0;
-	*blockCount = 0;
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
-	
-	bufferDesc = IOMemoryDescriptor::withAddress ( &capacityData,
-												   kREPORT_CAPACITY_DataSize,
-												   kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseTask );
-	
-	// We found media, get its capacity
-	if ( READ_CAPACITY ( request, bufferDesc, 0, 0x00, 0, 0 ) == true )
+	if ( fPollingThread != NULL )
 	{
 		
-		// The command was successfully built, now send it.
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		thread_call_free ( fPollingThread );
+		fPollingThread = NULL;
 		
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	// Release all memory/objects associated with the reserved fields.
+	if ( fPowerDownNotifier != NULL )
 	{
 		
-		*blockSize 	= OSSwapBigToHostInt32 ( capacityData.BLOCK_LENGTH_IN_BYTES );
-		*blockCount = ( ( UInt64 ) OSSwapBigToHostInt32 ( capacityData.RETURNED_LOGICAL_BLOCK_ADDRESS ) ) + 1;
-		
-		// Since valid capacity data was retreived from the device, set the
-		// result to true here so that if the READ CAPACITY 16 fails for any reason,
-		// the caller will still be notified that valid data was retrieved from the device.		
-		result = true;
-
-		// SBC-2 Spec 5.14 states that if the LBA address is 0xFFFFFFFF (kREPORT_CAPACITY_MaximumLBA),
-		// and the device is SPC-3/SBC-2 compliant, we shall issue a READ_CAPACITY_16 command.
-		if ( ( capacityData.RETURNED_LOGICAL_BLOCK_ADDRESS == kREPORT_CAPACITY_MaximumLBA ) &&
-			 ( GetANSIVersion ( ) >= kINQUIRY_ANSI_VERSION_SCSI_SPC_3_Compliant ) )
-		{
-			
-			SCSI_Capacity_Data_Long  longCapacityData = { 0 };
-			
-			// We need to release the previous bufferDesc
-			bufferDesc->release ( );
-			bufferDesc = IOMemoryDescriptor::withAddress (  &longCapacityData, 
-															kREPORT_CAPACITY_16_DataSize,
-															kIODirectionIn );
-			require_nonzero ( bufferDesc, ReleaseTask );
-			
-			if ( READ_CAPACITY_16 ( request, bufferDesc, 0, kREPORT_CAPACITY_16_DataSize, 0, 0 ) == true )
-			{
-			
-				serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-				
-				if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-					 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
-				{
-					
-					*blockSize  = OSSwapBigToHostInt32 ( longCapacityData.BLOCK_LENGTH_IN_BYTES );
-					*blockCount = OSSwapBigToHostInt64 ( longCapacityData.RETURNED_LOGICAL_BLOCK_ADDRESS ) + 1;
-					
-				}
-				
-			}
-			
-		}
-		
-		STATUS_LOG ( ( "%s: Media capacity: %qx and block size: %qx\n", getName ( ), *blockCount, *blockSize ) );
+		// remove() will also call release() on this object (IONotifier).
+		// See IONotifier.h for more info.
+		fPowerDownNotifier->remove ( );
+		fPowerDownNotifier = NULL;
 		
 	}
 	
-	bufferDesc->release ( );
-	bufferDesc = NULL;
-	
+}
+
+
+//
+//	 CreateCommandSetObjects - Creates command set objects			[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::CreateCommandSetObjects ( void )
+{
 	
-ReleaseTask:
+	bool	result = false;
 	
+	fSCSIBlockCommandObject =
+		SCSIBlockCommands::CreateSCSIBlockCommandObject ( );
+	require_nonzero ( fSCSIBlockCommandObject, ErrorExit );
 	
-	require_nonzero_quiet ( request, ErrorExit );
-	ReleaseSCSITask ( request );
-	request = NULL;
+	result = true;
 	
 	
 ErrorExit:
@@ -1774,435 +2588,5798 @@ ErrorExit:
 
 
 //
-//	 DetermineMediumGeometry - Determines geometry of the medium.	[PROTECTED]
+//	 FreeCommandSetObjects - Releases command set objects			[PROTECTED]
 //
 
 void
-IOSCSIBlockCommandsDevice::DetermineMediumGeometry ( void )
+IOSCSIBlockCommandsDevice::FreeCommandSetObjects ( void )
 {
 	
-	IOBufferMemoryDescriptor *	bufferDesc				= NULL;
-	OSDictionary *				dict					= NULL;
-	IOReturn					status					= kIOReturnSuccess;
-	UInt32						minBufferSize			= 0;
-	UInt16						blockDescriptorLength	= 0;
-	UInt32						modeDataLength			= 0;
-	UInt8						headerSize				= 0;
-	UInt8 *						buffer					= NULL;
-	bool						use10ByteModeSense		= true;
-	
-	require_quiet ( ( fMediaIsRemovable == false ), ErrorExit );
-	
-	dict = OSDictionary::withCapacity ( kNumberMediumGeometryKeys );
-	require_nonzero ( dict, ErrorExit );
-	
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader10 ), kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseDictionary );
+	if ( fSCSIBlockCommandObject != NULL )
+	{
+		
+		fSCSIBlockCommandObject->release ( );
+		fSCSIBlockCommandObject = NULL;
+  		
+	}
+	
+	// Release the reserved structure.
+	if ( fIOSCSIBlockCommandsDeviceReserved != NULL )
+	{
+		
+		FreeElevator ( );
+		FreeReadStreams ( );
+		FreeZones ( );
+		IODelete ( fIOSCSIBlockCommandsDeviceReserved, IOSCSIBlockCommandsDeviceExpansionData, 1 );
+		fIOSCSIBlockCommandsDeviceReserved = NULL;
+		
+	}
+	
+}
+
+
+//
+//	 GetSCSIBlockCommandObject - Accessor method					[PROTECTED]
+//
+
+SCSIBlockCommands *
+IOSCSIBlockCommandsDevice::GetSCSIBlockCommandObject ( void )
+{
+	
+	check ( fSCSIBlockCommandObject );
+	return fSCSIBlockCommandObject;
+	
+}
+
+
+//
+//	 GetSCSIPrimaryCommandObject - Accessor method					[PROTECTED]
+//
+
+SCSIPrimaryCommands	*
+IOSCSIBlockCommandsDevice::GetSCSIPrimaryCommandObject ( void )
+{
+	
+	check ( fSCSIBlockCommandObject );
+	return OSDynamicCast ( SCSIPrimaryCommands,
+						   GetSCSIBlockCommandObject ( ) );
+	
+}
+
+
+//
+//	 ClearNotReadyStatus - Clears any NOT_READY status on device	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::ClearNotReadyStatus ( void )
+{
+	
+	SCSI_Sense_Data				senseBuffer		= { 0 };
+	IOMemoryDescriptor *		bufferDesc		= NULL;
+	SCSIServiceResponse 		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	bool						driveReady 		= false;
+	bool						result 			= true;
+	
+	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
+													kSenseDefaultSize,
+													kIODirectionIn );
+	
+	check ( bufferDesc );
+	
+	request = GetSCSITask ( );
+	
+	check ( request );
+	
+	do
+	{
+		
+		if ( TEST_UNIT_READY ( request, 0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+			
+		}
+		
+		if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+		{
+			
+			bool validSense = false;
+			
+			if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
+			{
+				
+				validSense = GetAutoSenseData ( request, &senseBuffer );
+				if ( validSense == false )
+				{
+					
+					if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0  ) == true )
+					{
+						
+						// The command was successfully built, now send it
+						serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+						
+					}
+					
+					if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+					{
+						
+						validSense = true;
+						
+					}
+					
+				}
+				
+				if ( validSense == true )
+				{
+					
+					if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY ) &&
+								( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
+							( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x01 ) )
+					{
+						
+						STATUS_LOG ( ( "%s::drive not ready\n", getName ( ) ) );
+						driveReady = false;
+						IOSleep ( 200 );
+						
+					}
+					
+					else if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY  ) &&
+							( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
+							( ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ||
+							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x02 ) ||
+							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x03 ) ) )
+					{
+						
+						// The drive needs to be spun up. Issue a START_STOP_UNIT to it.
+						if ( START_STOP_UNIT ( request, 0x00, 0x00, 0x00, 0x01, 0x00 ) == true )
+						{
+							
+							serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+							
+						}
+						
+					}
+					
+					else
+					{
+						
+						driveReady = true;
+						STATUS_LOG ( ( "%s::drive READY\n", getName ( ) ) );
+						
+					}
+					
+					STATUS_LOG ( ( "sense data: %01x, %02x, %02x\n",
+								 ( senseBuffer.SENSE_KEY  & kSENSE_KEY_Mask ),
+								   senseBuffer.ADDITIONAL_SENSE_CODE,
+								   senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+					
+				}
+				
+			}
+			
+			else
+			{
+				
+				driveReady = true;
+				
+			}
+			
+		}
+		
+		else
+		{
+			
+			// the command failed - perhaps the device was hot unplugged
+			// give other threads some time to run.
+			IOSleep ( 200 );
+			
+		}
+	
+	// check isInactive in case device was hot unplugged during sleep
+	// and we are in an infinite loop here
+	} while ( ( driveReady == false ) && ( isInactive ( ) == false ) );
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	ReleaseSCSITask ( request );
+	
+	result = isInactive ( ) ? false : true;
+	
+	return result;
+	
+}
+
+
+//
+//	 EnablePolling - Schedules the polling thread to run			[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::EnablePolling ( void )
+{		
+	
+	AbsoluteTime	time;
+	
+	// No reason to start a thread if we've been terminatated
+	require ( ( isInactive ( ) == false ), Exit );
+	require ( fPollingThread, Exit );
+	require ( ( fPollingMode != kPollingMode_Suspended ), Exit );
+	
+	// Retain ourselves so that this object doesn't go away
+	// while we are polling
+	
+	retain ( );
+	
+	clock_interval_to_deadline ( 1000, kMillisecondScale, &time );
+	thread_call_enter_delayed ( fPollingThread, time );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 DisablePolling - Unschedules the polling thread if it hasn't run yet
+//																	[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::DisablePolling ( void )
+{		
+	
+	fPollingMode = kPollingMode_Suspended;
+	
+	// Cancel the thread if it is scheduled to run
+	require ( thread_call_cancel ( fPollingThread ), Exit );
+	
+	// It was running, so we balance out the retain()
+	// with a release()
+	release ( );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 DetermineDeviceCharacteristics - Determines device characteristics
+//																	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::DetermineDeviceCharacteristics ( void )
+{
+	
+	SCSIServiceResponse 			serviceResponse 	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier				request 			= NULL;
+	IOBufferMemoryDescriptor *		buffer	 			= NULL;
+	IOReturn						status				= kIOReturnSuccess;
+	SCSICmd_INQUIRY_StandardData * 	inquiryBuffer 		= NULL;
+	OSDictionary *					protocolDict		= NULL;
+	OSString *						interconnect		= NULL;
+	UInt8							inquiryBufferSize	= 0;
+	UInt8							cdbSizeMask			= 0;
+	UInt8							loop				= 0;
+	bool							succeeded			= false;
+	bool							WCEBit				= false;
+
+	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
+	
+	if ( fDefaultInquiryCount == 0 )
+	{
+		
+		// There is no default Inquiry count for this device, use the standard
+		// structure size.
+		STATUS_LOG ( ( "%s: use sizeof(SCSICmd_INQUIRY_StandardData) for Inquiry.\n", getName ( ) ) );
+		inquiryBufferSize = sizeof ( SCSICmd_INQUIRY_StandardData );
+		
+	}
+	
+	else
+	{
+		
+		// This device has a default inquiry count, use it.
+		STATUS_LOG ( ( "%s: use fDefaultInquiryCount for Inquiry.\n", getName ( ) ) );
+		inquiryBufferSize = fDefaultInquiryCount;
+		
+	}
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( inquiryBufferSize, kIODirectionIn );
+	require_nonzero_string ( buffer, ErrorExit,
+							 "Couldn't allocate INQUIRY memory descriptor" );
+	
+	inquiryBuffer = ( SCSICmd_INQUIRY_StandardData * ) buffer->getBytesNoCopy ( );
+	require_nonzero_string ( inquiryBuffer, ReleaseDescriptor,
+							 "Couldn't allocate INQUIRY buffer" );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	for ( loop = 0; ( ( loop < kMaxRetryCount ) && ( isInactive ( ) == false ) ); loop++ )
+	{
+		
+		if ( INQUIRY ( 	request,
+						buffer,
+						0,
+						0,
+						0x00,
+						inquiryBufferSize,
+						0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+			
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			succeeded = true;
+			break;
+			
+		}
+		
+		ERROR_LOG ( ( "!!! INQUIRY failed !!!, serviceResponse = %d, taskStatus = %d\n",
+					  serviceResponse, GetTaskStatus ( request ) ) );
+		
+		// Sleep for 1 second to try to let the device come online in case it
+		// just failed by freak occurrence (INQUIRY should NEVER fail, but apparently
+		// it sometimes does...)
+		IOSleep ( 1000 );
+		
+	}
+	
+	require ( succeeded, ReleaseTask );
+	
+	// Save ANSI version of the device
+	SetANSIVersion ( inquiryBuffer->VERSION & kINQUIRY_ANSI_VERSION_Mask );
+	
+	// Deprecated, but left here for sake of compatibility
+	fANSIVersion = GetANSIVersion ( );
+	
+	if ( ( inquiryBuffer->RMB & kINQUIRY_PERIPHERAL_RMB_BitMask ) ==
+		   kINQUIRY_PERIPHERAL_RMB_MediumRemovable )
+	{
+		
+		STATUS_LOG ( ( "Media is removable\n" ) );
+		fMediaIsRemovable = true;
+		
+	}
+	
+	else
+	{
+		
+		STATUS_LOG ( ( "Media is NOT removable\n" ) );
+		fMediaIsRemovable = false;
+		
+	}
+	
+	// Set the CMDQUE value so we know whether or not to enable TCQ.
+	SetCMDQUE ( inquiryBuffer->flags2 & kINQUIRY_Byte7_CMDQUE_Mask );
+	
+	// The 3PC bit says the device can act as an EXTENDED COPY copy manager.
+	fExtendedCopySupported			= ( ( inquiryBuffer->SCCSReserved & kINQUIRY_Byte5_3PC_Mask ) != 0 );
+	fExtendedCopyParametersValid	= false;
+	
+	// Host managed zoned devices have their own device type. Host aware
+	// ones are found from the Block Device Characteristics page below.
+	if ( ( inquiryBuffer->PERIPHERAL_DEVICE_TYPE & kINQUIRY_PERIPHERAL_TYPE_Mask ) ==
+		 kINQUIRY_PERIPHERAL_TYPE_HostManagedZonedBlockDevice )
+	{
+		fZonedModel = kSBCZonedModelHostManaged;
+	}
+	
+	// Pick the read and write CDB sizes the device implements. READ/WRITE(6)
+	// are mandatory for SCSI-1 and SCSI-2 devices and obsolete after that.
+	// They are only used on the parallel bus, since many USB and FireWire
+	// bridges which claim SCSI-2 reject them. READ/WRITE(12) are defined for
+	// optical memory devices, and READ/WRITE(16) from SBC-2 (SPC-3) on.
+	// SetMediumCharacteristics ( ) also enables the 16 byte forms for media
+	// the 10 byte forms can not address.
+	cdbSizeMask = kSCSIReadWriteCDBSize_10ByteMask;
+	
+	protocolDict = GetProtocolCharacteristicsDictionary ( );
+	if ( protocolDict != NULL )
+	{
+		interconnect = OSDynamicCast ( OSString, protocolDict->getObject ( kIOPropertyPhysicalInterconnectTypeKey ) );
+	}
+	
+	if ( ( ( GetANSIVersion ( ) == kINQUIRY_ANSI_VERSION_SCSI_1_Compliant ) ||
+		   ( GetANSIVersion ( ) == kINQUIRY_ANSI_VERSION_SCSI_2_Compliant ) ) &&
+		 ( interconnect != NULL ) &&
+		 ( interconnect->isEqualTo ( kIOPropertyPhysicalInterconnectTypeSCSIParallel ) ) )
+	{
+		cdbSizeMask |= kSCSIReadWriteCDBSize_6ByteMask;
+	}
+	
+	if ( ( inquiryBuffer->PERIPHERAL_DEVICE_TYPE & kINQUIRY_PERIPHERAL_TYPE_Mask ) ==
+		 kINQUIRY_PERIPHERAL_TYPE_OpticalMemorySBCDevice )
+	{
+		cdbSizeMask |= kSCSIReadWriteCDBSize_12ByteMask;
+	}
+	
+	if ( GetANSIVersion ( ) >= kINQUIRY_ANSI_VERSION_SCSI_SPC_3_Compliant )
+	{
+		cdbSizeMask |= kSCSIReadWriteCDBSize_16ByteMask;
+	}
+	
+	SetReadWriteCDBSizeMask ( cdbSizeMask );
+	
+	// Everything but the block size is known now, so capture the read and
+	// write task templates. Reads and writes still work through the command
+	// builders if they can not be allocated.
+	if ( InitializeReadWriteTaskTemplates ( fMediumBlockSize ) == false )
+	{
+		ERROR_LOG ( ( "%s: read/write task template allocation failed.\n", getName ( ) ) );
+	}
+	
+	// Find out which block device VPD pages the device supports and what
+	// logical block provisioning commands it implements.
+	DetermineBlockDeviceVPDPages ( );
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	// Check the current state of the write cache.
+	status = GetWriteCacheState ( &WCEBit );
+	
+	// Is the write cache turned off?
+	if ( ( WCEBit == false ) && ( status == kIOReturnSuccess ) )
+	{
+		
+		// Try to turn the write cache on.
+		status = SetWriteCacheState ( true );
+		if ( status == kIOReturnSuccess )
+		{
+			
+			// We succeeded turning the write cache on.
+			WCEBit = true;
+			
+		}
+		
+	}
+	
+	fWriteCacheEnabled = WCEBit;
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ReleaseDescriptor );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( buffer, ErrorExit );
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	STATUS_LOG ( ( "%s::%s succeeded = %d\n", getName ( ), __FUNCTION__, succeeded ) );
+	
+	return succeeded;
+	
+}
+
+
+//
+//	 SetMediumCharacteristics - Sets medium characteristics		[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::SetMediumCharacteristics (
+							UInt32	blockSize,
+							UInt32	blockCount )
+{
+	
+	SetMediumCharacteristics ( ( UInt64 ) blockSize, ( UInt64 ) blockCount );
+	
+}
+
+
+//
+//	 SetMediumCharacteristics64 - Sets medium characteristics		[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::SetMediumCharacteristics (
+							UInt64	blockSize,
+							UInt64	blockCount )
+{
+	
+	UInt64		maxBlocksRead	= 0;
+	UInt64		maxBlocksWrite	= 0;
+	UInt64		physicalSize	= 0;
+	
+	STATUS_LOG ( ( "mediumBlockSize = %qd, blockCount = %qd\n",
+					blockSize, blockCount ) );
+	
+	fMediumBlockSize	= blockSize;
+	fMediumBlockCount64 = blockCount;
+	
+	SetReadWriteTaskTemplateBlockSize ( blockSize );
+	
+	if ( fMediumBlockCount64 > kREPORT_CAPACITY_MaximumLBA )
+	{
+		
+		// The medium has more LBAs than can be reported in the 32 bit
+		// fMediumBlockCount variable, so set it to the maximum that it can report.
+		fMediumBlockCount = kREPORT_CAPACITY_MaximumLBA;
+		
+		// Only the 16 byte forms can address the end of the medium, and the
+		// capacity was read with READ CAPACITY(16), so the device has them.
+		SetReadWriteCDBSizeMask ( GetReadWriteCDBSizeMask ( ) | kSCSIReadWriteCDBSize_16ByteMask );
+		
+	}
+	
+	else
+	{
+		fMediumBlockCount = blockCount;
+	}
+	
+	maxBlocksRead	= ReportDeviceMaxBlocksReadTransfer ( );
+	maxBlocksWrite	= ReportDeviceMaxBlocksWriteTransfer ( );
+	
+	setProperty ( kIOMaximumBlockCountReadKey, maxBlocksRead, 64 );
+	setProperty ( kIOMaximumBlockCountWriteKey, maxBlocksWrite, 64 );
+	
+	// Let the layers above know the transfer size and alignment the device
+	// prefers, if it told us.
+	if ( ( fMediumBlockSize > 0 ) && ( fOptimalTransferLength > 0 ) )
+	{
+		setProperty ( kIOPropertyOptimalTransferByteCountKey, fOptimalTransferLength * fMediumBlockSize, 64 );
+	}
+	
+	if ( ( fMediumBlockSize > 0 ) && ( fOptimalTransferLengthGranularity > 0 ) )
+	{
+		setProperty ( kIOPropertyOptimalTransferGranularityKey, fOptimalTransferLengthGranularity * fMediumBlockSize, 64 );
+	}
+	
+	// Publish the physical block size and where the first whole physical
+	// block starts, so filesystems on 512 byte emulation drives can keep
+	// their writes aligned. Split reads and writes are realigned as well.
+	if ( fMediumBlockSize > 0 )
+	{
+		
+		physicalSize = fMediumBlockSize << fMediumPhysicalBlockExponent;
+		
+		setProperty ( kIOPropertyPhysicalBlockSizeKey, physicalSize, 64 );
+		setProperty ( kIOPropertyPhysicalBlockAlignmentOffsetKey,
+					  fMediumLowestAlignedBlock * fMediumBlockSize, 64 );
+		
+		fDeviceCharacteristicsDictionary->setObject (
+								kIOPropertyPhysicalBlockSizeKey,
+								getProperty ( kIOPropertyPhysicalBlockSizeKey ) );
+		fDeviceCharacteristicsDictionary->setObject (
+								kIOPropertyPhysicalBlockAlignmentOffsetKey,
+								getProperty ( kIOPropertyPhysicalBlockAlignmentOffsetKey ) );
+		
+	}
+	
+	SetReadWriteTransferAlignment ( 1 << fMediumPhysicalBlockExponent,
+									fMediumLowestAlignedBlock );
+	
+	PublishLogicalBlockProvisioning ( );
+	
+	// The zone layout of a zoned device never changes, so the zone table
+	// is only read the first time the medium is found.
+	if ( ( fZonedModel != kSBCZonedModelNone ) && ( fZones == NULL ) && ( blockCount > 0 ) )
+	{
+		
+		if ( InitializeZones ( ) == false )
+		{
+			ERROR_LOG ( ( "%s: zone table could not be read.\n", getName ( ) ) );
+		}
+		
+	}
+	
+}
+
+
+//
+//	 ResetMediumCharacteristics -	Resets medium characteristics to known
+//									values							[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::ResetMediumCharacteristics ( void )
+{
+	
+	fMediumBlockSize		= 0;
+	fMediumBlockCount 		= 0;
+	fMediumBlockCount64		= 0;
+	fMediumPresent			= false;
+	fMediumIsWriteProtected	= true;
+	fMediumRemovalPrevented	= false;
+	
+	SetReadWriteTaskTemplateBlockSize ( 0 );
+	
+	if ( fIOSCSIBlockCommandsDeviceReserved != NULL )
+	{
+		
+		fMediumLBPME					= false;
+		fMediumLBPRZ					= false;
+		fMediumPhysicalBlockExponent	= 0;
+		fMediumLowestAlignedBlock		= 0;
+		
+		SetReadWriteTransferAlignment ( 1, 0 );
+		PublishLogicalBlockProvisioning ( );
+		ResetReadStreams ( );
+		
+	}
+	
+	// The physical block layout belongs to the medium, so don't leave it
+	// behind for the next one.
+	removeProperty ( kIOPropertyPhysicalBlockSizeKey );
+	removeProperty ( kIOPropertyPhysicalBlockAlignmentOffsetKey );
+	
+	if ( fDeviceCharacteristicsDictionary != NULL )
+	{
+		
+		fDeviceCharacteristicsDictionary->removeObject ( kIOPropertyPhysicalBlockSizeKey );
+		fDeviceCharacteristicsDictionary->removeObject ( kIOPropertyPhysicalBlockAlignmentOffsetKey );
+		
+	}
+
+}
+
+
+//
+//	 CreateStorageServiceNub - Creates the linkage object for IOStorageFamily
+//								to use.								[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::CreateStorageServiceNub ( void )
+{
+	
+	IOService * 	nub = NULL;
+	
+	nub = OSTypeAlloc ( IOBlockStorageServices );
+	require_nonzero ( nub, ErrorExit );
+	
+	nub->init ( );
+	require ( nub->attach ( this ), ErrorExit );
+	
+	nub->registerService ( );
+	nub->release ( );
+	
+	return;
+	
+	
+ErrorExit:
+	
+	
+	PANIC_NOW ( ( "IOSCSIBlockCommandsDevice::CreateStorageServiceNub failed" ) );
+	return;
+	
+}
+
+
+//
+//	 ProcessPoll - Processes a poll for media.						[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::ProcessPoll ( void )
+{
+	
+	switch ( fPollingMode )
+	{
+		
+		case kPollingMode_NewMedia:
+		{
+			PollForNewMedia ( );
+		}
+		break;
+		
+		case kPollingMode_MediaRemoval:
+		{
+			PollForMediaRemoval ( );
+		}
+		break;
+		
+		default:
+		{
+			
+			// This is an unknown polling mode -- do nothing.
+			ERROR_LOG ( ( "%s:ProcessPoll Unknown polling mode.\n", getName ( ) ) );
+			
+		}
+		break;
+		
+	}
+	
+}
+
+
+//
+//	 PollForNewMedia - Polls for new media insertion.				[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::PollForNewMedia ( void )
+{
+	
+	bool			result	 	= false;
+	UInt64			blockCount	= 0;
+	UInt64			blockSize	= 0;
+	
+	// Since this is a poll for new media...	
+	fMediumPresent = false;
+	
+	result = DetermineMediaPresence ( );
+	require_quiet ( result, Exit );
+	
+	// If we got here, then we have found media
+	if ( fMediaIsRemovable == true )
+	{
+		fMediumRemovalPrevented = PreventMediumRemoval ( );
+	}
+	
+	else
+	{
+		fMediumRemovalPrevented = true;
+	}
+	
+	result = DetermineMediumCapacity ( &blockSize, &blockCount );
+	require ( result, Exit );
+	
+	// Attempt to determine its geometry now.
+	DetermineMediumGeometry ( );
+	
+	// What happens if the medium is unformatted?
+	// A check should be added to handle this case.
+	
+	SetMediumCharacteristics ( blockSize, blockCount );
+	
+	fMediumIsWriteProtected = DetermineMediumWriteProtectState ( );
+	
+	fMediumPresent	= true;
+	fPollingMode	= kPollingMode_Suspended;
+	
+	// Set the icon for this type of media.
+	SetMediumIcon ( );
+	
+	// Message up the chain that we have media
+	messageClients ( kIOMessageMediaStateHasChanged,
+					 ( void * ) kIOMediaStateOnline,
+					 0 );
+	
+	if ( fMediumRemovalPrevented == false )
+	{
+		
+		// Media is not locked into the drive, so this is most likely
+		// a manually ejectable device, start polling for media removal.
+		fPollingMode = kPollingMode_MediaRemoval;
+		fKnownManualEject = true;
+		fDeviceIsShared = true;
+		
+	}
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 DetermineMediaPresence - Checks if media has been inserted.	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::DetermineMediaPresence ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	bool					mediaFound 		= false;
+	OSBoolean *				keySwitchLocked = NULL;
+	
+	keySwitchLocked = OSDynamicCast (
+							OSBoolean,
+							getProperty ( kAppleKeySwitchProperty ) );
+	
+	if ( keySwitchLocked != NULL )
+	{
+		
+		// See if we should poll for media.
+		if ( keySwitchLocked->isTrue ( ) )
+		{
+			goto ErrorExit;
+		}
+		
+	}
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	// Do a TEST_UNIT_READY to generate sense data
+	if ( TEST_UNIT_READY ( request, 0 ) == true )
+	{
+		
+		// The command was successfully built, now send it, set timeout to 10 seconds.
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		
+		if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
+		{
+			
+			bool					validSense 	= false;
+			SCSI_Sense_Data			senseBuffer	= { 0 };
+			IOMemoryDescriptor *	bufferDesc	= NULL;
+			
+			validSense = GetAutoSenseData ( request, &senseBuffer );
+			if ( validSense == false )
+			{
+				
+				bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
+																kSenseDefaultSize,
+																kIODirectionIn );
+				require_nonzero ( bufferDesc, ReleaseTask );
+				
+				// Get the sense data to determine if media is present.
+				if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
+				{
+					
+					// The command was successfully built, now send it
+					serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+					
+				}
+				
+				bufferDesc->release ( );
+				bufferDesc = NULL;
+				
+				if ( ( serviceResponse != kSCSIServiceResponse_TASK_COMPLETE ) ||
+		 			 ( GetTaskStatus ( request ) != kSCSITaskStatus_GOOD ) )
+		 		{
+					
+					ERROR_LOG ( ( "%s: REQUEST_SENSE failed\n", getName ( ) ) );
+					goto ReleaseTask;
+					
+		 		}
+				
+			}
+			
+			if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x00 ) &&
+				 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) )
+			{
+				
+				STATUS_LOG ( ( "Media found\n" ) );
+				mediaFound = true;
+				
+			}
+			
+			else
+			{
+				
+				ERROR_LOG ( ( "ASC = 0x%02x, ASCQ = 0x%02x\n",
+								senseBuffer.ADDITIONAL_SENSE_CODE,
+								senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+				
+			}
+			
+		}
+		
+		else
+		{
+			
+			STATUS_LOG ( ( "Media found\n" ) );
+			mediaFound = true;
+			
+		}
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ErrorExit );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return mediaFound;
+	
+}
+
+
+//
+//	 PreventMediumRemoval - Prevents Medium Removal.				[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::PreventMediumRemoval ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	bool  					mediumLocked	= false;
+	
+	// Before forcing work to be done, verify that it is necessary by checking
+	// if this is a known manual eject device.
+	require ( ( fKnownManualEject == false ), Exit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, Exit );
+	
+	if ( PREVENT_ALLOW_MEDIUM_REMOVAL ( request, kMediaStateLocked, 0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+	 	 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		mediumLocked = true;
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+Exit:
+	
+	
+	return mediumLocked;
+	
+}
+
+
+//
+//	 DetermineMediumCapacity - Determines capacity of the medium.	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::DetermineMediumCapacity (
+					UInt64 * blockSize,
+					UInt64 * blockCount )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSI_Capacity_Data		capacityData	= { 0 };
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	SCSITaskIdentifier		request			= NULL;
+	bool					result			= false;
+	
+	*blockSize 	= 0;
+	*blockCount = 0;
+	
+	fMediumLBPME					= false;
+	fMediumLBPRZ					= false;
+	fMediumPhysicalBlockExponent	= 0;
+	fMediumLowestAlignedBlock		= 0;
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( &capacityData,
+												   kREPORT_CAPACITY_DataSize,
+												   kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseTask );
+	
+	// We found media, get its capacity
+	if ( READ_CAPACITY ( request, bufferDesc, 0, 0x00, 0, 0 ) == true )
+	{
+		
+		// The command was successfully built, now send it.
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		*blockSize 	= OSSwapBigToHostInt32 ( capacityData.BLOCK_LENGTH_IN_BYTES );
+		*blockCount = ( ( UInt64 ) OSSwapBigToHostInt32 ( capacityData.RETURNED_LOGICAL_BLOCK_ADDRESS ) ) + 1;
+		
+		// Since valid capacity data was retreived from the device, set the
+		// result to true here so that if the READ CAPACITY 16 fails for any reason,
+		// the caller will still be notified that valid data was retrieved from the device.		
+		result = true;
+
+		// SBC-2 Spec 5.14 states that if the LBA address is 0xFFFFFFFF (kREPORT_CAPACITY_MaximumLBA),
+		// and the device is SPC-3/SBC-2 compliant, we shall issue a READ_CAPACITY_16 command.
+		// The physical block layout and the logical block provisioning state are only
+		// reported in the READ_CAPACITY_16 data, so issue it for every SPC-3 device. If it
+		// fails, the READ_CAPACITY data is used as before.
+		if ( GetANSIVersion ( ) >= kINQUIRY_ANSI_VERSION_SCSI_SPC_3_Compliant )
+		{
+			
+			SCSI_Capacity_Data_Long  longCapacityData = { 0 };
+			
+			// We need to release the previous bufferDesc
+			bufferDesc->release ( );
+			bufferDesc = IOMemoryDescriptor::withAddress (  &longCapacityData, 
+															kREPORT_CAPACITY_16_DataSize,
+															kIODirectionIn );
+			require_nonzero ( bufferDesc, ReleaseTask );
+			
+			if ( READ_CAPACITY_16 ( request, bufferDesc, 0, kREPORT_CAPACITY_16_DataSize, 0, 0 ) == true )
+			{
+			
+				serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+				
+				if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+					 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+				{
+					
+					UInt16	provisioning = 0;
+					
+					*blockSize  = OSSwapBigToHostInt32 ( longCapacityData.BLOCK_LENGTH_IN_BYTES );
+					*blockCount = OSSwapBigToHostInt64 ( longCapacityData.RETURNED_LOGICAL_BLOCK_ADDRESS ) + 1;
+					
+					provisioning = OSSwapBigToHostInt16 ( longCapacityData.LBPME_LBPRZ_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS );
+					fMediumLBPME = ( provisioning & kREAD_CAPACITY_LBPME_Mask ) ? true : false;
+					fMediumLBPRZ = ( provisioning & kREAD_CAPACITY_LBPRZ_Mask ) ? true : false;
+					
+					fMediumPhysicalBlockExponent	= longCapacityData.LOGICAL_BLOCKS_PER_PHYSICAL_BLOCK_EXPONENT &
+													  kREAD_CAPACITY_LOGICAL_BLOCKS_PER_PHYSICAL_BLOCK_EXPONENT_Mask;
+					fMediumLowestAlignedBlock		= provisioning & kREAD_CAPACITY_LOWEST_ALIGNED_LOGICAL_BLOCK_ADDRESS_Mask;
+					
+				}
+				
+			}
+			
+		}
+		
+		STATUS_LOG ( ( "%s: Media capacity: %qx and block size: %qx\n", getName ( ), *blockCount, *blockSize ) );
+		
+	}
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ErrorExit );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 DetermineMediumGeometry - Determines geometry of the medium.	[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::DetermineMediumGeometry ( void )
+{
+	
+	IOBufferMemoryDescriptor *	bufferDesc				= NULL;
+	OSDictionary *				dict					= NULL;
+	IOReturn					status					= kIOReturnSuccess;
+	UInt32						minBufferSize			= 0;
+	UInt16						blockDescriptorLength	= 0;
+	UInt32						modeDataLength			= 0;
+	UInt8						headerSize				= 0;
+	UInt8 *						buffer					= NULL;
+	bool						use10ByteModeSense		= true;
+	
+	require_quiet ( ( fMediaIsRemovable == false ), ErrorExit );
+	
+	dict = OSDictionary::withCapacity ( kNumberMediumGeometryKeys );
+	require_nonzero ( dict, ErrorExit );
+	
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader10 ), kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseDictionary );
+	
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	bzero ( buffer, bufferDesc->getLength ( ) );
+	
+	status = GetModeSense ( bufferDesc,
+							kSBCModePageFormatDeviceCode,
+							sizeof ( SPCModeParameterHeader10 ),
+							&use10ByteModeSense );
+	require_success ( status, RigidDisk );
+	
+	if ( use10ByteModeSense )
+	{
+		
+		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		
+		blockDescriptorLength = OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
+		require ( ( ( blockDescriptorLength & 15 ) == 0 ), RigidDisk );
+		
+		// Get the length of data the device reports.
+		modeDataLength = OSSwapBigToHostInt16 ( header->MODE_DATA_LENGTH ) + sizeof ( header->MODE_DATA_LENGTH );
+		
+		// Some devices report more data than we need,
+		// and if we ask for the full amount, they don't complete the command,
+		// so, trim the data length to be the size of the header, the block descriptor length reported
+		// and the size of the mode page.
+		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader10 ) + blockDescriptorLength + sizeof ( SBCModePageFormatDevice ) );
+		
+	}
+	
+	else
+	{
+		
+		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		
+		blockDescriptorLength = header->BLOCK_DESCRIPTOR_LENGTH;
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
+		require ( ( ( blockDescriptorLength & 7 ) == 0 ), RigidDisk );
+		
+		// Get the length of data the device reports.
+		modeDataLength = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+		
+		// Some devices report more data than we need,
+		// and if we ask for the full amount, they don't complete the command,
+		// so, trim the data length to be the size of the header, the block descriptor length reported
+		// and the size of the mode page.
+		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader6 ) + blockDescriptorLength + sizeof ( SBCModePageFormatDevice ) );
+		
+	}
+	
+	bufferDesc->release ( );
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( modeDataLength, kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseDictionary );
+	
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	bzero ( buffer, bufferDesc->getLength ( ) );
+	
+	status = GetModeSense ( bufferDesc,
+							kSBCModePageFormatDeviceCode,
+							modeDataLength,
+							&use10ByteModeSense );
+	
+	if ( use10ByteModeSense )
+	{
+		
+		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		
+		headerSize 				= sizeof ( SPCModeParameterHeader10 );
+		blockDescriptorLength	= OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
+		require ( ( ( blockDescriptorLength & 15 ) == 0 ), RigidDisk );
+		
+	}
+	
+	else
+	{
+		
+		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		
+		headerSize				= sizeof ( SPCModeParameterHeader6 );
+		blockDescriptorLength	= header->BLOCK_DESCRIPTOR_LENGTH;
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
+		require ( ( ( blockDescriptorLength & 7 ) == 0 ), RigidDisk );
+		
+	}
+	
+	// Ensure that our buffer is of the minimum correct size.
+	// Also, check that the first byte of the page is the
+	// correct PAGE_CODE.
+	minBufferSize = headerSize + blockDescriptorLength + offsetof ( SBCModePageFormatDevice, INTERLEAVE );
+	require ( ( modeDataLength >= minBufferSize ), RigidDisk );
+	
+	{
+		
+		SBCModePageFormatDevice *	formatDevice 	= NULL;
+		OSNumber *					number			= NULL;
+		UInt8						pageCode		= 0;
+		
+		formatDevice = ( SBCModePageFormatDevice * ) &buffer[headerSize + blockDescriptorLength];
+		pageCode	 = formatDevice->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
+		
+		require ( ( pageCode == kSBCModePageFormatDeviceCode ), RigidDisk );
+		
+		// Make sure we are using host endianness
+		formatDevice->SECTORS_PER_TRACK				 = OSSwapBigToHostInt16 ( formatDevice->SECTORS_PER_TRACK );
+		formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR = OSSwapBigToHostInt16 ( formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR );
+		
+		number = OSNumber::withNumber ( formatDevice->SECTORS_PER_TRACK, 16 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertySectorCountPerTrackKey, number );
+			number->release ( );
+			number = NULL;
+			
+		}
+		
+		number = OSNumber::withNumber ( formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR, 16 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyBytesPerPhysicalSectorKey, number );
+			number->release ( );
+			number = NULL;
+			
+		}
+		
+	}
+	
+	
+RigidDisk:	
+	
+	
+	bufferDesc->release ( );
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader10 ), kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseDictionary );
 	
 	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
 	bzero ( buffer, bufferDesc->getLength ( ) );
 	
-	status = GetModeSense ( bufferDesc,
-							kSBCModePageFormatDeviceCode,
-							sizeof ( SPCModeParameterHeader10 ),
-							&use10ByteModeSense );
-	require_success ( status, RigidDisk );
+	status = GetModeSense ( bufferDesc,
+							kSBCModePageRigidDiskGeometryCode,
+							sizeof ( SPCModeParameterHeader10 ),
+							&use10ByteModeSense );
+	require_success ( status, ReleaseDescriptor );
+	
+	if ( use10ByteModeSense )
+	{
+		
+		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		
+		blockDescriptorLength = OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
+		require ( ( ( blockDescriptorLength & 15 ) == 0 ), ReleaseDescriptor );
+		
+		// Get the length of data the device reports.
+		modeDataLength = OSSwapBigToHostInt16 ( header->MODE_DATA_LENGTH ) + sizeof ( header->MODE_DATA_LENGTH );
+		
+		// Some devices report more data than we need,
+		// and if we ask for the full amount, they don't complete the command,
+		// so, trim the data length to be the size of the header, the block descriptor length reported
+		// and the size of the mode page.
+		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader10 ) + blockDescriptorLength + sizeof ( SBCModePageRigidDiskGeometry ) );
+		
+	}
+	
+	else
+	{
+		
+		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		
+		blockDescriptorLength = header->BLOCK_DESCRIPTOR_LENGTH;
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
+		require ( ( ( blockDescriptorLength & 7 ) == 0 ), ReleaseDescriptor );
+		
+		// Get the length of data the device reports.
+		modeDataLength = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+		
+		// Some devices report more data than we need,
+		// and if we ask for the full amount, they don't complete the command,
+		// so, trim the data length to be the size of the header, the block descriptor length reported
+		// and the size of the mode page.
+		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader6 ) + blockDescriptorLength + sizeof ( SBCModePageRigidDiskGeometry ) );
+		
+	}
+	
+	bufferDesc->release ( );
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( modeDataLength, kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseDictionary );
+	
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	bzero ( buffer, bufferDesc->getLength ( ) );	
+	status = GetModeSense ( bufferDesc,
+							kSBCModePageRigidDiskGeometryCode,
+							modeDataLength,
+							&use10ByteModeSense );
+	
+	require_success ( status, ReleaseDescriptor );
+	
+	if ( use10ByteModeSense )
+	{
+		
+		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		
+		headerSize 				= sizeof ( SPCModeParameterHeader10 );
+		blockDescriptorLength	= OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
+		require ( ( ( blockDescriptorLength & 15 ) == 0 ), ReleaseDescriptor );
+		
+	}
+	
+	else
+	{
+		
+		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		
+		headerSize				= sizeof ( SPCModeParameterHeader6 );
+		blockDescriptorLength	= header->BLOCK_DESCRIPTOR_LENGTH;
+		
+		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
+		require ( ( ( blockDescriptorLength & 7 ) == 0 ), ReleaseDescriptor );
+		
+	}
+	
+	// Ensure that our buffer is of the minimum correct size.
+	// Also, check that the first byte of the page is the
+	// correct PAGE_CODE.
+	minBufferSize = headerSize + blockDescriptorLength + offsetof ( SBCModePageRigidDiskGeometry, STARTING_CYLINDER_WRITE_PRECOMPENSATION );
+	require ( ( modeDataLength >= minBufferSize ), ReleaseDescriptor );
+	
+	{
+		
+		SBCModePageRigidDiskGeometry *	rigidDisk 	= NULL;
+		OSNumber *						number		= NULL;
+		UInt32							cylinders	= 0;	
+		UInt8							pageCode	= 0;
+		
+		rigidDisk	= ( SBCModePageRigidDiskGeometry * ) &buffer[headerSize + blockDescriptorLength];
+		pageCode	= rigidDisk->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
+		
+		require ( ( pageCode == kSBCModePageRigidDiskGeometryCode ), ReleaseDescriptor );
+		
+		cylinders = ( rigidDisk->NUMBER_OF_CYLINDERS[0] << 16 ) +
+					( rigidDisk->NUMBER_OF_CYLINDERS[1] << 8 ) +
+					  rigidDisk->NUMBER_OF_CYLINDERS[2];
+		
+		number = OSNumber::withNumber ( cylinders, 32 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyCylinderCountKey, number );
+			number->release ( );
+			number = NULL;
+			
+		}
+		
+		number = OSNumber::withNumber ( rigidDisk->NUMBER_OF_HEADS, 8 );
+		if ( number != NULL )
+		{
+			
+			dict->setObject ( kIOPropertyHeadCountKey, number );
+			number->release ( );
+			number = NULL;
+			
+		}
+		
+	}
+	
+	GetDeviceCharacteristicsDictionary ( )->setObject ( kIOPropertyRigidDiskGeometryKey, dict );
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( bufferDesc, ReleaseDictionary );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ReleaseDictionary:
+	
+	
+	require_nonzero_quiet ( dict, ErrorExit );
+	dict->release ( );
+	dict = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 DetermineMediumWriteProtectState - Determines medium write protect state.
+//																	[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::DetermineMediumWriteProtectState ( void )
+{
+	
+	SCSIServiceResponse 	serviceResponse 		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	IOMemoryDescriptor *	bufferDesc				= NULL;
+	SCSITaskIdentifier		request					= NULL;
+	bool					writeProtectDetermined 	= false;
+	bool					mediumIsProtected 		= true;
+	SCSI_Sense_Data			senseBuffer				= { 0 };
+	UInt8					modeBuffer[16]			= { 0 };
+	
+	// For now, report all fixed disks as writable since most have
+	// no way of changing this.
+	require_action_quiet ( fMediaIsRemovable, Exit, mediumIsProtected = false );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	// Send a Request Sense to the device, this seems to make some happy again.
+	bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
+													kSenseDefaultSize,
+													kIODirectionIn );
+	check ( bufferDesc );
+	
+	if ( bufferDesc != NULL )
+	{
+		
+		// Issue a Request Sense
+		// Whether the command completes successfully or not is irrelevent.
+		if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+			
+		}
+		
+		// release the sense data buffer;
+		bufferDesc->release ( );
+		bufferDesc = NULL;
+		
+	}
+	
+	// Now back to normal programming.
+	bufferDesc = IOMemoryDescriptor::withAddress ( 	modeBuffer,
+													8,
+													kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseTask );
+	
+	if ( GetANSIVersion ( ) == kINQUIRY_ANSI_VERSION_NoClaimedConformance )
+	{
+		
+		// The device does not claim compliance with any ANSI version, so it
+		// is most likely an ATAPI device, try the 10 byte command first.
+		
+		if ( MODE_SENSE_10 ( 	request,
+								bufferDesc,
+								0x00,
+								0x00,
+								0x00,	// Normally, we set DBD=1, but since we're only
+								0x3F,	// interested in modeBuffer[3], we set DBD=0 since
+								8,		// it makes legacy devices happier
+								0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			if ( ( modeBuffer[3] & kModeSenseSBCDeviceSpecific_WriteProtectMask ) == 0 )
+			{
+			 	mediumIsProtected = false;
+			}
+			
+			writeProtectDetermined = true;
+			
+		}
+		
+	}
+	
+	// Check if the write protect status has been successfully determined.
+	if ( writeProtectDetermined == false )
+	{
+		
+		// Either this device reports an ANSI version, or the 10 Byte command failed.
+		// Try the six byte mode sense.	
+		if ( MODE_SENSE_6 ( request,
+							bufferDesc,
+							0x00,
+							0x00,	// Normally, we set DBD=1, but since we're only
+							0x3F,	// interested in modeBuffer[3], we set DBD=0 since
+							8,		// it makes legacy devices happier
+							0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			if ( ( modeBuffer[2] & kModeSenseSBCDeviceSpecific_WriteProtectMask ) == 0 )
+			{
+				mediumIsProtected = false;
+			}
+			
+		}
+		
+		else
+		{
+			
+			ERROR_LOG ( ( "%s: Mode Sense failed\n", getName ( ) ) );
+			
+			// The mode sense failed, mark as write protected to be safe.
+			mediumIsProtected = true;
+			
+		}
+		
+	}
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ErrorExit );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+Exit:
+	
+	
+	return mediumIsProtected;
+	
+}
+
+
+//
+//	 SetMediumIcon - Sets an icon key in the registry if desired.	[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::SetMediumIcon ( void )
+{
+	
+	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::SetMediumIcon called\n" ) );
+	
+	// Methodology for setting icons
+	// 1. Find out if an icon key is already present. If there is one, do
+	// nothing since it might be from a plist entry. This makes it easy for
+	// subclassers to set a media property for their device (if it is known
+	// and can only be one media type - e.g. Zip) in their PB project, rather
+	// than adding a method to their subclass.
+	// 
+	// 2. Find out if the device is on an internal bus or external bus and
+	// what type of bus it is. If it is a bus for which we have a special
+	// icon at this point in time, then we set that icon key. The icons are
+	// located in the IOSCSIArchitectureModelFamily.kext/Contents/Resources
+	// directory.
+	//
+	// We currently have icons for the following:
+	//	 Firewire HD
+	//	 Fibre Channel HD
+	//	 USB HD
+	//	 SuperDisk
+	//	 MagnetoOptical
+	//	 SmartMedia
+	//	 MemoryStick
+	//	 Floppy
+	//
+	// We plan to have the following icons supported once we get artwork/licensing:
+	//	 CompactFlash
+	//	 Clik!
+	//	 Zip
+	//	 Jaz
+	
+	// Step 1. Find out if a media icon is present
+	if ( getProperty ( kIOMediaIconKey, gIOServicePlane ) == NULL )
+	{
+		
+		OSDictionary *	dict = NULL;
+		
+		STATUS_LOG ( ( "No current icon key\n" ) );
+		
+		// Step 2. No icon is present, see if we can provide one.
+		dict = GetProtocolCharacteristicsDictionary ( );
+		if ( dict != NULL )
+		{
+			
+			OSString *	protocolString 	= NULL;
+			
+			STATUS_LOG ( ( "Got Protocol Characteristics Dictionary\n" ) );
+
+			protocolString = OSDynamicCast ( OSString, dict->getObject ( kIOPropertyPhysicalInterconnectTypeKey ) );
+			if ( protocolString != NULL )
+			{
+				
+				const char *	protocol = NULL;
+				
+				STATUS_LOG ( ( "Got Protocol string\n" ) );
+
+				protocol = protocolString->getCStringNoCopy ( );
+				if ( protocol != NULL )
+				{
+					
+					OSString *	identifier		= NULL;
+					OSString *	resourceFile	= NULL;
+					
+					STATUS_LOG ( ( "Protocol = %s\n", protocol ) );
+					
+					identifier 	= OSString::withCString ( kIOSCSIArchitectureBundleIdentifierKey );
+					dict		= OSDictionary::withCapacity ( 2 );
+					
+					if ( fMediaIsRemovable == false )
+					{
+						
+						// If the protocol is FireWire, it needs an icon.
+						if ( strcmp ( protocol, "FireWire" ) == 0 )
+						{
+							
+							resourceFile = OSString::withCString ( kFireWireHDIconKey );
+							
+						}
+						
+						// If the protocol is USB and media is not removable, it needs an icon.
+						if ( strcmp ( protocol, "USB" ) == 0 )
+						{
+							
+							resourceFile = OSString::withCString ( kUSBHDIconKey );
+							
+						}
+						
+						// If the protocol is FibreChannel, it needs an icon.
+						if ( strcmp ( protocol, "Fibre Channel Interface" ) == 0 )
+						{
+							
+							resourceFile = OSString::withCString ( kFibreChannelHDIconKey );
+							
+						}
+						
+					}
+					
+					// Do we have an icon to set?
+					if ( resourceFile != NULL )
+					{
+						
+						STATUS_LOG ( ( "Resource file is non-NULL\n" ) );
+
+						// Make sure other resources are allocated
+						if ( ( dict != NULL ) && ( identifier != NULL ) )
+						{
+							
+							STATUS_LOG ( ( "Setting keys\n" ) );
+							
+							dict->setObject ( kCFBundleIdentifierKey, identifier );
+							dict->setObject ( kIOBundleResourceFileKey, resourceFile );
+							
+							setProperty ( kIOMediaIconKey, dict );
+							
+						}
+						
+						resourceFile->release ( );
+						
+					}
+					
+					if ( dict != NULL )
+					{
+						
+						dict->release ( );
+						dict = NULL;
+						
+					}
+					
+					if ( identifier != NULL )
+					{
+						
+						identifier->release ( );
+						identifier = NULL;
+						
+					}
+					
+				}
+				
+			}
+			
+		}
+		
+	}
+	
+}
+
+
+//
+//	 GetWriteCacheState - Gets the write cache state.				  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::GetWriteCacheState (
+							IOMemoryDescriptor * 	buffer,
+							UInt8					modePageControlValue )
+{
+	
+	IOReturn				status			= kIOReturnError;
+	SCSIServiceResponse 	serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request 		= NULL;
+	
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
+	
+	if ( MODE_SENSE_6 ( request,
+						buffer,
+						0x00,
+						modePageControlValue,
+						kSBCModePageCachingCode,
+						buffer->getLength ( ),
+						0x00 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		if ( GetRequestedDataTransferCount ( request ) == GetRealizedDataTransferCount ( request ) )
+		{
+			status = kIOReturnSuccess;
+		}
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GetWriteCacheState - Gets the write cache state.				   [PUBLIC]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::GetWriteCacheState ( bool * enabled )
+{
+	
+	IOReturn					status 			= kIOReturnUnsupported;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	SPCModeParameterHeader6 *	header			= NULL;
+	SBCModePageCaching *		cachePage		= NULL;
+	UInt8 *						bufferPtr		= NULL;
+	UInt8						pageCode		= 0;
+	UInt8						minSize			= 0;
+	UInt8						pageSize		= 0;
+	UInt8						blockDescLength	= 0;
+	
+	// There are a whole class of devices which do not like to be sent
+	// any MODE_SENSE or MODE_SELECT commands which they don't implement.
+	// Since removable devices don't usually have a cache, we restrict
+	// the device set to fixed hard disks for the following calls.
+	require ( ( fMediaIsRemovable == false ), ErrorExit );
+	
+	// Allocate the buffer.
+	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader6 ), kIODirectionIn );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
+	
+	// Obtain the header.
+	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
+	require_success ( status, ReleaseDescriptor );
+	
+	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
+	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+	
+	// The device specific parameter tells us whether the device supports
+	// the DPO and FUA bits.
+	fDPOFUASupported = ( ( header->DEVICE_SPECIFIC_PARAMETER &
+						   kModeSenseSBCDeviceSpecific_DPOFUAMask ) != 0 );
+	
+	// Save off the page size.
+	pageSize = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+	
+	// Sanity check the block descriptor length.
+	if ( ( header->BLOCK_DESCRIPTOR_LENGTH & 7 ) == 0 )
+	{
+		
+		// Block descriptor is in fact a multiple of 8.
+		// Assume we can trust it.
+		blockDescLength = header->BLOCK_DESCRIPTOR_LENGTH;		
+		
+	}
+	
+	// Sanity check on buffer size.
+	minSize = sizeof ( SPCModeParameterHeader6 ) + blockDescLength +
+		offsetof ( SBCModePageCaching, DEMAND_READ_WRITE_RETENTION_PRIORITY );
+	
+	require_action ( ( pageSize >= minSize ), ReleaseDescriptor, status = kIOReturnError );
+	
+	// Is pageSize greater than it needs to be?
+	pageSize = min ( pageSize, sizeof ( SPCModeParameterHeader6 ) + blockDescLength + sizeof ( SBCModePageCaching ) );
+	
+	buffer->release ( );
+	
+	// Allocate a buffer for data we need.
+	buffer = IOBufferMemoryDescriptor::withCapacity ( pageSize, kIODirectionOutIn );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
+	
+	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
+	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+	
+	// Obtain the full page.
+	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
+	require_success ( status, ReleaseDescriptor );
+	
+	cachePage = ( SBCModePageCaching * ) &bufferPtr[ sizeof ( SPCModeParameterHeader6 ) + blockDescLength ];
+	pageCode = cachePage->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
+	
+	// Sanity check on returned data from drive.
+	require_action ( ( pageCode == kSBCModePageCachingCode ), ReleaseDescriptor, status = kIOReturnError );
+	
+	// Find out if the WCE bit is set.
+	*enabled = cachePage->flags & kSBCModePageCaching_WCE_Mask;
+	
+	status = kIOReturnSuccess;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( buffer, ErrorExit );
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SetWriteCacheState - Sets the write cache state.				   [PUBLIC]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SetWriteCacheState ( bool enabled )
+{
+	
+	IOReturn					status 			= kIOReturnUnsupported;
+	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request 		= NULL;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	SPCModeParameterHeader6 *	header			= NULL;
+	SBCModePageCaching *		cachePage		= NULL;
+	UInt8 *						bufferPtr		= NULL;
+	UInt8						pageCode		= 0;
+	UInt8						minSize			= 0;
+	UInt8						pageSize		= 0;
+	UInt8						blockDescLength	= 0;
+	
+	// There are a whole class of devices which do not like to be sent
+	// any MODE_SENSE or MODE_SELECT commands which they don't implement.
+	// Since removable devices don't usually have a cache, we restrict
+	// the device set to fixed hard disks for the following calls.
+	require ( ( fMediaIsRemovable == false ), ErrorExit );
+	
+	// Allocate the buffer.
+	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader6 ), kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	// Obtain the header.
+	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
+	require_success ( status, ReleaseDescriptor );
+	
+	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
+	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+
+	// Save off the page size.
+	pageSize = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+	
+	// Sanity check the block descriptor length.
+	if ( ( header->BLOCK_DESCRIPTOR_LENGTH & 7 ) == 0 )
+	{
+		
+		// Block descriptor is in fact a multiple of 8. Assume we can trust it.
+		blockDescLength = header->BLOCK_DESCRIPTOR_LENGTH;		
+		
+	}
+	
+	// Sanity check on buffer size.
+	minSize = sizeof ( SPCModeParameterHeader6 ) + blockDescLength +
+		offsetof ( SBCModePageCaching, DEMAND_READ_WRITE_RETENTION_PRIORITY );
+	
+	require_action ( ( pageSize >= minSize ), ReleaseDescriptor, status = kIOReturnError );
+	
+	// Can't truncate pageSize like we do for MODE_SENSE command since MODE_SELECT requires full data
+	// buffer including header, block descriptors, and full mode page.
+	
+	buffer->release ( );
+	
+	// Allocate a buffer for full page size.
+	buffer = IOBufferMemoryDescriptor::withCapacity ( pageSize, kIODirectionOutIn );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
+	
+	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
+	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+	
+	// Obtain the full page.
+	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
+	require_success ( status, ReleaseDescriptor );
+	
+	cachePage = ( SBCModePageCaching * ) &bufferPtr[ sizeof ( SPCModeParameterHeader6 ) + blockDescLength ];
+	pageCode = cachePage->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
+	
+	// Sanity check on returned data from drive.
+	require_action ( ( pageCode == kSBCModePageCachingCode ), ReleaseDescriptor, status = kIOReturnError );
+	
+	// Set the page code in the buffer to the cache page code (remove the PS bit).
+	cachePage->header.PS_PAGE_CODE = kSBCModePageCachingCode;
+	
+	// Enable/disable cache as appropriate.
+	if ( enabled == true )
+		cachePage->flags |= kSBCModePageCaching_WCE_Mask;
+	else
+		cachePage->flags &= ~kSBCModePageCaching_WCE_Mask;
+	
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+	
+	// Write back out the new settings.
+	if ( MODE_SELECT_6 ( request,
+						 buffer,
+						 0x01,	// PageFormat		= 1
+						 0x00,	// SaveParameters	= 0
+						 pageSize,
+						 0x00 ) == true )
+	{
+		
+		// The command was successfully built, now send it.
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			fWriteCacheEnabled = enabled;
+			status = kIOReturnSuccess;
+			
+		}
+		
+		else
+		{
+			
+			status = kIOReturnError;
+			
+		}
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( buffer, ErrorExit );
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:	
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 PollForMediaRemoval - Polls for media removal.				[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::PollForMediaRemoval ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	// Do a TEST_UNIT_READY to generate sense data
+	if ( TEST_UNIT_READY ( request, 0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		
+		if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
+		{
+			
+			bool						validSense 	= false;
+			SCSI_Sense_Data				senseBuffer	= { 0 };
+			IOMemoryDescriptor *		bufferDesc	= NULL;
+			
+			validSense = GetAutoSenseData ( request, &senseBuffer );
+			if ( validSense == false )
+			{
+				
+				bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
+																kSenseDefaultSize,
+																kIODirectionIn );
+				require_nonzero ( bufferDesc, ReleaseTask );
+				
+				if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
+				{
+					
+					// The command was successfully built, now send it
+					serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+					
+				}
+				
+				bufferDesc->release ( );
+				bufferDesc = NULL;
+				
+				require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ), ReleaseTask );
+				require ( ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+				
+			}
+			
+			// Check the sense data to see if media is no longer present ( ASC == 0x3A )
+			// or if media has changed ( ASC==0x28, ASCQ==0x00 )
+			if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x3A ) ||
+			   ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x28 ) &&
+				 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ) )
+			{
+				
+				ERROR_LOG ( ( "Media was removed. Tearing down the media object." ) );
+				
+				// Media was removed, set the polling to determine when new media has been inserted
+				fPollingMode = kPollingMode_NewMedia;
+				
+				// Message up the chain that we do not have media
+				messageClients ( kIOMessageMediaStateHasChanged,
+								 ( void * ) kIOMediaStateOffline );
+				
+				ResetMediumCharacteristics ( );
+				EnablePolling ( );
+				
+			}
+			
+		}
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ErrorExit );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 IssueRead - DEPRECATED.										[PROTECTED]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::IssueRead (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount )
+{
+	return kIOReturnUnsupported;
+}
+
+
+//
+//	 IssueRead - Issues an asynchronous read command.				[PROTECTED]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::IssueRead (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							void *					clientData )
+{
+	
+	IOReturn	status = kIOReturnSuccess;
+	
+	status = SendReadWriteRequest ( buffer,
+									startBlock,
+									blockCount,
+									fMediumBlockSize,
+									false,
+									clientData,
+									&IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
+	
+	// Only look for a stream once the read itself is on its way, so that any
+	// PREFETCH is queued behind it.
+	if ( ( status == kIOReturnSuccess ) && ( fReadStreams != NULL ) )
+	{
+		DetectReadStream ( startBlock, blockCount );
+	}
+	
+	return status;
+	
+}
+
+
+//
+//	 IssueWrite - DEPRECATED.										[PROTECTED]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::IssueWrite ( IOMemoryDescriptor *	buffer,
+										UInt64					startBlock,
+										UInt64					blockCount )
+{
+	return kIOReturnUnsupported;
+}
+
+
+//
+//	 IssueWrite - Issues an asynchronous write command.			[PROTECTED]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::IssueWrite (
+						IOMemoryDescriptor *	buffer,
+						UInt64					startBlock,
+						UInt64					blockCount,
+						void *					clientData )
+{
+	
+	return IssueWriteRequest ( buffer, startBlock, blockCount, false, clientData );
+	
+}
+
+
+//
+//	 IssueWriteRequest - Issues an asynchronous write command, with the FUA
+//						  bit set if forceUnitAccess is set. The tasks are
+//						  sent by SendReadWriteTask ( ), so they go through
+//						  the elevator when it is in use.		  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::IssueWriteRequest (
+						IOMemoryDescriptor *	buffer,
+						UInt64					startBlock,
+						UInt64					blockCount,
+						bool					forceUnitAccess,
+						void *					clientData )
+{
+	
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  fMediumBlockSize,
+								  true,
+								  forceUnitAccess,
+								  clientData,
+								  &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
+	
+}
+
+
+//
+//	 BuildReadWriteTask - Builds a read or write task using the CDB size
+//						   chosen by SendReadWriteRequest ( ).		[PROTECTED]
+//
+
+bool
+IOSCSIBlockCommandsDevice::BuildReadWriteTask (
+							SCSITaskIdentifier		request,
+							IOMemoryDescriptor *	buffer,
+							UInt64					blockSize,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							UInt8					cdbSize,
+							bool					isWrite,
+							bool					forceUnitAccess )
+{
+	
+	bool	cmdStatus = false;
+	
+	// READ(6) and WRITE(6) have no FUA bit. Use the 10 byte forms, which
+	// every device with the 6 byte forms has, for those requests.
+	if ( ( cdbSize == kSCSICDBSize_6Byte ) && ( forceUnitAccess == true ) )
+	{
+		cdbSize = kSCSICDBSize_10Byte;
+	}
+	
+	// Use the device's pre-validated task template when there is one for
+	// this block size and CDB size. It also takes care of tagging.
+	if ( StampReadWriteTask ( request,
+							  buffer,
+							  blockSize,
+							  startBlock,
+							  blockCount,
+							  cdbSize,
+							  isWrite,
+							  forceUnitAccess ) == true )
+	{
+		
+		cmdStatus = true;
+		goto ErrorExit;
+		
+	}
+	
+	// The WRITE(6) builder can only address 16 bits of LBA.
+	if ( ( cdbSize == kSCSICDBSize_6Byte ) && ( isWrite == true ) &&
+		 ( startBlock > kSCSICmdFieldMask2Byte ) )
+	{
+		cdbSize = kSCSICDBSize_10Byte;
+	}
+	
+	switch ( cdbSize )
+	{
+		
+		case kSCSICDBSize_6Byte:
+		{
+			
+			if ( isWrite == true )
+			{
+				
+				cmdStatus = WRITE_6 ( request,
+									  buffer,
+									  blockSize,
+									  ( SCSICmdField2Byte ) startBlock,
+									  ( SCSICmdField1Byte ) blockCount,
+									  0 );
+				
+			}
+			
+			else
+			{
+				
+				cmdStatus = READ_6 ( request,
+									 buffer,
+									 blockSize,
+									 ( SCSICmdField21Bit ) startBlock,
+									 ( SCSICmdField1Byte ) blockCount,
+									 0 );
+				
+			}
+			
+		}
+		break;
+		
+		case kSCSICDBSize_10Byte:
+		{
+			
+			if ( isWrite == true )
+			{
+				
+				cmdStatus = WRITE_10 ( request,
+									   buffer,
+									   blockSize,
+									   0,
+									   0,
+									   forceUnitAccess,
+									   0,
+									   ( SCSICmdField4Byte ) startBlock,
+									   0,
+									   ( SCSICmdField2Byte ) blockCount,
+									   0 );
+				
+			}
+			
+			else
+			{
+				
+				cmdStatus = READ_10 ( request,
+									  buffer,
+									  blockSize,
+									  0,
+									  0,
+									  0,
+									  0,
+									  ( SCSICmdField4Byte ) startBlock,
+									  0,
+									  ( SCSICmdField2Byte ) blockCount,
+									  0 );
+				
+			}
+			
+		}
+		break;
+		
+		case kSCSICDBSize_12Byte:
+		{
+			
+			if ( isWrite == true )
+			{
+				
+				cmdStatus = WRITE_12 ( request,
+									   buffer,
+									   blockSize,
+									   0,
+									   0,
+									   forceUnitAccess,
+									   0,
+									   ( SCSICmdField4Byte ) startBlock,
+									   0,
+									   ( SCSICmdField4Byte ) blockCount,
+									   0 );
+				
+			}
+			
+			else
+			{
+				
+				cmdStatus = READ_12 ( request,
+									  buffer,
+									  blockSize,
+									  0,
+									  0,
+									  0,
+									  0,
+									  ( SCSICmdField4Byte ) startBlock,
+									  ( SCSICmdField4Byte ) blockCount,
+									  0,
+									  0 );
+				
+			}
+			
+		}
+		break;
+		
+		case kSCSICDBSize_16Byte:
+		{
+			
+			if ( isWrite == true )
+			{
+				
+				cmdStatus = WRITE_16 ( request,
+									   buffer,
+									   blockSize,
+									   0,
+									   0,
+									   forceUnitAccess,
+									   0,
+									   ( SCSICmdField8Byte ) startBlock,
+									   ( SCSICmdField4Byte ) blockCount,
+									   0,
+									   0 );
+				
+			}
+			
+			else
+			{
+				
+				cmdStatus = READ_16 ( request,
+									  buffer,
+									  blockSize,
+									  0,
+									  0,
+									  0,
+									  0,
+									  ( SCSICmdField8Byte ) startBlock,
+									  ( SCSICmdField4Byte ) blockCount,
+									  0,
+									  0 );
+				
+			}
+			
+		}
+		break;
+		
+		default:
+			break;
+		
+	}
+	
+	require ( cmdStatus, ErrorExit );
+	
+	// Tag the command if requested
+	if ( GetCMDQUE ( ) == true )
+	{
+		
+		SetTaskAttribute ( request, kSCSITask_SIMPLE );
+		SetTaggedTaskIdentifier ( request, GetUniqueTagID ( ) );
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return cmdStatus;
+	
+}
+
+
+//
+//	 SendReadWriteTask - Sends a read or write task, through the elevator
+//						  if it is in use.							[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::SendReadWriteTask (
+							SCSITaskIdentifier		request,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							bool					isWrite,
+							SCSITaskCompletion		taskCompletion )
+{
+	
+	if ( fElevatorEntries != NULL )
+	{
+		
+		// Let the elevator decide when to send the command.
+		EnqueueElevatorTask ( request, startBlock, blockCount, isWrite, taskCompletion );
+		
+	}
+	
+	else
+	{
+		
+		super::SendReadWriteTask ( request,
+								   startBlock,
+								   blockCount,
+								   isWrite,
+								   taskCompletion );
+		
+	}
+	
+}
+
+
+//
+//	 AsyncReadWriteCompletion - Completion routine for read/write requests.
+//															 		[PROTECTED]
+//
+
+void
+IOSCSIBlockCommandsDevice::AsyncReadWriteCompletion (
+								SCSITaskIdentifier completedTask )
+{
+	
+	IOReturn	status		= kIOReturnSuccess;
+	UInt64		actCount	= 0;
+	void *		clientData	= NULL;
+	
+	// Extract the client data from the SCSITaskIdentifier
+	clientData = GetApplicationLayerReference ( completedTask );
+	require_nonzero ( clientData, ErrorExit );
+	
+	if ( ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		// Our status is good, so return a success
+		actCount = GetRealizedDataTransferCount ( completedTask );
+		
+	}
+	
+	else
+	{
+		
+		// Set a generic IO error for starters
+		status = kIOReturnIOError;
+		
+		if ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_DeviceNotPresent )
+		{
+			
+			// The device went away before the request could be sent.
+			status = kIOReturnNotAttached;
+			
+		}
+		
+		else if ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE )
+		{
+			
+			// We have a status other than GOOD, see why.		
+			if ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION )
+			{
+				
+				SCSI_Sense_Data		senseDataBuffer = { 0 };
+				bool				senseIsValid	= false;
+				
+				senseIsValid = GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) );
+				if ( senseIsValid )
+				{
+					
+					// Check if this is a recovered error and the amount of data transferred
+					// was the amount requested. If so, don't treat those as hard errors.
+					if ( ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_RECOVERED_ERROR ) &&
+						 ( GetRequestedDataTransferCount ( completedTask ) == GetRealizedDataTransferCount ( completedTask ) ) )
+					{
+						
+						IOLog ( "READ or WRITE succeeded, but recoverable (soft) error occurred, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x, LBA = 0x%08x\n",
+								senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask,
+								senseDataBuffer.ADDITIONAL_SENSE_CODE,
+								senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER,
+								OSReadBigInt32 ( &senseDataBuffer.INFORMATION_1, 0 ) );
+						
+						status 		= kIOReturnSuccess;
+						actCount 	= GetRealizedDataTransferCount ( completedTask );
+						
+					}
+					
+					else
+					{
+						
+						ERROR_LOG ( ( "READ or WRITE failed, ASC = 0x%02x, ASCQ = 0x%02x\n",
+						senseDataBuffer.ADDITIONAL_SENSE_CODE,
+						senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+						
+					}
+					
+				}
+				
+			}
+	
+		}
+		
+	}
+	
+	IOBlockStorageServices::AsyncReadWriteComplete ( clientData, status, actCount );
+	
+	ReleaseSCSITask ( completedTask );	
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 InitializeElevator - Allocates the elevator used to sort requests for
+//						   devices without tagged queueing.			  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::InitializeElevator ( void )
+{
+	
+	bool	result	= false;
+	UInt32	index	= 0;
+	
+	fElevatorLock = IOSimpleLockAlloc ( );
+	require_nonzero ( fElevatorLock, ErrorExit );
+	
+	fElevatorEntries = IONew ( SBCElevatorEntry, kSBCElevatorEntryCount );
+	require_nonzero ( fElevatorEntries, ReleaseLock );
+	
+	bzero ( fElevatorEntries, sizeof ( SBCElevatorEntry ) * kSBCElevatorEntryCount );
+	
+	// Chain all of the entries onto the free list.
+	for ( index = 0; index < ( kSBCElevatorEntryCount - 1 ); index++ )
+	{
+		fElevatorEntries[index].next = &fElevatorEntries[index + 1];
+	}
+	
+	fElevatorFreeList	= fElevatorEntries;
+	fElevatorQueue		= NULL;
+	fElevatorInFlight	= NULL;
+	
+	result = true;
+	
+	return result;
+	
+	
+ReleaseLock:
+	
+	
+	IOSimpleLockFree ( fElevatorLock );
+	fElevatorLock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeElevator - Releases the elevator resources.				  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::FreeElevator ( void )
+{
+	
+	SBCElevatorEntry *	entry		= NULL;
+	SBCElevatorEntry *	queue		= NULL;
+	SCSITaskCompletion	completion	= NULL;
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	
+	if ( fElevatorEntries != NULL )
+	{
+		
+		// Take the requests which have not yet been sent off the elevator so
+		// that nothing else can send them, then fail each one back to its
+		// caller. Requests already sent to the device are completed by the
+		// protocol layer when it is torn down.
+		IOSimpleLockLock ( fElevatorLock );
+		queue = fElevatorQueue;
+		fElevatorQueue = NULL;
+		IOSimpleLockUnlock ( fElevatorLock );
+		
+		while ( queue != NULL )
+		{
+			
+			entry		= queue;
+			queue		= entry->next;
+			completion	= entry->completion;
+			
+			SetServiceResponse ( entry->request, kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
+			SetTaskStatus ( entry->request, kSCSITaskStatus_DeviceNotPresent );
+			SetRealizedDataTransferCount ( entry->request, 0 );
+			
+			completion ( entry->request );
+			
+		}
+		
+		IODelete ( fElevatorEntries, SBCElevatorEntry, kSBCElevatorEntryCount );
+		fElevatorEntries = NULL;
+		
+	}
+	
+	if ( fElevatorLock != NULL )
+	{
+		
+		IOSimpleLockFree ( fElevatorLock );
+		fElevatorLock = NULL;
+		
+	}
+	
+	fElevatorFreeList	= NULL;
+	fElevatorQueue		= NULL;
+	fElevatorInFlight	= NULL;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 EnqueueElevatorTask - Places a read or write request on the elevator
+//							and sends the next request if the device is
+//							idle.									  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::EnqueueElevatorTask (
+							SCSITaskIdentifier	request,
+							UInt64				startBlock,
+							UInt64				blockCount,
+							bool				isWrite,
+							SCSITaskCompletion	taskCompletion )
+{
+	
+	SBCElevatorEntry *	entry		= NULL;
+	SBCElevatorEntry *	previous	= NULL;
+	SBCElevatorEntry *	current		= NULL;
+	
+	IOSimpleLockLock ( fElevatorLock );
+	
+	// Keep track of how far the heads would have moved had the requests been
+	// sent in the order in which they arrived.
+	fElevatorArrivalSeekDistance += SeekDistance ( fElevatorArrivalPosition, startBlock );
+	fElevatorArrivalPosition = startBlock + blockCount;
+	
+	entry = fElevatorFreeList;
+	if ( entry == NULL )
+	{
+		
+		// All of the entries are in use. Rather than fail the request, send it
+		// to the device now, bypassing the elevator. Without an entry it is
+		// not counted as outstanding, and it completes straight to the
+		// caller's completion routine.
+		fElevatorSortedSeekDistance += SeekDistance ( fElevatorHeadPosition, startBlock );
+		fElevatorHeadPosition = startBlock + blockCount;
+		fElevatorTotalDispatchCount++;
+		IOSimpleLockUnlock ( fElevatorLock );
+		
+		SendCommand ( request,
+					  isWrite ? fWriteTimeoutDuration : fReadTimeoutDuration,
+					  taskCompletion );
+		
+	}
+	
+	else
+	{
+		
+		fElevatorFreeList = entry->next;
+		
+		entry->request		= request;
+		entry->startBlock	= startBlock;
+		entry->blockCount	= blockCount;
+		entry->completion	= taskCompletion;
+		entry->isWrite		= isWrite;
+		
+		clock_interval_to_deadline (
+			isWrite ? kSBCElevatorWriteDeadlineInMS : kSBCElevatorReadDeadlineInMS,
+			kMillisecondScale,
+			&entry->deadline );
+		
+		// Insert the entry after any others with the same starting block so that
+		// requests for the same block are sent in the order they arrived.
+		current = fElevatorQueue;
+		while ( ( current != NULL ) && ( current->startBlock <= startBlock ) )
+		{
+			
+			previous	= current;
+			current		= current->next;
+			
+		}
+		
+		entry->next = current;
+		
+		if ( previous == NULL )
+		{
+			fElevatorQueue = entry;
+		}
+		
+		else
+		{
+			previous->next = entry;
+		}
+		
+		IOSimpleLockUnlock ( fElevatorLock );
+		
+		DispatchElevatorTasks ( );
+		
+	}
+	
+}
+
+
+//
+//	 SelectElevatorEntry - Removes the next entry to be sent from the
+//							elevator. Must be called with fElevatorLock held.
+//																	  [PRIVATE]
+//
+
+SBCElevatorEntry *
+IOSCSIBlockCommandsDevice::SelectElevatorEntry ( void )
+{
+	
+	SBCElevatorEntry *	current			= NULL;
+	SBCElevatorEntry *	previous		= NULL;
+	SBCElevatorEntry *	selected		= NULL;
+	SBCElevatorEntry *	firstRead		= NULL;
+	SBCElevatorEntry *	nextRead		= NULL;
+	SBCElevatorEntry *	expiredRead		= NULL;
+	SBCElevatorEntry *	firstWrite		= NULL;
+	SBCElevatorEntry *	nextWrite		= NULL;
+	SBCElevatorEntry *	expiredWrite	= NULL;
+	AbsoluteTime		now;
+	
+	require_nonzero_quiet ( fElevatorQueue, ErrorExit );
+	
+	clock_get_uptime ( &now );
+	
+	// Walk the sorted list once, noting for reads and writes separately the
+	// lowest block, the first block at or beyond the heads and the oldest
+	// request whose deadline has passed.
+	for ( current = fElevatorQueue; current != NULL; current = current->next )
+	{
+		
+		if ( current->isWrite == false )
+		{
+			
+			if ( firstRead == NULL )
+				firstRead = current;
+			
+			if ( ( nextRead == NULL ) && ( current->startBlock >= fElevatorHeadPosition ) )
+				nextRead = current;
+			
+			if ( ( CMP_ABSOLUTETIME ( &current->deadline, &now ) <= 0 ) &&
+				 ( ( expiredRead == NULL ) ||
+				   ( CMP_ABSOLUTETIME ( &current->deadline, &expiredRead->deadline ) < 0 ) ) )
+			{
+				expiredRead = current;
+			}
+			
+		}
+		
+		else
+		{
+			
+			if ( firstWrite == NULL )
+				firstWrite = current;
+			
+			if ( ( nextWrite == NULL ) && ( current->startBlock >= fElevatorHeadPosition ) )
+				nextWrite = current;
+			
+			if ( ( CMP_ABSOLUTETIME ( &current->deadline, &now ) <= 0 ) &&
+				 ( ( expiredWrite == NULL ) ||
+				   ( CMP_ABSOLUTETIME ( &current->deadline, &expiredWrite->deadline ) < 0 ) ) )
+			{
+				expiredWrite = current;
+			}
+			
+		}
+		
+	}
+	
+	// Requests which have waited past their deadline go first. Otherwise
+	// reads are preferred over writes, since a thread is usually blocked
+	// waiting on a read, and requests are taken in ascending block order
+	// from the current head position, wrapping back around to the lowest
+	// block once there are no more ahead of the heads (C-LOOK).
+	if ( expiredRead != NULL )
+	{
+		selected = expiredRead;
+	}
+	
+	else if ( expiredWrite != NULL )
+	{
+		selected = expiredWrite;
+	}
+	
+	else if ( firstRead != NULL )
+	{
+		selected = ( nextRead != NULL ) ? nextRead : firstRead;
+	}
+	
+	else
+	{
+		selected = ( nextWrite != NULL ) ? nextWrite : firstWrite;
+	}
+	
+	if ( ( selected == expiredRead ) || ( selected == expiredWrite ) )
+	{
+		fElevatorDeadlineDispatchCount++;
+	}
+	
+	// Unlink the selected entry.
+	for ( current = fElevatorQueue; current != selected; current = current->next )
+	{
+		previous = current;
+	}
+	
+	if ( previous == NULL )
+	{
+		fElevatorQueue = selected->next;
+	}
+	
+	else
+	{
+		previous->next = selected->next;
+	}
+	
+	selected->next = NULL;
+	
+	fElevatorSortedSeekDistance += SeekDistance ( fElevatorHeadPosition, selected->startBlock );
+	fElevatorHeadPosition = selected->startBlock + selected->blockCount;
+	fElevatorTotalDispatchCount++;
+	
+	
+ErrorExit:
+	
+	
+	return selected;
+	
+}
+
+
+//
+//	 DispatchElevatorTasks - Sends requests from the elevator while the
+//							  device has room for them.				  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::DispatchElevatorTasks ( void )
+{
+	
+	SBCElevatorEntry *	entry	= NULL;
+	SCSITaskIdentifier	request	= NULL;
+	bool				isWrite	= false;
+	
+	IOSimpleLockLock ( fElevatorLock );
+	
+	// Only one thread sends requests at a time. If a request completes
+	// before SendCommand() returns, the completion comes back through here
+	// and the loop below sends the next request instead of recursing.
+	if ( fElevatorDispatching == false )
+	{
+		
+		fElevatorDispatching = true;
+		
+		while ( fElevatorOutstandingCount < kSBCElevatorMaximumOutstanding )
+		{
+			
+			entry = SelectElevatorEntry ( );
+			if ( entry == NULL )
+				break;
+			
+			request = entry->request;
+			isWrite = entry->isWrite;
+			
+			// The entry stays in flight until the request completes, so
+			// that the caller's completion routine can be found again.
+			entry->next			= fElevatorInFlight;
+			fElevatorInFlight	= entry;
+			
+			fElevatorOutstandingCount++;
+			IOSimpleLockUnlock ( fElevatorLock );
+			
+			SendCommand ( request,
+						  isWrite ? fWriteTimeoutDuration : fReadTimeoutDuration,
+						  &IOSCSIBlockCommandsDevice::ElevatorTaskComplete );
+			
+			IOSimpleLockLock ( fElevatorLock );
+			
+		}
+		
+		fElevatorDispatching = false;
+		
+	}
+	
+	IOSimpleLockUnlock ( fElevatorLock );
+	
+}
+
+
+//
+//	 CompleteElevatorTask - Called when a request sent by the elevator has
+//							 completed. Returns the completion routine the
+//							 request was queued with.				  [PRIVATE]
+//
+
+SCSITaskCompletion
+IOSCSIBlockCommandsDevice::CompleteElevatorTask ( SCSITaskIdentifier request )
+{
+	
+	SBCElevatorEntry *	entry		= NULL;
+	SBCElevatorEntry *	previous	= NULL;
+	SCSITaskCompletion	completion	= NULL;
+	
+	IOSimpleLockLock ( fElevatorLock );
+	
+	for ( entry = fElevatorInFlight; entry != NULL; entry = entry->next )
+	{
+		
+		if ( entry->request == request )
+			break;
+		
+		previous = entry;
+		
+	}
+	
+	if ( entry != NULL )
+	{
+		
+		if ( previous == NULL )
+		{
+			fElevatorInFlight = entry->next;
+		}
+		
+		else
+		{
+			previous->next = entry->next;
+		}
+		
+		completion = entry->completion;
+		
+		entry->request		= NULL;
+		entry->completion	= NULL;
+		entry->next			= fElevatorFreeList;
+		fElevatorFreeList	= entry;
+		
+		fElevatorOutstandingCount--;
+		
+	}
+	
+	IOSimpleLockUnlock ( fElevatorLock );
+	
+	DispatchElevatorTasks ( );
+	
+	return completion;
+	
+}
+
+
+//
+//	 ElevatorTaskComplete - Static completion routine for requests sent by
+//							 the elevator. Lets the elevator send the next
+//							 request before the caller is notified, so
+//							 that the device is kept busy.	  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::ElevatorTaskComplete ( SCSITaskIdentifier completedTask )
+{
+	
+	IOSCSIBlockCommandsDevice *	taskOwner	= NULL;
+	SCSITaskCompletion			completion	= NULL;
+	
+	require_nonzero ( completedTask, ErrorExit );
+	
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
+	
+	completion = taskOwner->CompleteElevatorTask ( completedTask );
+	require_nonzero ( completion, ErrorExit );
+	
+	completion ( completedTask );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 PublishElevatorStatistics - Updates the elevator statistics in the
+//								  registry.							  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::PublishElevatorStatistics ( void )
+{
+	
+	OSDictionary *	dict				= NULL;
+	OSNumber *		number				= NULL;
+	UInt64			sortedDistance		= 0;
+	UInt64			arrivalDistance		= 0;
+	UInt64			dispatchCount		= 0;
+	UInt64			deadlineCount		= 0;
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	require_nonzero_quiet ( fElevatorEntries, ErrorExit );
+	
+	// Take a consistent copy of the counters.
+	IOSimpleLockLock ( fElevatorLock );
+	sortedDistance	= fElevatorSortedSeekDistance;
+	arrivalDistance	= fElevatorArrivalSeekDistance;
+	dispatchCount	= fElevatorTotalDispatchCount;
+	deadlineCount	= fElevatorDeadlineDispatchCount;
+	IOSimpleLockUnlock ( fElevatorLock );
+	
+	dict = OSDictionary::withCapacity ( 5 );
+	require_nonzero ( dict, ErrorExit );
+	
+	number = OSNumber::withNumber ( sortedDistance, 64 );
+	dict->setObject ( kIOPropertyElevatorSortedSeekDistanceKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( arrivalDistance, 64 );
+	dict->setObject ( kIOPropertyElevatorArrivalSeekDistanceKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( ( arrivalDistance > sortedDistance ) ?
+									( arrivalDistance - sortedDistance ) : 0, 64 );
+	dict->setObject ( kIOPropertyElevatorSeekDistanceSavedKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( dispatchCount, 64 );
+	dict->setObject ( kIOPropertyElevatorDispatchCountKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( deadlineCount, 64 );
+	dict->setObject ( kIOPropertyElevatorDeadlineDispatchCountKey, number );
+	number->release ( );
+	
+	setProperty ( kIOPropertyElevatorStatisticsKey, dict );
+	dict->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 InitializeReadStreams - Allocates the read stream table.		  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::InitializeReadStreams ( void )
+{
+	
+	bool	result = false;
+	
+	fReadStreamLock = IOSimpleLockAlloc ( );
+	require_nonzero ( fReadStreamLock, ErrorExit );
+	
+	fReadStreams = IONew ( SBCReadStream, kSBCReadStreamCount );
+	require_nonzero ( fReadStreams, ReleaseLock );
+	
+	bzero ( fReadStreams, sizeof ( SBCReadStream ) * kSBCReadStreamCount );
+	
+	// Assume PREFETCH works until the device tells us otherwise.
+	fReadStreamPrefetchSupported	= true;
+	fReadStreamSequence				= 0;
+	fReadStreamScore				= 0;
+	
+	result = true;
+	goto ErrorExit;
+	
+	
+ReleaseLock:
+	
+	
+	IOSimpleLockFree ( fReadStreamLock );
+	fReadStreamLock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeReadStreams - Releases the read stream table.				  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::FreeReadStreams ( void )
+{
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	
+	if ( fReadStreams != NULL )
+	{
+		
+		IODelete ( fReadStreams, SBCReadStream, kSBCReadStreamCount );
+		fReadStreams = NULL;
+		
+	}
+	
+	if ( fReadStreamLock != NULL )
+	{
+		
+		IOSimpleLockFree ( fReadStreamLock );
+		fReadStreamLock = NULL;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ResetReadStreams - Forgets all of the read streams, e.g. when the
+//						 medium changes.							  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::ResetReadStreams ( void )
+{
+	
+	require_nonzero_quiet ( fReadStreams, ErrorExit );
+	
+	IOSimpleLockLock ( fReadStreamLock );
+	bzero ( fReadStreams, sizeof ( SBCReadStream ) * kSBCReadStreamCount );
+	fReadStreamSequence	= 0;
+	fReadStreamScore	= 0;
+	IOSimpleLockUnlock ( fReadStreamLock );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 DetectReadStream - Matches a read against the read streams and sends
+//						 a PREFETCH for the window following a
+//						 sequential stream.							  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::DetectReadStream ( UInt64	startBlock,
+											  UInt64	blockCount )
+{
+	
+	SBCReadStream *		stream			= NULL;
+	UInt64				minimumWindow	= 0;
+	UInt64				maximumWindow	= 0;
+	UInt64				prefetchStart	= 0;
+	UInt64				prefetchCount	= 0;
+	UInt32				index			= 0;
+	
+	require_quiet ( fReadStreamPrefetchSupported, ErrorExit );
+	require_quiet ( ( fMediumBlockSize != 0 ), ErrorExit );
+	
+	minimumWindow = kSBCReadStreamMinimumWindowBytes / fMediumBlockSize;
+	maximumWindow = kSBCReadStreamMaximumWindowBytes / fMediumBlockSize;
+	if ( minimumWindow == 0 )
+		minimumWindow = 1;
+	if ( maximumWindow < minimumWindow )
+		maximumWindow = minimumWindow;
+	
+	IOSimpleLockLock ( fReadStreamLock );
+	
+	fReadStreamSequence++;
+	
+	// Look for a stream this read continues, otherwise take the least
+	// recently used one.
+	for ( index = 0; index < kSBCReadStreamCount; index++ )
+	{
+		
+		if ( ( fReadStreams[index].lastUsed != 0 ) &&
+			 ( fReadStreams[index].nextBlock == startBlock ) )
+		{
+			
+			stream = &fReadStreams[index];
+			break;
+			
+		}
+		
+		if ( ( stream == NULL ) || ( fReadStreams[index].lastUsed < stream->lastUsed ) )
+		{
+			stream = &fReadStreams[index];
+		}
+		
+	}
+	
+	if ( ( stream->lastUsed != 0 ) && ( stream->nextBlock == startBlock ) )
+	{
+		
+		// The read continues the stream. If a window was prefetched for it,
+		// it was either waiting in the device's cache or the stream has
+		// outrun the read-ahead.
+		if ( stream->prefetchEnd != 0 )
+		{
+			
+			if ( ( startBlock >= stream->prefetchStart ) &&
+				 ( ( startBlock + blockCount ) <= stream->prefetchEnd ) )
+			{
+				fReadStreamHitCount++;
+			}
+			
+			else
+			{
+				fReadStreamMissCount++;
+			}
+			
+		}
+		
+		stream->sequentialCount++;
+		
+		// While read-ahead is off, a stream that stays sequential is one it
+		// would have served, so let it earn read-ahead back.
+		if ( ( fReadStreamScore < 0 ) &&
+			 ( stream->sequentialCount >= kSBCReadStreamSequentialThreshold ) )
+		{
+			fReadStreamScore++;
+		}
+		
+	}
+	
+	else
+	{
+		
+		// This read is random with respect to every stream we know of, so
+		// start a new one in place of the oldest. Any blocks that were
+		// prefetched for the old stream and never read were wasted.
+		if ( ( stream->lastUsed != 0 ) && ( stream->prefetchEnd > stream->nextBlock ) )
+		{
+			
+			fReadStreamWastedBlockCount += stream->prefetchEnd - stream->nextBlock;
+			
+			fReadStreamScore -= 2;
+			if ( fReadStreamScore < -kSBCReadStreamScoreLimit )
+				fReadStreamScore = -kSBCReadStreamScoreLimit;
+			
+		}
+		
+		bzero ( stream, sizeof ( SBCReadStream ) );
+		stream->window = minimumWindow;
+		
+	}
+	
+	stream->nextBlock	= startBlock + blockCount;
+	stream->lastUsed	= fReadStreamSequence;
+	
+	// Keep at least half a window of read-ahead in front of a sequential
+	// stream, unless read-ahead has been wasting more than it has saved.
+	if ( ( stream->sequentialCount >= kSBCReadStreamSequentialThreshold ) &&
+		 ( fReadStreamScore >= 0 ) &&
+		 ( ( stream->nextBlock + ( stream->window / 2 ) ) >= stream->prefetchEnd ) &&
+		 ( stream->nextBlock < fMediumBlockCount64 ) )
+	{
+		
+		// The stream has read into the last window, so it was worth having.
+		// Read further ahead next time.
+		if ( ( stream->prefetchEnd != 0 ) && ( stream->nextBlock > stream->prefetchStart ) )
+		{
+			
+			if ( fReadStreamScore < kSBCReadStreamScoreLimit )
+				fReadStreamScore++;
+			
+			stream->window *= 2;
+			if ( stream->window > maximumWindow )
+				stream->window = maximumWindow;
+			
+		}
+		
+		prefetchStart = stream->nextBlock;
+		if ( stream->prefetchEnd > prefetchStart )
+			prefetchStart = stream->prefetchEnd;
+		
+		if ( prefetchStart < fMediumBlockCount64 )
+		{
+			
+			prefetchCount = stream->window;
+			if ( prefetchCount > ( fMediumBlockCount64 - prefetchStart ) )
+				prefetchCount = fMediumBlockCount64 - prefetchStart;
+			
+			stream->prefetchStart	= prefetchStart;
+			stream->prefetchEnd		= prefetchStart + prefetchCount;
+			
+			fReadStreamPrefetchCount++;
+			
+		}
+		
+	}
+	
+	IOSimpleLockUnlock ( fReadStreamLock );
+	
+	if ( prefetchCount != 0 )
+	{
+		SendPrefetchCommand ( prefetchStart, prefetchCount );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 SendPrefetchCommand - Asks the device to read a range of blocks into
+//							its cache without waiting for it.		  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::SendPrefetchCommand ( UInt64	startBlock,
+												 UInt64	blockCount )
+{
+	
+	SCSITaskIdentifier	request		= NULL;
+	bool				cmdStatus	= false;
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	// With IMMED set the device completes the command as soon as it has
+	// been validated, so the prefetch does not hold up the reads behind it.
+	if ( ( startBlock <= kREPORT_CAPACITY_MaximumLBA ) &&
+		 ( blockCount <= kSBCPrefetch10MaximumBlockCount ) )
+	{
+		
+		cmdStatus = PREFETCH ( request,
+							   1,
+							   ( SCSICmdField4Byte ) startBlock,
+							   0,
+							   ( SCSICmdField2Byte ) blockCount,
+							   0 );
+		
+	}
+	
+	else
+	{
+		
+		cmdStatus = PREFETCH_16 ( request,
+								  1,
+								  startBlock,
+								  ( SCSICmdField4Byte ) blockCount,
+								  0,
+								  0 );
+		
+	}
+	
+	require ( cmdStatus, ReleaseTask );
+	
+	SendCommand ( request,
+				  kTenSecondTimeoutInMS,
+				  &IOSCSIBlockCommandsDevice::PrefetchComplete );
+	
+	return;
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 PrefetchComplete - Static completion routine for PREFETCH commands.
+//														 			  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::PrefetchComplete ( SCSITaskIdentifier completedTask )
+{
+	
+	IOSCSIBlockCommandsDevice *	taskOwner		= NULL;
+	SCSI_Sense_Data				senseDataBuffer	= { 0 };
+	
+	require_nonzero ( completedTask, ErrorExit );
+	
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
+	
+	// PREFETCH is optional. Stop sending it if the device does not
+	// implement it.
+	if ( ( taskOwner->GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( taskOwner->GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION ) &&
+		 ( taskOwner->GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) ) == true ) &&
+		 ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_ILLEGAL_REQUEST ) )
+	{
+		
+		ERROR_LOG ( ( "%s: PREFETCH not supported, read-ahead disabled.\n", taskOwner->getName ( ) ) );
+		taskOwner->fReadStreamPrefetchSupported = false;
+		
+	}
+	
+	taskOwner->ReleaseSCSITask ( completedTask );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 PublishReadStreamStatistics - Publishes the read-ahead counters.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::PublishReadStreamStatistics ( void )
+{
+	
+	OSDictionary *	dict				= NULL;
+	OSNumber *		number				= NULL;
+	UInt64			prefetchCount		= 0;
+	UInt64			hitCount			= 0;
+	UInt64			missCount			= 0;
+	UInt64			wastedBlockCount	= 0;
+	bool			enabled				= false;
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	require_nonzero_quiet ( fReadStreams, ErrorExit );
+	
+	// Take a consistent copy of the counters.
+	IOSimpleLockLock ( fReadStreamLock );
+	prefetchCount		= fReadStreamPrefetchCount;
+	hitCount			= fReadStreamHitCount;
+	missCount			= fReadStreamMissCount;
+	wastedBlockCount	= fReadStreamWastedBlockCount;
+	enabled				= ( fReadStreamPrefetchSupported == true ) && ( fReadStreamScore >= 0 );
+	IOSimpleLockUnlock ( fReadStreamLock );
+	
+	dict = OSDictionary::withCapacity ( 5 );
+	require_nonzero ( dict, ErrorExit );
+	
+	dict->setObject ( kIOPropertyReadAheadEnabledKey, enabled ? kOSBooleanTrue : kOSBooleanFalse );
+	
+	number = OSNumber::withNumber ( prefetchCount, 64 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyReadAheadPrefetchCountKey, number );
+		number->release ( );
+		
+	}
+	
+	number = OSNumber::withNumber ( hitCount, 64 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyReadAheadHitCountKey, number );
+		number->release ( );
+		
+	}
+	
+	number = OSNumber::withNumber ( missCount, 64 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyReadAheadMissCountKey, number );
+		number->release ( );
+		
+	}
+	
+	number = OSNumber::withNumber ( wastedBlockCount, 64 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyReadAheadWastedBlockCountKey, number );
+		number->release ( );
+		
+	}
+	
+	setProperty ( kIOPropertyReadAheadStatisticsKey, dict );
+	dict->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 UpdateCompletionCoalescing - Picks the completion coalescing level for
+//								   the current load and hands it to the
+//								   transport until the transport has the
+//								   latest level.					  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::UpdateCompletionCoalescing ( SInt32	depth,
+														UInt64	startBlock,
+														UInt64	blockCount )
+{
+	
+	SCSICompletionCoalescing	settings;
+	UInt32						current	= 0;
+	UInt32						level	= 0;
+	
+	// Racing requests may miscount the run, which only costs a poorer
+	// choice of level for a little while.
+	if ( startBlock == fCoalescingNextBlock )
+	{
+		
+		if ( fCoalescingSequentialCount < kSBCCoalescingStreamingSequentialCount )
+		{
+			fCoalescingSequentialCount++;
+		}
+		
+	}
+	
+	else
+	{
+		fCoalescingSequentialCount = 0;
+	}
+	
+	fCoalescingNextBlock = startBlock + blockCount;
+	
+	current = fCompletionCoalescingLevel;
+	level	= current;
+	
+	if ( depth <= 1 )
+	{
+		level = kSBCCoalescingLevel_Off;
+	}
+	
+	else if ( ( depth >= kSBCCoalescingStreamingDepth ) &&
+			  ( fCoalescingSequentialCount >= kSBCCoalescingStreamingSequentialCount ) )
+	{
+		level = kSBCCoalescingLevel_Streaming;
+	}
+	
+	else if ( depth >= kSBCCoalescingModerateDepth )
+	{
+		level = kSBCCoalescingLevel_Moderate;
+	}
+	
+	if ( level != current )
+	{
+		fCompletionCoalescingLevel = level;
+	}
+	
+	// One thread at a time programs the transport, and it re-reads the level
+	// after each call so that a change made meanwhile by a thread that lost
+	// the race is never left unprogrammed. The check is repeated after the
+	// programming flag is released for a change made just before that.
+	while ( fCompletionCoalescingProgrammedLevel != fCompletionCoalescingLevel )
+	{
+		
+		require_quiet ( OSCompareAndSwap ( 0, 1, &fCompletionCoalescingProgramming ), Exit );
+		
+		while ( fCompletionCoalescingProgrammedLevel != fCompletionCoalescingLevel )
+		{
+			
+			level		= fCompletionCoalescingLevel;
+			settings	= sCompletionCoalescingSettings[level];
+			GetProtocolDriver ( )->HandleProtocolServiceFeature (
+											kSCSIProtocolFeature_CompletionCoalescing,
+											&settings );
+			fCompletionCoalescingProgrammedLevel = level;
+			
+		}
+		
+		OSCompareAndSwap ( 1, 0, &fCompletionCoalescingProgramming );
+		
+	}
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+//
+//	 RetrieveVPDPage - Reads a vital product data page.			  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::RetrieveVPDPage (
+							UInt8		pageCode,
+							void *		pageData,
+							UInt8		pageLength )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	bool					result			= false;
+	
+	// Devices are allowed to return less than was asked for.
+	bzero ( pageData, pageLength );
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( pageData,
+												   pageLength,
+												   kIODirectionIn );
+	require_nonzero ( bufferDesc, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( INQUIRY ( request, bufferDesc, 0, 1, pageCode, pageLength, 0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		// Make sure the device returned the page that was asked for.
+		result = ( ( ( UInt8 * ) pageData )[1] == pageCode );
+		
+	}
+	
+	else
+	{
+		
+		ERROR_LOG ( ( "%s: INQUIRY page 0x%02x failed, serviceResponse = %d, taskStatus = %d\n",
+					  getName ( ), pageCode, serviceResponse, GetTaskStatus ( request ) ) );
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 DetermineBlockDeviceVPDPages - Reads the block device VPD pages the
+//									 device supports.				  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::DetermineBlockDeviceVPDPages ( void )
+{
+	
+	UInt8							pageList[kINQUIRY_MaximumDataSize];
+	SCSICmd_INQUIRY_Page00_Header *	header			= NULL;
+	SCSICmd_INQUIRY_PageB0_Data		limitsData;
+	SCSICmd_INQUIRY_PageB1_Data		characteristicsData;
+	SCSICmd_INQUIRY_PageB2_Data		provisioningData;
+	UInt32							length			= 0;
+	UInt32							index			= 0;
+	UInt32							value			= 0;
+	UInt32							maximumLength	= 0;
+	UInt16							pageLength		= 0;
+	UInt64							writeSameLength	= 0;
+	
+	fSupportedBlockVPDPages				= 0;
+	fUnmapSupported						= false;
+	fWriteSameUnmapSupported			= false;
+	fMaximumUnmapLBACount				= kINQUIRY_PageB0_UnmapCountUnlimited;
+	fMaximumUnmapBlockDescriptorCount	= kSBCUnmapMaximumBlockDescriptorCount;
+	fMaximumWriteSameLength				= kSBCWriteSameMaximumBlockCount;
+	fOptimalTransferLength				= 0;
+	fOptimalTransferLengthGranularity	= 0;
+	fMaximumCompareAndWriteLength		= 0;
+	
+	// WRITE SAME (16) is only tried on devices that claim SPC-3, for the
+	// same reason as below.
+	fWriteSameFillSupported = ( GetANSIVersion ( ) >= kINQUIRY_ANSI_VERSION_SCSI_SPC_3_Compliant );
+	
+	// The XOR commands are optional and have no capability bit, so they are
+	// tried on any device until one is rejected.
+	fXORCommandsSupported = true;
+	
+	// Older devices are known to misbehave when asked for pages they have
+	// never heard of, so only ask devices that claim SPC-3.
+	require_quiet ( ( GetANSIVersion ( ) >= kINQUIRY_ANSI_VERSION_SCSI_SPC_3_Compliant ), ErrorExit );
+	
+	require_quiet ( RetrieveVPDPage ( kINQUIRY_Page00_PageCode,
+									  pageList,
+									  sizeof ( pageList ) ), ErrorExit );
+	
+	header = ( SCSICmd_INQUIRY_Page00_Header * ) pageList;
+	length = header->PAGE_LENGTH + sizeof ( SCSICmd_INQUIRY_Page00_Header );
+	if ( length > sizeof ( pageList ) )
+	{
+		length = sizeof ( pageList );
+	}
+	
+	// Remember which of the block device specific pages (B0h - BFh) are
+	// supported.
+	for ( index = sizeof ( SCSICmd_INQUIRY_Page00_Header ); index < length; index++ )
+	{
+		
+		if ( ( pageList[index] >= kINQUIRY_PageB0_PageCode ) &&
+			 ( pageList[index] < ( kINQUIRY_PageB0_PageCode + kSBCBlockVPDPageCount ) ) )
+		{
+			fSupportedBlockVPDPages |= ( 1 << ( pageList[index] - kINQUIRY_PageB0_PageCode ) );
+		}
+		
+	}
+	
+	if ( ( fZonedModel == kSBCZonedModelNone ) &&
+		 ( IsBlockDeviceVPDPageSupported ( kINQUIRY_PageB1_PageCode ) == true ) )
+	{
+		
+		if ( RetrieveVPDPage ( kINQUIRY_PageB1_PageCode,
+							   &characteristicsData,
+							   sizeof ( characteristicsData ) ) == true )
+		{
+			
+			if ( ( characteristicsData.FLAGS & kINQUIRY_PageB1_ZONED_Mask ) == kINQUIRY_PageB1_ZONED_HostAware )
+			{
+				fZonedModel = kSBCZonedModelHostAware;
+			}
+			
+		}
+		
+	}
+	
+	if ( IsBlockDeviceVPDPageSupported ( kINQUIRY_PageB2_PageCode ) == true )
+	{
+		
+		if ( RetrieveVPDPage ( kINQUIRY_PageB2_PageCode,
+							   &provisioningData,
+							   sizeof ( provisioningData ) ) == true )
+		{
+			
+			fUnmapSupported = ( provisioningData.FLAGS & kINQUIRY_PageB2_LBPU_Mask ) ? true : false;
+			fWriteSameUnmapSupported = ( provisioningData.FLAGS & kINQUIRY_PageB2_LBPWS_Mask ) ? true : false;
+			
+		}
+		
+	}
+	
+	if ( IsBlockDeviceVPDPageSupported ( kINQUIRY_PageB0_PageCode ) == true )
+	{
+		
+		if ( RetrieveVPDPage ( kINQUIRY_PageB0_PageCode,
+							   &limitsData,
+							   sizeof ( limitsData ) ) == true )
+		{
+			
+			pageLength = OSSwapBigToHostInt16 ( limitsData.PAGE_LENGTH );
+			
+		}
+		
+		if ( pageLength >= kINQUIRY_PageB0_SBC2_PageLength )
+		{
+			
+			// Reads and writes are split so that no task is longer than
+			// the MAXIMUM TRANSFER LENGTH and split tasks end on the OPTIMAL
+			// TRANSFER LENGTH GRANULARITY. An optimal length longer than
+			// the device will take in one command is no use to anyone.
+			maximumLength						= OSSwapBigToHostInt32 ( limitsData.MAXIMUM_TRANSFER_LENGTH );
+			fOptimalTransferLength				= OSSwapBigToHostInt32 ( limitsData.OPTIMAL_TRANSFER_LENGTH );
+			fOptimalTransferLengthGranularity	= OSSwapBigToHostInt16 ( limitsData.OPTIMAL_TRANSFER_LENGTH_GRANULARITY );
+			
+			if ( ( maximumLength > 0 ) && ( fOptimalTransferLength > maximumLength ) )
+			{
+				fOptimalTransferLength = 0;
+			}
+			
+			SetReadWriteTransferLimits ( maximumLength,
+										 fOptimalTransferLength,
+										 fOptimalTransferLengthGranularity );
+			
+			// A length of zero means COMPARE AND WRITE is not supported.
+			fMaximumCompareAndWriteLength = limitsData.MAXIMUM_COMPARE_AND_WRITE_LENGTH;
+			
+		}
+		
+		if ( pageLength >= kINQUIRY_PageB0_PageLength )
+		{
+			
+			// A count of zero means the device does not implement UNMAP.
+			value = OSSwapBigToHostInt32 ( limitsData.MAXIMUM_UNMAP_LBA_COUNT );
+			if ( value == 0 )
+			{
+				fUnmapSupported = false;
+			}
+			
+			else
+			{
+				fMaximumUnmapLBACount = value;
+			}
+			
+			value = OSSwapBigToHostInt32 ( limitsData.MAXIMUM_UNMAP_BLOCK_DESCRIPTOR_COUNT );
+			if ( value == 0 )
+			{
+				fUnmapSupported = false;
+			}
+			
+			else if ( value < kSBCUnmapMaximumBlockDescriptorCount )
+			{
+				fMaximumUnmapBlockDescriptorCount = value;
+			}
+			
+			// A length of zero means there is no limit.
+			writeSameLength = OSReadBigInt64 ( limitsData.MAXIMUM_WRITE_SAME_LENGTH, 0 );
+			if ( ( writeSameLength != 0 ) && ( writeSameLength < kSBCWriteSameMaximumBlockCount ) )
+			{
+				fMaximumWriteSameLength = writeSameLength;
+			}
+			
+		}
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	STATUS_LOG ( ( "%s: VPD pages = 0x%04x, UNMAP = %d, WRITE SAME UNMAP = %d\n",
+				   getName ( ), fSupportedBlockVPDPages, fUnmapSupported, fWriteSameUnmapSupported ) );
+	
+	return;
+	
+}
+
+
+//
+//	 IsBlockDeviceVPDPageSupported - Reports whether a block device VPD
+//									  page is supported.			  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::IsBlockDeviceVPDPageSupported ( UInt8 pageCode )
+{
+	
+	bool	result = false;
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	require_quiet ( ( pageCode >= kINQUIRY_PageB0_PageCode ), ErrorExit );
+	require_quiet ( ( pageCode < ( kINQUIRY_PageB0_PageCode + kSBCBlockVPDPageCount ) ), ErrorExit );
+	
+	result = ( fSupportedBlockVPDPages & ( 1 << ( pageCode - kINQUIRY_PageB0_PageCode ) ) ) ? true : false;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 PublishLogicalBlockProvisioning - Updates the logical block
+//										provisioning properties in the
+//										registry.					  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::PublishLogicalBlockProvisioning ( void )
+{
+	
+	OSDictionary *	dict	= NULL;
+	OSNumber *		number	= NULL;
+	
+	require_nonzero_quiet ( fIOSCSIBlockCommandsDeviceReserved, ErrorExit );
+	
+	dict = OSDictionary::withCapacity ( 6 );
+	require_nonzero ( dict, ErrorExit );
+	
+	dict->setObject ( kIOPropertyProvisioningManagementEnabledKey,
+					  fMediumLBPME ? kOSBooleanTrue : kOSBooleanFalse );
+	dict->setObject ( kIOPropertyUnmappedBlocksReadZerosKey,
+					  fMediumLBPRZ ? kOSBooleanTrue : kOSBooleanFalse );
+	dict->setObject ( kIOPropertyUnmapSupportedKey,
+					  fUnmapSupported ? kOSBooleanTrue : kOSBooleanFalse );
+	dict->setObject ( kIOPropertyWriteSameUnmapSupportedKey,
+					  fWriteSameUnmapSupported ? kOSBooleanTrue : kOSBooleanFalse );
+	
+	number = OSNumber::withNumber ( fMaximumUnmapLBACount, 32 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyMaximumUnmapLBACountKey, number );
+		number->release ( );
+		
+	}
+	
+	number = OSNumber::withNumber ( fMaximumUnmapBlockDescriptorCount, 32 );
+	if ( number != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyMaximumUnmapDescriptorCountKey, number );
+		number->release ( );
+		
+	}
+	
+	setProperty ( kIOPropertyLogicalBlockProvisioningKey, dict );
+	dict->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 SendUnmapCommands - Unmaps the extents with UNMAP commands.	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendUnmapCommands (
+							SBCBlockExtent *	extents,
+							UInt32				extentCount )
+{
+	
+	SCSIServiceResponse				serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier				request				= NULL;
+	IOBufferMemoryDescriptor *		buffer				= NULL;
+	SBCUnmapParameterListHeader *	header				= NULL;
+	SBCUnmapBlockDescriptor *		descriptors			= NULL;
+	IOReturn						status				= kIOReturnSuccess;
+	UInt32							descriptorCount		= 0;
+	UInt32							index				= 0;
+	UInt64							commandBlockCount	= 0;
+	UInt64							blockStart			= 0;
+	UInt64							blocksLeft			= 0;
+	UInt64							blockCount			= 0;
+	UInt16							parameterListLength	= 0;
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity (
+					sizeof ( SBCUnmapParameterListHeader ) +
+					( fMaximumUnmapBlockDescriptorCount * sizeof ( SBCUnmapBlockDescriptor ) ),
+					kIODirectionOut );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoMemory );
+	
+	header = ( SBCUnmapParameterListHeader * ) buffer->getBytesNoCopy ( );
+	require_nonzero_action ( header, ReleaseDescriptor, status = kIOReturnNoMemory );
+	descriptors = ( SBCUnmapBlockDescriptor * ) ( header + 1 );
+	
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+	
+	blockStart	= extents[0].blockStart;
+	blocksLeft	= extents[0].blockCount;
+	
+	while ( index < extentCount )
+	{
+		
+		bzero ( header, buffer->getLength ( ) );
+		descriptorCount		= 0;
+		commandBlockCount	= 0;
+		
+		// Pack as many block descriptors into the parameter list as the
+		// device will take in one command. Extents too large for one
+		// descriptor or command are split.
+		while ( ( index < extentCount ) &&
+				( descriptorCount < fMaximumUnmapBlockDescriptorCount ) &&
+				( commandBlockCount < fMaximumUnmapLBACount ) )
+		{
+			
+			blockCount = blocksLeft;
+			if ( blockCount > ( fMaximumUnmapLBACount - commandBlockCount ) )
+			{
+				blockCount = fMaximumUnmapLBACount - commandBlockCount;
+			}
+			
+			descriptors[descriptorCount].LOGICAL_BLOCK_ADDRESS		= OSSwapHostToBigInt64 ( blockStart );
+			descriptors[descriptorCount].NUMBER_OF_LOGICAL_BLOCKS	= OSSwapHostToBigInt32 ( ( UInt32 ) blockCount );
+			
+			descriptorCount++;
+			commandBlockCount	+= blockCount;
+			blockStart			+= blockCount;
+			blocksLeft			-= blockCount;
+			
+			if ( blocksLeft == 0 )
+			{
+				
+				index++;
+				if ( index < extentCount )
+				{
+					
+					blockStart	= extents[index].blockStart;
+					blocksLeft	= extents[index].blockCount;
+					
+				}
+				
+			}
+			
+		}
+		
+		parameterListLength = sizeof ( SBCUnmapParameterListHeader ) +
+							  ( descriptorCount * sizeof ( SBCUnmapBlockDescriptor ) );
+		
+		header->UNMAP_DATA_LENGTH = OSSwapHostToBigInt16 ( parameterListLength - 2 );
+		header->UNMAP_BLOCK_DESCRIPTOR_DATA_LENGTH =
+			OSSwapHostToBigInt16 ( descriptorCount * sizeof ( SBCUnmapBlockDescriptor ) );
+		
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		
+		if ( UNMAP ( request, buffer, 0, 0, parameterListLength, 0 ) == true )
+		{
+			
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			
+		}
+		
+		require_action ( ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+						   ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) ),
+						 ReleaseTask,
+						 status = kIOReturnIOError );
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SendWriteSameUnmapCommands - Unmaps the extents with WRITE SAME (16)
+//								   commands.						  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendWriteSameUnmapCommands (
+							SBCBlockExtent *	extents,
+							UInt32				extentCount )
+{
+	
+	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	void *						bytes			= NULL;
+	IOReturn					status			= kIOReturnSuccess;
+	UInt32						index			= 0;
+	UInt64						blockStart		= 0;
+	UInt64						blocksLeft		= 0;
+	UInt64						blockCount		= 0;
+	
+	// The data-out buffer is one block of zeros, which is what the device
+	// writes if it chooses not to unmap a block.
+	buffer = IOBufferMemoryDescriptor::withCapacity ( fMediumBlockSize, kIODirectionOut );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoMemory );
+	
+	bytes = buffer->getBytesNoCopy ( );
+	require_nonzero_action ( bytes, ReleaseDescriptor, status = kIOReturnNoMemory );
+	bzero ( bytes, fMediumBlockSize );
+	
+	request = GetSCSITask ( );
+	require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+	
+	for ( index = 0; index < extentCount; index++ )
+	{
+		
+		blockStart	= extents[index].blockStart;
+		blocksLeft	= extents[index].blockCount;
+		
+		while ( blocksLeft > 0 )
+		{
+			
+			blockCount = blocksLeft;
+			if ( blockCount > fMaximumWriteSameLength )
+			{
+				blockCount = fMaximumWriteSameLength;
+			}
+			
+			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+			
+			if ( WRITE_SAME_16 ( request,
+								 buffer,
+								 fMediumBlockSize,
+								 0,
+								 0,
+								 1,
+								 blockStart,
+								 blockCount,
+								 0,
+								 0 ) == true )
+			{
+				
+				// The command was successfully built, now send it
+				serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+				
+			}
+			
+			require_action ( ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+							   ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) ),
+							 ReleaseTask,
+							 status = kIOReturnIOError );
+			
+			blockStart	+= blockCount;
+			blocksLeft	-= blockCount;
+			
+		}
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SendFillCommands - Sends the commands that fill a range of blocks.
+//																	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendFillCommands (
+							UInt64						startBlock,
+							UInt64						blockCount,
+							IOBufferMemoryDescriptor *	buffer,
+							UInt64						commandBlockLimit,
+							bool						writeSame )
+{
+	
+	SBCFillContext			context;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					commandBlockCount	= 0;
+	bool					cmdStatus			= false;
+	bool					stop				= false;
+	
+	bzero ( &context, sizeof ( context ) );
+	context.status		= kIOReturnSuccess;
+	context.writeSame	= writeSame;
+	
+	context.lock = IOLockAlloc ( );
+	require_nonzero_action ( context.lock, ErrorExit, context.status = kIOReturnNoResources );
+	
+	while ( blockCount > 0 )
+	{
+		
+		// Wait for one of the outstanding commands to complete, and stop
+		// sending more once one has failed.
+		IOLockLock ( context.lock );
+		
+		while ( context.outstanding >= kSBCFillOutstandingCount )
+		{
+			IOLockSleep ( context.lock, &context, THREAD_UNINT );
+		}
+		
+		stop = ( context.status != kIOReturnSuccess ) || ( context.writeSameRejected == true );
+		if ( stop == false )
+		{
+			context.outstanding++;
+		}
+		
+		IOLockUnlock ( context.lock );
+		
+		if ( stop == true )
+			break;
+		
+		commandBlockCount = blockCount;
+		if ( commandBlockCount > commandBlockLimit )
+			commandBlockCount = commandBlockLimit;
+		
+		cmdStatus	= false;
+		request		= GetSCSITask ( );
+		
+		if ( request != NULL )
+		{
+			
+			if ( writeSame == true )
+			{
+				
+				cmdStatus = WRITE_SAME_16 ( request,
+											buffer,
+											fMediumBlockSize,
+											0,
+											0,
+											0,
+											startBlock,
+											( SCSICmdField4Byte ) commandBlockCount,
+											0,
+											0 );
+				
+			}
+			
+			else
+			{
+				
+				cmdStatus = BuildReadWriteTask ( request,
+												 buffer,
+												 fMediumBlockSize,
+												 startBlock,
+												 commandBlockCount,
+												 GetReadWriteCDBSize ( startBlock, commandBlockCount ),
+												 true,
+												 false );
+				
+			}
+			
+		}
+		
+		if ( cmdStatus == false )
+		{
+			
+			if ( request != NULL )
+			{
+				ReleaseSCSITask ( request );
+			}
+			
+			IOLockLock ( context.lock );
+			context.outstanding--;
+			context.status = ( request != NULL ) ? kIOReturnError : kIOReturnNoResources;
+			IOLockUnlock ( context.lock );
+			
+			request = NULL;
+			break;
+			
+		}
+		
+		SetApplicationLayerReference ( request, &context );
+		SendCommand ( request,
+					  kThirtySecondTimeoutInMS,
+					  &IOSCSIBlockCommandsDevice::FillComplete );
+		
+		request		= NULL;
+		startBlock	+= commandBlockCount;
+		blockCount	-= commandBlockCount;
+		
+	}
+	
+	// The context lives on this stack, so wait for every command that
+	// refers to it.
+	IOLockLock ( context.lock );
 	
-	if ( use10ByteModeSense )
+	while ( context.outstanding > 0 )
+	{
+		IOLockSleep ( context.lock, &context, THREAD_UNINT );
+	}
+	
+	IOLockUnlock ( context.lock );
+	
+	IOLockFree ( context.lock );
+	context.lock = NULL;
+	
+	if ( ( context.status == kIOReturnSuccess ) && ( context.writeSameRejected == true ) )
+	{
+		context.status = kIOReturnUnsupported;
+	}
+	
+	
+ErrorExit:
+	
+	
+	return context.status;
+	
+}
+
+
+//
+//	 DetermineExtendedCopyParameters - Reads the copy manager's limits.
+//																	  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::DetermineExtendedCopyParameters ( void )
+{
+	
+	SCSIServiceResponse			serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request				= NULL;
+	IOBufferMemoryDescriptor *	buffer				= NULL;
+	SBCCopyOperatingParameters *	parameters			= NULL;
+	SCSI_Sense_Data				senseDataBuffer		= { 0 };
+	UInt32						descriptorLength	= 0;
+	UInt32						segmentCount		= 0;
+	UInt32						index				= 0;
+	bool						blockSegments		= false;
+	bool						identificationCSCDs	= false;
+	bool						answered			= false;
+	
+	require_quiet ( ( fExtendedCopyParametersValid == false ), ErrorExit );
+	
+	// Assume the worst until the parameters have been read.
+	fExtendedCopySupported = false;
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SBCCopyOperatingParameters ), kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	parameters = ( SBCCopyOperatingParameters * ) buffer->getBytesNoCopy ( );
+	require_nonzero ( parameters, ReleaseDescriptor );
+	bzero ( parameters, sizeof ( SBCCopyOperatingParameters ) );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( RECEIVE_COPY_RESULTS ( request,
+								buffer,
+								kSBCReceiveCopyResultsOperatingParameters,
+								0,
+								sizeof ( SBCCopyOperatingParameters ),
+								0 ) == true )
 	{
 		
-		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
 		
-		blockDescriptorLength = OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+	}
+	
+	// The device has answered if it returned the parameters or rejected
+	// the command. Anything else, such as a UNIT ATTENTION or BUSY, is
+	// asked again the next time.
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		
+		if ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD )
+		{
+			answered = true;
+		}
+		
+		else if ( ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION ) &&
+				  ( GetAutoSenseData ( request, &senseDataBuffer, sizeof ( senseDataBuffer ) ) == true ) &&
+				  ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_ILLEGAL_REQUEST ) )
+		{
+			answered = true;
+		}
+		
+	}
+	
+	require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			  ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+	
+	// We need block to block segments between identification descriptor
+	// CSCDs, and room for both CSCDs and at least one segment.
+	for ( index = 0;
+		  ( index < parameters->IMPLEMENTED_DESCRIPTOR_LIST_LENGTH ) &&
+		  ( index < sizeof ( parameters->IMPLEMENTED_DESCRIPTOR_TYPE_CODES ) );
+		  index++ )
+	{
+		
+		if ( parameters->IMPLEMENTED_DESCRIPTOR_TYPE_CODES[index] == kSBCExtendedCopyBlockToBlockSegment )
+			blockSegments = true;
+		
+		if ( parameters->IMPLEMENTED_DESCRIPTOR_TYPE_CODES[index] == kSBCExtendedCopyIdentificationCSCD )
+			identificationCSCDs = true;
+		
+	}
+	
+	require ( blockSegments && identificationCSCDs, ReleaseTask );
+	require ( ( OSSwapBigToHostInt16 ( parameters->MAXIMUM_CSCD_DESCRIPTOR_COUNT ) >= kSBCExtendedCopyCSCDCount ), ReleaseTask );
+	
+	descriptorLength = OSSwapBigToHostInt32 ( parameters->MAXIMUM_DESCRIPTOR_LIST_LENGTH );
+	require ( ( descriptorLength >= ( ( kSBCExtendedCopyCSCDCount * sizeof ( SBCExtendedCopyIdentificationDescriptor ) ) +
+									  sizeof ( SBCExtendedCopyBlockSegmentDescriptor ) ) ), ReleaseTask );
+	
+	segmentCount = ( descriptorLength - ( kSBCExtendedCopyCSCDCount * sizeof ( SBCExtendedCopyIdentificationDescriptor ) ) ) /
+					 sizeof ( SBCExtendedCopyBlockSegmentDescriptor );
+	if ( segmentCount > OSSwapBigToHostInt16 ( parameters->MAXIMUM_SEGMENT_DESCRIPTOR_COUNT ) )
+		segmentCount = OSSwapBigToHostInt16 ( parameters->MAXIMUM_SEGMENT_DESCRIPTOR_COUNT );
+	if ( segmentCount > kSBCExtendedCopyMaximumSegmentCount )
+		segmentCount = kSBCExtendedCopyMaximumSegmentCount;
+	require_nonzero ( segmentCount, ReleaseTask );
+	
+	fExtendedCopySegmentCount		= segmentCount;
+	fExtendedCopySegmentByteCount	= OSSwapBigToHostInt32 ( parameters->MAXIMUM_SEGMENT_LENGTH );
+	fExtendedCopyConcurrentCount	= parameters->MAXIMUM_CONCURRENT_COPIES;
+	
+	if ( fExtendedCopyConcurrentCount == 0 )
+		fExtendedCopyConcurrentCount = 1;
+	if ( fExtendedCopyConcurrentCount > kSBCExtendedCopyOutstandingCount )
+		fExtendedCopyConcurrentCount = kSBCExtendedCopyOutstandingCount;
+	
+	fExtendedCopySupported = true;
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	// Only ask once the device has given an answer, whatever it was.
+	if ( answered == true )
+	{
+		fExtendedCopyParametersValid = true;
+	}
+	
+	
+ErrorExit:
+	
+	
+	return fExtendedCopySupported;
+	
+}
+
+
+//
+//	 GetExtendedCopyDesignator - Builds the designation descriptor for this
+//								  logical unit for an identification
+//								  descriptor CSCD.					  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::GetExtendedCopyDesignator ( UInt8 * designator )
+{
+	
+	OSArray *		deviceIDs		= NULL;
+	OSDictionary *	idDictionary	= NULL;
+	OSNumber *		number			= NULL;
+	OSData *		idData			= NULL;
+	OSData *		bestData		= NULL;
+	UInt8			bestType		= 0;
+	UInt8			idType			= 0;
+	UInt32			index			= 0;
+	
+	// The target device publishes the INQUIRY page 83h identifiers on our
+	// provider.
+	deviceIDs = OSDynamicCast ( OSArray, GetProtocolDriver ( )->getProperty ( kIOPropertySCSIINQUIRYDeviceIdentification ) );
+	require_nonzero_quiet ( deviceIDs, ErrorExit );
+	
+	// Use a binary NAA or EUI-64 identifier of the logical unit, NAA by
+	// preference, which is what copy managers are required to accept.
+	for ( index = 0; index < deviceIDs->getCount ( ); index++ )
+	{
+		
+		idDictionary = OSDynamicCast ( OSDictionary, deviceIDs->getObject ( index ) );
+		if ( idDictionary == NULL )
+			continue;
+		
+		number = OSDynamicCast ( OSNumber, idDictionary->getObject ( kIOPropertySCSIINQUIRYDeviceIdAssociation ) );
+		if ( ( number == NULL ) || ( number->unsigned8BitValue ( ) != kINQUIRY_Page83_AssociationLogicalUnit ) )
+			continue;
+		
+		number = OSDynamicCast ( OSNumber, idDictionary->getObject ( kIOPropertySCSIINQUIRYDeviceIdCodeSet ) );
+		if ( ( number == NULL ) || ( number->unsigned8BitValue ( ) != kINQUIRY_Page83_CodeSetBinaryData ) )
+			continue;
+		
+		number = OSDynamicCast ( OSNumber, idDictionary->getObject ( kIOPropertySCSIINQUIRYDeviceIdType ) );
+		if ( number == NULL )
+			continue;
+		
+		idType = number->unsigned8BitValue ( );
+		if ( ( idType != kINQUIRY_Page83_IdentifierTypeFCNameIdentifier ) &&
+			 ( idType != kINQUIRY_Page83_IdentifierTypeIEEE_EUI64 ) )
+			continue;
+		
+		idData = OSDynamicCast ( OSData, idDictionary->getObject ( kIOPropertySCSIINQUIRYDeviceIdentifier ) );
+		if ( ( idData == NULL ) ||
+			 ( idData->getLength ( ) == 0 ) ||
+			 ( idData->getLength ( ) > kSBCExtendedCopyMaximumDesignatorLength ) )
+			continue;
+		
+		if ( ( bestData == NULL ) || ( idType == kINQUIRY_Page83_IdentifierTypeFCNameIdentifier ) )
+		{
+			
+			bestData = idData;
+			bestType = idType;
+			
+		}
+		
+	}
+	
+	require_nonzero_quiet ( bestData, ErrorExit );
+	
+	bzero ( designator, kSBCExtendedCopyDesignatorSize );
+	designator[0] = kINQUIRY_Page83_CodeSetBinaryData;
+	designator[1] = kINQUIRY_Page83_AssociationLogicalUnit | bestType;
+	designator[3] = bestData->getLength ( );
+	bcopy ( bestData->getBytesNoCopy ( ), &designator[4], bestData->getLength ( ) );
+	
+	return true;
+	
+	
+ErrorExit:
+	
+	
+	return false;
+	
+}
+
+
+//
+//	 GetExtendedCopyStatus - Asks the copy manager how far a failed copy
+//							  got.									  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::GetExtendedCopyStatus ( UInt8		listIdentifier,
+												   UInt16 *		segmentsProcessed )
+{
+	
+	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	SBCCopyStatus *				copyStatus		= NULL;
+	bool						result			= false;
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SBCCopyStatus ), kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	copyStatus = ( SBCCopyStatus * ) buffer->getBytesNoCopy ( );
+	require_nonzero ( copyStatus, ReleaseDescriptor );
+	bzero ( copyStatus, sizeof ( SBCCopyStatus ) );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( RECEIVE_COPY_RESULTS ( request,
+								buffer,
+								kSBCReceiveCopyResultsCopyStatus,
+								listIdentifier,
+								sizeof ( SBCCopyStatus ),
+								0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		
+	}
+	
+	require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			  ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+	
+	// The count is only final once the copy manager has given up on the
+	// copy. The segment in which the error occurred is counted as
+	// processed, so leave it out.
+	require ( ( ( copyStatus->COPY_MANAGER_STATUS & kSBCCopyManagerStatusMask ) ==
+				kSBCCopyManagerStatusCompletedWithErrors ), ReleaseTask );
+	
+	*segmentsProcessed = OSSwapBigToHostInt16 ( copyStatus->SEGMENTS_PROCESSED );
+	if ( *segmentsProcessed > 0 )
+		( *segmentsProcessed )--;
+	
+	result = true;
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 SendExtendedCopyCommands - Sends the EXTENDED COPY commands for a
+//								 copy.								  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendExtendedCopyCommands (
+							IOSCSIBlockCommandsDevice *	destination,
+							UInt64 *					sourceBlock,
+							UInt64 *					destinationBlock,
+							UInt64 *					blockCount )
+{
+	
+	SBCExtendedCopyOperation					operations[kSBCExtendedCopyOutstandingCount];
+	SBCExtendedCopyOperation *					operation			= NULL;
+	SBCExtendedCopyParameterListHeader *		header				= NULL;
+	SBCExtendedCopyIdentificationDescriptor *	cscd				= NULL;
+	SBCExtendedCopyBlockSegmentDescriptor *		segment				= NULL;
+	SCSITaskIdentifier							request				= NULL;
+	IOLock *									lock				= NULL;
+	IOReturn									status				= kIOReturnSuccess;
+	IOReturn									copyStatus			= kIOReturnSuccess;
+	UInt8										sourceDesignator[kSBCExtendedCopyDesignatorSize];
+	UInt8										destinationDesignator[kSBCExtendedCopyDesignatorSize];
+	UInt64										segmentBlockLimit	= 0;
+	UInt64										commandBlockCount	= 0;
+	UInt64										blocksLeft			= 0;
+	UInt64										segmentBlocks		= 0;
+	UInt32										parameterLength		= 0;
+	UInt32										segmentCount		= 0;
+	UInt16										segmentsProcessed	= 0;
+	UInt32										index				= 0;
+	UInt32										cscdIndex			= 0;
+	bool										stop				= false;
+	
+	bzero ( operations, sizeof ( operations ) );
+	
+	// Both logical units must be named by a designator the copy manager
+	// understands, otherwise copy through the host.
+	require_quiet ( GetExtendedCopyDesignator ( sourceDesignator ), ErrorExit );
+	require_quiet ( destination->GetExtendedCopyDesignator ( destinationDesignator ), ErrorExit );
+	
+	// Size the segments and the commands from the copy manager's limits.
+	segmentBlockLimit = kSBCExtendedCopyMaximumBlocksPerSegment;
+	if ( ( fExtendedCopySegmentByteCount != 0 ) &&
+		 ( ( fExtendedCopySegmentByteCount / fMediumBlockSize ) < segmentBlockLimit ) )
+		segmentBlockLimit = fExtendedCopySegmentByteCount / fMediumBlockSize;
+	if ( ( kSBCExtendedCopyMaximumBytes / fMediumBlockSize / fExtendedCopySegmentCount ) < segmentBlockLimit )
+		segmentBlockLimit = kSBCExtendedCopyMaximumBytes / fMediumBlockSize / fExtendedCopySegmentCount;
+	require_nonzero_quiet ( segmentBlockLimit, ErrorExit );
+	
+	parameterLength = sizeof ( SBCExtendedCopyParameterListHeader ) +
+					  ( kSBCExtendedCopyCSCDCount * sizeof ( SBCExtendedCopyIdentificationDescriptor ) ) +
+					  ( fExtendedCopySegmentCount * sizeof ( SBCExtendedCopyBlockSegmentDescriptor ) );
+	
+	lock = IOLockAlloc ( );
+	require_nonzero_action ( lock, ErrorExit, status = kIOReturnNoResources );
+	
+	for ( index = 0; index < fExtendedCopyConcurrentCount; index++ )
+	{
+		
+		operations[index].lock			= lock;
+		operations[index].parameterList	= IOBufferMemoryDescriptor::withCapacity ( parameterLength, kIODirectionOut );
+		require_nonzero_action ( operations[index].parameterList, ReleaseOperations, status = kIOReturnNoMemory );
+		
+	}
+	
+	while ( ( *blockCount > 0 ) && ( stop == false ) )
+	{
+		
+		// Wait for an operation that is not in flight.
+		IOLockLock ( lock );
+		
+		for ( ;; )
+		{
+			
+			operation = NULL;
+			for ( index = 0; index < fExtendedCopyConcurrentCount; index++ )
+			{
+				
+				if ( operations[index].state != kSBCExtendedCopyInFlight )
+				{
+					
+					operation = &operations[index];
+					break;
+					
+				}
+				
+			}
+			
+			if ( operation != NULL )
+				break;
+			
+			IOLockSleep ( lock, lock, THREAD_UNINT );
+			
+		}
+		
+		IOLockUnlock ( lock );
+		
+		// If the last command sent with this operation failed, copy what
+		// the device did not through the host, and stop offloading.
+		if ( ( operation->state == kSBCExtendedCopyComplete ) && ( operation->failed == true ) )
+			stop = true;
+		
+		if ( operation->state == kSBCExtendedCopyComplete )
+		{
+			
+			copyStatus = kIOReturnSuccess;
+			if ( operation->failed == true )
+			{
+				
+				if ( operation->unsupported == true )
+					fExtendedCopySupported = false;
+				
+				blocksLeft = 0;
+				if ( ( operation->unsupported == false ) &&
+					 ( GetExtendedCopyStatus ( operation->listIdentifier, &segmentsProcessed ) == true ) )
+					blocksLeft = segmentsProcessed * operation->segmentBlockCount;
+				if ( blocksLeft > operation->blockCount )
+					blocksLeft = operation->blockCount;
+				
+				copyStatus = CopyBlocksThroughHost ( destination,
+													 operation->sourceBlock + blocksLeft,
+													 operation->destinationBlock + blocksLeft,
+													 operation->blockCount - blocksLeft );
+				
+			}
+			
+			operation->state = kSBCExtendedCopyIdle;
+			if ( copyStatus != kIOReturnSuccess )
+			{
+				
+				status	= copyStatus;
+				stop	= true;
+				
+			}
+			
+		}
+		
+		if ( stop == true )
+			break;
+		
+		// Describe the next piece of the copy as a run of segments.
+		commandBlockCount = *blockCount;
+		if ( commandBlockCount > ( segmentBlockLimit * fExtendedCopySegmentCount ) )
+			commandBlockCount = segmentBlockLimit * fExtendedCopySegmentCount;
+		
+		header = ( SBCExtendedCopyParameterListHeader * ) operation->parameterList->getBytesNoCopy ( );
+		bzero ( header, parameterLength );
+		
+		operation->listIdentifier		= OSIncrementAtomic ( &fExtendedCopyListIdentifier ) & 0xFF;
+		operation->sourceBlock			= *sourceBlock;
+		operation->destinationBlock		= *destinationBlock;
+		operation->blockCount			= commandBlockCount;
+		operation->segmentBlockCount	= segmentBlockLimit;
+		operation->failed				= false;
+		operation->unsupported			= false;
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
-		require ( ( ( blockDescriptorLength & 15 ) == 0 ), RigidDisk );
+		cscd = ( SBCExtendedCopyIdentificationDescriptor * ) &header[1];
+		for ( cscdIndex = 0; cscdIndex < kSBCExtendedCopyCSCDCount; cscdIndex++ )
+		{
+			
+			cscd[cscdIndex].DESCRIPTOR_TYPE_CODE	= kSBCExtendedCopyIdentificationCSCD;
+			cscd[cscdIndex].PERIPHERAL_DEVICE_TYPE	= kINQUIRY_PERIPHERAL_TYPE_DirectAccessSBCDevice;
+			cscd[cscdIndex].DISK_BLOCK_LENGTH[0]	= ( fMediumBlockSize >> 16 ) & 0xFF;
+			cscd[cscdIndex].DISK_BLOCK_LENGTH[1]	= ( fMediumBlockSize >> 8 ) & 0xFF;
+			cscd[cscdIndex].DISK_BLOCK_LENGTH[2]	= fMediumBlockSize & 0xFF;
+			bcopy ( ( cscdIndex == 0 ) ? sourceDesignator : destinationDesignator,
+					cscd[cscdIndex].DESIGNATOR,
+					kSBCExtendedCopyDesignatorSize );
+			
+		}
 		
-		// Get the length of data the device reports.
-		modeDataLength = OSSwapBigToHostInt16 ( header->MODE_DATA_LENGTH ) + sizeof ( header->MODE_DATA_LENGTH );
+		segment			= ( SBCExtendedCopyBlockSegmentDescriptor * ) &cscd[kSBCExtendedCopyCSCDCount];
+		segmentCount	= 0;
+		blocksLeft		= commandBlockCount;
 		
-		// Some devices report more data than we need,
-		// and if we ask for the full amount, they don't complete the command,
-		// so, trim the data length to be the size of the header, the block descriptor length reported
-		// and the size of the mode page.
-		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader10 ) + blockDescriptorLength + sizeof ( SBCModePageFormatDevice ) );
+		while ( blocksLeft > 0 )
+		{
+			
+			segmentBlocks = blocksLeft;
+			if ( segmentBlocks > segmentBlockLimit )
+				segmentBlocks = segmentBlockLimit;
+			
+			segment[segmentCount].DESCRIPTOR_TYPE_CODE				= kSBCExtendedCopyBlockToBlockSegment;
+			segment[segmentCount].DESCRIPTOR_LENGTH					= OSSwapHostToBigInt16 ( sizeof ( SBCExtendedCopyBlockSegmentDescriptor ) - 4 );
+			segment[segmentCount].SOURCE_CSCD_DESCRIPTOR_ID			= OSSwapHostToBigInt16 ( 0 );
+			segment[segmentCount].DESTINATION_CSCD_DESCRIPTOR_ID	= OSSwapHostToBigInt16 ( 1 );
+			segment[segmentCount].NUMBER_OF_BLOCKS					= OSSwapHostToBigInt16 ( ( UInt16 ) segmentBlocks );
+			segment[segmentCount].SOURCE_LOGICAL_BLOCK_ADDRESS		= OSSwapHostToBigInt64 ( *sourceBlock + ( commandBlockCount - blocksLeft ) );
+			segment[segmentCount].DESTINATION_LOGICAL_BLOCK_ADDRESS	= OSSwapHostToBigInt64 ( *destinationBlock + ( commandBlockCount - blocksLeft ) );
+			
+			segmentCount++;
+			blocksLeft -= segmentBlocks;
+			
+		}
 		
-	}
-	
-	else
-	{
+		header->LIST_IDENTIFIER					= operation->listIdentifier;
+		header->CSCD_DESCRIPTOR_LIST_LENGTH		= OSSwapHostToBigInt16 ( kSBCExtendedCopyCSCDCount * sizeof ( SBCExtendedCopyIdentificationDescriptor ) );
+		header->SEGMENT_DESCRIPTOR_LIST_LENGTH	= OSSwapHostToBigInt32 ( segmentCount * sizeof ( SBCExtendedCopyBlockSegmentDescriptor ) );
 		
-		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		request = GetSCSITask ( );
+		require_nonzero_action ( request, WaitForOperations, status = kIOReturnNoResources );
 		
-		blockDescriptorLength = header->BLOCK_DESCRIPTOR_LENGTH;
+		if ( EXTENDED_COPY ( request,
+							 operation->parameterList,
+							 sizeof ( SBCExtendedCopyParameterListHeader ) +
+							 ( kSBCExtendedCopyCSCDCount * sizeof ( SBCExtendedCopyIdentificationDescriptor ) ) +
+							 ( segmentCount * sizeof ( SBCExtendedCopyBlockSegmentDescriptor ) ),
+							 0 ) == false )
+		{
+			
+			ReleaseSCSITask ( request );
+			request	= NULL;
+			status	= kIOReturnError;
+			break;
+			
+		}
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
-		require ( ( ( blockDescriptorLength & 7 ) == 0 ), RigidDisk );
+		operation->state = kSBCExtendedCopyInFlight;
 		
-		// Get the length of data the device reports.
-		modeDataLength = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+		SetApplicationLayerReference ( request, operation );
+		SendCommand ( request,
+					  kThirtySecondTimeoutInMS,
+					  &IOSCSIBlockCommandsDevice::ExtendedCopyComplete );
 		
-		// Some devices report more data than we need,
-		// and if we ask for the full amount, they don't complete the command,
-		// so, trim the data length to be the size of the header, the block descriptor length reported
-		// and the size of the mode page.
-		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader6 ) + blockDescriptorLength + sizeof ( SBCModePageFormatDevice ) );
+		request				= NULL;
+		*sourceBlock		+= commandBlockCount;
+		*destinationBlock	+= commandBlockCount;
+		*blockCount			-= commandBlockCount;
 		
 	}
 	
-	bufferDesc->release ( );
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( modeDataLength, kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseDictionary );
 	
-	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
-	bzero ( buffer, bufferDesc->getLength ( ) );
+WaitForOperations:
 	
-	status = GetModeSense ( bufferDesc,
-							kSBCModePageFormatDeviceCode,
-							modeDataLength,
-							&use10ByteModeSense );
 	
-	if ( use10ByteModeSense )
+	// The operations live on this stack, so wait for every command that
+	// refers to one, and finish any that failed.
+	for ( index = 0; index < fExtendedCopyConcurrentCount; index++ )
 	{
 		
-		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		operation = &operations[index];
 		
-		headerSize 				= sizeof ( SPCModeParameterHeader10 );
-		blockDescriptorLength	= OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		IOLockLock ( lock );
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
-		require ( ( ( blockDescriptorLength & 15 ) == 0 ), RigidDisk );
+		while ( operation->state == kSBCExtendedCopyInFlight )
+		{
+			IOLockSleep ( lock, lock, THREAD_UNINT );
+		}
+		
+		IOLockUnlock ( lock );
+		
+		if ( ( operation->state == kSBCExtendedCopyComplete ) && ( operation->failed == true ) )
+		{
+			
+			if ( operation->unsupported == true )
+				fExtendedCopySupported = false;
+			
+			blocksLeft = 0;
+			if ( ( operation->unsupported == false ) &&
+				 ( GetExtendedCopyStatus ( operation->listIdentifier, &segmentsProcessed ) == true ) )
+				blocksLeft = segmentsProcessed * operation->segmentBlockCount;
+			if ( blocksLeft > operation->blockCount )
+				blocksLeft = operation->blockCount;
+			
+			copyStatus = CopyBlocksThroughHost ( destination,
+												 operation->sourceBlock + blocksLeft,
+												 operation->destinationBlock + blocksLeft,
+												 operation->blockCount - blocksLeft );
+			
+			if ( status == kIOReturnSuccess )
+				status = copyStatus;
+			
+		}
+		
+		operation->state = kSBCExtendedCopyIdle;
 		
 	}
 	
-	else
+	
+ReleaseOperations:
+	
+	
+	for ( index = 0; index < kSBCExtendedCopyOutstandingCount; index++ )
 	{
 		
-		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
-		
-		headerSize				= sizeof ( SPCModeParameterHeader6 );
-		blockDescriptorLength	= header->BLOCK_DESCRIPTOR_LENGTH;
-		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
-		require ( ( ( blockDescriptorLength & 7 ) == 0 ), RigidDisk );
+		if ( operations[index].parameterList != NULL )
+		{
+			
+			operations[index].parameterList->release ( );
+			operations[index].parameterList = NULL;
+			
+		}
 		
 	}
 	
-	// Ensure that our buffer is of the minimum correct size.
-	// Also, check that the first byte of the page is the
-	// correct PAGE_CODE.
-	minBufferSize = headerSize + blockDescriptorLength + offsetof ( SBCModePageFormatDevice, INTERLEAVE );
-	require ( ( modeDataLength >= minBufferSize ), RigidDisk );
+	IOLockFree ( lock );
+	lock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 CopyBlocksThroughHost - Copies a range of blocks by reading them into
+//							  host memory and writing them out.		  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::CopyBlocksThroughHost (
+							IOSCSIBlockCommandsDevice *	destination,
+							UInt64						sourceBlock,
+							UInt64						destinationBlock,
+							UInt64						blockCount )
+{
+	
+	SCSIServiceResponse			serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request				= NULL;
+	IOBufferMemoryDescriptor *	buffer				= NULL;
+	IOReturn					status				= kIOReturnSuccess;
+	UInt64						bufferBlocks		= 0;
+	UInt64						commandBlockCount	= 0;
+	UInt64						limit				= 0;
 	
+	require_action ( ( destination->IsSequentialWriteRequiredRange ( destinationBlock, blockCount ) == false ),
+					 ErrorExit,
+					 status = kIOReturnUnsupported );
+	
+	bufferBlocks = kSBCCopyBufferMaximumBytes / fMediumBlockSize;
+	if ( bufferBlocks > blockCount )
+		bufferBlocks = blockCount;
+	if ( bufferBlocks == 0 )
+		bufferBlocks = 1;
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( bufferBlocks * fMediumBlockSize, kIODirectionOutIn );
+	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoMemory );
+	
+	while ( blockCount > 0 )
 	{
 		
-		SBCModePageFormatDevice *	formatDevice 	= NULL;
-		OSNumber *					number			= NULL;
-		UInt8						pageCode		= 0;
+		commandBlockCount = blockCount;
+		if ( commandBlockCount > bufferBlocks )
+			commandBlockCount = bufferBlocks;
 		
-		formatDevice = ( SBCModePageFormatDevice * ) &buffer[headerSize + blockDescriptorLength];
-		pageCode	 = formatDevice->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
+		limit = GetReadWriteTaskBlockLimit ( sourceBlock, fMediumBlockSize, false );
+		if ( ( limit != 0 ) && ( commandBlockCount > limit ) )
+			commandBlockCount = limit;
 		
-		require ( ( pageCode == kSBCModePageFormatDeviceCode ), RigidDisk );
+		limit = destination->GetReadWriteTaskBlockLimit ( destinationBlock, fMediumBlockSize, true );
+		if ( ( limit != 0 ) && ( commandBlockCount > limit ) )
+			commandBlockCount = limit;
 		
-		// Make sure we are using host endianness
-		formatDevice->SECTORS_PER_TRACK				 = OSSwapBigToHostInt16 ( formatDevice->SECTORS_PER_TRACK );
-		formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR = OSSwapBigToHostInt16 ( formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR );
+		// Read the blocks from this device...
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 		
-		number = OSNumber::withNumber ( formatDevice->SECTORS_PER_TRACK, 16 );
-		if ( number != NULL )
+		request = GetSCSITask ( );
+		require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+		
+		if ( BuildReadWriteTask ( request,
+								  buffer,
+								  fMediumBlockSize,
+								  sourceBlock,
+								  commandBlockCount,
+								  GetReadWriteCDBSize ( sourceBlock, commandBlockCount ),
+								  false,
+								  false ) == true )
 		{
 			
-			dict->setObject ( kIOPropertySectorCountPerTrackKey, number );
-			number->release ( );
-			number = NULL;
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
 			
 		}
 		
-		number = OSNumber::withNumber ( formatDevice->DATA_BYTES_PER_PHYSICAL_SECTOR, 16 );
-		if ( number != NULL )
+		if ( ( serviceResponse != kSCSIServiceResponse_TASK_COMPLETE ) ||
+			 ( GetTaskStatus ( request ) != kSCSITaskStatus_GOOD ) )
+			status = kIOReturnIOError;
+		
+		ReleaseSCSITask ( request );
+		request = NULL;
+		
+		require_success ( status, ReleaseDescriptor );
+		
+		// ...and write them to the destination.
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		
+		request = destination->GetSCSITask ( );
+		require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+		
+		if ( destination->BuildReadWriteTask ( request,
+											   buffer,
+											   fMediumBlockSize,
+											   destinationBlock,
+											   commandBlockCount,
+											   destination->GetReadWriteCDBSize ( destinationBlock, commandBlockCount ),
+											   true,
+											   false ) == true )
 		{
 			
-			dict->setObject ( kIOPropertyBytesPerPhysicalSectorKey, number );
-			number->release ( );
-			number = NULL;
+			// The command was successfully built, now send it
+			serviceResponse = destination->SendCommand ( request, kThirtySecondTimeoutInMS );
 			
 		}
 		
+		if ( ( serviceResponse != kSCSIServiceResponse_TASK_COMPLETE ) ||
+			 ( destination->GetTaskStatus ( request ) != kSCSITaskStatus_GOOD ) )
+			status = kIOReturnIOError;
+		
+		destination->ReleaseSCSITask ( request );
+		request = NULL;
+		
+		require_success ( status, ReleaseDescriptor );
+		
+		sourceBlock			+= commandBlockCount;
+		destinationBlock	+= commandBlockCount;
+		blockCount			-= commandBlockCount;
+		
 	}
 	
 	
-RigidDisk:	
+ReleaseDescriptor:
 	
 	
-	bufferDesc->release ( );
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader10 ), kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseDictionary );
+	buffer->release ( );
+	buffer = NULL;
 	
-	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
-	bzero ( buffer, bufferDesc->getLength ( ) );
 	
-	status = GetModeSense ( bufferDesc,
-							kSBCModePageRigidDiskGeometryCode,
-							sizeof ( SPCModeParameterHeader10 ),
-							&use10ByteModeSense );
-	require_success ( status, ReleaseDescriptor );
+ErrorExit:
 	
-	if ( use10ByteModeSense )
+	
+	return status;
+	
+}
+
+
+//
+//	 AdvanceParityOperation - Moves a parity operation on to its next
+//							   step.								  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::AdvanceParityOperation (
+							IOSCSIBlockCommandsDevice *	parityDevice,
+							SBCParityOperation *		operation,
+							IOBufferMemoryDescriptor *	hostBuffer )
+{
+	
+	IOReturn	status		= kIOReturnSuccess;
+	bool		applyDelta	= false;
+	
+	if ( operation->step == kSBCParityStepIdle )
 	{
 		
-		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
+		operation->retries = 0;
 		
-		blockDescriptorLength = OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		// A new operation. Let the drive XOR the old and new data if it can.
+		if ( ( fXORCommandsSupported == true ) &&
+			 ( ( operation->dataBlock + operation->blockCount - 1 ) <= kSBCParityMaximumLBA ) )
+		{
+			
+			status = SendParityCommand ( this, operation, kSBCParityStepXDWRITE );
+			require_success ( status, CompleteOperation );
+			goto Exit;
+			
+		}
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
-		require ( ( ( blockDescriptorLength & 15 ) == 0 ), ReleaseDescriptor );
+		status = ComputeParityDeltaThroughHost ( operation, hostBuffer );
+		require_success ( status, CompleteOperation );
+		applyDelta = true;
 		
-		// Get the length of data the device reports.
-		modeDataLength = OSSwapBigToHostInt16 ( header->MODE_DATA_LENGTH ) + sizeof ( header->MODE_DATA_LENGTH );
+	}
+	
+	else if ( operation->step == kSBCParityStepXDWRITE )
+	{
 		
-		// Some devices report more data than we need,
-		// and if we ask for the full amount, they don't complete the command,
-		// so, trim the data length to be the size of the header, the block descriptor length reported
-		// and the size of the mode page.
-		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader10 ) + blockDescriptorLength + sizeof ( SBCModePageRigidDiskGeometry ) );
+		if ( operation->failed == true )
+		{
+			
+			// Nothing was written if the command was rejected, so the
+			// operation can start over in host memory.
+			require_action ( operation->unsupported, CompleteOperation, status = kIOReturnIOError );
+			
+			ERROR_LOG ( ( "%s: XDWRITE rejected, computing parity in host memory.\n", getName ( ) ) );
+			fXORCommandsSupported = false;
+			
+			status = ComputeParityDeltaThroughHost ( operation, hostBuffer );
+			require_success ( status, CompleteOperation );
+			applyDelta = true;
+			
+		}
+		
+		else
+		{
+			
+			status = SendParityCommand ( this, operation, kSBCParityStepXDREAD );
+			require_success ( status, CompleteOperation );
+			
+		}
 		
 	}
 	
-	else
+	else if ( operation->step == kSBCParityStepXDREAD )
 	{
 		
-		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
+		// The new data has already been written, so without the XOR data
+		// there is no bringing the parity up to date. Reading it has no side
+		// effects, so a failed read is tried again.
+		if ( operation->failed == true )
+		{
+			
+			if ( operation->unsupported == true )
+			{
+				fXORCommandsSupported = false;
+			}
+			
+			else if ( operation->retries < kSBCParityRetryCount )
+			{
+				
+				operation->retries++;
+				status = SendParityCommand ( this, operation, kSBCParityStepXDREAD );
+				require_success ( status, ParityStale );
+				goto Exit;
+				
+			}
+			
+			goto ParityStale;
+			
+		}
 		
-		blockDescriptorLength = header->BLOCK_DESCRIPTOR_LENGTH;
+		applyDelta = true;
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
-		require ( ( ( blockDescriptorLength & 7 ) == 0 ), ReleaseDescriptor );
+	}
+	
+	else if ( operation->step == kSBCParityStepXPWRITE )
+	{
 		
-		// Get the length of data the device reports.
-		modeDataLength = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+		if ( operation->failed == true )
+		{
+			
+			// The parity is untouched if the command was rejected. Otherwise
+			// it is unknown whether the change was applied, and applying it
+			// twice would be as wrong as not applying it.
+			require_quiet ( operation->unsupported, ParityStale );
+			
+			ERROR_LOG ( ( "%s: XPWRITE rejected, updating parity in host memory.\n", parityDevice->getName ( ) ) );
+			parityDevice->fXORCommandsSupported = false;
+			
+			status = ApplyParityDeltaThroughHost ( operation, hostBuffer );
+			require_success ( status, ParityStale );
+			
+		}
 		
-		// Some devices report more data than we need,
-		// and if we ask for the full amount, they don't complete the command,
-		// so, trim the data length to be the size of the header, the block descriptor length reported
-		// and the size of the mode page.
-		modeDataLength = min ( modeDataLength, sizeof ( SPCModeParameterHeader6 ) + blockDescriptorLength + sizeof ( SBCModePageRigidDiskGeometry ) );
+		goto CompleteOperation;
 		
 	}
 	
-	bufferDesc->release ( );
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( modeDataLength, kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseDictionary );
-	
-	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
-	bzero ( buffer, bufferDesc->getLength ( ) );	
-	status = GetModeSense ( bufferDesc,
-							kSBCModePageRigidDiskGeometryCode,
-							modeDataLength,
-							&use10ByteModeSense );
-	
-	require_success ( status, ReleaseDescriptor );
-	
-	if ( use10ByteModeSense )
+	if ( applyDelta == true )
 	{
 		
-		SPCModeParameterHeader10 *	header = ( SPCModeParameterHeader10 * ) buffer;
-		
-		headerSize 				= sizeof ( SPCModeParameterHeader10 );
-		blockDescriptorLength	= OSSwapBigToHostInt16 ( header->BLOCK_DESCRIPTOR_LENGTH );
+		// The XOR buffer now holds the change to make to the parity.
+		if ( ( parityDevice->fXORCommandsSupported == true ) &&
+			 ( ( operation->parityBlock + operation->blockCount - 1 ) <= kSBCParityMaximumLBA ) )
+		{
+			
+			status = SendParityCommand ( parityDevice, operation, kSBCParityStepXPWRITE );
+			require_success ( status, ParityStale );
+			goto Exit;
+			
+		}
 		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 16.
-		require ( ( ( blockDescriptorLength & 15 ) == 0 ), ReleaseDescriptor );
+		status = ApplyParityDeltaThroughHost ( operation, hostBuffer );
+		require_success ( status, ParityStale );
+		goto CompleteOperation;
 		
 	}
 	
-	else
+	
+Exit:
+	
+	
+	return status;
+	
+	
+ParityStale:
+	
+	
+	// The new data is on the medium but its parity is not.
+	ERROR_LOG ( ( "%s: parity of blocks %lld-%lld is stale.\n",
+				  parityDevice->getName ( ),
+				  operation->parityBlock,
+				  operation->parityBlock + operation->blockCount - 1 ) );
+	status = kIOReturnSCSIParityStale;
+	
+	
+CompleteOperation:
+	
+	
+	operation->step = kSBCParityStepIdle;
+	
+	if ( operation->dataBuffer != NULL )
 	{
 		
-		SPCModeParameterHeader6 *	header = ( SPCModeParameterHeader6 * ) buffer;
-		
-		headerSize				= sizeof ( SPCModeParameterHeader6 );
-		blockDescriptorLength	= header->BLOCK_DESCRIPTOR_LENGTH;
-		
-		// Sanity check. Make sure BLOCK_DESCRIPTOR_LENGTH is a multiple of 8.
-		require ( ( ( blockDescriptorLength & 7 ) == 0 ), ReleaseDescriptor );
+		operation->dataBuffer->release ( );
+		operation->dataBuffer = NULL;
 		
 	}
 	
-	// Ensure that our buffer is of the minimum correct size.
-	// Also, check that the first byte of the page is the
-	// correct PAGE_CODE.
-	minBufferSize = headerSize + blockDescriptorLength + offsetof ( SBCModePageRigidDiskGeometry, STARTING_CYLINDER_WRITE_PRECOMPENSATION );
-	require ( ( modeDataLength >= minBufferSize ), ReleaseDescriptor );
+	return status;
+	
+}
+
+
+//
+//	 SendParityCommand - Sends one of the XOR commands for a parity
+//						  operation.								  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendParityCommand (
+							IOSCSIBlockCommandsDevice *	device,
+							SBCParityOperation *		operation,
+							UInt8						step )
+{
+	
+	SCSITaskIdentifier	request		= NULL;
+	IOReturn			status		= kIOReturnNoResources;
+	bool				built		= false;
 	
+	request = device->GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	switch ( step )
 	{
 		
-		SBCModePageRigidDiskGeometry *	rigidDisk 	= NULL;
-		OSNumber *						number		= NULL;
-		UInt32							cylinders	= 0;	
-		UInt8							pageCode	= 0;
-		
-		rigidDisk	= ( SBCModePageRigidDiskGeometry * ) &buffer[headerSize + blockDescriptorLength];
-		pageCode	= rigidDisk->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
-		
-		require ( ( pageCode == kSBCModePageRigidDiskGeometryCode ), ReleaseDescriptor );
-		
-		cylinders = ( rigidDisk->NUMBER_OF_CYLINDERS[0] << 16 ) +
-					( rigidDisk->NUMBER_OF_CYLINDERS[1] << 8 ) +
-					  rigidDisk->NUMBER_OF_CYLINDERS[2];
+		case kSBCParityStepXDWRITE:
+		{
+			
+			// Writes the new data and keeps its XOR with the old data.
+			built = device->XDWRITE ( request,
+									  operation->dataBuffer,
+									  fMediumBlockSize,
+									  0,
+									  0,
+									  0,
+									  0,
+									  0,
+									  operation->dataBlock,
+									  0,
+									  operation->blockCount,
+									  0 );
+			
+		}
+		break;
 		
-		number = OSNumber::withNumber ( cylinders, 32 );
-		if ( number != NULL )
+		case kSBCParityStepXDREAD:
 		{
 			
-			dict->setObject ( kIOPropertyCylinderCountKey, number );
-			number->release ( );
-			number = NULL;
+			built = device->XDREAD ( request,
+									 operation->xorBuffer,
+									 fMediumBlockSize,
+									 0,
+									 operation->dataBlock,
+									 0,
+									 operation->blockCount,
+									 0 );
 			
 		}
+		break;
 		
-		number = OSNumber::withNumber ( rigidDisk->NUMBER_OF_HEADS, 8 );
-		if ( number != NULL )
+		case kSBCParityStepXPWRITE:
 		{
 			
-			dict->setObject ( kIOPropertyHeadCountKey, number );
-			number->release ( );
-			number = NULL;
+			built = device->XPWRITE ( request,
+									  operation->xorBuffer,
+									  fMediumBlockSize,
+									  0,
+									  0,
+									  0,
+									  0,
+									  operation->parityBlock,
+									  0,
+									  operation->blockCount,
+									  0 );
 			
 		}
+		break;
+		
+		default:
+			break;
 		
 	}
 	
-	GetDeviceCharacteristicsDictionary ( )->setObject ( kIOPropertyRigidDiskGeometryKey, dict );
+	require_action ( built, ReleaseTask, status = kIOReturnBadArgument );
 	
+	operation->step			= step;
+	operation->failed		= false;
+	operation->unsupported	= false;
+	operation->inFlight		= true;
 	
-ReleaseDescriptor:
+	device->SetApplicationLayerReference ( request, operation );
+	device->SendCommand ( request,
+						  kThirtySecondTimeoutInMS,
+						  &IOSCSIBlockCommandsDevice::ParityComplete );
 	
+	return kIOReturnSuccess;
 	
-	require_nonzero_quiet ( bufferDesc, ReleaseDictionary );
-	bufferDesc->release ( );
-	bufferDesc = NULL;
 	
+ReleaseTask:
 	
-ReleaseDictionary:
 	
+	device->ReleaseSCSITask ( request );
+	request = NULL;
 	
-	require_nonzero_quiet ( dict, ErrorExit );
-	dict->release ( );
-	dict = NULL;
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 ComputeParityDeltaThroughHost - Writes the new data for a parity
+//									  operation and XORs it with the old
+//									  data in host memory.			  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::ComputeParityDeltaThroughHost (
+							SBCParityOperation *		operation,
+							IOBufferMemoryDescriptor *	hostBuffer )
+{
+	
+	IOReturn	status		= kIOReturnSuccess;
+	UInt64		byteCount	= 0;
+	
+	byteCount = operation->blockCount * fMediumBlockSize;
+	
+	// Read the old data into the XOR buffer before it is overwritten.
+	status = SendBlockReadWrite ( operation->xorBuffer, operation->dataBlock, operation->blockCount, false );
+	require_success ( status, ErrorExit );
+	
+	status = SendBlockReadWrite ( operation->dataBuffer, operation->dataBlock, operation->blockCount, true );
+	require_success ( status, ErrorExit );
+	
+	require_action ( ( operation->dataBuffer->readBytes ( 0, hostBuffer->getBytesNoCopy ( ), byteCount ) == byteCount ),
+					 ErrorExit,
+					 status = kIOReturnIOError );
+	
+	XORBytes ( ( UInt8 * ) operation->xorBuffer->getBytesNoCopy ( ),
+			   ( UInt8 * ) hostBuffer->getBytesNoCopy ( ),
+			   byteCount );
 	
 	
 ErrorExit:
 	
 	
-	return;
+	return status;
 	
 }
 
 
 //
-//	 DetermineMediumWriteProtectState - Determines medium write protect state.
-//																	[PROTECTED]
+//	 ApplyParityDeltaThroughHost - XORs the change for a parity operation
+//									into the parity in host memory.	  [PRIVATE]
 //
 
-bool
-IOSCSIBlockCommandsDevice::DetermineMediumWriteProtectState ( void )
+IOReturn
+IOSCSIBlockCommandsDevice::ApplyParityDeltaThroughHost (
+							SBCParityOperation *		operation,
+							IOBufferMemoryDescriptor *	hostBuffer )
 {
 	
-	SCSIServiceResponse 	serviceResponse 		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	IOMemoryDescriptor *	bufferDesc				= NULL;
-	SCSITaskIdentifier		request					= NULL;
-	bool					writeProtectDetermined 	= false;
-	bool					mediumIsProtected 		= true;
-	SCSI_Sense_Data			senseBuffer				= { 0 };
-	UInt8					modeBuffer[16]			= { 0 };
+	IOReturn	status		= kIOReturnSuccess;
 	
-	// For now, report all fixed disks as writable since most have
-	// no way of changing this.
-	require_action_quiet ( fMediaIsRemovable, Exit, mediumIsProtected = false );
+	status = operation->parityDevice->SendBlockReadWrite ( hostBuffer,
+														   operation->parityBlock,
+														   operation->blockCount,
+														   false );
+	require_success ( status, ErrorExit );
+	
+	XORBytes ( ( UInt8 * ) hostBuffer->getBytesNoCopy ( ),
+			   ( UInt8 * ) operation->xorBuffer->getBytesNoCopy ( ),
+			   operation->blockCount * fMediumBlockSize );
+	
+	status = operation->parityDevice->SendBlockReadWrite ( hostBuffer,
+														   operation->parityBlock,
+														   operation->blockCount,
+														   true );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SendBlockReadWrite - Sends a single read or write and waits for it.
+//																	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::SendBlockReadWrite (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							bool					isWrite )
+{
+	
+	SCSIServiceResponse		serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOReturn				status			= kIOReturnIOError;
 	
 	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
 	
-	// Send a Request Sense to the device, this seems to make some happy again.
-	bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
-													kSenseDefaultSize,
-													kIODirectionIn );
-	check ( bufferDesc );
+	if ( BuildReadWriteTask ( request,
+							  buffer,
+							  fMediumBlockSize,
+							  startBlock,
+							  blockCount,
+							  GetReadWriteCDBSize ( startBlock, blockCount ),
+							  isWrite,
+							  false ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+	}
 	
-	if ( bufferDesc != NULL )
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		status = kIOReturnSuccess;
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 InitializeZones - Reads the zone table of a zoned device.		  [PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::InitializeZones ( void )
+{
+	
+	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	IOBufferMemoryDescriptor *	buffer			= NULL;
+	SBCReportZonesHeader *		header			= NULL;
+	UInt32						zoneCount		= 0;
+	bool						result			= false;
+	
+	fZoneLock = IOLockAlloc ( );
+	require_nonzero ( fZoneLock, ErrorExit );
+	
+	fZoneWriteTimer = thread_call_allocate (
+					( thread_call_func_t ) IOSCSIBlockCommandsDevice::sZoneWriteTimerExpired,
+					( thread_call_param_t ) this );
+	require_nonzero ( fZoneWriteTimer, FreeZoneTable );
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SBCReportZonesHeader ), kIODirectionIn );
+	require_nonzero ( buffer, FreeZoneTable );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseBuffer );
+	
+	// The header alone holds the length of the whole zone list.
+	if ( REPORT_ZONES ( request,
+						buffer,
+						0,
+						sizeof ( SBCReportZonesHeader ),
+						0,
+						0,
+						0 ) == true )
 	{
 		
-		// Issue a Request Sense
-		// Whether the command completes successfully or not is irrelevent.
-		if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
-		{
-			
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-			
-		}
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+	}
+	
+	require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			  ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+	
+	header		= ( SBCReportZonesHeader * ) buffer->getBytesNoCopy ( );
+	zoneCount	= OSSwapBigToHostInt32 ( header->ZONE_LIST_LENGTH ) / sizeof ( SBCZoneDescriptor );
+	require_nonzero ( zoneCount, ReleaseTask );
+	
+	fZones = IONew ( SBCZone, zoneCount );
+	require_nonzero ( fZones, ReleaseTask );
+	
+	bzero ( fZones, zoneCount * sizeof ( SBCZone ) );
+	fZoneCount = zoneCount;
+	
+	// The first zone starts at block 0, the rest are found as the zone
+	// descriptors are read.
+	require_success ( RefreshZones ( 0, zoneCount ), ReleaseTask );
+	
+	PublishZoneGeometry ( );
+	result = true;
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseBuffer:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+FreeZoneTable:
+	
+	
+	if ( result == false )
+	{
+		FreeZones ( );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeZones - Frees the zone table.								  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::FreeZones ( void )
+{
+	
+	// The timer holds a reference to us while it is armed, so it can not
+	// be pending by the time we are freed.
+	if ( fZoneWriteTimer != NULL )
+	{
 		
-		// release the sense data buffer;
-		bufferDesc->release ( );
-		bufferDesc = NULL;
+		thread_call_free ( fZoneWriteTimer );
+		fZoneWriteTimer = NULL;
 		
 	}
 	
-	// Now back to normal programming.
-	bufferDesc = IOMemoryDescriptor::withAddress ( 	modeBuffer,
-													8,
-													kIODirectionIn );
-	require_nonzero ( bufferDesc, ReleaseTask );
-	
-	if ( GetANSIVersion ( ) == kINQUIRY_ANSI_VERSION_NoClaimedConformance )
+	if ( fZones != NULL )
 	{
 		
-		// The device does not claim compliance with any ANSI version, so it
-		// is most likely an ATAPI device, try the 10 byte command first.
+		IODelete ( fZones, SBCZone, fZoneCount );
+		fZones = NULL;
 		
-		if ( MODE_SENSE_10 ( 	request,
-								bufferDesc,
-								0x00,
-								0x00,
-								0x00,	// Normally, we set DBD=1, but since we're only
-								0x3F,	// interested in modeBuffer[3], we set DBD=0 since
-								8,		// it makes legacy devices happier
-								0 ) == true )
-		{
-			
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-			
-		}
+	}
+	
+	fZoneCount = 0;
+	
+	if ( fZoneLock != NULL )
+	{
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
-		{
-			
-			if ( ( modeBuffer[3] & kModeSenseSBCDeviceSpecific_WriteProtectMask ) == 0 )
-			{
-			 	mediumIsProtected = false;
-			}
-			
-			writeProtectDetermined = true;
-			
-		}
+		IOLockFree ( fZoneLock );
+		fZoneLock = NULL;
 		
 	}
 	
-	// Check if the write protect status has been successfully determined.
-	if ( writeProtectDetermined == false )
+}
+
+
+//
+//	 RefreshZones - Reads a range of zones from the device into the zone
+//					 table.											  [PRIVATE]
+//
+
+IOReturn
+IOSCSIBlockCommandsDevice::RefreshZones ( UInt32	firstZone,
+										  UInt32	zoneCount )
+{
+	
+	SCSIServiceResponse			serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request				= NULL;
+	IOBufferMemoryDescriptor *	buffer				= NULL;
+	SBCReportZonesHeader *		header				= NULL;
+	SBCZoneDescriptor *			descriptors			= NULL;
+	SBCZone *					zone				= NULL;
+	IOReturn					status				= kIOReturnBadArgument;
+	UInt64						nextBlock			= 0;
+	UInt64						realizedCount		= 0;
+	UInt32						allocationLength	= 0;
+	UInt32						batchCount			= 0;
+	UInt32						reportedCount		= 0;
+	UInt32						index				= 0;
+	
+	require ( ( firstZone < fZoneCount ) && ( zoneCount <= ( fZoneCount - firstZone ) ), ErrorExit );
+	
+	status = kIOReturnNoResources;
+	allocationLength = sizeof ( SBCReportZonesHeader ) +
+					   ( kSBCZoneReportBatchCount * sizeof ( SBCZoneDescriptor ) );
+	
+	buffer = IOBufferMemoryDescriptor::withCapacity ( allocationLength, kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseBuffer );
+	
+	header		= ( SBCReportZonesHeader * ) buffer->getBytesNoCopy ( );
+	descriptors	= ( SBCZoneDescriptor * ) ( header + 1 );
+	nextBlock	= fZones[firstZone].start;
+	
+	while ( zoneCount > 0 )
 	{
 		
-		// Either this device reports an ANSI version, or the 10 Byte command failed.
-		// Try the six byte mode sense.	
-		if ( MODE_SENSE_6 ( request,
-							bufferDesc,
-							0x00,
-							0x00,	// Normally, we set DBD=1, but since we're only
-							0x3F,	// interested in modeBuffer[3], we set DBD=0 since
-							8,		// it makes legacy devices happier
+		batchCount = zoneCount;
+		if ( batchCount > kSBCZoneReportBatchCount )
+		{
+			batchCount = kSBCZoneReportBatchCount;
+		}
+		
+		allocationLength = sizeof ( SBCReportZonesHeader ) + ( batchCount * sizeof ( SBCZoneDescriptor ) );
+		serviceResponse	 = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		
+		// With PARTIAL set the ZONE LIST LENGTH only covers the zones that
+		// fit, so the device need not look at the zones past them.
+		if ( REPORT_ZONES ( request,
+							buffer,
+							nextBlock,
+							allocationLength,
+							1,
+							0,
 							0 ) == true )
 		{
 			
@@ -2211,586 +8388,839 @@ IOSCSIBlockCommandsDevice::DetermineMediumWriteProtectState ( void )
 			
 		}
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		status = kIOReturnIOError;
+		require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+				  ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
+		
+		reportedCount = OSSwapBigToHostInt32 ( header->ZONE_LIST_LENGTH ) / sizeof ( SBCZoneDescriptor );
+		if ( reportedCount > batchCount )
+		{
+			reportedCount = batchCount;
+		}
+		
+		realizedCount = GetRealizedDataTransferCount ( request );
+		if ( realizedCount < allocationLength )
 		{
 			
-			if ( ( modeBuffer[2] & kModeSenseSBCDeviceSpecific_WriteProtectMask ) == 0 )
+			realizedCount = ( realizedCount > sizeof ( SBCReportZonesHeader ) ) ?
+							( realizedCount - sizeof ( SBCReportZonesHeader ) ) / sizeof ( SBCZoneDescriptor ) : 0;
+			
+			if ( reportedCount > realizedCount )
 			{
-				mediumIsProtected = false;
+				reportedCount = realizedCount;
 			}
 			
 		}
 		
-		else
+		require_nonzero ( reportedCount, ReleaseTask );
+		
+		IOLockLock ( fZoneLock );
+		
+		for ( index = 0; index < reportedCount; index++ )
 		{
 			
-			ERROR_LOG ( ( "%s: Mode Sense failed\n", getName ( ) ) );
+			zone			= &fZones[firstZone + index];
+			zone->start		= OSSwapBigToHostInt64 ( descriptors[index].ZONE_START_LBA );
+			zone->length	= OSSwapBigToHostInt64 ( descriptors[index].ZONE_LENGTH );
+			zone->type		= descriptors[index].ZONE_TYPE & kSBCZoneTypeMask;
+			zone->condition	= descriptors[index].ZONE_CONDITION >> kSBCZoneConditionShift;
 			
-			// The mode sense failed, mark as write protected to be safe.
-			mediumIsProtected = true;
+			// While writes to a zone are queued or in flight the write
+			// pointer tracked here is ahead of the device's, so keep it.
+			if ( ( zone->stale == true ) ||
+				 ( ( zone->queue == NULL ) && ( zone->inFlight == NULL ) ) )
+			{
+				
+				// The write pointer of a full zone is not defined.
+				if ( zone->condition == kSBCZoneConditionFull )
+				{
+					zone->writePointer = zone->start + zone->length;
+				}
+				
+				else
+				{
+					zone->writePointer = OSSwapBigToHostInt64 ( descriptors[index].WRITE_POINTER_LBA );
+				}
+				
+				zone->appendPointer	= zone->writePointer;
+				zone->stale			= false;
+				
+			}
 			
 		}
 		
+		IOLockUnlock ( fZoneLock );
+		
+		nextBlock	= zone->start + zone->length;
+		firstZone	+= reportedCount;
+		zoneCount	-= reportedCount;
+		
 	}
 	
-	bufferDesc->release ( );
-	bufferDesc = NULL;
+	status = kIOReturnSuccess;
 	
 	
 ReleaseTask:
 	
 	
-	require_nonzero_quiet ( request, ErrorExit );
 	ReleaseSCSITask ( request );
 	request = NULL;
 	
 	
-ErrorExit:
-Exit:
+ReleaseBuffer:
 	
 	
-	return mediumIsProtected;
+	buffer->release ( );
+	buffer = NULL;
 	
-}
-
-
-//
-//	 SetMediumIcon - Sets an icon key in the registry if desired.	[PROTECTED]
-//
-
-void
-IOSCSIBlockCommandsDevice::SetMediumIcon ( void )
-{
 	
-	STATUS_LOG ( ( "IOSCSIBlockCommandsDevice::SetMediumIcon called\n" ) );
+ErrorExit:
 	
-	// Methodology for setting icons
-	// 1. Find out if an icon key is already present. If there is one, do
-	// nothing since it might be from a plist entry. This makes it easy for
-	// subclassers to set a media property for their device (if it is known
-	// and can only be one media type - e.g. Zip) in their PB project, rather
-	// than adding a method to their subclass.
-	// 
-	// 2. Find out if the device is on an internal bus or external bus and
-	// what type of bus it is. If it is a bus for which we have a special
-	// icon at this point in time, then we set that icon key. The icons are
-	// located in the IOSCSIArchitectureModelFamily.kext/Contents/Resources
-	// directory.
-	//
-	// We currently have icons for the following:
-	//	 Firewire HD
-	//	 Fibre Channel HD
-	//	 USB HD
-	//	 SuperDisk
-	//	 MagnetoOptical
-	//	 SmartMedia
-	//	 MemoryStick
-	//	 Floppy
-	//
-	// We plan to have the following icons supported once we get artwork/licensing:
-	//	 CompactFlash
-	//	 Clik!
-	//	 Zip
-	//	 Jaz
 	
-	// Step 1. Find out if a media icon is present
-	if ( getProperty ( kIOMediaIconKey, gIOServicePlane ) == NULL )
-	{
-		
-		OSDictionary *	dict = NULL;
-		
-		STATUS_LOG ( ( "No current icon key\n" ) );
-		
-		// Step 2. No icon is present, see if we can provide one.
-		dict = GetProtocolCharacteristicsDictionary ( );
-		if ( dict != NULL )
-		{
-			
-			OSString *	protocolString 	= NULL;
-			
-			STATUS_LOG ( ( "Got Protocol Characteristics Dictionary\n" ) );
-
-			protocolString = OSDynamicCast ( OSString, dict->getObject ( kIOPropertyPhysicalInterconnectTypeKey ) );
-			if ( protocolString != NULL )
-			{
-				
-				const char *	protocol = NULL;
-				
-				STATUS_LOG ( ( "Got Protocol string\n" ) );
-
-				protocol = protocolString->getCStringNoCopy ( );
-				if ( protocol != NULL )
-				{
-					
-					OSString *	identifier		= NULL;
-					OSString *	resourceFile	= NULL;
-					
-					STATUS_LOG ( ( "Protocol = %s\n", protocol ) );
-					
-					identifier 	= OSString::withCString ( kIOSCSIArchitectureBundleIdentifierKey );
-					dict		= OSDictionary::withCapacity ( 2 );
-					
-					if ( fMediaIsRemovable == false )
-					{
-						
-						// If the protocol is FireWire, it needs an icon.
-						if ( strcmp ( protocol, "FireWire" ) == 0 )
-						{
-							
-							resourceFile = OSString::withCString ( kFireWireHDIconKey );
-							
-						}
-						
-						// If the protocol is USB and media is not removable, it needs an icon.
-						if ( strcmp ( protocol, "USB" ) == 0 )
-						{
-							
-							resourceFile = OSString::withCString ( kUSBHDIconKey );
-							
-						}
-						
-						// If the protocol is FibreChannel, it needs an icon.
-						if ( strcmp ( protocol, "Fibre Channel Interface" ) == 0 )
-						{
-							
-							resourceFile = OSString::withCString ( kFibreChannelHDIconKey );
-							
-						}
-						
-					}
-					
-					// Do we have an icon to set?
-					if ( resourceFile != NULL )
-					{
-						
-						STATUS_LOG ( ( "Resource file is non-NULL\n" ) );
+	return status;
+	
+}
 
-						// Make sure other resources are allocated
-						if ( ( dict != NULL ) && ( identifier != NULL ) )
-						{
-							
-							STATUS_LOG ( ( "Setting keys\n" ) );
-							
-							dict->setObject ( kCFBundleIdentifierKey, identifier );
-							dict->setObject ( kIOBundleResourceFileKey, resourceFile );
-							
-							setProperty ( kIOMediaIconKey, dict );
-							
-						}
-						
-						resourceFile->release ( );
-						
-					}
-					
-					if ( dict != NULL )
-					{
-						
-						dict->release ( );
-						dict = NULL;
-						
-					}
-					
-					if ( identifier != NULL )
-					{
-						
-						identifier->release ( );
-						identifier = NULL;
-						
-					}
-					
-				}
-				
-			}
+
+//
+//	 FindZone - Returns the zone containing a block.				  [PRIVATE]
+//
+
+SBCZone *
+IOSCSIBlockCommandsDevice::FindZone ( UInt64 block )
+{
+	
+	SBCZone *	zone	= NULL;
+	UInt32		low		= 0;
+	UInt32		high	= fZoneCount;
+	UInt32		middle	= 0;
+	
+	// The zones are in LBA order and cover the medium without gaps.
+	while ( low < high )
+	{
+		
+		middle = low + ( ( high - low ) / 2 );
+		
+		if ( block < fZones[middle].start )
+		{
+			high = middle;
+		}
+		
+		else if ( block >= ( fZones[middle].start + fZones[middle].length ) )
+		{
+			low = middle + 1;
+		}
+		
+		else
+		{
+			
+			zone = &fZones[middle];
+			break;
 			
 		}
 		
 	}
 	
+	return zone;
+	
 }
 
 
 //
-//	 GetWriteCacheState - Gets the write cache state.				  [PRIVATE]
+//	 IsSequentialWriteRequiredRange - Returns whether any block in a range
+//									   is in a sequential write required
+//									   zone.						  [PRIVATE]
 //
 
-IOReturn
-IOSCSIBlockCommandsDevice::GetWriteCacheState (
-							IOMemoryDescriptor * 	buffer,
-							UInt8					modePageControlValue )
+bool
+IOSCSIBlockCommandsDevice::IsSequentialWriteRequiredRange (
+							UInt64	startBlock,
+							UInt64	blockCount )
 {
 	
-	IOReturn				status			= kIOReturnError;
-	SCSIServiceResponse 	serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier		request 		= NULL;
+	SBCZone *	zone	= NULL;
+	SBCZone *	end		= NULL;
+	bool		result	= false;
 	
-	request = GetSCSITask ( );
-	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
+	require_nonzero_quiet ( fZones, Exit );
+	require_nonzero_quiet ( blockCount, Exit );
 	
-	if ( MODE_SENSE_6 ( request,
-						buffer,
-						0x00,
-						modePageControlValue,
-						kSBCModePageCachingCode,
-						buffer->getLength ( ),
-						0x00 ) == true )
+	zone = FindZone ( startBlock );
+	require_nonzero_quiet ( zone, Exit );
+	
+	// The zones are contiguous, so walk forward until the range ends.
+	end = &fZones[fZoneCount];
+	while ( ( zone < end ) && ( zone->start < ( startBlock + blockCount ) ) )
 	{
 		
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		if ( zone->type == kSBCZoneTypeSequentialWriteRequired )
+		{
+			
+			result = true;
+			break;
+			
+		}
+		
+		zone++;
 		
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	
+Exit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 PublishZoneGeometry - Publishes the zone layout of the medium.  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::PublishZoneGeometry ( void )
+{
+	
+	OSDictionary *	dict				= NULL;
+	OSNumber *		number				= NULL;
+	OSString *		string				= NULL;
+	UInt64			zoneSize			= 0;
+	UInt32			conventionalCount	= 0;
+	UInt32			sequentialCount		= 0;
+	UInt32			index				= 0;
+	
+	require_nonzero_quiet ( fZones, ErrorExit );
+	
+	// Report the size of the sequential zones, which are normally all the
+	// same size and make up most of the medium.
+	for ( index = 0; index < fZoneCount; index++ )
 	{
 		
-		if ( GetRequestedDataTransferCount ( request ) == GetRealizedDataTransferCount ( request ) )
+		if ( fZones[index].type == kSBCZoneTypeConventional )
 		{
-			status = kIOReturnSuccess;
+			conventionalCount++;
+		}
+		
+		else
+		{
+			
+			if ( zoneSize == 0 )
+			{
+				zoneSize = fZones[index].length * fMediumBlockSize;
+			}
+			
+			if ( fZones[index].type == kSBCZoneTypeSequentialWriteRequired )
+			{
+				sequentialCount++;
+			}
+			
 		}
 		
 	}
 	
-	ReleaseSCSITask ( request );
-	request = NULL;
+	dict = OSDictionary::withCapacity ( 5 );
+	require_nonzero ( dict, ErrorExit );
+	
+	string = OSString::withCString ( ( fZonedModel == kSBCZonedModelHostManaged ) ?
+									 kIOPropertyZoneModelHostManaged : kIOPropertyZoneModelHostAware );
+	if ( string != NULL )
+	{
+		
+		dict->setObject ( kIOPropertyZoneModelKey, string );
+		string->release ( );
+		
+	}
+	
+	number = OSNumber::withNumber ( fZoneCount, 32 );
+	dict->setObject ( kIOPropertyZoneCountKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( zoneSize, 64 );
+	dict->setObject ( kIOPropertyZoneSizeKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( conventionalCount, 32 );
+	dict->setObject ( kIOPropertyConventionalZoneCountKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( sequentialCount, 32 );
+	dict->setObject ( kIOPropertySequentialWriteZoneCountKey, number );
+	number->release ( );
+	
+	setProperty ( kIOPropertyZonedBlockDeviceKey, dict );
+	dict->release ( );
 	
 	
 ErrorExit:
 	
 	
-	return status;
+	return;
 	
 }
 
 
 //
-//	 GetWriteCacheState - Gets the write cache state.				   [PUBLIC]
+//	 EnqueueZoneWrite - Queues a write on its zone, in LBA order.	  [PRIVATE]
 //
 
 IOReturn
-IOSCSIBlockCommandsDevice::GetWriteCacheState ( bool * enabled )
+IOSCSIBlockCommandsDevice::EnqueueZoneWrite ( SBCZone *			zone,
+											  SBCZoneWrite *	write,
+											  bool				append )
 {
 	
-	IOReturn					status 			= kIOReturnUnsupported;
-	IOBufferMemoryDescriptor *	buffer			= NULL;
-	SPCModeParameterHeader6 *	header			= NULL;
-	SBCModePageCaching *		cachePage		= NULL;
-	UInt8 *						bufferPtr		= NULL;
-	UInt8						pageCode		= 0;
-	UInt8						minSize			= 0;
-	UInt8						pageSize		= 0;
-	UInt8						blockDescLength	= 0;
+	SBCZoneWrite **		link		= NULL;
+	SBCZoneWrite *		previous	= NULL;
+	SBCZoneWrite *		inFlight	= NULL;
+	IOReturn			status		= kIOReturnSuccess;
+	UInt64				endBlock	= 0;
+	bool				held		= false;
 	
-	// There are a whole class of devices which do not like to be sent
-	// any MODE_SENSE or MODE_SELECT commands which they don't implement.
-	// Since removable devices don't usually have a cache, we restrict
-	// the device set to fixed hard disks for the following calls.
-	require ( ( fMediaIsRemovable == false ), ErrorExit );
+	IOLockLock ( fZoneLock );
 	
-	// Allocate the buffer.
-	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader6 ), kIODirectionIn );
-	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
+	if ( zone->busy == true )
+	{
+		
+		status = kIOReturnBusy;
+		goto Unlock;
+		
+	}
 	
-	// Obtain the header.
-	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
-	require_success ( status, ReleaseDescriptor );
+	// A zone whose last write failed is read again before it takes more.
+	// We may be called from the completion of that write, when a retry is
+	// sent, so the zone is read on the timer's thread and the write is
+	// held until then.
+	if ( zone->stale == true )
+	{
+		
+		write->append	= append;
+		write->next		= NULL;
+		
+		link = &zone->held;
+		while ( *link != NULL )
+		{
+			link = &( *link )->next;
+		}
+		
+		*link	= write;
+		held	= true;
+		goto Unlock;
+		
+	}
 	
-	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
-	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+	// Appends go after everything already written or queued.
+	if ( append == true )
+	{
+		write->startBlock = zone->appendPointer;
+	}
 	
-	// Save off the page size.
-	pageSize = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+	endBlock = write->startBlock + write->blockCount;
 	
-	// Sanity check the block descriptor length.
-	if ( ( header->BLOCK_DESCRIPTOR_LENGTH & 7 ) == 0 )
+	// Blocks behind the write pointer can not be written again until the
+	// zone is reset.
+	if ( ( write->startBlock < zone->writePointer ) ||
+		 ( endBlock <= write->startBlock ) ||
+		 ( endBlock > ( zone->start + zone->length ) ) )
 	{
 		
-		// Block descriptor is in fact a multiple of 8.
-		// Assume we can trust it.
-		blockDescLength = header->BLOCK_DESCRIPTOR_LENGTH;		
+		status = ( append == true ) ? kIOReturnNoSpace : kIOReturnBadArgument;
+		goto Unlock;
 		
 	}
 	
-	// Sanity check on buffer size.
-	minSize = sizeof ( SPCModeParameterHeader6 ) + blockDescLength +
-		offsetof ( SBCModePageCaching, DEMAND_READ_WRITE_RETENTION_PRIORITY );
+	inFlight = zone->inFlight;
+	if ( ( inFlight != NULL ) &&
+		 ( write->startBlock < ( inFlight->startBlock + inFlight->blockCount ) ) &&
+		 ( endBlock > inFlight->startBlock ) )
+	{
+		
+		status = kIOReturnBadArgument;
+		goto Unlock;
+		
+	}
 	
-	require_action ( ( pageSize >= minSize ), ReleaseDescriptor, status = kIOReturnError );
+	// Find the write's place in the queue and refuse it if it overlaps the
+	// writes on either side.
+	link = &zone->queue;
+	while ( ( *link != NULL ) && ( ( *link )->startBlock < write->startBlock ) )
+	{
+		
+		previous	= *link;
+		link		= &previous->next;
+		
+	}
 	
-	// Is pageSize greater than it needs to be?
-	pageSize = min ( pageSize, sizeof ( SPCModeParameterHeader6 ) + blockDescLength + sizeof ( SBCModePageCaching ) );
+	if ( ( ( previous != NULL ) && ( ( previous->startBlock + previous->blockCount ) > write->startBlock ) ) ||
+		 ( ( *link != NULL ) && ( ( *link )->startBlock < endBlock ) ) )
+	{
+		
+		status = kIOReturnBadArgument;
+		goto Unlock;
+		
+	}
 	
-	buffer->release ( );
+	clock_interval_to_deadline ( kSBCZoneWriteDeadlineInMS,
+								 kMillisecondScale,
+								 &write->deadline );
+	
+	write->next	= *link;
+	*link		= write;
+	
+	if ( endBlock > zone->appendPointer )
+	{
+		zone->appendPointer = endBlock;
+	}
+	
+	
+Unlock:
+	
+	
+	IOLockUnlock ( fZoneLock );
+	
+	if ( held == true )
+	{
+		
+		// The timer holds a reference to us while it is armed.
+		if ( thread_call_enter ( fZoneWriteTimer ) == false )
+		{
+			retain ( );
+		}
+		
+	}
+	
+	else if ( status == kIOReturnSuccess )
+	{
+		DispatchZoneWrites ( zone );
+	}
+	
+	return status;
+	
+}
+
+
+//
+//	 DispatchZoneWrites - Sends the next write of a zone if it starts at
+//						   the write pointer.						  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::DispatchZoneWrites ( SBCZone * zone )
+{
+	
+	SBCZoneWrite *	write	= NULL;
+	AbsoluteTime	now;
+	
+	IOLockLock ( fZoneLock );
+	
+	if ( ( zone->inFlight == NULL ) && ( zone->queue != NULL ) )
+	{
+		
+		write = zone->queue;
+		clock_get_uptime ( &now );
+		
+		// If the gap in front of the first write has not been filled by its
+		// deadline, send it anyway and let the device fail it rather than
+		// hold up the zone for good.
+		if ( ( write->startBlock == zone->writePointer ) ||
+			 ( CMP_ABSOLUTETIME ( &write->deadline, &now ) <= 0 ) )
+		{
+			
+			zone->queue		= write->next;
+			zone->inFlight	= write;
+			write->next		= NULL;
+			
+		}
+		
+		else
+		{
+			
+			// Look again once the deadline has passed. The timer holds a
+			// reference to us while it is armed.
+			if ( thread_call_enter_delayed ( fZoneWriteTimer, write->deadline ) == false )
+			{
+				retain ( );
+			}
+			
+			write = NULL;
+			
+		}
+		
+	}
+	
+	IOLockUnlock ( fZoneLock );
+	
+	if ( write != NULL )
+	{
+		SendZoneWrite ( zone, write );
+	}
+	
+}
+
+
+//
+//	 RefreshStaleZone - Reads a stale zone again and queues the writes
+//						 held for it.								  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::RefreshStaleZone ( SBCZone * zone )
+{
+	
+	SBCZoneWrite *	held	= NULL;
+	SBCZoneWrite *	next	= NULL;
+	IOReturn		status	= kIOReturnSuccess;
+	bool			stale	= false;
+	
+	RefreshZones ( zone - fZones, 1 );
+	
+	IOLockLock ( fZoneLock );
+	
+	held		= zone->held;
+	zone->held	= NULL;
+	stale		= zone->stale;
+	
+	IOLockUnlock ( fZoneLock );
+	
+	// Queue the held writes in the order they came. If the zone could not
+	// be read, fail them rather than hold them again, or the timer would
+	// spin on a zone the device will not report.
+	while ( held != NULL )
+	{
+		
+		next		= held->next;
+		held->next	= NULL;
+		
+		if ( stale == true )
+		{
+			status = kIOReturnIOError;
+		}
+		
+		else
+		{
+			status = EnqueueZoneWrite ( zone, held, held->append );
+		}
+		
+		if ( status != kIOReturnSuccess )
+		{
+			FinishZoneWrite ( held, status );
+		}
+		
+		held = next;
+		
+	}
+	
+}
+
+
+//
+//	 SendZoneWrite - Sends the next task of a zone's write in flight.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::SendZoneWrite ( SBCZone *		zone,
+										   SBCZoneWrite *	write )
+{
+	
+	SCSITaskIdentifier		request		= NULL;
+	IOMemoryDescriptor *	taskBuffer	= NULL;
+	UInt64					startBlock	= 0;
+	UInt64					blockCount	= 0;
+	bool					cmdStatus	= false;
+	
+	startBlock = write->startBlock + write->blocksWritten;
+	blockCount = GetReadWriteSplitBlockCount ( startBlock,
+											   write->blockCount - write->blocksWritten,
+											   fMediumBlockSize,
+											   true );
+	require_nonzero ( blockCount, ErrorExit );
+	
+	// A write that fits in one task is sent with the client's buffer.
+	if ( blockCount == write->blockCount )
+	{
+		
+		taskBuffer = write->buffer;
+		taskBuffer->retain ( );
+		
+	}
 	
-	// Allocate a buffer for data we need.
-	buffer = IOBufferMemoryDescriptor::withCapacity ( pageSize, kIODirectionOutIn );
-	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
+	else
+	{
+		
+		taskBuffer = IOMemoryDescriptor::withSubRange ( write->buffer,
+														write->blocksWritten * fMediumBlockSize,
+														blockCount * fMediumBlockSize,
+														kIODirectionOut );
+		require_nonzero ( taskBuffer, ErrorExit );
+		
+	}
 	
-	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
-	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseBuffer );
+	
+	cmdStatus = BuildReadWriteTask ( request,
+									 taskBuffer,
+									 fMediumBlockSize,
+									 startBlock,
+									 blockCount,
+									 GetReadWriteCDBSize ( startBlock, blockCount ),
+									 true,
+									 write->forceUnitAccess );
+	require ( cmdStatus, ReleaseTask );
+	
+	write->taskBuffer		= taskBuffer;
+	write->taskBlockCount	= blockCount;
+	
+	// The task bypasses the elevator, the zone already sends its writes in
+	// the only order the device will take them.
+	SetApplicationLayerReference ( request, zone );
+	SendCommand ( request,
+				  fWriteTimeoutDuration,
+				  &IOSCSIBlockCommandsDevice::ZoneWriteComplete );
 	
-	// Obtain the full page.
-	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
-	require_success ( status, ReleaseDescriptor );
+	return;
 	
-	cachePage = ( SBCModePageCaching * ) &bufferPtr[ sizeof ( SPCModeParameterHeader6 ) + blockDescLength ];
-	pageCode = cachePage->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
 	
-	// Sanity check on returned data from drive.
-	require_action ( ( pageCode == kSBCModePageCachingCode ), ReleaseDescriptor, status = kIOReturnError );
+ReleaseTask:
 	
-	// Find out if the WCE bit is set.
-	*enabled = cachePage->flags & kSBCModePageCaching_WCE_Mask;
 	
-	status = kIOReturnSuccess;
+	ReleaseSCSITask ( request );
+	request = NULL;
 	
 	
-ReleaseDescriptor:
+ReleaseBuffer:
 	
 	
-	require_nonzero_quiet ( buffer, ErrorExit );
-	buffer->release ( );
-	buffer = NULL;
+	taskBuffer->release ( );
+	taskBuffer = NULL;
 	
 	
 ErrorExit:
 	
 	
-	return status;
+	// Fail the write as if the device had.
+	CompleteZoneWrite ( zone, NULL );
 	
 }
 
 
 //
-//	 SetWriteCacheState - Sets the write cache state.				   [PUBLIC]
+//	 CompleteZoneWrite - Accounts for a completed task of a zone's write
+//						  in flight and sends the next one.			  [PRIVATE]
 //
 
-IOReturn
-IOSCSIBlockCommandsDevice::SetWriteCacheState ( bool enabled )
+void
+IOSCSIBlockCommandsDevice::CompleteZoneWrite ( SBCZone *			zone,
+											   SCSITaskIdentifier	request )
 {
 	
-	IOReturn					status 			= kIOReturnUnsupported;
-	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier			request 		= NULL;
-	IOBufferMemoryDescriptor *	buffer			= NULL;
-	SPCModeParameterHeader6 *	header			= NULL;
-	SBCModePageCaching *		cachePage		= NULL;
-	UInt8 *						bufferPtr		= NULL;
-	UInt8						pageCode		= 0;
-	UInt8						minSize			= 0;
-	UInt8						pageSize		= 0;
-	UInt8						blockDescLength	= 0;
-	
-	// There are a whole class of devices which do not like to be sent
-	// any MODE_SENSE or MODE_SELECT commands which they don't implement.
-	// Since removable devices don't usually have a cache, we restrict
-	// the device set to fixed hard disks for the following calls.
-	require ( ( fMediaIsRemovable == false ), ErrorExit );
-	
-	// Allocate the buffer.
-	buffer = IOBufferMemoryDescriptor::withCapacity ( sizeof ( SPCModeParameterHeader6 ), kIODirectionIn );
-	require_nonzero ( buffer, ErrorExit );
-	
-	// Obtain the header.
-	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
-	require_success ( status, ReleaseDescriptor );
-	
-	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
-	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
-
-	// Save off the page size.
-	pageSize = header->MODE_DATA_LENGTH + sizeof ( header->MODE_DATA_LENGTH );
+	SBCZoneWrite *	write		= NULL;
+	SBCZoneWrite *	done		= NULL;
+	SBCZoneWrite *	failed		= NULL;
+	SBCZoneWrite *	next		= NULL;
+	bool			succeeded	= false;
 	
-	// Sanity check the block descriptor length.
-	if ( ( header->BLOCK_DESCRIPTOR_LENGTH & 7 ) == 0 )
+	// A NULL request is a task that could not be sent.
+	if ( request != NULL )
 	{
 		
-		// Block descriptor is in fact a multiple of 8. Assume we can trust it.
-		blockDescLength = header->BLOCK_DESCRIPTOR_LENGTH;		
+		succeeded = ( GetServiceResponse ( request ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+					( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD );
+		
+		ReleaseSCSITask ( request );
+		request = NULL;
 		
 	}
 	
-	// Sanity check on buffer size.
-	minSize = sizeof ( SPCModeParameterHeader6 ) + blockDescLength +
-		offsetof ( SBCModePageCaching, DEMAND_READ_WRITE_RETENTION_PRIORITY );
-	
-	require_action ( ( pageSize >= minSize ), ReleaseDescriptor, status = kIOReturnError );
-	
-	// Can't truncate pageSize like we do for MODE_SENSE command since MODE_SELECT requires full data
-	// buffer including header, block descriptors, and full mode page.
-	
-	buffer->release ( );
-	
-	// Allocate a buffer for full page size.
-	buffer = IOBufferMemoryDescriptor::withCapacity ( pageSize, kIODirectionOutIn );
-	require_nonzero_action ( buffer, ErrorExit, status = kIOReturnNoResources );
-	
-	bufferPtr 	= ( UInt8 * ) buffer->getBytesNoCopy ( );
-	header		= ( SPCModeParameterHeader6 * ) bufferPtr;
-	
-	// Obtain the full page.
-	status = GetWriteCacheState ( buffer, kModePageControlCurrentValues );
-	require_success ( status, ReleaseDescriptor );
-	
-	cachePage = ( SBCModePageCaching * ) &bufferPtr[ sizeof ( SPCModeParameterHeader6 ) + blockDescLength ];
-	pageCode = cachePage->header.PS_PAGE_CODE & kModePageFormat_PAGE_CODE_Mask;
-	
-	// Sanity check on returned data from drive.
-	require_action ( ( pageCode == kSBCModePageCachingCode ), ReleaseDescriptor, status = kIOReturnError );
-	
-	// Set the page code in the buffer to the cache page code (remove the PS bit).
-	cachePage->header.PS_PAGE_CODE = kSBCModePageCachingCode;
+	IOLockLock ( fZoneLock );
 	
-	// Enable/disable cache as appropriate.
-	if ( enabled == true )
-		cachePage->flags |= kSBCModePageCaching_WCE_Mask;
-	else
-		cachePage->flags &= ~kSBCModePageCaching_WCE_Mask;
+	write = zone->inFlight;
 	
-	request = GetSCSITask ( );
-	require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
+	if ( write->taskBuffer != NULL )
+	{
+		
+		write->taskBuffer->release ( );
+		write->taskBuffer = NULL;
+		
+	}
 	
-	// Write back out the new settings.
-	if ( MODE_SELECT_6 ( request,
-						 buffer,
-						 0x01,	// PageFormat		= 1
-						 0x00,	// SaveParameters	= 0
-						 pageSize,
-						 0x00 ) == true )
+	if ( succeeded == true )
 	{
 		
-		// The command was successfully built, now send it.
-		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		write->blocksWritten	+= write->taskBlockCount;
+		zone->writePointer		= write->startBlock + write->blocksWritten;
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		if ( write->blocksWritten == write->blockCount )
 		{
 			
-			fWriteCacheEnabled = enabled;
-			status = kIOReturnSuccess;
+			zone->inFlight	= NULL;
+			done			= write;
 			
 		}
 		
-		else
+	}
+	
+	else
+	{
+		
+		// The device's write pointer is not known any more. None of the
+		// writes queued behind this one can land where they were meant to,
+		// so fail them all and read the zone again before the next write.
+		ERROR_LOG ( ( "%s: write to zone at %lld failed.\n", getName ( ), zone->start ) );
+		
+		zone->inFlight	= NULL;
+		zone->stale		= true;
+		done			= write;
+		failed			= zone->queue;
+		zone->queue		= NULL;
+		
+	}
+	
+	IOLockUnlock ( fZoneLock );
+	
+	if ( done == NULL )
+	{
+		
+		// The rest of a long write goes before anything behind it.
+		SendZoneWrite ( zone, write );
+		
+	}
+	
+	else
+	{
+		
+		// Keep the zone busy before the client is notified.
+		DispatchZoneWrites ( zone );
+		FinishZoneWrite ( done, succeeded ? kIOReturnSuccess : kIOReturnIOError );
+		
+		while ( failed != NULL )
 		{
 			
-			status = kIOReturnError;
+			next = failed->next;
+			FinishZoneWrite ( failed, kIOReturnIOError );
+			failed = next;
 			
 		}
 		
 	}
 	
-	ReleaseSCSITask ( request );
-	request = NULL;
-	
-	
-ReleaseDescriptor:
-	
-	
-	require_nonzero_quiet ( buffer, ErrorExit );
-	buffer->release ( );
-	buffer = NULL;
-	
-	
-ErrorExit:	
-	
-	
-	return status;
-	
 }
 
 
 //
-//	 PollForMediaRemoval - Polls for media removal.				[PROTECTED]
+//	 FinishZoneWrite - Completes a zone write to its client.		  [PRIVATE]
 //
 
 void
-IOSCSIBlockCommandsDevice::PollForMediaRemoval ( void )
+IOSCSIBlockCommandsDevice::FinishZoneWrite ( SBCZoneWrite *	write,
+											 IOReturn		status )
 {
 	
-	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier		request			= NULL;
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	UInt64	actCount = 0;
 	
-	// Do a TEST_UNIT_READY to generate sense data
-	if ( TEST_UNIT_READY ( request, 0 ) == true )
+	if ( write->clientData != NULL )
 	{
 		
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+		if ( status == kIOReturnSuccess )
+		{
+			actCount = write->blockCount * fMediumBlockSize;
+		}
+		
+		IOBlockStorageServices::AsyncReadWriteComplete ( write->clientData, status, actCount );
+		IODelete ( write, SBCZoneWrite, 1 );
 		
 	}
 	
-	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	else
 	{
 		
-		if ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION )
-		{
-			
-			bool						validSense 	= false;
-			SCSI_Sense_Data				senseBuffer	= { 0 };
-			IOMemoryDescriptor *		bufferDesc	= NULL;
-			
-			validSense = GetAutoSenseData ( request, &senseBuffer );
-			if ( validSense == false )
-			{
-				
-				bufferDesc = IOMemoryDescriptor::withAddress ( ( void * ) &senseBuffer,
-																kSenseDefaultSize,
-																kIODirectionIn );
-				require_nonzero ( bufferDesc, ReleaseTask );
-				
-				if ( REQUEST_SENSE ( request, bufferDesc, kSenseDefaultSize, 0 ) == true )
-				{
-					
-					// The command was successfully built, now send it
-					serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
-					
-				}
-				
-				bufferDesc->release ( );
-				bufferDesc = NULL;
-				
-				require ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ), ReleaseTask );
-				require ( ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseTask );
-				
-			}
-			
-			// Check the sense data to see if media is no longer present ( ASC == 0x3A )
-			// or if media has changed ( ASC==0x28, ASCQ==0x00 )
-			if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x3A ) ||
-			   ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x28 ) &&
-				 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ) )
-			{
-				
-				ERROR_LOG ( ( "Media was removed. Tearing down the media object." ) );
-				
-				// Media was removed, set the polling to determine when new media has been inserted
-				fPollingMode = kPollingMode_NewMedia;
-				
-				// Message up the chain that we do not have media
-				messageClients ( kIOMessageMediaStateHasChanged,
-								 ( void * ) kIOMediaStateOffline );
-				
-				ResetMediumCharacteristics ( );
-				EnablePolling ( );
-				
-			}
-			
+		// An append. Its caller is waiting for it and frees it.
+		IOLockLock ( fZoneLock );
+		
+		write->status	= status;
+		write->complete	= true;
+		IOLockWakeup ( fZoneLock, write, false );
+		
+		IOLockUnlock ( fZoneLock );
+		
+	}
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Static Methods
+#pragma mark -
+#endif
+
+
+//
+//	 FillComplete - Static completion routine for the commands sent by
+//					 SendFillCommands ( ).					  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::FillComplete ( SCSITaskIdentifier completedTask )
+{
+	
+	IOSCSIBlockCommandsDevice *	taskOwner		= NULL;
+	SBCFillContext *			context			= NULL;
+	SCSI_Sense_Data				senseDataBuffer	= { 0 };
+	bool						rejected		= false;
+	bool						failed			= false;
+	
+	require_nonzero ( completedTask, ErrorExit );
+	
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
+	
+	context = ( SBCFillContext * ) taskOwner->GetApplicationLayerReference ( completedTask );
+	require_nonzero ( context, ErrorExit );
+	
+	if ( ( taskOwner->GetServiceResponse ( completedTask ) != kSCSIServiceResponse_TASK_COMPLETE ) ||
+		 ( taskOwner->GetTaskStatus ( completedTask ) != kSCSITaskStatus_GOOD ) )
+	{
+		
+		failed = true;
+		
+		// A WRITE SAME that fails with INVALID COMMAND OPERATION CODE or
+		// INVALID FIELD IN CDB is not implemented by the device (or not
+		// with the fields we used), rather than a failed write. Any other
+		// ILLEGAL REQUEST, such as LBA OUT OF RANGE, is a real error.
+		if ( ( context->writeSame == true ) &&
+			 ( taskOwner->GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( taskOwner->GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION ) &&
+			 ( taskOwner->GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) ) == true ) &&
+			 ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_ILLEGAL_REQUEST ) &&
+			 ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE == kSENSE_ASC_InvalidCommandOperationCode ) ||
+			   ( senseDataBuffer.ADDITIONAL_SENSE_CODE == kSENSE_ASC_InvalidFieldInCDB ) ) &&
+			 ( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) )
+		{
+			rejected = true;
 		}
 		
 	}
 	
+	taskOwner->ReleaseSCSITask ( completedTask );
 	
-ReleaseTask:
+	// The context may go away as soon as the lock is dropped.
+	IOLockLock ( context->lock );
 	
+	if ( rejected == true )
+	{
+		context->writeSameRejected = true;
+	}
 	
-	require_nonzero_quiet ( request, ErrorExit );
-	ReleaseSCSITask ( request );
-	request = NULL;
+	else if ( failed == true )
+	{
+		context->status = kIOReturnIOError;
+	}
+	
+	context->outstanding--;
+	IOLockWakeup ( context->lock, context, false );
+	IOLockUnlock ( context->lock );
 	
 	
 ErrorExit:
@@ -2802,299 +9232,199 @@ ErrorExit:
 
 
 //
-//	 IssueRead - DEPRECATED.										[PROTECTED]
-//
-
-IOReturn
-IOSCSIBlockCommandsDevice::IssueRead (
-							IOMemoryDescriptor *	buffer,
-							UInt64					startBlock,
-							UInt64					blockCount )
-{
-	return kIOReturnUnsupported;
-}
-
-
-//
-//	 IssueRead - Issues an asynchronous read command.				[PROTECTED]
+//	 ParityComplete - Static completion routine for the XOR commands sent
+//					   by SendParityCommand ( ).			  [STATIC][PRIVATE]
 //
 
-IOReturn
-IOSCSIBlockCommandsDevice::IssueRead (
-							IOMemoryDescriptor *	buffer,
-							UInt64					startBlock,
-							UInt64					blockCount,
-							void *					clientData )
+void
+IOSCSIBlockCommandsDevice::ParityComplete ( SCSITaskIdentifier completedTask )
 {
 	
-	IOReturn 				status		= kIOReturnNoResources;
-	SCSITaskIdentifier		request		= NULL;
-	bool					cmdStatus   = false;
+	IOSCSIBlockCommandsDevice *	taskOwner		= NULL;
+	SBCParityOperation *		operation		= NULL;
+	SCSI_Sense_Data				senseDataBuffer	= { 0 };
+	bool						failed			= false;
+	bool						unsupported		= false;
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_nonzero ( completedTask, ErrorExit );
 	
-	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
-	{
-
-		cmdStatus = READ_16 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField8Byte ) startBlock,
-					( SCSICmdField4Byte ) blockCount,
-					0,
-					0 );
-								
-	}
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
 	
-	else
-	{
-
-		cmdStatus = READ_10 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 );
-
-	}
+	operation = ( SBCParityOperation * ) taskOwner->GetApplicationLayerReference ( completedTask );
+	require_nonzero ( operation, ErrorExit );
 	
-	if ( cmdStatus == true )
+	if ( ( taskOwner->GetServiceResponse ( completedTask ) != kSCSIServiceResponse_TASK_COMPLETE ) ||
+		 ( taskOwner->GetTaskStatus ( completedTask ) != kSCSITaskStatus_GOOD ) )
 	{
 		
-		// The command was successfully built, now send it
-		SetApplicationLayerReference ( request, clientData );
+		failed = true;
 		
-		// Tag the command if requested
-		if ( GetCMDQUE ( ) == true )
+		if ( ( taskOwner->GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( taskOwner->GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION ) &&
+			 ( taskOwner->GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) ) == true ) &&
+			 ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_ILLEGAL_REQUEST ) &&
+			 ( senseDataBuffer.ADDITIONAL_SENSE_CODE == kSENSE_ASC_InvalidCommandOperationCode ) )
 		{
-			
-			SetTaskAttribute ( request, kSCSITask_SIMPLE );
-			SetTaggedTaskIdentifier ( request, GetUniqueTagID ( ) );
-			
+			unsupported = true;
 		}
-
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
 		
 	}
 	
-	else
-	{
-		
-		ReleaseSCSITask ( request );
-		request	= NULL;
-		status	= kIOReturnBadArgument;
-		
-	}
-
+	taskOwner->ReleaseSCSITask ( completedTask );
+	
+	IOLockLock ( operation->lock );
+	operation->failed		= failed;
+	operation->unsupported	= unsupported;
+	operation->inFlight		= false;
+	IOLockWakeup ( operation->lock, operation->lock, false );
+	IOLockUnlock ( operation->lock );
+	
+	
 ErrorExit:
 	
 	
-	return status;
+	return;
 	
 }
 
 
 //
-//	 IssueWrite - DEPRECATED.										[PROTECTED]
-//
-
-IOReturn
-IOSCSIBlockCommandsDevice::IssueWrite ( IOMemoryDescriptor *	buffer,
-										UInt64					startBlock,
-										UInt64					blockCount )
-{
-	return kIOReturnUnsupported;
-}
-
-
-//
-//	 IssueWrite - Issues an asynchronous write command.			[PROTECTED]
+//	 ExtendedCopyComplete - Static completion routine for EXTENDED COPY
+//							 commands.						  [STATIC][PRIVATE]
 //
 
-IOReturn
-IOSCSIBlockCommandsDevice::IssueWrite (
-						IOMemoryDescriptor *	buffer,
-						UInt64					startBlock,
-						UInt64					blockCount,
-						void *					clientData )
+void
+IOSCSIBlockCommandsDevice::ExtendedCopyComplete ( SCSITaskIdentifier completedTask )
 {
-	IOReturn				status		= kIOReturnNoResources;
-	SCSITaskIdentifier		request		= NULL;
-	bool					cmdStatus   = false;
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	IOSCSIBlockCommandsDevice *	taskOwner		= NULL;
+	SBCExtendedCopyOperation *	operation		= NULL;
+	SCSI_Sense_Data				senseDataBuffer	= { 0 };
+	bool						failed			= false;
+	bool						unsupported		= false;
 	
-	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
-	{
-		
-		cmdStatus = WRITE_16 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField8Byte ) startBlock,
-					( SCSICmdField4Byte ) blockCount,
-					0,
-					0 );
-		
-	}	
+	require_nonzero ( completedTask, ErrorExit );
 	
-	else
-	{
-
-		cmdStatus = WRITE_10 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 );
-
-	}
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
 	
-	if ( cmdStatus == true )
+	operation = ( SBCExtendedCopyOperation * ) taskOwner->GetApplicationLayerReference ( completedTask );
+	require_nonzero ( operation, ErrorExit );
+	
+	if ( ( taskOwner->GetServiceResponse ( completedTask ) != kSCSIServiceResponse_TASK_COMPLETE ) ||
+		 ( taskOwner->GetTaskStatus ( completedTask ) != kSCSITaskStatus_GOOD ) )
 	{
 		
-		// The command was successfully built, now send it
-		SetApplicationLayerReference ( request, clientData );
+		failed = true;
 		
-		// Tag the command if requested
-		if ( GetCMDQUE ( ) == true )
+		// An unknown operation code means the device can not copy at all.
+		// Anything else (an unreachable destination, say) only fails this
+		// copy.
+		if ( ( taskOwner->GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( taskOwner->GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION ) &&
+			 ( taskOwner->GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) ) == true ) &&
+			 ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_ILLEGAL_REQUEST ) &&
+			 ( senseDataBuffer.ADDITIONAL_SENSE_CODE == kSENSE_ASC_InvalidCommandOperationCode ) )
 		{
-			
-			SetTaskAttribute ( request, kSCSITask_SIMPLE );
-			SetTaggedTaskIdentifier ( request, GetUniqueTagID ( ) );
-			
+			unsupported = true;
 		}
 		
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
-		
 	}
 	
-	else
-	{
-		
-		ReleaseSCSITask ( request );
-		request	= NULL;
-		status	= kIOReturnBadArgument;
-		
-	}	
+	taskOwner->ReleaseSCSITask ( completedTask );
+	
+	// The operation may be reused as soon as the lock is dropped.
+	IOLockLock ( operation->lock );
+	operation->failed		= failed;
+	operation->unsupported	= unsupported;
+	operation->state		= kSBCExtendedCopyComplete;
+	IOLockWakeup ( operation->lock, operation->lock, false );
+	IOLockUnlock ( operation->lock );
 	
 	
 ErrorExit:
 	
 	
-	return status;
+	return;
 	
 }
 
 
 //
-//	 AsyncReadWriteCompletion - Completion routine for read/write requests.
-//															 		[PROTECTED]
+//	 ZoneWriteComplete - Static completion routine for zone writes.
+//														 			  [PRIVATE]
 //
 
 void
-IOSCSIBlockCommandsDevice::AsyncReadWriteCompletion (
-								SCSITaskIdentifier completedTask )
+IOSCSIBlockCommandsDevice::ZoneWriteComplete ( SCSITaskIdentifier completedTask )
 {
 	
-	IOReturn	status		= kIOReturnSuccess;
-	UInt64		actCount	= 0;
-	void *		clientData	= NULL;
+	IOSCSIBlockCommandsDevice *	taskOwner	= NULL;
+	SBCZone *					zone		= NULL;
 	
-	// Extract the client data from the SCSITaskIdentifier
-	clientData = GetApplicationLayerReference ( completedTask );
-	require_nonzero ( clientData, ErrorExit );
+	require_nonzero ( completedTask, ErrorExit );
 	
-	if ( ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_GOOD ) )
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( completedTask );
+	require_nonzero ( taskOwner, ErrorExit );
+	
+	zone = ( SBCZone * ) taskOwner->GetApplicationLayerReference ( completedTask );
+	require_nonzero ( zone, ErrorExit );
+	
+	taskOwner->CompleteZoneWrite ( zone, completedTask );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 sZoneWriteTimerExpired - Static method called to read stale zones
+//							   again and to send zone writes whose
+//							   deadline has passed.			  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::sZoneWriteTimerExpired ( void * device, void * refCon )
+{
+	
+	IOSCSIBlockCommandsDevice *	driver	= NULL;
+	SBCZone *					zone	= NULL;
+	UInt32						index	= 0;
+	bool						held	= false;
+	bool						queued	= false;
+	
+	driver = ( IOSCSIBlockCommandsDevice * ) device;
+	require_nonzero ( driver, ErrorExit );
+	
+	for ( index = 0; index < driver->fZoneCount; index++ )
 	{
 		
-		// Our status is good, so return a success
-		actCount = GetRealizedDataTransferCount ( completedTask );
+		zone = &driver->fZones[index];
 		
-	}
-	
-	else
-	{
+		IOLockLock ( driver->fZoneLock );
+		held	= ( zone->held != NULL );
+		queued	= ( zone->queue != NULL );
+		IOLockUnlock ( driver->fZoneLock );
 		
-		// Set a generic IO error for starters
-		status = kIOReturnIOError;
+		if ( held == true )
+		{
+			driver->RefreshStaleZone ( zone );
+		}
 		
-		if ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE )
+		else if ( queued == true )
 		{
-			
-			// We have a status other than GOOD, see why.		
-			if ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_CHECK_CONDITION )
-			{
-				
-				SCSI_Sense_Data		senseDataBuffer = { 0 };
-				bool				senseIsValid	= false;
-				
-				senseIsValid = GetAutoSenseData ( completedTask, &senseDataBuffer, sizeof ( senseDataBuffer ) );
-				if ( senseIsValid )
-				{
-					
-					// Check if this is a recovered error and the amount of data transferred
-					// was the amount requested. If so, don't treat those as hard errors.
-					if ( ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_RECOVERED_ERROR ) &&
-						 ( GetRequestedDataTransferCount ( completedTask ) == GetRealizedDataTransferCount ( completedTask ) ) )
-					{
-						
-						IOLog ( "READ or WRITE succeeded, but recoverable (soft) error occurred, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x, LBA = 0x%08x\n",
-								senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER,
-								OSReadBigInt32 ( &senseDataBuffer.INFORMATION_1, 0 ) );
-						
-						status 		= kIOReturnSuccess;
-						actCount 	= GetRealizedDataTransferCount ( completedTask );
-						
-					}
-					
-					else
-					{
-						
-						ERROR_LOG ( ( "READ or WRITE failed, ASC = 0x%02x, ASCQ = 0x%02x\n",
-						senseDataBuffer.ADDITIONAL_SENSE_CODE,
-						senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
-						
-					}
-					
-				}
-				
-			}
-	
+			driver->DispatchZoneWrites ( zone );
 		}
 		
 	}
 	
-	IOBlockStorageServices::AsyncReadWriteComplete ( clientData, status, actCount );
-	
-	ReleaseSCSITask ( completedTask );	
+	// drop the retain taken when the timer was armed
+	driver->release ( );
 	
 	
 ErrorExit:
@@ -3105,13 +9435,6 @@ ErrorExit:
 }
 
 
-#if 0
-#pragma mark -
-#pragma mark  Static Methods
-#pragma mark -
-#endif
-
-
 //
 //	 AsyncReadWriteComplete - 	Static completion routine for
 //								read/write requests.		  [STATIC][PRIVATE]
@@ -3126,10 +9449,21 @@ IOSCSIBlockCommandsDevice::AsyncReadWriteComplete (
 	
 	require_nonzero ( request, ErrorExit );
 	
-	taskOwner = OSDynamicCast ( IOSCSIBlockCommandsDevice, sGetOwnerForTask ( request ) );
+	// This completion is only ever set on tasks this class created, so the
+	// owner does not need a type check on every I/O.
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) sGetOwnerForTask ( request );
 	require_nonzero ( taskOwner, ErrorExit );
 	
-	taskOwner->AsyncReadWriteCompletion ( request );
+	// Only complete the client request once every task it was split into
+	// has completed.
+	request = taskOwner->CompleteReadWriteTask ( request );
+	if ( request != NULL )
+	{
+		
+		OSDecrementAtomic ( &taskOwner->fReadWriteOutstandingCount );
+		taskOwner->AsyncReadWriteCompletion ( request );
+		
+	}
 	
 	
 ErrorExit:
@@ -3176,6 +9510,63 @@ ErrorExit:
 }
 
 
+//
+//	 SeekDistance - Returns the number of blocks between two positions.
+//																	   [STATIC]
+//
+
+static inline UInt64
+SeekDistance ( UInt64 from, UInt64 to )
+{
+	
+	return ( to > from ) ? ( to - from ) : ( from - to );
+	
+}
+
+
+//
+//	 XORBytes - XORs source into destination.						   [STATIC]
+//
+
+static void
+XORBytes ( UInt8 * destination, const UInt8 * source, UInt64 byteCount )
+{
+	
+	UInt64 *		destinationWords	= NULL;
+	const UInt64 *	sourceWords			= NULL;
+	UInt64			index				= 0;
+	
+	// Vector registers are not available to kernel code without saving the
+	// thread's state, so XOR a word at a time, four words per pass. The
+	// buffers are always whole blocks, but may not be word aligned.
+	if ( ( ( ( uintptr_t ) destination | ( uintptr_t ) source ) & ( sizeof ( UInt64 ) - 1 ) ) == 0 )
+	{
+		
+		destinationWords	= ( UInt64 * ) destination;
+		sourceWords			= ( const UInt64 * ) source;
+		
+		for ( index = 0; ( index + 4 ) <= ( byteCount / sizeof ( UInt64 ) ); index += 4 )
+		{
+			
+			destinationWords[index]		^= sourceWords[index];
+			destinationWords[index + 1]	^= sourceWords[index + 1];
+			destinationWords[index + 2]	^= sourceWords[index + 2];
+			destinationWords[index + 3]	^= sourceWords[index + 3];
+			
+		}
+		
+		index *= sizeof ( UInt64 );
+		
+	}
+	
+	for ( ; index < byteCount; index++ )
+	{
+		destination[index] ^= source[index];
+	}
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark  VTable Padding
@@ -3186,18 +9577,18 @@ ErrorExit:
 OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 1 );	/* PowerDownHandler */
 OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 2 );	/* SetMediumIcon 	*/
 OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 3 );	/* AsyncReadWriteCompletion	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 4 );	/* UnmapBlocks	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 5 );	/* AsyncReadWriteWithFUA	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 6 );	/* SynchronizeCacheRange	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 7 );	/* WriteSameBlocks	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 8 );	/* CopyBlocks	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 9 );	/* CompareAndWriteBlocks	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 10 );	/* UpdateParity	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 11 );	/* ManageZones	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 12 );	/* AppendToZone	*/
+OSMetaClassDefineReservedUsed ( IOSCSIBlockCommandsDevice, 13 );	/* ReportZone	*/
 
 // Space reserved for future expansion.
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  4 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  5 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  6 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  7 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  8 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice,  9 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 10 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 11 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 12 );
-OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 13 );
 OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 14 );
 OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 15 );
 OSMetaClassDefineReservedUnused ( IOSCSIBlockCommandsDevice, 16 );
\ No newline at end of file
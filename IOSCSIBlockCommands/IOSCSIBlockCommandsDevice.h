@@ -49,6 +49,74 @@ enum
 	kMediaStateLocked 	= 1
 };
 
+// A range of logical blocks, used to describe the blocks passed to
+// UnmapBlocks ( ).
+typedef struct SBCBlockExtent
+{
+	UInt64		blockStart;
+	UInt64		blockCount;
+} SBCBlockExtent;
+
+// One stripe unit update passed to UpdateParity ( ). data holds blockCount
+// blocks of new data for dataBlock on the data device. The parity for those
+// blocks is at parityBlock on the parity device.
+typedef struct SBCParityUpdate
+{
+	UInt64					dataBlock;
+	UInt64					parityBlock;
+	UInt64					blockCount;
+	IOMemoryDescriptor *	data;
+} SBCParityUpdate;
+
+// Returned by CompareAndWriteBlocks ( ) when the blocks on the medium did
+// not match the compare data. Nothing was written.
+#define kIOReturnSCSIMiscompare		iokit_family_err ( sub_iokit_scsi, 0x01 )
+
+// Returned by UpdateParity ( ) when new data was written but the parity
+// could not be brought up to date. The parity of those blocks has to be
+// rebuilt from the data stripe units.
+#define kIOReturnSCSIParityStale	iokit_family_err ( sub_iokit_scsi, 0x02 )
+
+// Zone types and conditions of a zoned block device as defined in ZBC,
+// returned by ReportZone ( ).
+enum
+{
+	kSBCZoneTypeConventional				= 0x01,
+	kSBCZoneTypeSequentialWriteRequired		= 0x02,
+	kSBCZoneTypeSequentialWritePreferred	= 0x03
+};
+
+enum
+{
+	kSBCZoneConditionNotWritePointer		= 0x00,
+	kSBCZoneConditionEmpty					= 0x01,
+	kSBCZoneConditionImplicitlyOpened		= 0x02,
+	kSBCZoneConditionExplicitlyOpened		= 0x03,
+	kSBCZoneConditionClosed					= 0x04,
+	kSBCZoneConditionReadOnly				= 0x0D,
+	kSBCZoneConditionFull					= 0x0E,
+	kSBCZoneConditionOffline				= 0x0F
+};
+
+// Actions passed to ManageZones ( ).
+enum
+{
+	kSBCZoneActionClose						= 0x01,
+	kSBCZoneActionFinish					= 0x02,
+	kSBCZoneActionOpen						= 0x03,
+	kSBCZoneActionResetWritePointer			= 0x04
+};
+
+// The layout and state of one zone, returned by ReportZone ( ).
+typedef struct SBCZoneInformation
+{
+	UInt64		zoneStart;
+	UInt64		zoneLength;
+	UInt64		writePointer;
+	UInt8		zoneType;
+	UInt8		zoneCondition;
+} SBCZoneInformation;
+
 
 //
 //	Includes
@@ -69,6 +137,23 @@ enum
 // IOSCSIBlockCommandsDevice class.
 class SCSIBlockCommands;
 
+// Forward declaration for the elevator entries that are used internally by the
+// IOSCSIBlockCommandsDevice class.
+struct SBCElevatorEntry;
+
+// Forward declaration for the parity update state that is used internally by
+// the IOSCSIBlockCommandsDevice class.
+struct SBCParityOperation;
+
+// Forward declaration for the sequential read stream state that is used
+// internally by the IOSCSIBlockCommandsDevice class.
+struct SBCReadStream;
+
+// Forward declarations for the zone table and zone write queue entries
+// that are used internally by the IOSCSIBlockCommandsDevice class.
+struct SBCZone;
+struct SBCZoneWrite;
+
 //
 //	Class Declaration
 //
@@ -87,6 +172,155 @@ private:
 	
 	static void				AsyncReadWriteComplete ( SCSITaskIdentifier	completedTask );
 	
+	// Sends a write the same way for IssueWrite ( ) and for FUA writes,
+	// so that both go through the elevator.
+	IOReturn				IssueWriteRequest ( IOMemoryDescriptor *	buffer,
+												UInt64					startBlock,
+												UInt64					blockCount,
+												bool					forceUnitAccess,
+												void *					clientData );
+	
+	// The elevator holds read and write requests for devices which can not
+	// reorder commands themselves (no tagged queueing) and sends them one at
+	// a time in C-LOOK order. Each request carries a deadline, after which it
+	// is sent ahead of the sorted order so that no request can be starved.
+	bool					InitializeElevator ( void );
+	void					FreeElevator ( void );
+	void					EnqueueElevatorTask ( SCSITaskIdentifier	request,
+												  UInt64				startBlock,
+												  UInt64				blockCount,
+												  bool					isWrite,
+												  SCSITaskCompletion	taskCompletion );
+	SBCElevatorEntry *		SelectElevatorEntry ( void );
+	void					DispatchElevatorTasks ( void );
+	SCSITaskCompletion		CompleteElevatorTask ( SCSITaskIdentifier request );
+	static void				ElevatorTaskComplete ( SCSITaskIdentifier completedTask );
+	void					PublishElevatorStatistics ( void );
+	
+	// Read-ahead for sequential read streams. Reads are matched against a
+	// small table of streams by LBA continuity. Once a stream has been
+	// sequential for a few reads, a PREFETCH (IMMED) is sent for the window
+	// following it. The window grows each time the stream reads through a
+	// prefetched window, and a stream that is abandoned is replaced by one
+	// that starts again from the smallest window. Read-ahead stops while
+	// abandoned windows outweigh used ones, and sequential reads made while
+	// it is stopped turn it back on.
+	bool					InitializeReadStreams ( void );
+	void					FreeReadStreams ( void );
+	void					ResetReadStreams ( void );
+	void					DetectReadStream ( UInt64	startBlock,
+											   UInt64	blockCount );
+	void					SendPrefetchCommand ( UInt64	startBlock,
+												  UInt64	blockCount );
+	static void				PrefetchComplete ( SCSITaskIdentifier completedTask );
+	void					PublishReadStreamStatistics ( void );
+	
+	// Completion coalescing for transports which support it. The setting
+	// follows the number of outstanding reads and writes: off at a queue
+	// depth of one, moderate for deeper queues and aggressive for deep
+	// sequential streams.
+	void					UpdateCompletionCoalescing ( SInt32	depth,
+														 UInt64	startBlock,
+														 UInt64	blockCount );
+
+	// Block Limits and logical block provisioning (thin provisioning)
+	// support. The VPD pages are read once with the device characteristics,
+	// LBPME and LBPRZ are read from the READ CAPACITY (16) data each time a
+	// medium is found.
+	bool					RetrieveVPDPage ( UInt8		pageCode,
+											  void *	pageData,
+											  UInt8		pageLength );
+	void					DetermineBlockDeviceVPDPages ( void );
+	bool					IsBlockDeviceVPDPageSupported ( UInt8 pageCode );
+	void					PublishLogicalBlockProvisioning ( void );
+	IOReturn				SendUnmapCommands ( SBCBlockExtent *	extents,
+												UInt32				extentCount );
+	IOReturn				SendWriteSameUnmapCommands ( SBCBlockExtent *	extents,
+														 UInt32				extentCount );
+	
+	// Fills a range of blocks with a pattern, keeping several commands
+	// outstanding at a time. The commands are either WRITE SAME (16) with a
+	// single block of data or ordinary writes of a buffer of repeated blocks.
+	IOReturn				SendFillCommands ( UInt64						startBlock,
+											   UInt64						blockCount,
+											   IOBufferMemoryDescriptor *	buffer,
+											   UInt64						commandBlockLimit,
+											   bool							writeSame );
+	static void				FillComplete ( SCSITaskIdentifier completedTask );
+	
+	// EXTENDED COPY (third party copy) support. Copies are sent to this
+	// device, which is the source, as block to block segments between two
+	// identification descriptor CSCDs built from the INQUIRY page 83h
+	// logical unit designators. Any part of a copy the device refuses or
+	// fails is copied through host memory instead.
+	bool					DetermineExtendedCopyParameters ( void );
+	bool					GetExtendedCopyDesignator ( UInt8 * designator );
+	bool					GetExtendedCopyStatus ( UInt8		listIdentifier,
+													UInt16 *	segmentsProcessed );
+	IOReturn				SendExtendedCopyCommands (
+								IOSCSIBlockCommandsDevice *	destination,
+								UInt64 *					sourceBlock,
+								UInt64 *					destinationBlock,
+								UInt64 *					blockCount );
+	IOReturn				CopyBlocksThroughHost (
+								IOSCSIBlockCommandsDevice *	destination,
+								UInt64						sourceBlock,
+								UInt64						destinationBlock,
+								UInt64						blockCount );
+	static void				ExtendedCopyComplete ( SCSITaskIdentifier completedTask );
+	
+	// Parity updates for software RAID. A stripe unit update is split into
+	// operations of at most one buffer. Each operation gets the XOR of the
+	// old and new data from the data device (XDWRITE then XDREAD) and XORs
+	// it into the parity device (XPWRITE). Either half is done in host
+	// memory on a device without the XOR commands.
+	IOReturn				SendParityCommand ( IOSCSIBlockCommandsDevice *	device,
+												SBCParityOperation *		operation,
+												UInt8						step );
+	IOReturn				AdvanceParityOperation ( IOSCSIBlockCommandsDevice *	parityDevice,
+													 SBCParityOperation *			operation,
+													 IOBufferMemoryDescriptor *		hostBuffer );
+	IOReturn				ComputeParityDeltaThroughHost ( SBCParityOperation *		operation,
+															IOBufferMemoryDescriptor *	hostBuffer );
+	IOReturn				ApplyParityDeltaThroughHost ( SBCParityOperation *			operation,
+														  IOBufferMemoryDescriptor *	hostBuffer );
+	IOReturn				SendBlockReadWrite ( IOMemoryDescriptor *	buffer,
+												 UInt64					startBlock,
+												 UInt64					blockCount,
+												 bool					isWrite );
+	static void				ParityComplete ( SCSITaskIdentifier completedTask );
+	
+	// Zoned block device (ZBC) support. The zone table is read with REPORT
+	// ZONES when the medium is found, and single zones are read again after
+	// they are managed, or on the timer's thread once a write to them has
+	// failed. Writes to sequential write required zones are queued per zone
+	// in LBA order and each zone has at most one write in flight, which is
+	// sent once it starts at the zone's write pointer. Writes to different
+	// zones are sent concurrently. Writes that do not go through
+	// AsyncReadWrite ( ) cannot be sequenced, so they are refused on
+	// sequential write required zones.
+	bool					InitializeZones ( void );
+	void					FreeZones ( void );
+	IOReturn				RefreshZones ( UInt32	firstZone,
+										   UInt32	zoneCount );
+	SBCZone *				FindZone ( UInt64 block );
+	bool					IsSequentialWriteRequiredRange ( UInt64	startBlock,
+															 UInt64	blockCount );
+	void					PublishZoneGeometry ( void );
+	IOReturn				EnqueueZoneWrite ( SBCZone *		zone,
+											   SBCZoneWrite *	write,
+											   bool				append );
+	void					DispatchZoneWrites ( SBCZone * zone );
+	void					RefreshStaleZone ( SBCZone * zone );
+	void					SendZoneWrite ( SBCZone *		zone,
+											SBCZoneWrite *	write );
+	void					CompleteZoneWrite ( SBCZone *			zone,
+												SCSITaskIdentifier	request );
+	void					FinishZoneWrite ( SBCZoneWrite *	write,
+											  IOReturn			status );
+	static void				ZoneWriteComplete ( SCSITaskIdentifier completedTask );
+	static void				sZoneWriteTimerExpired ( void * device, void * refCon );
+	
 protected:
 	
 	// Reserve space for future expansion.
@@ -96,6 +330,94 @@ protected:
 		bool				fWriteCacheEnabled;
 		bool				fDeviceIsShared;
 		UInt64				fMediumBlockCount64;
+		
+		// Elevator state for devices which do not support tagged queueing.
+		IOSimpleLock *		fElevatorLock;
+		SBCElevatorEntry *	fElevatorEntries;
+		SBCElevatorEntry *	fElevatorFreeList;
+		SBCElevatorEntry *	fElevatorQueue;
+		SBCElevatorEntry *	fElevatorInFlight;
+		UInt32				fElevatorOutstandingCount;
+		bool				fElevatorDispatching;
+		bool				fDeviceIsSolidState;
+		UInt64				fElevatorHeadPosition;
+		UInt64				fElevatorArrivalPosition;
+		UInt64				fElevatorSortedSeekDistance;
+		UInt64				fElevatorArrivalSeekDistance;
+		UInt64				fElevatorDeadlineDispatchCount;
+		UInt64				fElevatorTotalDispatchCount;
+		
+		// Logical block provisioning state.
+		UInt16				fSupportedBlockVPDPages;
+		bool				fMediumLBPME;
+		bool				fMediumLBPRZ;
+		bool				fUnmapSupported;
+		bool				fWriteSameUnmapSupported;
+		UInt32				fMaximumUnmapLBACount;
+		UInt32				fMaximumUnmapBlockDescriptorCount;
+		UInt64				fMaximumWriteSameLength;
+		
+		// Block Limits VPD page transfer preferences, in blocks.
+		UInt32				fOptimalTransferLength;
+		UInt32				fOptimalTransferLengthGranularity;
+		
+		// Physical block layout of the medium from READ CAPACITY (16).
+		UInt8				fMediumPhysicalBlockExponent;
+		UInt16				fMediumLowestAlignedBlock;
+		
+		// Set if the device honours the FUA bit in READ and WRITE commands.
+		bool				fDPOFUASupported;
+		
+		// Sequential read stream detection and read-ahead.
+		IOSimpleLock *		fReadStreamLock;
+		SBCReadStream *		fReadStreams;
+		UInt64				fReadStreamSequence;
+		SInt32				fReadStreamScore;
+		bool				fReadStreamPrefetchSupported;
+		UInt64				fReadStreamPrefetchCount;
+		UInt64				fReadStreamHitCount;
+		UInt64				fReadStreamMissCount;
+		UInt64				fReadStreamWastedBlockCount;
+		
+		// Cleared once the device rejects WRITE SAME (16) for a fill.
+		bool				fWriteSameFillSupported;
+		
+		// EXTENDED COPY state. The limits are read from the copy manager's
+		// operating parameters the first time a copy is sent.
+		bool				fExtendedCopySupported;
+		bool				fExtendedCopyParametersValid;
+		UInt16				fExtendedCopySegmentCount;
+		UInt32				fExtendedCopySegmentByteCount;
+		UInt8				fExtendedCopyConcurrentCount;
+		SInt32				fExtendedCopyListIdentifier;
+		
+		// MAXIMUM COMPARE AND WRITE LENGTH from the Block Limits page. Zero
+		// if the device does not support COMPARE AND WRITE.
+		UInt8				fMaximumCompareAndWriteLength;
+		
+		// Cleared once the device rejects XDWRITE, XDREAD or XPWRITE.
+		bool				fXORCommandsSupported;
+		
+		// Zoned block device state. The timer sends writes which have
+		// waited too long for the gap in front of them to be filled.
+		UInt8				fZonedModel;
+		SBCZone *			fZones;
+		UInt32				fZoneCount;
+		IOLock *			fZoneLock;
+		thread_call_t		fZoneWriteTimer;
+		
+		// Completion coalescing state. fCompletionCoalescingLevel is the
+		// level wanted and fCompletionCoalescingProgrammedLevel the level
+		// the transport was last given. Only the thread that wins
+		// fCompletionCoalescingProgramming with OSCompareAndSwap talks to
+		// the transport. The other fields are hints updated without a lock.
+		bool				fCompletionCoalescingSupported;
+		volatile UInt32		fCompletionCoalescingLevel;
+		volatile UInt32		fCompletionCoalescingProgrammedLevel;
+		volatile UInt32		fCompletionCoalescingProgramming;
+		SInt32				fReadWriteOutstandingCount;
+		UInt64				fCoalescingNextBlock;
+		UInt32				fCoalescingSequentialCount;
 	};
     IOSCSIBlockCommandsDeviceExpansionData * fIOSCSIBlockCommandsDeviceReserved;
 	
@@ -117,6 +439,10 @@ protected:
 	// ReportMediumTotalBlockCount() should be used to retrieve it and the member routine
 	// SetMediumCharacteristics() should be used to set it.
 	#define fMediumBlockCount64	fIOSCSIBlockCommandsDeviceReserved->fMediumBlockCount64
+	
+	// The fDeviceIsSolidState is set from the device characteristics and is used
+	// to keep the elevator from being enabled for devices that have no seek penalty.
+	#define fDeviceIsSolidState	fIOSCSIBlockCommandsDeviceReserved->fDeviceIsSolidState
 
 private:
 	/* OBSOLETE. Use IOSCSIPrimaryCommandsDevice::Get/SetANSIVersion */
@@ -233,6 +559,25 @@ protected:
 					  		UInt64					blockCount,
 							void * 					clientData );
 	
+	// We override these methods to encode the SBC read and write commands
+	// for SendReadWriteRequest ( ) and to pass the tasks through the elevator.
+	virtual bool		BuildReadWriteTask (
+							SCSITaskIdentifier		request,
+							IOMemoryDescriptor *	buffer,
+							UInt64					blockSize,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							UInt8					cdbSize,
+							bool					isWrite,
+							bool					forceUnitAccess );
+	
+	virtual void		SendReadWriteTask (
+							SCSITaskIdentifier		request,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							bool					isWrite,
+							SCSITaskCompletion		taskCompletion );
+	
 	// ----- Power Management Support ------
 	
 	// We override this method to set our power states and register ourselves
@@ -323,11 +668,37 @@ public:
 	virtual UInt64		ReportMediumTotalBlockCount ( void );
 	virtual bool		ReportMediumWriteProtection ( void );
 	
+	// The elevator statistics are refreshed when the properties are serialized.
+	virtual bool		serializeProperties ( OSSerialize * s ) const;
+	
 	
 protected:
 	
 	
 	// Command methods to access all commands available to SBC based devices.
+	
+	// Defined in ZBC. Closes the zone starting at ZONE_ID, or
+	// every open zone if ALL is set.
+	bool CLOSE_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL );
+	
+	// Defined in SBC-3. The data buffer holds NUMBER_OF_LOGICAL_BLOCKS
+	// blocks of compare data followed by as many blocks of write data.
+	bool COMPARE_AND_WRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit			DPO,
+						SCSICmdField1Bit			FUA,
+						SCSICmdField8Byte			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField1Byte			NUMBER_OF_LOGICAL_BLOCKS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField1Byte			CONTROL );
+	
 	virtual bool ERASE_10 (
 						SCSITaskIdentifier			request,
 						SCSICmdField1Bit 			ERA,
@@ -344,6 +715,13 @@ protected:
 						SCSICmdField4Byte 			TRANSFER_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
 
+	// Defined in ZBC. Moves the write pointer of the zone to its end.
+	bool FINISH_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL );
+	
 	virtual bool FORMAT_UNIT (
 						SCSITaskIdentifier			request,
 						IOMemoryDescriptor *		dataBuffer,
@@ -404,6 +782,13 @@ protected:
 						SCSICmdField2Byte 			PARAMETER_LIST_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
 
+	// Defined in ZBC. Explicitly opens the zone starting at ZONE_ID.
+	bool OPEN_ZONE (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL );
+	
 	virtual bool PREFETCH (
 						SCSITaskIdentifier			request,
 						SCSICmdField1Bit 			IMMED,
@@ -607,6 +992,25 @@ protected:
 						SCSICmdField4Byte 			PARAMETER_LIST_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
 
+	// Defined in ZBC. Returns a 64 byte header followed by a 64 byte
+	// descriptor for each zone at or after ZONE_START_LBA.
+	bool REPORT_ZONES (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField8Byte			ZONE_START_LBA,
+						SCSICmdField4Byte			ALLOCATION_LENGTH,
+						SCSICmdField1Bit			PARTIAL,
+						SCSICmdField6Bit			REPORTING_OPTIONS,
+						SCSICmdField1Byte			CONTROL );
+	
+	// Defined in ZBC. Rewinds the write pointer of the zone to its
+	// start.
+	bool RESET_WRITE_POINTER (
+						SCSITaskIdentifier			request,
+						SCSICmdField8Byte			ZONE_ID,
+						SCSICmdField1Bit			ALL,
+						SCSICmdField1Byte			CONTROL );
+	
 	virtual bool REZERO_UNIT (
 						SCSITaskIdentifier			request,
 						SCSICmdField1Byte 			CONTROL );
@@ -701,6 +1105,15 @@ protected:
 						SCSICmdField4Byte			NUMBER_OF_BLOCKS,
 						SCSICmdField5Bit			GROUP_NUMBER,
 						SCSICmdField1Byte			CONTROL );
+	
+	// Defined in SBC-3
+	bool UNMAP (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						SCSICmdField1Bit			ANCHOR,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte			PARAMETER_LIST_LENGTH,
+						SCSICmdField1Byte			CONTROL );
 						
 	virtual bool UPDATE_BLOCK (
 						SCSITaskIdentifier			request,
@@ -944,6 +1357,20 @@ protected:
 						SCSICmdField4Byte			TRANSFER_LENGTH,
 						SCSICmdField5Bit			GROUP_NUMBER,
 						SCSICmdField1Byte			CONTROL );
+	
+	// Defined in SBC-3. The data buffer holds a single logical block of
+	// blockSize bytes.
+	bool WRITE_SAME_16 (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit			ANCHOR,
+						SCSICmdField1Bit			UNMAP,
+						SCSICmdField8Byte			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField4Byte			NUMBER_OF_LOGICAL_BLOCKS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField1Byte			CONTROL );
 
 	virtual bool XDREAD (
 						SCSITaskIdentifier			request,
@@ -961,6 +1388,18 @@ protected:
 						SCSICmdField5Bit			GROUP_NUMBER,
 						SCSICmdField2Byte 			TRANSFER_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
+	
+	// Same as above, but TRANSFER_LENGTH is in blocks of blockSize bytes and
+	// the XOR data is read into the data buffer.
+	bool XDREAD (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField1Bit			XORPINFO,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL );
 
 	virtual bool XDWRITE (
 						SCSITaskIdentifier			request,
@@ -985,6 +1424,21 @@ protected:
 						SCSICmdField5Bit			GROUP_NUMBER,
 						SCSICmdField2Byte 			TRANSFER_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
+	
+	// Same as above, but TRANSFER_LENGTH is in blocks of blockSize bytes.
+	bool XDWRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField3Bit			WRPROTECT,
+						SCSICmdField1Bit 			DPO,
+						SCSICmdField1Bit 			FUA,
+						SCSICmdField1Bit 			DISABLE_WRITE,
+						SCSICmdField1Bit			FUA_NV,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL );
 
 	virtual bool XDWRITE_EXTENDED (
 						SCSITaskIdentifier			request,
@@ -1036,6 +1490,20 @@ protected:
 						SCSICmdField5Bit			GROUP_NUMBER,
 						SCSICmdField2Byte 			TRANSFER_LENGTH,
 						SCSICmdField1Byte 			CONTROL );
+	
+	// Same as above, but TRANSFER_LENGTH is in blocks of blockSize bytes.
+	bool XPWRITE (
+						SCSITaskIdentifier			request,
+						IOMemoryDescriptor *		dataBuffer,
+						UInt32						blockSize,
+						SCSICmdField1Bit 			DPO,
+						SCSICmdField1Bit 			FUA,
+						SCSICmdField1Bit 			FUA_NV,
+						SCSICmdField1Bit 			XORPINFO,
+						SCSICmdField4Byte 			LOGICAL_BLOCK_ADDRESS,
+						SCSICmdField5Bit			GROUP_NUMBER,
+						SCSICmdField2Byte 			TRANSFER_LENGTH,
+						SCSICmdField1Byte 			CONTROL );
 
 	/* Added with 10.2 */	
 	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 1 );
@@ -1064,20 +1532,158 @@ protected:
 
 	virtual	void AsyncReadWriteCompletion ( SCSITaskIdentifier completedTask );
 	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 4 );
+	
+public:
+	
+	// Unmaps (discards) the given ranges of logical blocks on a thin
+	// provisioned medium. The ranges are batched into as few UNMAP commands
+	// as the device's limits allow, or sent as WRITE SAME (16) commands with
+	// the UNMAP bit set if the device does not support UNMAP. Returns
+	// kIOReturnUnsupported if logical block provisioning is not enabled.
+	virtual IOReturn	UnmapBlocks (
+							SBCBlockExtent *		extents,
+							UInt32					extentCount );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 5 );
+	
+public:
+	
+	// Same as AsyncReadWrite ( ), but a write with forceUnitAccess set
+	// is sent with the FUA bit so it is on the medium when it completes.
+	// Returns kIOReturnUnsupported if the write cache is enabled and the
+	// device does not support FUA, in which case the caller should write
+	// and then call SynchronizeCache ( ). It has its own name so that a
+	// subclass overriding AsyncReadWrite ( ) does not hide it.
+	virtual IOReturn	AsyncReadWriteWithFUA (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							UInt64					blockSize,
+							bool					forceUnitAccess,
+							void * 					clientData );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 6 );
+	
+public:
+	
+	// Synchronizes only the given range of the write cache. A blockCount
+	// of 0 (zero) synchronizes from startBlock to the end of the medium.
+	virtual IOReturn	SynchronizeCacheRange (
+							UInt64					startBlock,
+							UInt64					blockCount );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 7 );
+	
+public:
+	
+	// Writes the same block of data to every block in a range, e.g. to zero
+	// a volume. pattern holds one block of data, or is NULL to write zeros.
+	// The device replicates the block itself with WRITE SAME (16) if it
+	// supports it, otherwise the pattern is written with ordinary writes.
+	virtual IOReturn	WriteSameBlocks (
+							UInt64					startBlock,
+							UInt64					blockCount,
+							IOMemoryDescriptor *	pattern );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 8 );
+	
+public:
+	
+	// Copies blockCount blocks from sourceBlock on this device to
+	// destinationBlock on destination, which may be this device. If the
+	// device supports EXTENDED COPY the data is moved by the array without
+	// passing through host memory. Both media must use the same block size.
+	virtual IOReturn	CopyBlocks (
+							IOSCSIBlockCommandsDevice *	destination,
+							UInt64						sourceBlock,
+							UInt64						destinationBlock,
+							UInt64						blockCount );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 9 );
+	
+public:
+	
+	// Atomically compares blockCount blocks at startBlock with the first
+	// blockCount blocks of buffer and, only if they match, writes the
+	// blocks that follow them in buffer. Returns kIOReturnSCSIMiscompare
+	// if the data did not match, with the byte offset of the first
+	// mismatch in miscompareOffset when the device reports it, or
+	// kIOReturnUnsupported if the device does not support COMPARE AND
+	// WRITE.
+	virtual IOReturn	CompareAndWriteBlocks (
+							UInt64					startBlock,
+							UInt64					blockCount,
+							IOMemoryDescriptor *	buffer,
+							UInt64 *				miscompareOffset );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 10 );
+	
+public:
+	
+	// Writes new data to this device, which holds a data stripe unit of a
+	// parity RAID set, and updates the parity on parityDevice to match.
+	// The drives compute the parity change themselves if they support the
+	// XOR commands, otherwise the old data and parity are read and the XOR
+	// is done in host memory. Several updates are kept in flight at once.
+	// Both media must use the same block size. Returns
+	// kIOReturnSCSIParityStale if data was written whose parity could not
+	// be updated.
+	virtual IOReturn	UpdateParity (
+							IOSCSIBlockCommandsDevice *	parityDevice,
+							SBCParityUpdate *			updates,
+							UInt32						updateCount );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 11 );
+	
+public:
+	
+	// Opens, closes, finishes or resets the write pointer of the zone
+	// starting at zoneStartBlock, or of every zone if allZones is set.
+	// Returns kIOReturnBusy if writes to the zone are queued or in flight,
+	// or kIOReturnUnsupported if the device is not zoned.
+	virtual IOReturn	ManageZones (
+							UInt8					action,
+							UInt64					zoneStartBlock,
+							bool					allZones );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 12 );
+	
+public:
+	
+	// Writes blockCount blocks at the write pointer of the sequential write
+	// required zone starting at zoneStartBlock, queued behind any writes
+	// already waiting for the zone, and returns the block they were written
+	// at in startBlock. Returns kIOReturnNoSpace if the zone is too full.
+	virtual IOReturn	AppendToZone (
+							UInt64					zoneStartBlock,
+							IOMemoryDescriptor *	buffer,
+							UInt64					blockCount,
+							UInt64 *				startBlock );
+	
+	/* Added with 10.4 */
+	OSMetaClassDeclareReservedUsed ( IOSCSIBlockCommandsDevice, 13 );
+	
+public:
+	
+	// Reports the zone containing block, from the cached zone table.
+	virtual IOReturn	ReportZone (
+							UInt64					block,
+							SBCZoneInformation *	zoneInformation );
+	
 	
 private:
 	
 	// Space reserved for future expansion.
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 4 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 5 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 6 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 7 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 8 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 9 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 10 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 11 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 12 );
-	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 13 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 14 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 15 );
 	OSMetaClassDeclareReservedUnused ( IOSCSIBlockCommandsDevice, 16 );
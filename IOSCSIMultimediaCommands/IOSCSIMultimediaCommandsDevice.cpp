@@ -2773,6 +2773,29 @@ IOSCSIMultimediaCommandsDevice::DetermineDeviceCharacteristics ( void )
 	status = DetermineDeviceFeatures ( );
 	require_success ( status, ErrorExit );
 	
+	// Capture the read and write task templates, the block size is filled
+	// in once there is media. READ(12) is mandatory for DVD drives, so they
+	// may also be sent the 12 byte forms for transfers the 10 byte forms
+	// can not describe. There are no builders for them, so they are only
+	// enabled along with the templates.
+	if ( InitializeReadWriteTaskTemplates ( fMediaBlockSize ) == true )
+	{
+		
+		if ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask )
+		{
+			
+			SetReadWriteCDBSizeMask ( kSCSIReadWriteCDBSize_10ByteMask |
+									  kSCSIReadWriteCDBSize_12ByteMask );
+			
+		}
+		
+	}
+	
+	else
+	{
+		ERROR_LOG ( ( "%s: read/write task template allocation failed.\n", getName ( ) ) );
+	}
+	
 	result = true;
 	
 	
@@ -3800,6 +3823,8 @@ IOSCSIMultimediaCommandsDevice::SetMediaCharacteristics (
 	fMediaBlockSize		= blockSize;
 	fMediaBlockCount	= blockCount;
 	
+	SetReadWriteTaskTemplateBlockSize ( blockSize );
+	
 	ReportMaxReadTransfer  ( fMediaBlockSize, &maxBytesRead );
 	ReportMaxWriteTransfer ( fMediaBlockSize, &maxBytesWrite );
 		
@@ -3821,6 +3846,8 @@ IOSCSIMultimediaCommandsDevice::ResetMediaCharacteristics ( void )
 	fMediaType				= kCDMediaTypeUnknown;
 	fMediaIsWriteProtected	= true;
 	
+	SetReadWriteTaskTemplateBlockSize ( 0 );
+	
 }
 
 
@@ -4829,48 +4856,13 @@ IOSCSIMultimediaCommandsDevice::IssueRead (
 							UInt64					blockCount )
 {
 	
-	IOReturn 				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
-	
-	if ( READ_10 ( 	request,
-					buffer,
-					fMediaBlockSize,
-					0,
-					0,
-					0,
-					startBlock,
-					blockCount,
-					0 ) == true )
-	{
-		
-		SetApplicationLayerReference ( request, clientData );
-		
-		// The command was successfully built, now send it
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
-		
-	}
-	
-	else
-	{
-		
-		status = kIOReturnBadArgument;
-		ReleaseSCSITask ( request );
-		request = NULL;
-		
-	}
-	
-	
-ErrorExit:
-	
-	
-	return status;
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  fMediaBlockSize,
+								  false,
+								  clientData,
+								  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
 	
 }
 
@@ -4887,40 +4879,82 @@ IOSCSIMultimediaCommandsDevice::IssueWrite (
 							UInt64					blockCount )
 {
 	
-	IOReturn 				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  fMediaBlockSize,
+								  true,
+								  clientData,
+								  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+}
+
+
+//
+//	 BuildReadWriteTask - Builds a read or write task using the CDB size
+//						   chosen by SendReadWriteRequest ( ).		[PROTECTED]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::BuildReadWriteTask (
+							SCSITaskIdentifier		request,
+							IOMemoryDescriptor *	buffer,
+							UInt64					blockSize,
+							UInt64					startBlock,
+							UInt64					blockCount,
+							UInt8					cdbSize,
+							bool					isWrite,
+							bool					forceUnitAccess )
+{
 	
-	if ( WRITE_10 ( request, 
-					buffer,
-					fMediaBlockSize,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 ) == true )
+	bool	cmdStatus = false;
+	
+	// Use the device's task template when there is one for this block size.
+	if ( StampReadWriteTask ( request,
+							  buffer,
+							  blockSize,
+							  startBlock,
+							  blockCount,
+							  cdbSize,
+							  isWrite,
+							  forceUnitAccess ) == true )
 	{
 		
-		SetApplicationLayerReference ( request, clientData );
+		cmdStatus = true;
+		goto ErrorExit;
 		
-		// The command was successfully built, now send it
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
+	}
+	
+	// Only the 10 byte read and write commands have builders.
+	require ( ( cdbSize == kSCSICDBSize_10Byte ), ErrorExit );
+	
+	if ( isWrite == true )
+	{
 		
-		status = kIOReturnSuccess;
+		cmdStatus = WRITE_10 ( request,
+							   buffer,
+							   blockSize,
+							   0,
+							   0,
+							   0,
+							   ( SCSICmdField4Byte ) startBlock,
+							   ( SCSICmdField2Byte ) blockCount,
+							   0 );
 		
 	}
 	
 	else
 	{
 		
-		status = kIOReturnBadArgument;
-		ReleaseSCSITask ( request );
-		request = NULL;
+		cmdStatus = READ_10 ( request,
+							  buffer,
+							  blockSize,
+							  0,
+							  0,
+							  0,
+							  ( SCSICmdField4Byte ) startBlock,
+							  ( SCSICmdField2Byte ) blockCount,
+							  0 );
 		
 	}
 	
@@ -4928,7 +4962,7 @@ IOSCSIMultimediaCommandsDevice::IssueWrite (
 ErrorExit:
 	
 	
-	return status;
+	return cmdStatus;
 	
 }
 
@@ -5103,10 +5137,16 @@ IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete (
 	
 	require_nonzero ( request, ErrorExit );
 	
-	taskOwner = OSDynamicCast ( IOSCSIMultimediaCommandsDevice, sGetOwnerForTask ( request ) );
+	taskOwner = ( IOSCSIMultimediaCommandsDevice * ) sGetOwnerForTask ( request );
 	require_nonzero ( taskOwner, ErrorExit );
 	
-	taskOwner->AsyncReadWriteCompletion ( request );
+	// Only complete the client request once every task it was split into
+	// has completed.
+	request = taskOwner->CompleteReadWriteTask ( request );
+	if ( request != NULL )
+	{
+		taskOwner->AsyncReadWriteCompletion ( request );
+	}
 	
 	
 ErrorExit:
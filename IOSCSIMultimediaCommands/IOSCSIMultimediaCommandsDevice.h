@@ -281,6 +281,17 @@ protected:
 									void *					clientData,
 									UInt64					startBlock,
 									UInt64					blockCount );
+	
+	// We override this method to encode the MMC read and write commands
+	// for SendReadWriteRequest ( ).
+	virtual bool		BuildReadWriteTask ( SCSITaskIdentifier		request,
+											 IOMemoryDescriptor *	buffer,
+											 UInt64					blockSize,
+											 UInt64					startBlock,
+											 UInt64					blockCount,
+											 UInt8					cdbSize,
+											 bool					isWrite,
+											 bool					forceUnitAccess );
 
     virtual void		SetMediaCharacteristics ( UInt32 blockSize, UInt32 blockCount );
  	virtual void		ResetMediaCharacteristics ( void );
@@ -498,32 +498,17 @@ IOSCSIReducedBlockCommandsDevice::ReportMaxReadTransfer (
 									UInt64 * 	max )
 {
 	
-	UInt32	maxBlockCount 	= kDefaultMaxBlocksPerIO;
-	UInt64	maxByteCount	= 0;
-	bool	supported		= false;
+	UInt64	maxBlockCount 	= kDefaultMaxBlocksPerIO;
 	
 	STATUS_LOG ( ( "IOSCSIReducedBlockCommandsDevice::ReportMaxReadTransfer.\n" ) );
 	
-	// See if the transport driver wants us to limit the block transfer count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumReadBlockTransferCount,
-						&maxBlockCount );
-	
-	if ( supported == false )
-		maxBlockCount = kDefaultMaxBlocksPerIO;
-	
-	// See if the transport driver wants us to limit the transfer byte count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumReadTransferByteCount,
-						&maxByteCount );	
-	
-	if ( ( supported == true ) && ( maxByteCount > 0 ) )
+	// The transport's limits apply to each task. Larger requests are split
+	// by SendReadWriteRequest ( ), so report the request limit instead.
+	if ( fMediaBlockSize > 0 )
 	{
 		
-		setProperty ( kIOMaximumByteCountReadKey, maxByteCount, 64 );
-		
-		if ( fMediaBlockSize > 0 )
-			maxBlockCount = min ( maxBlockCount, ( maxByteCount / fMediaBlockSize ) );
+		maxBlockCount = GetReadWriteRequestBlockLimit ( fMediaBlockSize );
+		setProperty ( kIOMaximumByteCountReadKey, maxBlockCount * fMediaBlockSize, 64 );
 		
 	}
 	
@@ -547,32 +532,17 @@ IOSCSIReducedBlockCommandsDevice::ReportMaxWriteTransfer (
 									UInt64 *	max )
 {
 	
-	UInt32	maxBlockCount 	= kDefaultMaxBlocksPerIO;
-	UInt64	maxByteCount	= 0;
-	bool	supported		= false;
+	UInt64	maxBlockCount 	= kDefaultMaxBlocksPerIO;
 	
 	STATUS_LOG ( ( "IOSCSIReducedBlockCommandsDevice::ReportMaxWriteTransfer.\n" ) );
 	
-	// See if the transport driver wants us to limit the block transfer count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumWriteBlockTransferCount,
-						&maxBlockCount );
-	
-	if ( supported == false )
-		maxBlockCount = kDefaultMaxBlocksPerIO;
-	
-	// See if the transport driver wants us to limit the transfer byte count
-	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
-						kSCSIProtocolFeature_MaximumWriteTransferByteCount,
-						&maxByteCount );	
-	
-	if ( ( supported == true ) && ( maxByteCount > 0 ) )
+	// The transport's limits apply to each task. Larger requests are split
+	// by SendReadWriteRequest ( ), so report the request limit instead.
+	if ( fMediaBlockSize > 0 )
 	{
 		
-		setProperty ( kIOMaximumByteCountWriteKey, maxByteCount, 64 );
-		
-		if ( fMediaBlockSize > 0 )
-			maxBlockCount = min ( maxBlockCount, ( maxByteCount / fMediaBlockSize ) );
+		maxBlockCount = GetReadWriteRequestBlockLimit ( fMediaBlockSize );
+		setProperty ( kIOMaximumByteCountWriteKey, maxBlockCount * fMediaBlockSize, 64 );
 		
 	}
 	
@@ -1250,6 +1220,17 @@ IOSCSIReducedBlockCommandsDevice::DetermineDeviceCharacteristics ( void )
 		
 	}
 	
+	// RBC only defines the 10 byte read and write commands.
+	SetReadWriteCDBSizeMask ( kSCSIReadWriteCDBSize_10ByteMask );
+	
+	// Capture the read and write task templates, the block size is filled
+	// in once there is media. Reads and writes still work through the
+	// command builders if they can not be allocated.
+	if ( InitializeReadWriteTaskTemplates ( fMediaBlockSize ) == false )
+	{
+		ERROR_LOG ( ( "%s: read/write task template allocation failed.\n", getName ( ) ) );
+	}
+	
 	
 ReleaseTask:
 	
@@ -1304,6 +1285,8 @@ IOSCSIReducedBlockCommandsDevice::SetMediaCharacteristics (
 	fMediaBlockSize		= blockSize;
 	fMediaBlockCount	= blockCount;
 	
+	SetReadWriteTaskTemplateBlockSize ( blockSize );
+	
 	ReportMaxReadTransfer  ( fMediaBlockSize, &maxBytesRead );
 	ReportMaxWriteTransfer ( fMediaBlockSize, &maxBytesWrite );
 		
@@ -1324,6 +1307,8 @@ IOSCSIReducedBlockCommandsDevice::ResetMediaCharacteristics ( void )
 	fMediaPresent			= false;
 	fMediaIsWriteProtected 	= true;
 	
+	SetReadWriteTaskTemplateBlockSize ( 0 );
+	
 }
 
 
@@ -1944,42 +1929,13 @@ IOSCSIReducedBlockCommandsDevice::IssueRead (
 									void *					clientData )
 {
 	
-	IOReturn 				status 	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
-	
-	if ( READ_10 (	request,
-					buffer,
-					fMediaBlockSize,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount ) == true )
-	{
-		
-		SetApplicationLayerReference ( request, clientData );
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
-		
-	}
-	
-	else
-	{
-		
-		ReleaseSCSITask ( request );
-		request = NULL;
-		status = kIOReturnBadArgument;
-		
-	}
-	
-	
-ErrorExit:
-	
-	
-	return status;
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  fMediaBlockSize,
+								  false,
+								  clientData,
+								  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
 	
 }
 
@@ -2010,35 +1966,75 @@ IOSCSIReducedBlockCommandsDevice::IssueWrite (
 							void *					clientData )
 {
 	
-	IOReturn				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
+	return SendReadWriteRequest ( buffer,
+								  startBlock,
+								  blockCount,
+								  fMediaBlockSize,
+								  true,
+								  clientData,
+								  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+}
+
+
+//
+//	 BuildReadWriteTask - Builds a read or write task using the CDB size
+//						   chosen by SendReadWriteRequest ( ).		[PROTECTED]
+//
+
+bool
+IOSCSIReducedBlockCommandsDevice::BuildReadWriteTask (
+									SCSITaskIdentifier		request,
+									IOMemoryDescriptor *	buffer,
+									UInt64					blockSize,
+									UInt64					startBlock,
+									UInt64					blockCount,
+									UInt8					cdbSize,
+									bool					isWrite,
+									bool					forceUnitAccess )
+{
 	
-	if ( WRITE_10 ( request, 
-					buffer,
-	 				fMediaBlockSize,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount ) == true )
+	bool	cmdStatus = false;
+	
+	// RBC only defines the 10 byte read and write commands.
+	require ( ( cdbSize == kSCSICDBSize_10Byte ), ErrorExit );
+	
+	// Use the device's task template when there is one for this block size.
+	if ( StampReadWriteTask ( request,
+							  buffer,
+							  blockSize,
+							  startBlock,
+							  blockCount,
+							  cdbSize,
+							  isWrite,
+							  forceUnitAccess ) == true )
 	{
 		
-		SetApplicationLayerReference ( request, clientData );
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
+		cmdStatus = true;
+		goto ErrorExit;
 		
-		status = kIOReturnSuccess;
+	}
+	
+	if ( isWrite == true )
+	{
+		
+		cmdStatus = WRITE_10 ( request,
+							   buffer,
+							   blockSize,
+							   0,
+							   ( SCSICmdField4Byte ) startBlock,
+							   ( SCSICmdField2Byte ) blockCount );
 		
 	}
 	
 	else
 	{
 		
-		ReleaseSCSITask ( request );
-		request = NULL;
-		status = kIOReturnBadArgument;
+		cmdStatus = READ_10 ( request,
+							  buffer,
+							  blockSize,
+							  ( SCSICmdField4Byte ) startBlock,
+							  ( SCSICmdField2Byte ) blockCount );
 		
 	}
 	
@@ -2046,7 +2042,7 @@ IOSCSIReducedBlockCommandsDevice::IssueWrite (
 ErrorExit:
 	
 	
-	return status;
+	return cmdStatus;
 	
 }
 
@@ -2166,10 +2162,16 @@ IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete (
 	
 	require_nonzero ( request, ErrorExit );
 	
-	taskOwner = OSDynamicCast ( IOSCSIReducedBlockCommandsDevice, sGetOwnerForTask ( request ) );
+	taskOwner = ( IOSCSIReducedBlockCommandsDevice * ) sGetOwnerForTask ( request );
 	require_nonzero ( taskOwner, ErrorExit );
 	
-	taskOwner->AsyncReadWriteCompletion ( request );
+	// Only complete the client request once every task it was split into
+	// has completed.
+	request = taskOwner->CompleteReadWriteTask ( request );
+	if ( request != NULL )
+	{
+		taskOwner->AsyncReadWriteCompletion ( request );
+	}
 	
 	
 ErrorExit:
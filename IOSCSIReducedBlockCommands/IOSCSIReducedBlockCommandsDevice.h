@@ -153,6 +153,17 @@ protected:
 									 UInt64					blockCount,
 									 void *					clientData );
 	
+	// We override this method to encode the RBC read and write commands
+	// for SendReadWriteRequest ( ).
+	virtual bool		BuildReadWriteTask ( SCSITaskIdentifier		request,
+											 IOMemoryDescriptor *	buffer,
+											 UInt64					blockSize,
+											 UInt64					startBlock,
+											 UInt64					blockCount,
+											 UInt8					cdbSize,
+											 bool					isWrite,
+											 bool					forceUnitAccess );
+	
 	// This method will retreive the SCSI Primary Command Set object for
 	// the class.  For subclasses, this will be overridden using a
 	// dynamic cast on the subclasses base command set object.
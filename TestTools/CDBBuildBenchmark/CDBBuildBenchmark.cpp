@@ -0,0 +1,351 @@
+/*
+ * CDBBuildBenchmark - Compares the cost of building SBC-2 READ (10) and
+ * READ (16) CDBs the old way (an IsParameterValid ( ) call per field, then
+ * the byte-per-argument SetCommandDescriptorBlock ( )) with the SCSICDBField
+ * layouts IOSCSIBlockCommandsBuilder.cpp now uses.
+ *
+ * Build with:
+ *	c++ -O2 -o CDBBuildBenchmark CDBBuildBenchmark.cpp
+ */
+
+
+//
+//	Includes
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <IOKit/scsi/SCSICommandDefinitions.h>
+#include <IOKit/scsi/SCSICommandOperationCodes.h>
+
+
+//
+//	Constants
+//
+
+#define kIterations		50000000
+
+// Keeps the compiler from dropping calls whose results are never read.
+#define KeepTask(task)	__asm__ __volatile__ ( "" : : "g" ( task ) : "memory" )
+
+typedef UInt8 CDB[16];
+
+// A stand-in for the CDB storage in a SCSITask.
+typedef struct BenchmarkTask
+{
+	CDB		cdb;
+	UInt8	cdbSize;
+} BenchmarkTask;
+
+
+//
+//	Command Descriptor Block Layouts - Copied from IOSCSIBlockCommandsBuilder.cpp
+//
+
+struct SBCReadWrite10CDB
+{
+	typedef SCSICDBField < 0, 0, 8 >	OPERATION_CODE;
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 32 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 6, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 7, 0, 16 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 9, 0, 8 >	CONTROL;
+	enum { kSize = 10 };
+};
+
+struct SBCReadWrite16CDB
+{
+	typedef SCSICDBField < 0, 0, 8 >	OPERATION_CODE;
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 64 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 10, 0, 32 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 14, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 15, 0, 8 >	CONTROL;
+	enum { kSize = 16 };
+};
+
+
+//
+//	Old builders - Out of line, as the IOSCSIPrimaryCommandsDevice methods are
+//
+
+static bool __attribute__ ( ( noinline ) )
+IsParameterValid ( UInt64 param, UInt64 mask )
+{
+	return ( ( param | mask ) == mask );
+}
+
+
+static bool __attribute__ ( ( noinline ) )
+SetCommandDescriptorBlock ( BenchmarkTask * task,
+							UInt8 b0, UInt8 b1, UInt8 b2, UInt8 b3, UInt8 b4,
+							UInt8 b5, UInt8 b6, UInt8 b7, UInt8 b8, UInt8 b9 )
+{
+	
+	task->cdb[0] = b0;	task->cdb[1] = b1;	task->cdb[2] = b2;	task->cdb[3] = b3;
+	task->cdb[4] = b4;	task->cdb[5] = b5;	task->cdb[6] = b6;	task->cdb[7] = b7;
+	task->cdb[8] = b8;	task->cdb[9] = b9;
+	memset ( &task->cdb[10], 0, 6 );
+	task->cdbSize = 10;
+	
+	return true;
+	
+}
+
+
+static bool __attribute__ ( ( noinline ) )
+SetCommandDescriptorBlock ( BenchmarkTask * task,
+							UInt8 b0, UInt8 b1, UInt8 b2, UInt8 b3, UInt8 b4,
+							UInt8 b5, UInt8 b6, UInt8 b7, UInt8 b8, UInt8 b9,
+							UInt8 b10, UInt8 b11, UInt8 b12, UInt8 b13,
+							UInt8 b14, UInt8 b15 )
+{
+	
+	task->cdb[0] = b0;	task->cdb[1] = b1;	task->cdb[2] = b2;	task->cdb[3] = b3;
+	task->cdb[4] = b4;	task->cdb[5] = b5;	task->cdb[6] = b6;	task->cdb[7] = b7;
+	task->cdb[8] = b8;	task->cdb[9] = b9;	task->cdb[10] = b10;	task->cdb[11] = b11;
+	task->cdb[12] = b12;	task->cdb[13] = b13;	task->cdb[14] = b14;	task->cdb[15] = b15;
+	task->cdbSize = 16;
+	
+	return true;
+	
+}
+
+
+static bool __attribute__ ( ( noinline ) )
+OldREAD_10 ( BenchmarkTask * task, UInt8 PROTECT, UInt8 DPO, UInt8 FUA, UInt8 FUA_NV,
+			 UInt32 LBA, UInt8 GROUP_NUMBER, UInt16 TRANSFER_LENGTH, UInt8 CONTROL )
+{
+	
+	if ( IsParameterValid ( PROTECT, kSCSICmdFieldMask3Bit ) == false )
+		return false;
+	if ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( LBA, kSCSICmdFieldMask4Byte ) == false )
+		return false;
+	if ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ) == false )
+		return false;
+	if ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ) == false )
+		return false;
+	if ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ) == false )
+		return false;
+	
+	return SetCommandDescriptorBlock ( task,
+									   kSCSICmd_READ_10,
+									   ( PROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
+									   ( LBA >> 24 ) & 0xFF,
+									   ( LBA >> 16 ) & 0xFF,
+									   ( LBA >> 8  ) & 0xFF,
+									   LBA & 0xFF,
+									   GROUP_NUMBER,
+									   ( TRANSFER_LENGTH >> 8 ) & 0xFF,
+									   TRANSFER_LENGTH & 0xFF,
+									   CONTROL );
+	
+}
+
+
+static bool __attribute__ ( ( noinline ) )
+OldREAD_16 ( BenchmarkTask * task, UInt8 PROTECT, UInt8 DPO, UInt8 FUA, UInt8 FUA_NV,
+			 UInt64 LBA, UInt32 TRANSFER_LENGTH, UInt8 GROUP_NUMBER, UInt8 CONTROL )
+{
+	
+	if ( IsParameterValid ( PROTECT, kSCSICmdFieldMask3Bit ) == false )
+		return false;
+	if ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ) == false )
+		return false;
+	if ( IsParameterValid ( LBA, kSCSICmdFieldMask8Byte ) == false )
+		return false;
+	if ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ) == false )
+		return false;
+	if ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ) == false )
+		return false;
+	if ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ) == false )
+		return false;
+	
+	return SetCommandDescriptorBlock ( task,
+									   kSCSICmd_READ_16,
+									   ( PROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
+									   ( LBA >> 56 ) & 0xFF,
+									   ( LBA >> 48 ) & 0xFF,
+									   ( LBA >> 40 ) & 0xFF,
+									   ( LBA >> 32 ) & 0xFF,
+									   ( LBA >> 24 ) & 0xFF,
+									   ( LBA >> 16 ) & 0xFF,
+									   ( LBA >> 8  ) & 0xFF,
+									   LBA & 0xFF,
+									   ( TRANSFER_LENGTH >> 24 ) & 0xFF,
+									   ( TRANSFER_LENGTH >> 16 ) & 0xFF,
+									   ( TRANSFER_LENGTH >> 8  ) & 0xFF,
+									   TRANSFER_LENGTH & 0xFF,
+									   GROUP_NUMBER,
+									   CONTROL );
+	
+}
+
+
+//
+//	Layout builders - The same shape as BuildReadWriteCDB ( ) in
+//	IOSCSIBlockCommandsBuilder.cpp, followed by the packed CDB copy.
+//
+
+template < typename LAYOUT >
+static bool __attribute__ ( ( noinline ) )
+LayoutREAD ( BenchmarkTask * task, UInt8 OPERATION_CODE, UInt8 PROTECT, UInt8 DPO,
+			 UInt8 FUA, UInt8 FUA_NV, UInt64 LBA, UInt32 TRANSFER_LENGTH,
+			 UInt8 GROUP_NUMBER, UInt8 CONTROL )
+{
+	
+	CDB		cdb;
+	
+	if ( ( LAYOUT::PROTECT::IsValid ( PROTECT ) &
+		   LAYOUT::DPO::IsValid ( DPO ) &
+		   LAYOUT::FUA::IsValid ( FUA ) &
+		   LAYOUT::FUA_NV::IsValid ( FUA_NV ) &
+		   LAYOUT::LOGICAL_BLOCK_ADDRESS::IsValid ( LBA ) &
+		   LAYOUT::TRANSFER_LENGTH::IsValid ( TRANSFER_LENGTH ) &
+		   LAYOUT::GROUP_NUMBER::IsValid ( GROUP_NUMBER ) ) == false )
+	{
+		return false;
+	}
+	
+	memset ( cdb, 0, sizeof ( cdb ) );
+	
+	LAYOUT::OPERATION_CODE::Pack ( cdb, OPERATION_CODE );
+	LAYOUT::PROTECT::Pack ( cdb, PROTECT );
+	LAYOUT::DPO::Pack ( cdb, DPO );
+	LAYOUT::FUA::Pack ( cdb, FUA );
+	LAYOUT::FUA_NV::Pack ( cdb, FUA_NV );
+	LAYOUT::LOGICAL_BLOCK_ADDRESS::Pack ( cdb, LBA );
+	LAYOUT::TRANSFER_LENGTH::Pack ( cdb, TRANSFER_LENGTH );
+	LAYOUT::GROUP_NUMBER::Pack ( cdb, GROUP_NUMBER );
+	LAYOUT::CONTROL::Pack ( cdb, CONTROL );
+	
+	memcpy ( task->cdb, cdb, sizeof ( cdb ) );
+	task->cdbSize = LAYOUT::kSize;
+	
+	return true;
+	
+}
+
+
+//
+//	Timing
+//
+
+static double
+Now ( void )
+{
+	
+	struct timeval	tv;
+	
+	gettimeofday ( &tv, NULL );
+	return ( tv.tv_sec * 1000000000.0 ) + ( tv.tv_usec * 1000.0 );
+	
+}
+
+
+static void
+Report ( const char * name, double start, double end )
+{
+	printf ( "%-24s %6.2f ns/CDB\n", name, ( end - start ) / kIterations );
+}
+
+
+//
+//	main
+//
+
+int
+main ( int argc, const char * argv[] )
+{
+	
+	BenchmarkTask	oldTask;
+	BenchmarkTask	newTask;
+	UInt32			index	= 0;
+	double			start	= 0;
+	double			end		= 0;
+	int				result	= 0;
+	
+	printf ( "CDB Build Benchmark, %d iterations\n\n", kIterations );
+	
+	// Both builders must produce identical CDBs and reject the same values.
+	OldREAD_10 ( &oldTask, 0x5, 1, 1, 0, 0x12345678, 0x1F, 0xABCD, 0 );
+	LayoutREAD < SBCReadWrite10CDB > ( &newTask, kSCSICmd_READ_10, 0x5, 1, 1, 0, 0x12345678, 0xABCD, 0x1F, 0 );
+	if ( memcmp ( &oldTask, &newTask, sizeof ( BenchmarkTask ) ) != 0 )
+	{
+		printf ( "FAILED: READ (10) CDBs differ\n" );
+		result = 1;
+	}
+	
+	OldREAD_16 ( &oldTask, 0x3, 0, 1, 1, 0x0123456789ABCDEFULL, 0xFEDCBA98, 0x11, 0x80 );
+	LayoutREAD < SBCReadWrite16CDB > ( &newTask, kSCSICmd_READ_16, 0x3, 0, 1, 1, 0x0123456789ABCDEFULL, 0xFEDCBA98, 0x11, 0x80 );
+	if ( memcmp ( &oldTask, &newTask, sizeof ( BenchmarkTask ) ) != 0 )
+	{
+		printf ( "FAILED: READ (16) CDBs differ\n" );
+		result = 1;
+	}
+	
+	if ( ( LayoutREAD < SBCReadWrite10CDB > ( &newTask, kSCSICmd_READ_10, 0x8, 0, 0, 0, 0, 1, 0, 0 ) == true ) ||
+		 ( LayoutREAD < SBCReadWrite10CDB > ( &newTask, kSCSICmd_READ_10, 0, 0, 0, 0, 0, 0x10000, 0, 0 ) == true ) ||
+		 ( LayoutREAD < SBCReadWrite16CDB > ( &newTask, kSCSICmd_READ_16, 0, 0, 0, 0, 0, 1, 0x20, 0 ) == true ) )
+	{
+		printf ( "FAILED: an out of range field was accepted\n" );
+		result = 1;
+	}
+	
+	start = Now ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		OldREAD_10 ( &oldTask, 0, 0, 0, 0, index, 0, 8, 0 );
+		KeepTask ( &oldTask );
+	}
+	end = Now ( );
+	Report ( "READ (10) old", start, end );
+	
+	start = Now ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		LayoutREAD < SBCReadWrite10CDB > ( &newTask, kSCSICmd_READ_10, 0, 0, 0, 0, index, 8, 0, 0 );
+		KeepTask ( &newTask );
+	}
+	end = Now ( );
+	Report ( "READ (10) layout", start, end );
+	
+	start = Now ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		OldREAD_16 ( &oldTask, 0, 0, 0, 0, index, 8, 0, 0 );
+		KeepTask ( &oldTask );
+	}
+	end = Now ( );
+	Report ( "READ (16) old", start, end );
+	
+	start = Now ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		LayoutREAD < SBCReadWrite16CDB > ( &newTask, kSCSICmd_READ_16, 0, 0, 0, 0, index, 8, 0, 0 );
+		KeepTask ( &newTask );
+	}
+	end = Now ( );
+	Report ( "READ (16) layout", start, end );
+	
+	return result;
+	
+}
@@ -0,0 +1,329 @@
+/*
+ * CompletionPathBenchmark - Measures the cycles per I/O spent identifying
+ * objects on the read/write completion path: the OSDynamicCast ( ) metaclass
+ * walks IOSCSIBlockCommandsDevice, IOSCSITargetDevice and
+ * SCSITargetDevicePathManager used to make for every completed task, and the
+ * SCSITaskFromIdentifier ( ) and owner casts they make now.
+ *
+ * The class hierarchies and the metaclass walk are modelled on libkern's
+ * OSMetaClass::checkMetaCast ( ). A vendor subclass of
+ * IOSCSIBlockCommandsDevice is used as the task owner, as it usually is.
+ *
+ * Build with:
+ *	c++ -O2 -o CompletionPathBenchmark CompletionPathBenchmark.cpp
+ */
+
+
+//
+//	Includes
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+
+//
+//	Constants
+//
+
+#define kIterations		50000000
+
+// Keeps the compiler from dropping calls whose results are never read.
+#define KeepValue(value)	__asm__ __volatile__ ( "" : : "g" ( value ) : "memory" )
+
+typedef uint64_t	UInt64;
+typedef uint32_t	UInt32;
+
+
+//
+//	Metaclasses - A model of OSMetaClass
+//
+
+struct MetaClass
+{
+	const MetaClass *	superClassLink;
+	const char *		className;
+};
+
+class Object
+{
+
+public:
+	
+	virtual const MetaClass *	getMetaClass ( void ) const = 0;
+	virtual						~Object ( void ) { }
+	
+};
+
+#define DeclareClass(name, super)													\
+	static const MetaClass name##MetaClass = { &super##MetaClass, #name };		\
+	class name : public super														\
+	{																				\
+	public:																			\
+		virtual const MetaClass * getMetaClass ( void ) const						\
+		{																			\
+			return &name##MetaClass;												\
+		}
+
+static const MetaClass ObjectMetaClass = { NULL, "OSObject" };
+
+DeclareClass ( IOCommand, Object )
+};
+
+DeclareClass ( SCSITask, IOCommand )
+	void *	fOwner;
+	void *	fApplicationLayerReference;
+	void *	fTargetLayerReference;
+};
+
+DeclareClass ( IORegistryEntry, Object )
+};
+
+DeclareClass ( IOService, IORegistryEntry )
+};
+
+DeclareClass ( IOSCSIPrimaryCommandsDevice, IOService )
+};
+
+DeclareClass ( IOSCSIBlockCommandsDevice, IOSCSIPrimaryCommandsDevice )
+	UInt32	fReadWriteOutstandingCount;
+};
+
+DeclareClass ( VendorBlockCommandsDevice, IOSCSIBlockCommandsDevice )
+};
+
+// OSMetaClass::checkMetaCast ( ), which OSDynamicCast ( ) calls out of line.
+static const Object * __attribute__ ( ( noinline ) )
+CheckMetaCast ( const MetaClass * toMeta, const Object * check )
+{
+
+	const MetaClass *	fromMeta = NULL;
+
+	if ( check == NULL )
+		return NULL;
+
+	for ( fromMeta = check->getMetaClass ( ); fromMeta != NULL; fromMeta = fromMeta->superClassLink )
+	{
+
+		if ( toMeta == fromMeta )
+			return check;
+
+	}
+
+	return NULL;
+
+}
+
+#define OSDynamicCast(type, inst)	\
+	( ( type * ) CheckMetaCast ( &type##MetaClass, ( const Object * ) ( inst ) ) )
+
+
+//
+//	Completion path - Before
+//
+
+// IOSCSIPrimaryCommandsDevice::sGetOwnerForTask ( ) in a release build.
+static Object * __attribute__ ( ( noinline ) )
+GetOwnerForTask ( Object * request )
+{
+	return ( Object * ) ( ( SCSITask * ) request )->fOwner;
+}
+
+static void * __attribute__ ( ( noinline ) )
+OldGetTargetLayerReference ( Object * request )
+{
+
+	SCSITask *	scsiRequest = OSDynamicCast ( SCSITask, request );
+	void *		result		= NULL;
+
+	if ( scsiRequest != NULL )
+		result = scsiRequest->fTargetLayerReference;
+
+	return result;
+
+}
+
+static bool __attribute__ ( ( noinline ) )
+OldIsPathManagerTask ( Object * request, void * pathManager )
+{
+
+	SCSITask *	scsiRequest = OSDynamicCast ( SCSITask, request );
+	bool		result		= false;
+
+	if ( scsiRequest != NULL )
+		result = ( scsiRequest->fApplicationLayerReference == pathManager );
+
+	return result;
+
+}
+
+// The target's task callback, the path manager's completion check, the
+// elevator's completion routine and AsyncReadWriteComplete ( ).
+static bool __attribute__ ( ( noinline ) )
+OldCompletion ( Object * request, void * pathManager )
+{
+
+	IOSCSIBlockCommandsDevice *	taskOwner	= NULL;
+	void *						target		= NULL;
+
+	target = OldGetTargetLayerReference ( request );
+	if ( target == NULL )
+		return false;
+
+	if ( OldIsPathManagerTask ( request, pathManager ) == true )
+		return false;
+
+	taskOwner = OSDynamicCast ( IOSCSIBlockCommandsDevice, GetOwnerForTask ( request ) );
+	if ( taskOwner == NULL )
+		return false;
+
+	taskOwner = OSDynamicCast ( IOSCSIBlockCommandsDevice, GetOwnerForTask ( request ) );
+	if ( taskOwner == NULL )
+		return false;
+
+	taskOwner->fReadWriteOutstandingCount--;
+	return true;
+
+}
+
+
+//
+//	Completion path - After
+//
+
+// SCSITaskFromIdentifier ( ) in a release build.
+#define SCSITaskFromIdentifier(request)		( ( SCSITask * ) ( request ) )
+
+static void * __attribute__ ( ( noinline ) )
+NewGetTargetLayerReference ( Object * request )
+{
+	return SCSITaskFromIdentifier ( request )->fTargetLayerReference;
+}
+
+static bool __attribute__ ( ( noinline ) )
+NewIsPathManagerTask ( Object * request, void * pathManager )
+{
+	return ( SCSITaskFromIdentifier ( request )->fApplicationLayerReference == pathManager );
+}
+
+static bool __attribute__ ( ( noinline ) )
+NewCompletion ( Object * request, void * pathManager )
+{
+
+	IOSCSIBlockCommandsDevice *	taskOwner	= NULL;
+	void *						target		= NULL;
+
+	target = NewGetTargetLayerReference ( request );
+	if ( target == NULL )
+		return false;
+
+	if ( NewIsPathManagerTask ( request, pathManager ) == true )
+		return false;
+
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) GetOwnerForTask ( request );
+	if ( taskOwner == NULL )
+		return false;
+
+	taskOwner = ( IOSCSIBlockCommandsDevice * ) GetOwnerForTask ( request );
+	if ( taskOwner == NULL )
+		return false;
+
+	taskOwner->fReadWriteOutstandingCount--;
+	return true;
+
+}
+
+
+//
+//	Timing
+//
+
+static inline UInt64
+ReadCycleCounter ( void )
+{
+
+#if defined ( __i386__ ) || defined ( __x86_64__ )
+
+	UInt32	low		= 0;
+	UInt32	high	= 0;
+
+	__asm__ __volatile__ ( "rdtsc" : "=a" ( low ), "=d" ( high ) );
+	return ( ( UInt64 ) high << 32 ) | low;
+
+#else
+
+	// No cycle counter, report nanoseconds instead.
+	struct timeval	tv;
+
+	gettimeofday ( &tv, NULL );
+	return ( ( UInt64 ) tv.tv_sec * 1000000000ULL ) + ( ( UInt64 ) tv.tv_usec * 1000ULL );
+
+#endif
+
+}
+
+
+static void
+Report ( const char * name, UInt64 start, UInt64 end )
+{
+	printf ( "%-24s %6.2f cycles/IO\n", name, ( double ) ( end - start ) / kIterations );
+}
+
+
+//
+//	main
+//
+
+int
+main ( int argc, const char * argv[] )
+{
+
+	SCSITask *					task		= new SCSITask;
+	VendorBlockCommandsDevice *	owner		= new VendorBlockCommandsDevice;
+	int							pathManager	= 0;
+	UInt32						index		= 0;
+	UInt64						start		= 0;
+	UInt64						end			= 0;
+	bool						result		= false;
+
+	task->fOwner						= owner;
+	task->fApplicationLayerReference	= NULL;
+	task->fTargetLayerReference			= owner;
+	owner->fReadWriteOutstandingCount	= 0;
+
+	printf ( "Completion Path Benchmark, %d iterations\n\n", kIterations );
+
+	if ( ( OldCompletion ( task, &pathManager ) == false ) ||
+		 ( NewCompletion ( task, &pathManager ) == false ) )
+	{
+
+		printf ( "FAILED: the completion did not find the task owner\n" );
+		return 1;
+
+	}
+
+	start = ReadCycleCounter ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		result = OldCompletion ( task, &pathManager );
+		KeepValue ( result );
+	}
+	end = ReadCycleCounter ( );
+	Report ( "OSDynamicCast", start, end );
+
+	start = ReadCycleCounter ( );
+	for ( index = 0; index < kIterations; index++ )
+	{
+		result = NewCompletion ( task, &pathManager );
+		KeepValue ( result );
+	}
+	end = ReadCycleCounter ( );
+	Report ( "SCSITaskFromIdentifier", start, end );
+
+	delete task;
+	delete owner;
+
+	return 0;
+
+}
@@ -2,6 +2,7 @@
 #include <IOKit/scsi/SCSICmds_MODE_Definitions.h>
 #include <IOKit/scsi/SCSICmds_REQUEST_SENSE_Defs.h>
 #include <IOKit/scsi/SCSICmds_REPORT_LUNS_Definitions.h>
+#include <IOKit/scsi/SCSITask.h>
 
 static void
 PrintSCSICmds_INQUIRY_Sizes ( void );
@@ -15,6 +16,9 @@ PrintSCSICmds_REQUEST_SENSE_Sizes ( void );
 static void
 PrintSCSICmds_REPORT_LUNS_Sizes ( void );
 
+static void
+PrintSCSITask_Sizes ( void );
+
 
 int
 main ( int argc, const char * argv[] )
@@ -27,6 +31,8 @@ main ( int argc, const char * argv[] )
 	PrintSCSICmds_REQUEST_SENSE_Sizes ( );
 	PrintSCSICmds_REPORT_LUNS_Sizes ( );
 	
+	PrintSCSITask_Sizes ( );
+	
 	return 0;
 	
 }
@@ -108,4 +114,21 @@ PrintSCSICmds_REPORT_LUNS_Sizes ( void )
 	
 	printf ( "\n" );
 	
+}
+
+
+static void
+PrintSCSITask_Sizes ( void )
+{
+	
+	printf ( "SCSITask sizes\n" );
+	
+	// The footprint of the object header, these fields and the task owner
+	// is checked against kSCSITaskHotFootprintSize when SCSITask.cpp is
+	// compiled, since the kernel object layout is not visible here.
+	printf ( "SCSITaskHotData = %ld\n", ( UInt32 ) sizeof ( SCSITaskHotData ) );
+	printf ( "kSCSITaskHotFootprintSize = %ld\n", ( UInt32 ) kSCSITaskHotFootprintSize );
+	
+	printf ( "\n" );
+	
 }
\ No newline at end of file
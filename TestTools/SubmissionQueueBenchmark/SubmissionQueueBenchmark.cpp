@@ -0,0 +1,653 @@
+/*
+ * SubmissionQueueBenchmark - Measures how the IOSCSIProtocolServices
+ * submission path scales from 1 to N submitting threads, with the single
+ * shared queue and with one submission queue per thread. The queueing code
+ * is a user space copy of the one in IOSCSIProtocolServices.cpp, driving a
+ * simulated transport whose command slots are shared by all of its hardware
+ * queues.
+ *
+ * When the other queues hold every slot, a queue the transport refused has
+ * nothing of its own in flight and only makes progress if a completion on
+ * another queue drives it again. The benchmark fails if any thread stops
+ * making progress.
+ *
+ * Build with:
+ *	c++ -O2 -o SubmissionQueueBenchmark SubmissionQueueBenchmark.cpp -lpthread
+ *
+ * Run with:
+ *	./SubmissionQueueBenchmark [maximum thread count]
+ */
+
+
+//
+//	Includes
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+//
+//	Constants
+//
+
+#define kIterations				1000000
+#define kMaximumThreads			64
+#define kTasksPerThread			32
+#define kTransportSlots			64
+#define kStallTimeInNS			( 10 * 1000000000.0 )
+
+enum
+{
+	kSCSITaskQueueBusyMask			= ( 1 << 0 ),
+	kSCSITaskQueueCompletionMask	= ( 1 << 1 )
+};
+
+typedef uint32_t	UInt32;
+typedef int32_t		SInt32;
+typedef uint64_t	UInt64;
+
+
+//
+//	Atomics and locks - User space versions of the kernel routines
+//
+
+static inline UInt32
+OSBitOrAtomic ( UInt32 mask, volatile UInt32 * address )
+{
+	return __sync_fetch_and_or ( address, mask );
+}
+
+static inline UInt32
+OSBitAndAtomic ( UInt32 mask, volatile UInt32 * address )
+{
+	return __sync_fetch_and_and ( address, mask );
+}
+
+static inline bool
+OSCompareAndSwap ( UInt32 oldValue, UInt32 newValue, volatile UInt32 * address )
+{
+	return __sync_bool_compare_and_swap ( address, oldValue, newValue );
+}
+
+static inline SInt32
+OSIncrementAtomic ( volatile SInt32 * address )
+{
+	return __sync_fetch_and_add ( address, 1 );
+}
+
+static inline SInt32
+OSDecrementAtomic ( volatile SInt32 * address )
+{
+	return __sync_fetch_and_sub ( address, 1 );
+}
+
+typedef struct SpinLock
+{
+	volatile UInt32		locked;
+} SpinLock;
+
+static inline void
+SpinLockLock ( SpinLock * lock )
+{
+	
+	while ( __sync_lock_test_and_set ( &lock->locked, 1 ) != 0 )
+	{
+		
+		while ( lock->locked != 0 )
+		{
+		}
+		
+	}
+	
+}
+
+static inline void
+SpinLockUnlock ( SpinLock * lock )
+{
+	__sync_lock_release ( &lock->locked );
+}
+
+
+//
+//	Structures
+//
+
+struct BenchmarkQueue;
+
+typedef struct BenchmarkTask
+{
+	struct BenchmarkTask *		next;
+	struct BenchmarkQueue *		queue;
+	UInt32						owner;
+} BenchmarkTask;
+
+// A SCSISubmissionQueue, plus the simulated hardware queue it feeds.
+typedef struct BenchmarkQueue
+{
+	
+	SpinLock					lock;
+	BenchmarkTask *				head;
+	BenchmarkTask *				tail;
+	UInt32						queuedTaskCount;
+	volatile UInt32				semaphore;
+	volatile UInt32				refused;
+	
+	// Commands the transport has accepted on this hardware queue.
+	SpinLock					hardwareLock;
+	BenchmarkTask *				hardwareHead;
+	BenchmarkTask *				hardwareTail;
+	
+} __attribute__ ( ( aligned ( 64 ) ) ) BenchmarkQueue;
+
+typedef struct BenchmarkThread
+{
+	
+	pthread_t					thread;
+	UInt32						index;
+	BenchmarkQueue *			queue;
+	
+	// Tasks which are not outstanding.
+	SpinLock					lock;
+	BenchmarkTask *				freeList;
+	UInt64						completed;
+	
+	BenchmarkTask				tasks[kTasksPerThread];
+	
+} __attribute__ ( ( aligned ( 64 ) ) ) BenchmarkThread;
+
+
+//
+//	Globals
+//
+
+static BenchmarkQueue		gQueues[kMaximumThreads];
+static BenchmarkThread		gThreads[kMaximumThreads];
+static UInt32				gQueueCount;
+static UInt32				gThreadCount;
+
+static volatile SInt32		gFreeTransportSlots;
+static volatile SInt32		gCompletionCount;
+static volatile SInt32		gRefusedQueueCount;
+
+static volatile SInt32		gReadyCount;
+static volatile UInt32		gGo;
+static volatile UInt32		gStalled;
+
+
+//
+//	Timing
+//
+
+static double
+Now ( void )
+{
+	
+	struct timeval	tv;
+	
+	gettimeofday ( &tv, NULL );
+	return ( tv.tv_sec * 1000000000.0 ) + ( tv.tv_usec * 1000.0 );
+	
+}
+
+
+//
+//	Simulated transport
+//
+
+static bool
+SendSCSICommand ( BenchmarkTask * task )
+{
+	
+	BenchmarkQueue *	queue = task->queue;
+	SInt32				slots = 0;
+	
+	// Take one of the slots shared by all of the hardware queues.
+	do
+	{
+		
+		slots = gFreeTransportSlots;
+		if ( slots == 0 )
+			return false;
+		
+	} while ( __sync_bool_compare_and_swap ( &gFreeTransportSlots, slots, slots - 1 ) == false );
+	
+	SpinLockLock ( &queue->hardwareLock );
+	
+	task->next = NULL;
+	if ( queue->hardwareHead == NULL )
+		queue->hardwareHead = task;
+	else
+		queue->hardwareTail->next = task;
+	queue->hardwareTail = task;
+	
+	SpinLockUnlock ( &queue->hardwareLock );
+	
+	return true;
+	
+}
+
+
+//
+//	Queueing - Copied from IOSCSIProtocolServices.cpp
+//
+
+static void
+AddTaskToQueue ( BenchmarkQueue * queue, BenchmarkTask * task )
+{
+	
+	SpinLockLock ( &queue->lock );
+	
+	task->next = NULL;
+	if ( queue->head == NULL )
+		queue->head = task;
+	else
+		queue->tail->next = task;
+	queue->tail = task;
+	queue->queuedTaskCount++;
+	
+	SpinLockUnlock ( &queue->lock );
+	
+}
+
+
+static void
+AddTaskToHeadOfQueue ( BenchmarkQueue * queue, BenchmarkTask * task )
+{
+	
+	SpinLockLock ( &queue->lock );
+	
+	task->next = queue->head;
+	queue->head = task;
+	if ( queue->tail == NULL )
+		queue->tail = task;
+	queue->queuedTaskCount++;
+	
+	SpinLockUnlock ( &queue->lock );
+	
+}
+
+
+static BenchmarkTask *
+RetrieveNextTaskFromQueue ( BenchmarkQueue * queue )
+{
+	
+	BenchmarkTask *		task = NULL;
+	
+	SpinLockLock ( &queue->lock );
+	
+	task = queue->head;
+	if ( task != NULL )
+	{
+		
+		queue->head = task->next;
+		if ( queue->head == NULL )
+			queue->tail = NULL;
+		queue->queuedTaskCount--;
+		
+	}
+	
+	SpinLockUnlock ( &queue->lock );
+	
+	return task;
+	
+}
+
+
+static void
+SendTasksFromQueue ( BenchmarkQueue * queue )
+{
+	
+	while ( queue->queuedTaskCount != 0 )
+	{
+		
+		bool	qDrained = false;
+		
+		if ( OSBitOrAtomic ( kSCSITaskQueueBusyMask, &queue->semaphore ) & kSCSITaskQueueBusyMask )
+			break;
+		
+		while ( true )
+		{
+			
+			BenchmarkTask *		nextVictim		= NULL;
+			SInt32				completionCount	= 0;
+			
+			OSBitAndAtomic ( ~kSCSITaskQueueCompletionMask, &queue->semaphore );
+			completionCount = gCompletionCount;
+			
+			nextVictim = RetrieveNextTaskFromQueue ( queue );
+			if ( nextVictim == NULL )
+			{
+				
+				qDrained = true;
+				break;
+				
+			}
+			
+			if ( SendSCSICommand ( nextVictim ) == false )
+			{
+				
+				AddTaskToHeadOfQueue ( queue, nextVictim );
+				
+				if ( OSCompareAndSwap ( 0, 1, &queue->refused ) == true )
+					OSIncrementAtomic ( &gRefusedQueueCount );
+				
+				if ( gCompletionCount != completionCount )
+					OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+				
+				break;
+				
+			}
+			
+		}
+		
+		OSBitAndAtomic ( ~kSCSITaskQueueBusyMask, &queue->semaphore );
+		
+		if ( ( qDrained == false ) && ( ( queue->semaphore & kSCSITaskQueueCompletionMask ) == 0 ) )
+			break;
+		
+	}
+	
+}
+
+
+static void
+SendTasksFromRefusedQueues ( void )
+{
+	
+	for ( UInt32 index = 0; index < gQueueCount; index++ )
+	{
+		
+		BenchmarkQueue *	queue = &gQueues[index];
+		
+		if ( OSCompareAndSwap ( 1, 0, &queue->refused ) == true )
+		{
+			
+			OSDecrementAtomic ( &gRefusedQueueCount );
+			OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+			SendTasksFromQueue ( queue );
+			
+		}
+		
+	}
+	
+}
+
+
+static void
+ExecuteCommand ( BenchmarkThread * thread, BenchmarkTask * task )
+{
+	
+	task->queue = thread->queue;
+	AddTaskToQueue ( task->queue, task );
+	SendTasksFromQueue ( task->queue );
+	
+}
+
+
+static void
+CommandCompleted ( BenchmarkTask * task )
+{
+	
+	BenchmarkQueue *	queue	= task->queue;
+	BenchmarkThread *	owner	= &gThreads[task->owner];
+	
+	OSIncrementAtomic ( &gCompletionCount );
+	OSBitOrAtomic ( kSCSITaskQueueCompletionMask, &queue->semaphore );
+	
+	// ProcessCompletedTask - hand the task back to the thread it belongs to.
+	SpinLockLock ( &owner->lock );
+	task->next = owner->freeList;
+	owner->freeList = task;
+	owner->completed++;
+	SpinLockUnlock ( &owner->lock );
+	
+	SendTasksFromQueue ( queue );
+	
+	if ( gRefusedQueueCount != 0 )
+		SendTasksFromRefusedQueues ( );
+	
+}
+
+
+// Completes the oldest command on a hardware queue, as the transport's
+// interrupt handler would. Returns false if the queue had nothing in flight.
+static bool
+CompleteCommand ( BenchmarkQueue * queue )
+{
+	
+	BenchmarkTask *		task = NULL;
+	
+	SpinLockLock ( &queue->hardwareLock );
+	
+	task = queue->hardwareHead;
+	if ( task != NULL )
+	{
+		
+		queue->hardwareHead = task->next;
+		if ( queue->hardwareHead == NULL )
+			queue->hardwareTail = NULL;
+		
+	}
+	
+	SpinLockUnlock ( &queue->hardwareLock );
+	
+	if ( task == NULL )
+		return false;
+	
+	__sync_fetch_and_add ( &gFreeTransportSlots, 1 );
+	CommandCompleted ( task );
+	
+	return true;
+	
+}
+
+
+//
+//	Worker threads
+//
+
+static BenchmarkTask *
+GetFreeTask ( BenchmarkThread * thread )
+{
+	
+	BenchmarkTask *		task = NULL;
+	
+	SpinLockLock ( &thread->lock );
+	
+	task = thread->freeList;
+	if ( task != NULL )
+		thread->freeList = task->next;
+	
+	SpinLockUnlock ( &thread->lock );
+	
+	return task;
+	
+}
+
+
+static void *
+Worker ( void * context )
+{
+	
+	BenchmarkThread *	thread			= ( BenchmarkThread * ) context;
+	BenchmarkTask *		task			= NULL;
+	UInt64				submitted		= 0;
+	UInt64				lastCompleted	= 0;
+	double				lastProgress	= 0;
+	
+	OSIncrementAtomic ( &gReadyCount );
+	while ( gGo == 0 )
+	{
+	}
+	
+	lastProgress = Now ( );
+	
+	while ( ( thread->completed < kIterations ) && ( gStalled == 0 ) )
+	{
+		
+		task = NULL;
+		if ( submitted < kIterations )
+			task = GetFreeTask ( thread );
+		
+		if ( task != NULL )
+		{
+			
+			ExecuteCommand ( thread, task );
+			submitted++;
+			
+		}
+		
+		else if ( CompleteCommand ( thread->queue ) == false )
+		{
+			
+			// Nothing of this thread's is in flight. Its tasks are waiting
+			// on its queue for a completion somewhere else to send them.
+			if ( thread->completed != lastCompleted )
+			{
+				
+				lastCompleted	= thread->completed;
+				lastProgress	= Now ( );
+				
+			}
+			
+			else if ( ( Now ( ) - lastProgress ) > kStallTimeInNS )
+			{
+				gStalled = 1;
+			}
+			
+			sched_yield ( );
+			
+		}
+		
+	}
+	
+	return NULL;
+	
+}
+
+
+//
+//	Run - Returns the number of commands completed per second, or 0 if the
+//	run stalled.
+//
+
+static double
+Run ( UInt32 threadCount, UInt32 queueCount )
+{
+	
+	double	start	= 0;
+	double	end		= 0;
+	
+	memset ( gQueues, 0, sizeof ( gQueues ) );
+	memset ( gThreads, 0, sizeof ( gThreads ) );
+	
+	gThreadCount		= threadCount;
+	gQueueCount			= queueCount;
+	gFreeTransportSlots	= kTransportSlots;
+	gCompletionCount	= 0;
+	gRefusedQueueCount	= 0;
+	gReadyCount			= 0;
+	gGo					= 0;
+	gStalled			= 0;
+	
+	for ( UInt32 index = 0; index < threadCount; index++ )
+	{
+		
+		BenchmarkThread *	thread = &gThreads[index];
+		
+		thread->index = index;
+		thread->queue = &gQueues[index % queueCount];
+		
+		for ( UInt32 taskIndex = 0; taskIndex < kTasksPerThread; taskIndex++ )
+		{
+			
+			thread->tasks[taskIndex].owner	= index;
+			thread->tasks[taskIndex].next	= thread->freeList;
+			thread->freeList = &thread->tasks[taskIndex];
+			
+		}
+		
+		pthread_create ( &thread->thread, NULL, Worker, thread );
+		
+	}
+	
+	while ( gReadyCount != ( SInt32 ) threadCount )
+	{
+	}
+	
+	start = Now ( );
+	gGo = 1;
+	
+	for ( UInt32 index = 0; index < threadCount; index++ )
+	{
+		pthread_join ( gThreads[index].thread, NULL );
+	}
+	
+	end = Now ( );
+	
+	if ( gStalled != 0 )
+		return 0;
+	
+	return ( ( double ) threadCount * kIterations ) / ( ( end - start ) / 1000000000.0 );
+	
+}
+
+
+//
+//	main
+//
+
+int
+main ( int argc, const char * argv[] )
+{
+	
+	UInt32	maximumThreads	= 0;
+	double	shared			= 0;
+	double	perThread		= 0;
+	int		result			= 0;
+	
+	if ( argc > 1 )
+		maximumThreads = atoi ( argv[1] );
+	else
+		maximumThreads = ( UInt32 ) sysconf ( _SC_NPROCESSORS_ONLN );
+	
+	if ( maximumThreads < 1 )
+		maximumThreads = 1;
+	
+	if ( maximumThreads > kMaximumThreads )
+		maximumThreads = kMaximumThreads;
+	
+	printf ( "Submission Queue Benchmark, %d commands per thread, %d transport slots\n\n",
+			 kIterations, kTransportSlots );
+	printf ( "%-8s %20s %20s\n", "threads", "shared queue", "queue per thread" );
+	
+	for ( UInt32 threadCount = 1; threadCount <= maximumThreads; threadCount++ )
+	{
+		
+		shared		= Run ( threadCount, 1 );
+		perThread	= Run ( threadCount, threadCount );
+		
+		printf ( "%-8u %13.2f M/sec %13.2f M/sec\n", threadCount,
+				 shared / 1000000.0, perThread / 1000000.0 );
+		
+		if ( ( shared == 0 ) || ( perThread == 0 ) )
+		{
+			
+			printf ( "FAILED: a queue stopped making progress with %u threads\n", threadCount );
+			result = 1;
+			break;
+			
+		}
+		
+	}
+	
+	return result;
+	
+}